@@ -0,0 +1,371 @@
+#include "blankspace.h"
+#ifndef _WIN32
+#  include <dirent.h>
+#  include <pthread.h>
+#  include <sys/stat.h>
+#  include <time.h>
+#  include <unistd.h>
+#endif
+
+/* ------------------------------------------------------------------------- *
+ * Batch runner                                                              *
+ * ------------------------------------------------------------------------- */
+#ifndef _WIN32
+/*!
+ * @brief A run of the program on one input file
+ */
+typedef struct {
+  char       *filename;     /*!< Path of the input file */
+  const char *name;         /*!< Name of the input file in the directory */
+  char       *output;       /*!< Output of the run, or NULL if it is empty */
+  size_t      output_size;
+  const char *error;        /*!< Why the run failed, or NULL */
+  double      latency;      /*!< Seconds taken by the run */
+} Job;
+
+/*!
+ * @brief Range of jobs owned by a worker
+ *
+ * The owner takes jobs from the head, and the other workers steal the upper
+ * half of the range when they run out of their own.
+ */
+typedef struct {
+  pthread_mutex_t lock;
+  size_t          head;
+  size_t          tail;
+} JobQueue;
+
+/*!
+ * @brief Jobs and the program shared by all the workers
+ */
+typedef struct {
+  const BsProgram *program;
+  Job             *jobs;
+  JobQueue        *queues;
+  size_t           n_worker;
+} Batch;
+
+/*!
+ * @brief Argument of a worker thread
+ */
+typedef struct {
+  Batch *batch;
+  size_t id;
+} Worker;
+
+
+/*!
+ * @brief Get the time of a monotonic clock in seconds
+ */
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1000000000;
+}
+
+
+/*!
+ * @brief Allocate memory or exit on failure
+ */
+static void *xrealloc(void *ptr, size_t size) {
+  void *p = realloc(ptr, size);
+  if (p == NULL) {
+    fputs("Failed to allocate memory for batch\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+/*!
+ * @brief Order jobs by the names of their input files
+ */
+static int compare_job(const void *a, const void *b) {
+  return strcmp(((const Job *) a)->name, ((const Job *) b)->name);
+}
+
+
+/*!
+ * @brief Order latencies in ascending order
+ */
+static int compare_latency(const void *a, const void *b) {
+  double x = *(const double *) a;
+  double y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+
+/*!
+ * @brief Make a job for every regular file in a directory
+ * @param [in]  dir    Directory of the input files
+ * @param [out] n_job  The number of jobs
+ * @return  Jobs sorted by name (must be freed by the caller), or NULL if the
+ *          directory can't be read
+ */
+static Job *list_jobs(const char *dir, size_t *n_job) {
+  DIR *dp = opendir(dir);
+  struct dirent *ent;
+  Job *jobs = NULL;
+  size_t capacity = 0;
+  size_t dir_len = strlen(dir);
+
+  *n_job = 0;
+  if (dp == NULL) {
+    return NULL;
+  }
+  while ((ent = readdir(dp)) != NULL) {
+    struct stat st;
+    char *filename = (char *) xrealloc(NULL, dir_len + strlen(ent->d_name) + 2);
+    sprintf(filename, "%s/%s", dir, ent->d_name);
+    if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode)) {
+      free(filename);
+      continue;
+    }
+    if (*n_job == capacity) {
+      capacity = capacity == 0 ? 64 : capacity * 2;
+      jobs = (Job *) xrealloc(jobs, capacity * sizeof(Job));
+    }
+    jobs[*n_job].filename = filename;
+    jobs[*n_job].name = filename + dir_len + 1;
+    jobs[*n_job].output = NULL;
+    jobs[*n_job].output_size = 0;
+    jobs[*n_job].error = NULL;
+    jobs[*n_job].latency = 0;
+    (*n_job)++;
+  }
+  closedir(dp);
+  if (*n_job > 0) {
+    qsort(jobs, *n_job, sizeof(Job), compare_job);
+  } else if (jobs == NULL) {
+    jobs = (Job *) xrealloc(NULL, sizeof(Job));
+  }
+  return jobs;
+}
+
+
+/*!
+ * @brief Take the next job of a worker, stealing one if it has none left
+ * @param [in,out] batch  Batch
+ * @param [in]     self   Index of the worker
+ * @param [out]    idx    Index of the job taken
+ * @return  FALSE if no job is left anywhere
+ */
+static int take_job(Batch *batch, size_t self, size_t *idx) {
+  JobQueue *own = &batch->queues[self];
+  size_t i;
+
+  pthread_mutex_lock(&own->lock);
+  if (own->head < own->tail) {
+    *idx = own->head++;
+    pthread_mutex_unlock(&own->lock);
+    return TRUE;
+  }
+  pthread_mutex_unlock(&own->lock);
+
+  for (i = 1; i < batch->n_worker; i++) {
+    JobQueue *victim = &batch->queues[(self + i) % batch->n_worker];
+    size_t mid, tail;
+    pthread_mutex_lock(&victim->lock);
+    if (victim->head == victim->tail) {
+      pthread_mutex_unlock(&victim->lock);
+      continue;
+    }
+    /* Leave the lower half, which the victim runs next */
+    tail = victim->tail;
+    mid = victim->head + (tail - victim->head) / 2;
+    victim->tail = mid;
+    pthread_mutex_unlock(&victim->lock);
+    pthread_mutex_lock(&own->lock);
+    own->head = mid + 1;
+    own->tail = tail;
+    pthread_mutex_unlock(&own->lock);
+    *idx = mid;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+
+/*!
+ * @brief Read the input of a job from its file
+ */
+static size_t read_file(void *arg, char *buf, size_t size) {
+  return fread(buf, 1, size, (FILE *) arg);
+}
+
+
+/*!
+ * @brief Run the program on the input file of a job
+ * @param [in]     batch  Batch
+ * @param [in,out] vm     VM of the worker
+ * @param [in,out] job    Job
+ */
+static void run_job(const Batch *batch, BsVM *vm, Job *job) {
+  double start = now();
+  BsIO io = {read_file, NULL, NULL, NULL, 0, FALSE};
+
+  if ((io.arg = fopen(job->filename, "rb")) == NULL) {
+    job->error = "Unable to open file";
+    return;
+  }
+  bs_run(vm, batch->program, &io);
+  fclose((FILE *) io.arg);
+  job->error = bs_vm_error(vm);
+  job->output = output_detach(&vm->output, &job->output_size);
+  job->latency = now() - start;
+}
+
+
+/*!
+ * @brief Run jobs until none is left
+ * @param [in] arg  Worker
+ * @return  NULL
+ */
+static void *work(void *arg) {
+  const Worker *worker = (const Worker *) arg;
+  BsVM *vm = bs_vm_create();
+  size_t idx;
+
+  while (take_job(worker->batch, worker->id, &idx)) {
+    run_job(worker->batch, vm, &worker->batch->jobs[idx]);
+  }
+  bs_vm_free(vm);
+  return NULL;
+}
+
+
+/*!
+ * @brief Get a percentile of sorted latencies by the nearest rank
+ */
+__attribute__((pure))
+static double percentile(const double *sorted, size_t n, size_t percent) {
+  size_t rank = (n * percent + 99) / 100;
+  return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+
+/*!
+ * @brief Show the throughput and the latency percentiles of a batch
+ */
+static void show_batch_stats(FILE *fp, const Job *jobs, size_t n_job, size_t n_failed, size_t n_worker, double elapsed) {
+  double *latencies = (double *) xrealloc(NULL, (n_job + 1) * sizeof(double));
+  size_t i;
+
+  for (i = 0; i < n_job; i++) {
+    latencies[i] = jobs[i].latency;
+  }
+  qsort(latencies, n_job, sizeof(double), compare_latency);
+  fprintf(fp, "Batch: %lu jobs (%lu failed) in %.3f s on %lu threads, %.1f jobs/s\n",
+      (unsigned long) n_job, (unsigned long) n_failed, elapsed, (unsigned long) n_worker,
+      elapsed > 0 ? (double) n_job / elapsed : 0);
+  if (n_job > 0) {
+    fprintf(fp, "Latency: p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+        percentile(latencies, n_job, 50) * 1000,
+        percentile(latencies, n_job, 90) * 1000,
+        percentile(latencies, n_job, 99) * 1000,
+        latencies[n_job - 1] * 1000);
+  }
+  free(latencies);
+}
+#endif
+
+
+/*!
+ * @brief Run a program on every file of a directory in parallel
+ *
+ * The program is shared by all the workers, each of which has its own VM
+ * and keeps the output in memory.
+ * The outputs are written in the order of the names of the input files,
+ * each after a header line "==> NAME <==", and the statistics are shown on
+ * stderr at the end.
+ * @param [in] program  Program
+ * @param [in] param    Parameters of this program
+ * @return  TRUE if all the jobs halt normally
+ */
+int run_batch(const BsProgram *program, const Param *param) {
+#ifdef _WIN32
+  (void) program;
+  (void) param;
+  fputs("--batch is not supported on this platform\n", stderr);
+  return FALSE;
+#else
+  Batch batch;
+  Worker *workers;
+  pthread_t *threads;
+  FILE *ofp = stdout;
+  size_t i, n_job, n_failed = 0;
+  long n_cpu;
+  double start, elapsed;
+
+  if ((batch.jobs = list_jobs(param->batch_dir, &n_job)) == NULL) {
+    fprintf(stderr, "Unable to open directory: %s\n", param->batch_dir);
+    return FALSE;
+  }
+  n_cpu = sysconf(_SC_NPROCESSORS_ONLN);
+  batch.n_worker = param->n_jobs > 0 ? (size_t) param->n_jobs : n_cpu > 0 ? (size_t) n_cpu : 1;
+  if (batch.n_worker > n_job) {
+    batch.n_worker = n_job > 0 ? n_job : 1;
+  }
+  batch.program = program;
+  batch.queues = (JobQueue *) xrealloc(NULL, batch.n_worker * sizeof(JobQueue));
+  workers = (Worker *) xrealloc(NULL, batch.n_worker * sizeof(Worker));
+  threads = (pthread_t *) xrealloc(NULL, batch.n_worker * sizeof(pthread_t));
+  for (i = 0; i < batch.n_worker; i++) {
+    pthread_mutex_init(&batch.queues[i].lock, NULL);
+    batch.queues[i].head = n_job * i / batch.n_worker;
+    batch.queues[i].tail = n_job * (i + 1) / batch.n_worker;
+    workers[i].batch = &batch;
+    workers[i].id = i;
+  }
+
+  start = now();
+  /* The calling thread is the first worker */
+  for (i = 1; i < batch.n_worker; i++) {
+    if (pthread_create(&threads[i], NULL, work, &workers[i]) != 0) {
+      fputs("Failed to create a thread\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+  }
+  work(&workers[0]);
+  for (i = 1; i < batch.n_worker; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  elapsed = now() - start;
+
+  if (param->out_filename != NULL && (ofp = fopen(param->out_filename, "w")) == NULL) {
+    fprintf(stderr, "Unable to open file: %s\n", param->out_filename);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < n_job; i++) {
+    fprintf(ofp, "==> %s <==\n", batch.jobs[i].name);
+    if (batch.jobs[i].output != NULL) {
+      fwrite(batch.jobs[i].output, 1, batch.jobs[i].output_size, ofp);
+    }
+  }
+  if (ofp != stdout) {
+    fclose(ofp);
+  } else {
+    fflush(stdout);
+  }
+  for (i = 0; i < n_job; i++) {
+    if (batch.jobs[i].error != NULL) {
+      fprintf(stderr, "%s: %s\n", batch.jobs[i].name, batch.jobs[i].error);
+      n_failed++;
+    }
+  }
+  show_batch_stats(stderr, batch.jobs, n_job, n_failed, batch.n_worker, elapsed);
+
+  for (i = 0; i < n_job; i++) {
+    free(batch.jobs[i].filename);
+    free(batch.jobs[i].output);
+  }
+  for (i = 0; i < batch.n_worker; i++) {
+    pthread_mutex_destroy(&batch.queues[i].lock);
+  }
+  free(batch.jobs);
+  free(batch.queues);
+  free(workers);
+  free(threads);
+  return n_failed == 0;
+#endif
+}
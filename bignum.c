@@ -0,0 +1,880 @@
+#include "blankspace.h"
+#include <ctype.h>
+#include <stdint.h>
+
+/* ------------------------------------------------------------------------- *
+ * Arbitrary-precision integer                                               *
+ * ------------------------------------------------------------------------- */
+/*! The number of bits of a limb */
+#define LIMB_BITS  32
+/*! The number of limbs which can hold the magnitude of any WsInt */
+#define N_WS_INT_LIMB  ((sizeof(WsInt) * 8 + LIMB_BITS - 1) / LIMB_BITS)
+/*! The number of bits of WsInt */
+#define WS_INT_BITS  ((WsInt) (sizeof(WsInt) * 8))
+/*! Largest decimal power which fits in a limb, and its number of digits */
+#define DECIMAL_BASE    1000000000u
+#define DECIMAL_DIGITS  9
+/*! Initial number of entries of the bignum table */
+#define INITIAL_N_ENTRY  64
+/*! Minimum number of allocations between two garbage collections */
+#define MIN_GC_THRESHOLD  4096
+
+/*! Flags of the entries of the bignum table */
+#define ENTRY_USED    0x01
+#define ENTRY_MARKED  0x02
+#define ENTRY_PINNED  0x04
+
+/*!
+ * @brief Sign and magnitude of an integer
+ */
+typedef struct {
+  int       negative;
+  size_t    n_limb;  /*!< The number of limbs, 0 for zero */
+  uint32_t *limb;    /*!< Magnitude, least significant limb first */
+} Bignum;
+
+/*!
+ * @brief Table of the bignums referred to by tagged values
+ */
+struct BignumTable {
+  Bignum        *entries;
+  unsigned char *flags;
+  size_t        *free_list;  /*!< Indices of the unused entries below n_entry */
+  size_t         n_free;
+  size_t         n_entry;    /*!< The number of entries ever used */
+  size_t         capacity;
+  size_t         n_live;
+  size_t         n_alloc;    /*!< The number of allocations since the last GC */
+  size_t         threshold;  /*!< n_alloc which triggers the next GC */
+};
+
+
+/*!
+ * @brief Allocate memory or exit
+ */
+static void *bignum_alloc(size_t size) {
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    fputs("Failed to allocate memory for bignum\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+/*!
+ * @brief Allocate limbs filled with zeros
+ */
+static uint32_t *alloc_limbs(size_t n) {
+  uint32_t *limb = (uint32_t *) bignum_alloc(n * sizeof(uint32_t));
+  memset(limb, 0, n * sizeof(uint32_t));
+  return limb;
+}
+
+
+/*!
+ * @brief Get the number of limbs without the leading zeros
+ */
+__attribute__((pure))
+static size_t normalized_size(const uint32_t *limb, size_t n) {
+  while (n > 0 && limb[n - 1] == 0) {
+    n--;
+  }
+  return n;
+}
+
+
+/*!
+ * @brief Stop the run of execute_bignum() on a runtime error
+ */
+__attribute__((noreturn))
+static void bignum_error(BsVM *vm, const char *message) {
+  vm->error = message;
+  longjmp(vm->bignum_escape, 1);
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Magnitude                                                                 *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Compare two magnitudes
+ * @return  Negative, zero or positive if a is less than, equal to or greater
+ *          than b
+ */
+__attribute__((pure))
+static int mag_cmp(const uint32_t *a, size_t na, const uint32_t *b, size_t nb) {
+  if (na != nb) {
+    return na < nb ? -1 : 1;
+  }
+  while (na-- > 0) {
+    if (a[na] != b[na]) {
+      return a[na] < b[na] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+
+/*!
+ * @brief r = a + b, where r has max(na, nb) + 1 limbs
+ */
+static void mag_add(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb) {
+  uint64_t carry = 0;
+  size_t i;
+  if (na < nb) {
+    SWAP(const uint32_t *, &a, &b);
+    SWAP(size_t, &na, &nb);
+  }
+  for (i = 0; i < na; i++) {
+    carry += (uint64_t) a[i] + (i < nb ? b[i] : 0);
+    r[i] = (uint32_t) carry;
+    carry >>= LIMB_BITS;
+  }
+  r[na] = (uint32_t) carry;
+}
+
+
+/*!
+ * @brief r = a - b, where a >= b and r has na limbs
+ */
+static void mag_sub(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb) {
+  uint32_t borrow = 0;
+  size_t i;
+  for (i = 0; i < na; i++) {
+    uint64_t d = (uint64_t) a[i] - (i < nb ? b[i] : 0) - borrow;
+    r[i] = (uint32_t) d;
+    borrow = (uint32_t) (d >> 63);
+  }
+}
+
+
+/*!
+ * @brief r = a * b, where r has na + nb limbs filled with zeros
+ */
+static void mag_mul(uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb) {
+  size_t i, j;
+  for (i = 0; i < na; i++) {
+    uint64_t carry = 0;
+    for (j = 0; j < nb; j++) {
+      carry += (uint64_t) a[i] * b[j] + r[i + j];
+      r[i + j] = (uint32_t) carry;
+      carry >>= LIMB_BITS;
+    }
+    r[i + nb] = (uint32_t) carry;
+  }
+}
+
+
+/*!
+ * @brief q = a / d in place, returning a % d
+ */
+static uint32_t mag_divmod_limb(uint32_t *a, size_t na, uint32_t d) {
+  uint64_t rem = 0;
+  while (na-- > 0) {
+    uint64_t cur = rem << LIMB_BITS | a[na];
+    a[na] = (uint32_t) (cur / d);
+    rem = cur % d;
+  }
+  return (uint32_t) rem;
+}
+
+
+/*!
+ * @brief Long division of magnitudes (Knuth's algorithm D)
+ * @param [out] q   Quotient of na - nb + 1 limbs
+ * @param [out] r   Remainder of nb limbs
+ * @param [in]  a   Dividend, not less than the divisor
+ * @param [in]  na  The number of limbs of the dividend
+ * @param [in]  b   Divisor without leading zeros
+ * @param [in]  nb  The number of limbs of the divisor (at least 2)
+ */
+static void mag_divmod(uint32_t *q, uint32_t *r, const uint32_t *a, size_t na, const uint32_t *b, size_t nb) {
+  uint32_t *u = alloc_limbs(na + 1);
+  uint32_t *v = alloc_limbs(nb);
+  int s = __builtin_clz(b[nb - 1]);
+  size_t i, j;
+
+  /* Normalize, so that the most significant bit of the divisor is set */
+  for (i = nb - 1; i > 0; i--) {
+    v[i] = s == 0 ? b[i] : (uint32_t) (b[i] << s | b[i - 1] >> (LIMB_BITS - s));
+  }
+  v[0] = (uint32_t) (b[0] << s);
+  u[na] = s == 0 ? 0 : a[na - 1] >> (LIMB_BITS - s);
+  for (i = na - 1; i > 0; i--) {
+    u[i] = s == 0 ? a[i] : (uint32_t) (a[i] << s | a[i - 1] >> (LIMB_BITS - s));
+  }
+  u[0] = (uint32_t) (a[0] << s);
+
+  for (j = na - nb + 1; j-- > 0;) {
+    uint64_t num = (uint64_t) u[j + nb] << LIMB_BITS | u[j + nb - 1];
+    uint64_t qhat = num / v[nb - 1];
+    uint64_t rhat = num % v[nb - 1];
+    int64_t borrow = 0, t;
+
+    while (qhat >> LIMB_BITS != 0
+        || qhat * v[nb - 2] > (rhat << LIMB_BITS | u[j + nb - 2])) {
+      qhat--;
+      rhat += v[nb - 1];
+      if (rhat >> LIMB_BITS != 0) {
+        break;
+      }
+    }
+    /* u[j .. j + nb] -= qhat * v */
+    for (i = 0; i < nb; i++) {
+      uint64_t p = qhat * v[i];
+      t = (int64_t) u[i + j] - borrow - (int64_t) (p & 0xffffffffu);
+      u[i + j] = (uint32_t) t;
+      borrow = (int64_t) (p >> LIMB_BITS) - (t >> LIMB_BITS);
+    }
+    t = (int64_t) u[j + nb] - borrow;
+    u[j + nb] = (uint32_t) t;
+    q[j] = (uint32_t) qhat;
+    if (t < 0) {
+      /* qhat was one too large; add the divisor back */
+      uint64_t carry = 0;
+      q[j]--;
+      for (i = 0; i < nb; i++) {
+        carry += (uint64_t) u[i + j] + v[i];
+        u[i + j] = (uint32_t) carry;
+        carry >>= LIMB_BITS;
+      }
+      u[j + nb] = (uint32_t) (u[j + nb] + carry);
+    }
+  }
+  for (i = 0; i < nb; i++) {
+    r[i] = s == 0 ? u[i] : (uint32_t) (u[i] >> s | u[i + 1] << (LIMB_BITS - s));
+  }
+  free(u);
+  free(v);
+}
+
+
+/*!
+ * @brief Negate limbs in two's complement in place
+ */
+static void twos_negate(uint32_t *limb, size_t n) {
+  uint64_t carry = 1;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    carry += (uint32_t) ~limb[i];
+    limb[i] = (uint32_t) carry;
+    carry >>= LIMB_BITS;
+  }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Values                                                                    *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Get the magnitude of a WsInt
+ */
+__attribute__((const))
+static unsigned long long magnitude_of(long long n) {
+  return n < 0 ? 0ULL - (unsigned long long) n : (unsigned long long) n;
+}
+
+
+/*!
+ * @brief Store the sign and the magnitude of a native integer
+ * @param [out] x     Bignum which refers to limb
+ * @param [out] limb  Buffer of N_WS_INT_LIMB limbs
+ * @param [in]  n     Native integer
+ */
+static void from_native(Bignum *x, uint32_t *limb, long long n) {
+  unsigned long long m = magnitude_of(n);
+  size_t i;
+  for (i = 0; i < N_WS_INT_LIMB; i++) {
+    limb[i] = (uint32_t) m;
+    m = (m >> (LIMB_BITS - 1)) >> 1;
+  }
+  x->negative = n < 0;
+  x->limb = limb;
+  x->n_limb = normalized_size(limb, N_WS_INT_LIMB);
+}
+
+
+/*!
+ * @brief Get the sign and the magnitude of a tagged value
+ *
+ * A small integer is expanded into given buffer; a bignum is referred to
+ * directly, so that the result is only valid until the table grows.
+ * @param [in]  v     Tagged value
+ * @param [out] buf   Bignum for a small integer
+ * @param [out] limb  Buffer of N_WS_INT_LIMB limbs for a small integer
+ * @return  Sign and magnitude of the value
+ */
+static const Bignum *view(const BsVM *vm, WsInt v, Bignum *buf, uint32_t *limb) {
+  if (BIGNUM_IS_SMALL(v)) {
+    from_native(buf, limb, (long long) BIGNUM_UNTAG(v));
+    return buf;
+  }
+  return &vm->bignums->entries[BIGNUM_UNTAG(v)];
+}
+
+
+/*!
+ * @brief Give a VM an empty bignum table, unless it already has one
+ * @param [in,out] vm  VM
+ */
+void bignum_init(BsVM *vm) {
+  if (vm->bignums != NULL) {
+    return;
+  }
+  vm->bignums = (BignumTable *) bignum_alloc(sizeof(BignumTable));
+  memset(vm->bignums, 0, sizeof(BignumTable));
+  vm->bignums->threshold = MIN_GC_THRESHOLD;
+}
+
+
+/*!
+ * @brief Add a bignum to the table
+ * @param [in] x      Bignum whose limbs are owned by the table from now on
+ * @param [in] flags  Additional flags of the entry
+ * @return  Tagged reference to the bignum
+ */
+static WsInt new_entry(BsVM *vm, const Bignum *x, unsigned char flags) {
+  BignumTable *table = vm->bignums;
+  size_t idx;
+  if (table->n_free > 0) {
+    idx = table->free_list[--table->n_free];
+  } else {
+    if (table->n_entry == table->capacity) {
+      table->capacity = table->capacity == 0 ? INITIAL_N_ENTRY : table->capacity * 2;
+      if ((WsInt) table->capacity > BIGNUM_SMALL_MAX) {
+        bignum_error(vm, "Too many bignums");
+      }
+      table->entries = (Bignum *) realloc(table->entries, table->capacity * sizeof(Bignum));
+      table->flags = (unsigned char *) realloc(table->flags, table->capacity);
+      table->free_list = (size_t *) realloc(table->free_list, table->capacity * sizeof(size_t));
+      if (table->entries == NULL || table->flags == NULL || table->free_list == NULL) {
+        bignum_error(vm, "Failed to allocate memory for bignum");
+      }
+    }
+    idx = table->n_entry++;
+  }
+  table->entries[idx] = *x;
+  table->flags[idx] = (unsigned char) (ENTRY_USED | flags);
+  table->n_live++;
+  table->n_alloc++;
+  return (WsInt) (BIGNUM_TAG((WsInt) idx) | 1);
+}
+
+
+/*!
+ * @brief Turn a result into a tagged value
+ *
+ * A result which fits in a small integer never becomes a bignum, so that a
+ * bignum is never zero and never equal to any small integer.
+ * @param [in] x      Result whose limbs are consumed
+ * @param [in] flags  Additional flags of the entry if it becomes a bignum
+ * @return  Tagged value
+ */
+static WsInt make_value(BsVM *vm, Bignum *x, unsigned char flags) {
+  x->n_limb = normalized_size(x->limb, x->n_limb);
+  if (x->n_limb <= N_WS_INT_LIMB) {
+    unsigned long long m = 0;
+    size_t i = x->n_limb;
+    while (i-- > 0) {
+      m = (m << (LIMB_BITS - 1)) << 1 | x->limb[i];
+    }
+    if (m <= (unsigned long long) BIGNUM_SMALL_MAX
+        || (x->negative && m == (unsigned long long) BIGNUM_SMALL_MAX + 1)) {
+      free(x->limb);
+      return BIGNUM_TAG(x->negative ? (WsInt) -(long long) m : (WsInt) m);
+    }
+  }
+  return new_entry(vm, x, flags);
+}
+
+
+/*!
+ * @brief r = a + b or a - b
+ */
+static void add_signed(Bignum *r, const Bignum *a, const Bignum *b, int subtract) {
+  int b_negative = b->negative ^ subtract;
+  if (a->negative == b_negative) {
+    r->n_limb = (a->n_limb > b->n_limb ? a->n_limb : b->n_limb) + 1;
+    r->limb = alloc_limbs(r->n_limb);
+    mag_add(r->limb, a->limb, a->n_limb, b->limb, b->n_limb);
+    r->negative = a->negative;
+  } else if (mag_cmp(a->limb, a->n_limb, b->limb, b->n_limb) >= 0) {
+    r->n_limb = a->n_limb;
+    r->limb = alloc_limbs(r->n_limb);
+    mag_sub(r->limb, a->limb, a->n_limb, b->limb, b->n_limb);
+    r->negative = a->negative;
+  } else {
+    r->n_limb = b->n_limb;
+    r->limb = alloc_limbs(r->n_limb);
+    mag_sub(r->limb, b->limb, b->n_limb, a->limb, a->n_limb);
+    r->negative = b_negative;
+  }
+}
+
+
+/*!
+ * @brief r = a / b or a % b, truncated toward zero like C
+ */
+static void divmod_signed(BsVM *vm, Bignum *r, const Bignum *a, const Bignum *b, int want_remainder) {
+  uint32_t *q;
+  if (b->n_limb == 0) {
+    bignum_error(vm, "Zero division");
+  }
+  if (mag_cmp(a->limb, a->n_limb, b->limb, b->n_limb) < 0) {
+    r->negative = a->negative;
+    r->n_limb = want_remainder ? a->n_limb : 0;
+    r->limb = alloc_limbs(r->n_limb);
+    memcpy(r->limb, a->limb, r->n_limb * sizeof(uint32_t));
+    return;
+  }
+  q = alloc_limbs(a->n_limb - b->n_limb + 1);
+  r->limb = alloc_limbs(b->n_limb);
+  if (b->n_limb == 1) {
+    memcpy(q, a->limb, a->n_limb * sizeof(uint32_t));
+    r->limb[0] = mag_divmod_limb(q, a->n_limb, b->limb[0]);
+  } else {
+    mag_divmod(q, r->limb, a->limb, a->n_limb, b->limb, b->n_limb);
+  }
+  if (want_remainder) {
+    free(q);
+    r->n_limb = b->n_limb;
+    r->negative = a->negative;
+  } else {
+    free(r->limb);
+    r->limb = q;
+    r->n_limb = a->n_limb - b->n_limb + 1;
+    r->negative = a->negative != b->negative;
+  }
+}
+
+
+/*!
+ * @brief r = a AND b, a OR b or a XOR b in infinite two's complement
+ */
+static void bitwise(Bignum *r, const Bignum *a, const Bignum *b, int opcode) {
+  size_t n = (a->n_limb > b->n_limb ? a->n_limb : b->n_limb) + 1;
+  uint32_t *y = alloc_limbs(n);
+  size_t i;
+
+  r->limb = alloc_limbs(n);
+  memcpy(r->limb, a->limb, a->n_limb * sizeof(uint32_t));
+  memcpy(y, b->limb, b->n_limb * sizeof(uint32_t));
+  if (a->negative) {
+    twos_negate(r->limb, n);
+  }
+  if (b->negative) {
+    twos_negate(y, n);
+  }
+  for (i = 0; i < n; i++) {
+    r->limb[i] = opcode == BIT_AND ? r->limb[i] & y[i]
+      : opcode == BIT_OR ? r->limb[i] | y[i]
+      : r->limb[i] ^ y[i];
+  }
+  free(y);
+  r->n_limb = n;
+  r->negative = (r->limb[n - 1] >> (LIMB_BITS - 1)) != 0;
+  if (r->negative) {
+    twos_negate(r->limb, n);
+  }
+}
+
+
+/*!
+ * @brief r = a * 2^k
+ */
+static void shift_left(Bignum *r, const Bignum *a, size_t k) {
+  size_t words = k / LIMB_BITS;
+  int bits = (int) (k % LIMB_BITS);
+  size_t i;
+
+  r->negative = a->negative;
+  r->n_limb = a->n_limb + words + 1;
+  r->limb = alloc_limbs(r->n_limb);
+  for (i = 0; i < a->n_limb; i++) {
+    r->limb[i + words] |= (uint32_t) (a->limb[i] << bits);
+    if (bits != 0) {
+      r->limb[i + words + 1] = a->limb[i] >> (LIMB_BITS - bits);
+    }
+  }
+}
+
+
+/*!
+ * @brief r = floor(a / 2^k), like an arithmetic shift
+ */
+static void shift_right(Bignum *r, const Bignum *a, size_t k) {
+  size_t words = k / LIMB_BITS;
+  int bits = (int) (k % LIMB_BITS);
+  int inexact = FALSE;
+  size_t i;
+
+  r->negative = a->negative;
+  if (words >= a->n_limb) {
+    r->n_limb = 1;
+    r->limb = alloc_limbs(1);
+    r->limb[0] = a->negative && a->n_limb != 0;
+    return;
+  }
+  r->n_limb = a->n_limb - words + 1;
+  r->limb = alloc_limbs(r->n_limb);
+  for (i = 0; i < words; i++) {
+    inexact |= a->limb[i] != 0;
+  }
+  inexact |= bits != 0 && (a->limb[words] & ((1u << bits) - 1)) != 0;
+  for (i = words; i < a->n_limb; i++) {
+    r->limb[i - words] = a->limb[i] >> bits;
+    if (bits != 0 && i + 1 < a->n_limb) {
+      r->limb[i - words] |= (uint32_t) (a->limb[i + 1] << (LIMB_BITS - bits));
+    }
+  }
+  /* Round toward negative infinity */
+  if (a->negative && inexact) {
+    for (i = 0; ++r->limb[i] == 0; i++);
+  }
+}
+
+
+/*!
+ * @brief Apply a binary operator to tagged values
+ *
+ * This is the slow path of execute_bignum(), which is taken when an operand
+ * is a bignum or the result of small integers overflows.
+ * @param [in] opcode  Opcode of the operator
+ * @param [in] a       Left operand (second element of the stack)
+ * @param [in] b       Right operand (top of the stack)
+ * @return  Tagged result
+ */
+WsInt bignum_binary(BsVM *vm, int opcode, WsInt a, WsInt b) {
+  uint32_t a_limb[N_WS_INT_LIMB], b_limb[N_WS_INT_LIMB];
+  Bignum a_buf, b_buf, r;
+  const Bignum *x = view(vm, a, &a_buf, a_limb);
+  const Bignum *y = view(vm, b, &b_buf, b_limb);
+  long long k;
+
+  switch (opcode) {
+    case ARITH_ADD:
+    case ARITH_SUB:
+      add_signed(&r, x, y, opcode == ARITH_SUB);
+      break;
+    case ARITH_MUL:
+      r.negative = x->negative != y->negative;
+      r.n_limb = x->n_limb + y->n_limb;
+      r.limb = alloc_limbs(r.n_limb);
+      mag_mul(r.limb, x->limb, x->n_limb, y->limb, y->n_limb);
+      break;
+    case ARITH_DIV:
+    case ARITH_MOD:
+      divmod_signed(vm, &r, x, y, opcode == ARITH_MOD);
+      break;
+    case BIT_AND:
+    case BIT_OR:
+    case BIT_XOR:
+      bitwise(&r, x, y, opcode);
+      break;
+    case BIT_LS:
+    case BIT_RS:
+      if (!BIGNUM_IS_SMALL(b)) {
+        if ((opcode == BIT_LS) != y->negative) {
+          bignum_error(vm, "Shift count is too large");
+        }
+        /* Everything is shifted out */
+        k = (long long) (x->n_limb + 1) * LIMB_BITS;
+      } else {
+        k = (long long) BIGNUM_UNTAG(b);
+        if (opcode == BIT_RS) {
+          k = -k;
+        }
+      }
+      if (k >= 0) {
+        shift_left(&r, x, (size_t) k);
+      } else {
+        shift_right(&r, x, (size_t) magnitude_of(k));
+      }
+      break;
+    default:
+      fprintf(stderr, "Undefined instruction is detected [%02x]\n", opcode);
+      return 0;
+  }
+  return make_value(vm, &r, 0);
+}
+
+
+/*!
+ * @brief Bitwise NOT of a tagged value, which is -(v + 1)
+ */
+WsInt bignum_not(BsVM *vm, WsInt v) {
+  uint32_t limb[N_WS_INT_LIMB], one_limb[N_WS_INT_LIMB];
+  Bignum buf, one, r;
+  const Bignum *x = view(vm, v, &buf, limb);
+
+  from_native(&one, one_limb, 1);
+  add_signed(&r, x, &one, FALSE);
+  r.negative = !r.negative;
+  return make_value(vm, &r, 0);
+}
+
+
+/*!
+ * @brief Check whether a tagged value is negative
+ */
+__attribute__((pure))
+int bignum_is_negative(const BsVM *vm, WsInt v) {
+  return BIGNUM_IS_SMALL(v) ? v < 0 : vm->bignums->entries[BIGNUM_UNTAG(v)].negative;
+}
+
+
+/*!
+ * @brief Convert a tagged value into WsInt
+ * @param [in]  v  Tagged value
+ * @param [out] n  The value, or its lowest bits if it doesn't fit
+ * @return  TRUE if the value fits in WsInt
+ */
+int bignum_to_ws_int(const BsVM *vm, WsInt v, WsInt *n) {
+  const Bignum *x;
+  unsigned long long m = 0;
+  size_t i;
+
+  if (BIGNUM_IS_SMALL(v)) {
+    *n = BIGNUM_UNTAG(v);
+    return TRUE;
+  }
+  x = &vm->bignums->entries[BIGNUM_UNTAG(v)];
+  for (i = x->n_limb < N_WS_INT_LIMB ? x->n_limb : N_WS_INT_LIMB; i-- > 0;) {
+    m = (m << (LIMB_BITS - 1)) << 1 | x->limb[i];
+  }
+  *n = (WsInt) (x->negative ? 0ULL - m : m);
+  return x->n_limb <= N_WS_INT_LIMB
+    && (m >> (WS_INT_BITS - 1) == 0 || (x->negative && m == 1ULL << (WS_INT_BITS - 1)));
+}
+
+
+/*!
+ * @brief Convert a tagged value into a heap address
+ *
+ * Stops the run with an error if the value is out of the range of WsInt.
+ */
+__attribute__((pure))
+WsInt bignum_address(BsVM *vm, WsInt v) {
+  WsInt addr;
+  if (!bignum_to_ws_int(vm, v, &addr)) {
+    bignum_error(vm, "Heap address is out of range");
+  }
+  return addr;
+}
+
+
+/*!
+ * @brief Convert an immediate operand into a tagged value
+ *
+ * An operand which doesn't fit in a small integer becomes a bignum which is
+ * never collected.
+ */
+WsInt bignum_constant(BsVM *vm, WsInt n) {
+  uint32_t limb[N_WS_INT_LIMB];
+  Bignum x;
+  if (BIGNUM_SMALL_MIN <= n && n <= BIGNUM_SMALL_MAX) {
+    return BIGNUM_TAG(n);
+  }
+  from_native(&x, limb, (long long) n);
+  x.limb = alloc_limbs(N_WS_INT_LIMB);
+  memcpy(x.limb, limb, sizeof(limb));
+  return new_entry(vm, &x, ENTRY_PINNED);
+}
+
+
+/*!
+ * @brief Print a tagged value in decimal to the output buffer
+ * @param [in] v  Tagged value
+ */
+void bignum_print(BsVM *vm, WsInt v) {
+  const Bignum *x;
+  uint32_t *limb, *chunks;
+  size_t n, i, n_chunk = 0;
+  char digits[DECIMAL_DIGITS];
+
+  if (BIGNUM_IS_SMALL(v)) {
+    output_num(&vm->output, BIGNUM_UNTAG(v));
+    return;
+  }
+  x = &vm->bignums->entries[BIGNUM_UNTAG(v)];
+  n = x->n_limb;
+  limb = alloc_limbs(n);
+  memcpy(limb, x->limb, n * sizeof(uint32_t));
+  /* 10^9 < 2^30, so that there are at most 32/29 chunks per limb */
+  chunks = alloc_limbs(n * 32 / 29 + 2);
+  while (n > 0) {
+    chunks[n_chunk++] = mag_divmod_limb(limb, n, DECIMAL_BASE);
+    n = normalized_size(limb, n);
+  }
+  if (x->negative) {
+    OUTPUT_CHAR(&vm->output, '-');
+  }
+  output_num(&vm->output, (WsInt) chunks[--n_chunk]);
+  while (n_chunk-- > 0) {
+    uint32_t chunk = chunks[n_chunk];
+    for (i = DECIMAL_DIGITS; i-- > 0;) {
+      digits[i] = (char) ('0' + chunk % 10);
+      chunk /= 10;
+    }
+    output_write(&vm->output, digits, DECIMAL_DIGITS);
+  }
+  free(chunks);
+  free(limb);
+}
+
+
+/*!
+ * @brief x = x * scale + chunk, growing the limbs if necessary
+ */
+static void mul_add_limb(BsVM *vm, Bignum *x, size_t *capacity, uint32_t scale, uint32_t chunk) {
+  uint64_t carry = chunk;
+  size_t i;
+  for (i = 0; i < x->n_limb; i++) {
+    carry += (uint64_t) x->limb[i] * scale;
+    x->limb[i] = (uint32_t) carry;
+    carry >>= LIMB_BITS;
+  }
+  if (carry != 0) {
+    if (x->n_limb == *capacity) {
+      *capacity *= 2;
+      if ((x->limb = (uint32_t *) realloc(x->limb, *capacity * sizeof(uint32_t))) == NULL) {
+        bignum_error(vm, "Failed to allocate memory for bignum");
+      }
+    }
+    x->limb[x->n_limb++] = (uint32_t) carry;
+  }
+}
+
+
+/*!
+ * @brief Read a decimal integer of any width from the input of a VM, like
+ *        scanf("%d")
+ * @param [in,out] vm  VM
+ * @param [out]    v   Tagged value
+ * @return  TRUE if an integer is read
+ */
+int bignum_scan(BsVM *vm, WsInt *v) {
+  InputBuffer *in = &vm->input;
+  Bignum x;
+  size_t capacity = N_WS_INT_LIMB;
+  uint32_t chunk = 0, scale = 1;
+  int c;
+
+  while ((c = INPUT_CHAR(in)) != EOF && isspace(c));
+  x.negative = c == '-';
+  if (c == '-' || c == '+') {
+    c = INPUT_CHAR(in);
+  }
+  if (c == EOF || !isdigit(c)) {
+    if (c != EOF) {
+      INPUT_UNGET(in);
+    }
+    return FALSE;
+  }
+  x.limb = alloc_limbs(capacity);
+  x.n_limb = 0;
+  /* Accumulate DECIMAL_DIGITS digits at a time */
+  for (; c != EOF && isdigit(c); c = INPUT_CHAR(in)) {
+    chunk = chunk * 10 + (uint32_t) (c - '0');
+    scale *= 10;
+    if (scale == DECIMAL_BASE) {
+      mul_add_limb(vm, &x, &capacity, scale, chunk);
+      chunk = 0;
+      scale = 1;
+    }
+  }
+  if (c != EOF) {
+    INPUT_UNGET(in);
+  }
+  mul_add_limb(vm, &x, &capacity, scale, chunk);
+  *v = make_value(vm, &x, 0);
+  return TRUE;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Garbage collection                                                        *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Mark the bignum referred to by a tagged value as reachable
+ */
+static void mark_value(BignumTable *table, WsInt v) {
+  if (!BIGNUM_IS_SMALL(v)) {
+    table->flags[BIGNUM_UNTAG(v)] |= ENTRY_MARKED;
+  }
+}
+
+
+/*!
+ * @brief Mark the bignums referred to by the cells of a heap page
+ */
+static void mark_page(const WsInt *page, void *table) {
+  size_t i;
+  for (i = 0; i < HEAP_PAGE_SIZE; i++) {
+    mark_value((BignumTable *) table, page[i]);
+  }
+}
+
+
+/*!
+ * @brief Free the bignums which are unreachable, if enough of them have been
+ *        allocated since the last collection
+ *
+ * Bignums are immutable and only referred to from the stack, the cached top
+ * of the stack and the heap, which are scanned as the roots.
+ * This must be called only between instructions.
+ * @param [in,out] vm   VM
+ * @param [in]     sp   Stack pointer
+ * @param [in]     tos  Cached top of the stack
+ */
+void bignum_collect_if_needed(BsVM *vm, const WsInt *sp, WsInt tos) {
+  BignumTable *table = vm->bignums;
+  const WsInt *base;
+  size_t i;
+  if (table->n_alloc < table->threshold) {
+    return;
+  }
+  for (base = vm->stack; base < sp; base++) {
+    mark_value(table, *base);
+  }
+  mark_value(table, tos);
+  heap_foreach_page(&vm->heap, mark_page, table);
+  for (i = 0; i < table->n_entry; i++) {
+    unsigned char flags = table->flags[i];
+    if ((flags & ENTRY_USED) && !(flags & (ENTRY_MARKED | ENTRY_PINNED))) {
+      free(table->entries[i].limb);
+      table->flags[i] = 0;
+      table->free_list[table->n_free++] = i;
+      table->n_live--;
+    } else {
+      table->flags[i] = (unsigned char) (flags & ~ENTRY_MARKED);
+    }
+  }
+  table->n_alloc = 0;
+  /* Keep the garbage at most as large as the live bignums */
+  table->threshold = table->n_live > MIN_GC_THRESHOLD ? table->n_live : MIN_GC_THRESHOLD;
+}
+
+
+/*!
+ * @brief Free all the bignums of a VM including the pinned ones
+ * @param [in,out] vm  VM
+ */
+void bignum_free_all(BsVM *vm) {
+  BignumTable *table = vm->bignums;
+  size_t i;
+  if (table == NULL) {
+    return;
+  }
+  for (i = 0; i < table->n_entry; i++) {
+    if (table->flags[i] & ENTRY_USED) {
+      free(table->entries[i].limb);
+    }
+  }
+  free(table->entries);
+  free(table->flags);
+  free(table->free_list);
+  free(table);
+  vm->bignums = NULL;
+}
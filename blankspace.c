@@ -3,12 +3,33 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef _MSC_VER
+#  include <io.h>
+#  define isatty(fd)  _isatty(fd)
+#  define fileno(fp)  _fileno(fp)
+#else
+#  include <unistd.h>
+#endif
 
-WsInt stack[STACK_SIZE] = {0};
-size_t stack_idx = 0;
-
-LabelInfo *label_info_list[MAX_N_LABEL] = {NULL};
-size_t n_label_info = 0;
+/*! Values of long options which don't have a short option */
+enum LongOption {
+  OPT_BATCH = 0x100,
+  OPT_BIGNUM,
+  OPT_CACHE,
+  OPT_EMIT_BYTECODE,
+  OPT_FOLDED,
+  OPT_FUSE,
+  OPT_HEAP_STATS,
+  OPT_INTERACTIVE,
+  OPT_JIT,
+  OPT_JOBS,
+  OPT_LOAD_BYTECODE,
+  OPT_NATIVE,
+  OPT_PROFILE,
+  OPT_SAMPLE,
+  OPT_TIERED,
+  OPT_TRACE
+};
 
 /*!
  * @brief Entry point of this program
@@ -17,62 +38,96 @@ size_t n_label_info = 0;
  * @return  Status-code
  */
 int main(int argc, char *argv[]) {
-  static char code[MAX_SOURCE_SIZE] = {0};
-  static unsigned char bytecode[MAX_BYTECODE_SIZE] = {0};
-  Param param = {NULL, NULL, '*'};
-  FILE *ifp, *ofp;
-  size_t bytecode_size;
+  Param param = {NULL, NULL, '*', FALSE, 0, FALSE, FALSE, FALSE, FALSE, NULL, NULL, 0, FALSE, 0, 1, NULL, NULL};
+  BsOptions options;
+  SourceReader reader;
+  Bytecode bytecode;
+  BsVM *vm;
+  FILE *ofp;
+  Instruction *inst;
+  char *image_filename;
+  uint64_t source_hash;
+  size_t n_inst;
 
   parse_arguments(&param, argc, argv);
   if (param.in_filename == NULL) {
     fprintf(stderr, "Invalid arguments\n");
     return EXIT_FAILURE;
   }
-  if (!strcmp(param.in_filename, "-")) {
-    ifp = stdin;
-  } else if ((ifp = fopen(param.in_filename, "r")) == NULL) {
-    fprintf(stderr, "Unable to open file: %s\n", argv[1]);
-    return EXIT_FAILURE;
+  if (param.mode == '*' || param.mode == OPT_JIT) {
+    return run_program(&param);
   }
-  if (!read_file(ifp, code, LENGTHOF(code))) {
-    return EXIT_FAILURE;
+  if (param.mode == OPT_NATIVE) {
+    return run_native(&param);
+  }
+  if (param.mode == OPT_PROFILE) {
+    return run_profile(&param);
   }
-  if (ifp != stdin) {
-    fclose(ifp);
+  if (!open_source(&reader, param.in_filename)) {
+    fprintf(stderr, "Unable to open file: %s\n", param.in_filename);
+    return EXIT_FAILURE;
   }
+  options = options_of(&param);
+  vm = vm_create();
 
   switch (param.mode) {
     case 'b':
-      compile(bytecode, &bytecode_size, code);
-      show_bytecode(bytecode, bytecode_size);
+      compile(vm, &bytecode, &reader, NULL);
+      show_bytecode(bytecode.data, bytecode.size);
+      free(bytecode.data);
       break;
     case 'f':
       if (param.out_filename == NULL) {
-        filter(stdout, code);
+        filter(stdout, &reader);
       } else {
         if ((ofp = fopen(param.out_filename, "w")) == NULL) {
           fprintf(stderr, "Unable to open file: %s\n", param.out_filename);
           return EXIT_FAILURE;
         }
-        filter(ofp, code);
+        filter(ofp, &reader);
         fclose(ofp);
       }
       break;
     case 'm':
-      compile(bytecode, &bytecode_size, code);
-      show_mnemonic(stdout, bytecode, bytecode_size);
+      if ((inst = build_instructions(vm, param.in_filename, &reader, &options, TRUE, NULL, &n_inst)) == NULL) {
+        return EXIT_FAILURE;
+      }
+      show_mnemonic(stdout, inst, n_inst);
+      free_instructions(inst);
       break;
     case 't':
+      if ((inst = build_instructions(vm, param.in_filename, &reader, &options, FALSE, NULL, &n_inst)) == NULL) {
+        return EXIT_FAILURE;
+      }
       if (param.out_filename == NULL) {
-        translate(stdout, code);
+        translate(stdout, inst, n_inst, param.opt_level, NULL);
+      } else if (is_dirname(param.out_filename)) {
+        if (!translate_units(param.out_filename, inst, n_inst, param.opt_level)) {
+          return EXIT_FAILURE;
+        }
       } else {
         if ((ofp = fopen(param.out_filename, "w")) == NULL) {
           fprintf(stderr, "Unable to open file: %s\n", param.out_filename);
           return EXIT_FAILURE;
         }
-        translate(ofp, code);
+        translate(ofp, inst, n_inst, param.opt_level, NULL);
         fclose(ofp);
       }
+      free_instructions(inst);
+      break;
+    case OPT_EMIT_BYTECODE:
+      if (!hash_and_rewind(&reader, &source_hash)) {
+        source_hash = 0;
+      }
+      if ((inst = build_instructions(vm, param.in_filename, &reader, &options, FALSE, NULL, &n_inst)) == NULL) {
+        return EXIT_FAILURE;
+      }
+      image_filename = image_filename_of(param.in_filename, param.out_filename);
+      if (!save_image(image_filename, inst, n_inst, param.opt_level, source_hash)) {
+        return EXIT_FAILURE;
+      }
+      free(image_filename);
+      free_instructions(inst);
       break;
     case 's':  // New 'blankspace' mode
       if (param.out_filename == NULL) {
@@ -86,14 +141,318 @@ int main(int argc, char *argv[]) {
         fclose(ofp);
       }
       break;
-    default:
-      compile(bytecode, &bytecode_size, code);
-      execute(bytecode);
-      break;
   }
+  vm_destroy(vm);
+  close_source(&reader);
   return EXIT_SUCCESS;
 }
 
+
+/*!
+ * @brief Read stdin up to the end of a line, so that a terminal isn't
+ *        waited for more than the user typed
+ */
+static size_t read_stdin(void *arg, char *buf, size_t size) {
+  size_t n = 0;
+  int c;
+
+  (void) arg;
+  while (n < size && (c = getchar()) != EOF) {
+    buf[n++] = (char) c;
+    if (c == '\n') {
+      break;
+    }
+  }
+  return n;
+}
+
+
+/*!
+ * @brief Write the output of the program to stdout
+ *
+ * stdout is flushed every time, so that prompts are shown before reads in
+ * interactive mode.
+ */
+static void write_stdout(void *arg, const char *buf, size_t size) {
+  (void) arg;
+  fwrite(buf, 1, size, stdout);
+  fflush(stdout);
+}
+
+
+/*!
+ * @brief Compile the program and run it on stdin and stdout, or on the
+ *        files of --batch
+ * @param [in] param  Parameters of this program
+ * @return  Status-code
+ */
+int run_program(const Param *param) {
+  BsOptions options = options_of(param);
+  BsIO io = {read_stdin, write_stdout, NULL, NULL, 0, FALSE};
+  BsProgram *program;
+  BsVM *vm;
+  int status = EXIT_SUCCESS;
+
+  if (param->mode == OPT_JIT) {
+    if (param->bignum) {
+      fputs("JIT compiler doesn't support --bignum; using the interpreter\n", stderr);
+    } else if (!jit_available()) {
+      fputs("JIT compiler is not available for this build; using the interpreter\n", stderr);
+    }
+  }
+  if (param->tiered) {
+    if (param->bignum || param->mode == OPT_JIT) {
+      fputs("--tiered doesn't support --bignum and --jit; ignored\n", stderr);
+    } else if (!tier_available()) {
+      fputs("Tiered execution is not available for this build; using the interpreter\n", stderr);
+    }
+  }
+  if ((program = bs_compile_file(param->in_filename, &options)) == NULL) {
+    if (!param->load_bytecode) {
+      fprintf(stderr, "Unable to open file: %s\n", param->in_filename);
+    }
+    return EXIT_FAILURE;
+  }
+  if (param->batch_dir != NULL) {
+    status = run_batch(program, param) ? EXIT_SUCCESS : EXIT_FAILURE;
+    bs_program_free(program);
+    return status;
+  }
+
+  io.interactive = param->interactive || isatty(fileno(stdout));
+  vm = bs_vm_create();
+  if (!bs_run(vm, program, &io)) {
+    fflush(stdout);
+    fprintf(stderr, "%s\n", bs_vm_error(vm));
+    status = EXIT_FAILURE;
+  }
+  if (param->heap_stats) {
+    fflush(stdout);
+    bs_vm_show_heap_stats(vm, stderr);
+  }
+  bs_vm_free(vm);
+  bs_program_free(program);
+  return status;
+}
+
+
+/*!
+ * @brief Run the program as a shared object built from the translated C
+ *        source code
+ *
+ * The shared object is cached by the hash of the source code and the flags
+ * of the C compiler (see native_cache_filename()), so that later runs of the
+ * same program only load it.
+ * The interpreter runs the program if it can't be built natively.
+ * @param [in] param  Parameters of this program
+ * @return  Status-code
+ */
+int run_native(const Param *param) {
+  Param fallback = *param;
+  BsOptions options = options_of(param);
+  SourceReader reader;
+  BsVM *vm;
+  Instruction *inst;
+  NativeEntry entry = NULL;
+  char *filename = NULL;
+  uint64_t source_hash;
+  size_t n_inst;
+
+  fallback.mode = '*';
+  if (param->bignum || param->load_bytecode) {
+    fprintf(stderr, "--native doesn't support %s; using the interpreter\n",
+        param->bignum ? "--bignum" : "--load-bytecode");
+    return run_program(&fallback);
+  }
+  if (!native_available()) {
+    fputs("Native compilation is not available for this build; using the interpreter\n", stderr);
+    return run_program(&fallback);
+  }
+  if (!open_source(&reader, param->in_filename)) {
+    fprintf(stderr, "Unable to open file: %s\n", param->in_filename);
+    return EXIT_FAILURE;
+  }
+  if (hash_and_rewind(&reader, &source_hash)) {
+    filename = native_cache_filename(param->cache_dir, source_hash, param->opt_level);
+  }
+  if (filename != NULL && (entry = native_load(filename)) == NULL) {
+    vm = vm_create();
+    inst = build_instructions(vm, param->in_filename, &reader, &options, FALSE, NULL, &n_inst);
+    vm_destroy(vm);
+    if (inst != NULL) {
+      if (native_compile(filename, inst, n_inst, param->opt_level)) {
+        entry = native_load(filename);
+      }
+      free_instructions(inst);
+    }
+  }
+  close_source(&reader);
+  free(filename);
+  if (entry == NULL) {
+    fputs("Unable to build the program natively; using the interpreter\n", stderr);
+    return run_program(&fallback);
+  }
+  return entry(param->interactive || isatty(fileno(stdout)));
+}
+
+
+/*!
+ * @brief Run the program with the profiler on stdin and stdout
+ *
+ * The program is run by execute_profile(), and the profile is written to
+ * the file given by -o, or to stderr.
+ * The source code is always compiled, so that the profile can point into
+ * it.
+ * The call graph is also written as folded stacks into the file given by
+ * --folded, and the calls as a trace into the file given by --trace.
+ * @param [in] param  Parameters of this program
+ * @return  Status-code
+ */
+int run_profile(const Param *param) {
+  BsOptions options = options_of(param);
+  BsIO io = {read_stdin, write_stdout, NULL, NULL, 0, FALSE};
+  SourceReader reader;
+  SourceMap map;
+  Profile profile;
+  BsVM *vm;
+  Instruction *inst;
+  FILE *ofp = stderr;
+  size_t n_inst;
+  int status = EXIT_SUCCESS;
+
+  if (param->bignum || param->tiered) {
+    fputs("--profile doesn't support --bignum and --tiered; ignored\n", stderr);
+  }
+  if (!param->load_bytecode && !open_source(&reader, param->in_filename)) {
+    fprintf(stderr, "Unable to open file: %s\n", param->in_filename);
+    return EXIT_FAILURE;
+  }
+  vm = vm_create();
+  inst = build_instructions(vm, param->in_filename, &reader, &options, TRUE, &map, &n_inst);
+  if (!param->load_bytecode) {
+    close_source(&reader);
+  }
+  if (inst == NULL) {
+    vm_destroy(vm);
+    return EXIT_FAILURE;
+  }
+
+  io.interactive = param->interactive || isatty(fileno(stdout));
+  vm_set_io(vm, &io);
+  if (!execute_profile(vm, inst, n_inst, param->sample_period, param->trace_filename != NULL, &profile)) {
+    fflush(stdout);
+    fprintf(stderr, "%s\n", vm->error);
+    status = EXIT_FAILURE;
+  }
+  fflush(stdout);
+  if (param->out_filename != NULL && (ofp = fopen(param->out_filename, "w")) == NULL) {
+    fprintf(stderr, "Unable to open file: %s\n", param->out_filename);
+    status = EXIT_FAILURE;
+  } else {
+    show_profile(ofp, &profile, inst, param->in_filename, &map);
+    if (ofp != stderr) {
+      fclose(ofp);
+    }
+  }
+  if (param->folded_filename != NULL) {
+    if ((ofp = fopen(param->folded_filename, "w")) == NULL) {
+      fprintf(stderr, "Unable to open file: %s\n", param->folded_filename);
+      status = EXIT_FAILURE;
+    } else {
+      write_folded(ofp, &profile, &map);
+      fclose(ofp);
+    }
+  }
+  if (param->trace_filename != NULL) {
+    if ((ofp = fopen(param->trace_filename, "w")) == NULL) {
+      fprintf(stderr, "Unable to open file: %s\n", param->trace_filename);
+      status = EXIT_FAILURE;
+    } else {
+      write_trace(ofp, &profile, &map);
+      fclose(ofp);
+    }
+  }
+  free_profile(&profile);
+  free_source_map(&map);
+  free_instructions(inst);
+  vm_destroy(vm);
+  return status;
+}
+
+
+/*!
+ * @brief Get the options of compilation given by the command-line
+ * @param [in] param  Parameters of this program
+ * @return  Options of compilation
+ */
+__attribute__((pure))
+BsOptions options_of(const Param *param) {
+  BsOptions options;
+  options.opt_level = param->opt_level;
+  options.flags = 0;
+  if (param->fuse) {
+    options.flags |= BS_FUSE;
+  }
+  if (param->bignum) {
+    options.flags |= BS_BIGNUM;
+  }
+  if (param->mode == OPT_JIT) {
+    options.flags |= BS_JIT;
+  }
+  if (param->load_bytecode) {
+    options.flags |= BS_LOAD_BYTECODE;
+  }
+  if (param->tiered) {
+    options.flags |= BS_TIERED;
+  }
+  options.cache_dir = param->cache_dir;
+  options.tier_threshold = param->tier_threshold;
+  return options;
+}
+
+
+/*!
+ * @brief Check whether a filename given by -o names a directory
+ * @param [in] filename  Filename
+ * @return  TRUE if the filename ends with a path separator
+ */
+__attribute__((pure))
+int is_dirname(const char *filename) {
+  size_t len = strlen(filename);
+  return len > 0 && (filename[len - 1] == '/' || filename[len - 1] == '\\');
+}
+
+
+/*!
+ * @brief Get the name of the bytecode image written by --emit-bytecode
+ *
+ * If no output file is specified, the extension ".bs" of the source file
+ * is replaced with ".bsc", or ".bsc" is appended.
+ * @param [in] in_filename   Name of the source file
+ * @param [in] out_filename  Name of the output file, or NULL
+ * @return  Name of the image (must be freed by the caller)
+ */
+char *image_filename_of(const char *in_filename, const char *out_filename) {
+  const char *name = out_filename != NULL ? out_filename : !strcmp(in_filename, "-") ? "a.bsc" : in_filename;
+  size_t len = strlen(name);
+  char *filename = (char *) malloc(len + 5);
+
+  if (filename == NULL) {
+    fputs("Failed to allocate memory for image filename\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(filename, name);
+  if (name == in_filename) {
+    if (len >= 3 && !strcmp(&filename[len - 3], ".bs")) {
+      strcat(filename, "c");
+    } else {
+      strcat(filename, ".bsc");
+    }
+  }
+  return filename;
+}
+
+
 /*!
  * @brief Parse command-line arguments and set parameters.
  *
@@ -104,24 +463,46 @@ int main(int argc, char *argv[]) {
  */
 void parse_arguments(Param *param, int argc, char *argv[]) {
   static const struct option opts[] = {
+    {"batch",     required_argument, NULL, OPT_BATCH},
+    {"bignum",    no_argument,       NULL, OPT_BIGNUM},
     {"bytecode",  no_argument,       NULL, 'b'},
+    {"cache",     required_argument, NULL, OPT_CACHE},
+    {"emit-bytecode", no_argument,   NULL, OPT_EMIT_BYTECODE},
     {"filter",    no_argument,       NULL, 'f'},
+    {"folded",    required_argument, NULL, OPT_FOLDED},
+    {"fuse",      no_argument,       NULL, OPT_FUSE},
+    {"heap-stats", no_argument,      NULL, OPT_HEAP_STATS},
     {"help",      no_argument,       NULL, 'h'},
+    {"interactive", no_argument,     NULL, OPT_INTERACTIVE},
+    {"jit",       no_argument,       NULL, OPT_JIT},
+    {"jobs",      required_argument, NULL, OPT_JOBS},
+    {"load-bytecode", no_argument,   NULL, OPT_LOAD_BYTECODE},
     {"mnemonic",  no_argument,       NULL, 'm'},
+    {"native",    no_argument,       NULL, OPT_NATIVE},
+    {"optimize",  required_argument, NULL, 'O'},
     {"output",    required_argument, NULL, 'o'},
+    {"profile",   no_argument,       NULL, OPT_PROFILE},
+    {"sample",    required_argument, NULL, OPT_SAMPLE},
+    {"tiered",    optional_argument, NULL, OPT_TIERED},
+    {"trace",     required_argument, NULL, OPT_TRACE},
     {"translate", no_argument,       NULL, 't'},
     {"blankspace", no_argument,      NULL, 's'},  // New option for blankspace mode
     {0, 0, 0, 0}  /* must be filled with zero */
   };
   int ret;
   int optidx = 0;
-  while ((ret = getopt_long(argc, argv, "bfhmo:s", opts, &optidx)) != -1) {
+  int has_profile_output = FALSE;
+  while ((ret = getopt_long(argc, argv, "bfhmO:o:ts", opts, &optidx)) != -1) {
     switch (ret) {
       case 'b':  /* -b, --bytecode */
       case 'f':  /* -f, --filter */
       case 'm':  /* -m, --mnemonic */
       case 't':  /* -t, --translate */
       case 's':  /* -s, --blankspace */
+      case OPT_JIT:  /* --jit */
+      case OPT_EMIT_BYTECODE:  /* --emit-bytecode */
+      case OPT_NATIVE:  /* --native */
+      case OPT_PROFILE:  /* --profile */
         param->mode = ret;
         break;
       case 'h':  /* -h, --help */
@@ -130,11 +511,62 @@ void parse_arguments(Param *param, int argc, char *argv[]) {
       case 'o':  /* -o, --output */
         param->out_filename = optarg;
         break;
+      case 'O':  /* -O LEVEL, --optimize=LEVEL */
+        param->opt_level = atoi(optarg);
+        break;
+      case OPT_BATCH:  /* --batch=DIR */
+        param->batch_dir = optarg;
+        break;
+      case OPT_BIGNUM:  /* --bignum */
+        param->bignum = TRUE;
+        break;
+      case OPT_CACHE:  /* --cache=DIR */
+        param->cache_dir = optarg;
+        break;
+      case OPT_FOLDED:  /* --folded=FILE */
+        param->folded_filename = optarg;
+        has_profile_output = TRUE;
+        break;
+      case OPT_FUSE:  /* --fuse */
+        param->fuse = TRUE;
+        break;
+      case OPT_HEAP_STATS:  /* --heap-stats */
+        param->heap_stats = TRUE;
+        break;
+      case OPT_INTERACTIVE:  /* --interactive */
+        param->interactive = TRUE;
+        break;
+      case OPT_JOBS:  /* --jobs=N */
+        param->n_jobs = atoi(optarg);
+        break;
+      case OPT_LOAD_BYTECODE:  /* --load-bytecode */
+        param->load_bytecode = TRUE;
+        break;
+      case OPT_SAMPLE:  /* --sample=N */
+        param->sample_period = strtoul(optarg, NULL, 10);
+        has_profile_output = TRUE;
+        break;
+      case OPT_TIERED:  /* --tiered[=N] */
+        param->tiered = TRUE;
+        param->tier_threshold = optarg != NULL ? strtoul(optarg, NULL, 10) : 0;
+        break;
+      case OPT_TRACE:  /* --trace=FILE */
+        param->trace_filename = optarg;
+        has_profile_output = TRUE;
+        break;
       case '?':  /* unknown option */
         show_usage(argv[0]);
         exit(EXIT_FAILURE);
     }
   }
+  /* --folded, --sample and --trace imply --profile, and no other mode */
+  if (has_profile_output) {
+    if (param->mode != '*' && param->mode != OPT_PROFILE) {
+      fputs("--folded, --sample and --trace can be used only with --profile\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+    param->mode = OPT_PROFILE;
+  }
   if (optind != argc - 1) {
     fputs("Please specify one blankspace source code\n", stderr);
     show_usage(argv[0]);
@@ -152,18 +584,71 @@ void show_usage(const char *progname) {
       "[Usage]\n"
       "  $ %s FILE [options]\n"
       "[Options]\n"
+      "  --batch=DIR\n"
+      "    Run the program once for every file in DIR, given as its input, on\n"
+      "    all cores\n"
+      "  --bignum\n"
+      "    Use arbitrary-precision integers (interpreter only)\n"
       "  -b, --bytecode\n"
       "    Show code in hexadecimal\n"
+      "  --cache=DIR\n"
+      "    Reuse compiled bytecode images cached in DIR, keyed by the hash of\n"
+      "    the source code\n"
+      "  --emit-bytecode\n"
+      "    Write a bytecode image to the file given by -o (default: FILE.bsc)\n"
       "  -f, --filter\n"
       "    Visualize blankspace source code\n"
+      "  --folded=FILE\n"
+      "    Profile the program as --profile does, and write its call paths into\n"
+      "    FILE as folded stacks for flame graphs\n"
+      "  --fuse\n"
+      "    Fuse frequent instruction pairs into superinstructions\n"
+      "  --heap-stats\n"
+      "    Show statistics of the heap on stderr at exit\n"
       "  -h, --help\n"
       "    Show help and exit\n"
+      "  --interactive\n"
+      "    Flush the output before every read even if stdout is not a terminal\n"
+      "  --jit\n"
+      "    Compile the program into x86-64 machine code and run it\n"
+      "  --jobs=N\n"
+      "    Use N threads for --batch (default: the number of cores)\n"
+      "  --load-bytecode\n"
+      "    Treat FILE as a bytecode image written by --emit-bytecode\n"
       "  -m, --mnemonic\n"
       "    Show byte code in mnemonic format\n"
+      "  --native\n"
+      "    Translate the program into C, compile it into a shared object with\n"
+      "    the C compiler ($CC or " NATIVE_CC ") and run it; the shared object is\n"
+      "    cached in the directory of --cache (default: ~/.cache/blankspace)\n"
+      "  -O LEVEL, --optimize=LEVEL\n"
+      "    Specify optimization level (default: 0)\n"
+      "      0: No optimization\n"
+      "      1: Constant folding, algebraic simplification, removal of dead\n"
+      "         push/discard pairs and jump threading\n"
+      "      2: Level 1, removal of unreachable code and superinstructions\n"
       "  -o FILE, --output=FILE\n"
       "    Specify output filename\n"
+      "  --profile\n"
+      "    Run the program counting the executions of every opcode and\n"
+      "    instruction and timing the subroutines, and show them sorted by\n"
+      "    hotness with their positions in FILE on stderr (or into -o FILE),\n"
+      "    together with the call graph by the labels of the subroutines\n"
+      "  --sample=N\n"
+      "    Profile the program as --profile does, counting only every Nth\n"
+      "    instruction\n"
+      "  --tiered[=N]\n"
+      "    Interpret the program, and compile the subroutines and the loops run\n"
+      "    N times (default: %lu) into native code in the background\n"
+      "    with the C compiler; the shared objects are cached as with --native\n"
+      "  --trace=FILE\n"
+      "    Profile the program as --profile does, and write every call into\n"
+      "    FILE in the Trace Event Format of Chrome\n"
       "  -t, --translate\n"
       "    Translate brainfuck to C source code\n"
+      "    With -o DIR/, write the C source code split into translation units\n"
+      "    and a Makefile into DIR\n"
       "  -s, --convert\n"
-      "    Convert input file to blankspace (S and T for space and tab)\n", progname);
+      "    Convert input file to blankspace (S and T for space and tab)\n",
+      progname, (unsigned long) TIER_THRESHOLD);
 }
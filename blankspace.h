@@ -1,35 +1,32 @@
 #pragma once
 #include <assert.h>
+#include <setjmp.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include <getopt.h>
+#include "libblankspace.h"
 #if defined(_MSC_VER) && defined(_DEBUG)
 #  include <msvcdbg.h>
 #endif
 
-#ifndef MAX_SOURCE_SIZE
-#  define MAX_SOURCE_SIZE  65536
-#endif
-#ifndef MAX_BYTECODE_SIZE
-#  define MAX_BYTECODE_SIZE  1048576
-#endif
-#ifndef MAX_LABEL_LENGTH
-#  define MAX_LABEL_LENGTH  65536
-#endif
-#ifndef MAX_N_LABEL
-#  define MAX_N_LABEL  1024
-#endif
-#ifndef UNDEF_LIST_SIZE
-#  define UNDEF_LIST_SIZE  256
-#endif
 #ifndef STACK_SIZE
 #  define STACK_SIZE  65536
 #endif
 #ifndef HEAP_SIZE
 #  define HEAP_SIZE  65536
 #endif
+#ifndef HEAP_PAGE_BITS
+#  define HEAP_PAGE_BITS  12
+#endif
+#ifndef OUTPUT_BUFFER_SIZE
+#  define OUTPUT_BUFFER_SIZE  65536
+#endif
+#ifndef INPUT_BUFFER_SIZE
+#  define INPUT_BUFFER_SIZE  4096
+#endif
 #ifndef CALL_STACK_SIZE
 #  define CALL_STACK_SIZE  65536
 #endif
@@ -39,9 +36,21 @@
 #ifndef WS_ADDR_INT
 #  define WS_ADDR_INT  unsigned int
 #endif
+#ifndef TRANSLATION_UNIT_SIZE
+#  define TRANSLATION_UNIT_SIZE  2048
+#endif
 #ifndef INDENT_STR
 #  define INDENT_STR  "  "
 #endif
+#ifndef NATIVE_CC
+#  define NATIVE_CC  "cc"
+#endif
+#ifndef NATIVE_CFLAGS
+#  define NATIVE_CFLAGS  "-O2 -shared -fPIC"
+#endif
+#ifndef TIER_THRESHOLD
+#  define TIER_THRESHOLD  10000
+#endif
 
 #define TRUE  1
 #define FALSE 0
@@ -49,6 +58,10 @@
 #define LENGTHOF(array)  (sizeof(array) / sizeof((array)[0]))
 #define ADDR_DIFF(a, b) \
   ((const unsigned char *) (a) - (const unsigned char *) (b))
+#define NATIVE_ENTRY  "bs_native_main"
+#define TIER_ENTRY  "bs_tier_enter"
+#define HEAP_PAGE_SIZE  ((size_t) 1 << HEAP_PAGE_BITS)
+#define HEAP_PAGE_MASK  (HEAP_PAGE_SIZE - 1)
 #define SWAP(type, a, b) \
   do { \
     type __tmp_swap_var__ = *(a); \
@@ -64,26 +77,392 @@ enum OpCode {
   HEAP_STORE, HEAP_LOAD,
   FLOW_LABEL, FLOW_GOSUB, FLOW_JUMP, FLOW_BEZ, FLOW_BLTZ, FLOW_ENDSUB,
   IO_PUT_CHAR, IO_PUT_NUM, IO_READ_CHAR, IO_READ_NUM,
-  BIT_AND, BIT_OR, BIT_XOR, BIT_LS, BIT_RS, BIT_NOT
+  BIT_AND, BIT_OR, BIT_XOR, BIT_LS, BIT_RS, BIT_NOT,
+  FUSED_PUSH_ADD, FUSED_DUP_BEZ, FUSED_SUB_BLTZ, FUSED_PUSH_LOAD,
+  CHECK_STACK, CHECK_ROOM
 };
 
 
 typedef WS_INT  WsInt;
 typedef WS_ADDR_INT  WsAddrInt;
 
+/*!
+ * @brief Operand of a decoded instruction
+ */
+typedef union {
+  WsInt     num;   /*!< Immediate number */
+  WsAddrInt addr;  /*!< Index of the jump target instruction */
+} Operand;
+
+/*!
+ * @brief Fixed-width instruction record decoded from bytecode
+ */
+typedef struct {
+  int     opcode;
+  Operand operand;
+} Instruction;
+
+/*!
+ * @brief Growable buffer of byte-packed bytecode
+ */
+typedef struct {
+  unsigned char *data;
+  size_t         size;      /*!< The number of bytes emitted */
+  size_t         capacity;  /*!< Allocated size of data */
+} Bytecode;
+
+/*!
+ * @brief Reader which yields the whitespaces of blankspace source code
+ */
+typedef struct {
+  FILE       *fp;         /*!< Stream to read, or NULL */
+  const char *text;       /*!< Whole source code in memory, or NULL */
+  size_t      text_size;  /*!< Size of text */
+  const char *src;        /*!< Part of text which is not read yet */
+  size_t      src_size;   /*!< Size of src */
+  void       *map;        /*!< Mapped region, or NULL */
+  size_t      map_size;
+  char       *buf;        /*!< Chunk of whitespaces */
+  size_t      pos;        /*!< Index of the next whitespace in buf */
+  size_t      len;        /*!< The number of whitespaces in buf */
+  size_t      n_read;     /*!< The number of whitespaces of the chunks
+                               before buf */
+} SourceReader;
+
+/*!
+ * @brief Get the next whitespace of source code, or '\0' at the end
+ */
+#define READER_NEXT(reader) \
+  ((reader)->pos < (reader)->len ? (reader)->buf[(reader)->pos++] : reader_fill(reader))
+
+/*!
+ * @brief Get the index of the next whitespace among all the whitespaces of
+ *        source code
+ */
+#define READER_OFFSET(reader)  ((reader)->n_read + (reader)->pos)
+
+/*!
+ * @brief Label defined in source code
+ */
+typedef struct {
+  size_t  offset;  /*!< Source offset of the instruction at the label */
+  char   *name;    /*!< Label spelled by label_name() */
+} SourceLabel;
+
+/*!
+ * @brief Offsets in source code of the instructions compiled from it
+ *
+ * An offset is the index of the first whitespace of the command among all
+ * the whitespaces of source code, which doesn't count the other characters.
+ */
+typedef struct {
+  size_t      *offsets;   /*!< Offset of every instruction, by index */
+  size_t       n_inst;
+  size_t       capacity;  /*!< Allocated length of offsets */
+  SourceLabel *labels;    /*!< Labels sorted by offset */
+  size_t       n_label;
+} SourceMap;
+
+/*! Entry of the root node of a call graph, which is the main program */
+#define PROFILE_ROOT  ((size_t) -1)
+
+/*!
+ * @brief Call path in the call graph of a profile
+ *
+ * The nodes are stored in the order of their first calls, so that every
+ * parent comes before its children.
+ */
+typedef struct {
+  size_t             entry;         /*!< Index of the subroutine, or
+                                         PROFILE_ROOT */
+  size_t             parent;        /*!< Index of the node of the caller */
+  size_t             first_child;   /*!< Index of the first callee, or 0 */
+  size_t             next_sibling;  /*!< Index of the next callee of the
+                                         parent, or 0 */
+  unsigned long long calls;
+  unsigned long long samples;       /*!< Samples taken in this path itself */
+  unsigned long long cycles;        /*!< Cycles spent in this path itself */
+} CallNode;
+
+/*!
+ * @brief Call recorded for a trace, in nanoseconds from the start of the run
+ */
+typedef struct {
+  size_t             node;   /*!< Index of the node of the call path */
+  unsigned long long start;
+  unsigned long long nsec;
+} TraceEvent;
+
+/*!
+ * @brief Execution counts and times collected by execute_profile()
+ *
+ * Everything is indexed by the instructions given to execute_profile(),
+ * not by the verified ones.
+ * With a sampling period of N, only every Nth instruction is counted.
+ */
+typedef struct {
+  unsigned long long  opcode_counts[CHECK_ROOM + 1];  /*!< Executions of
+                                                           every opcode */
+  unsigned long long *counts;  /*!< Executions of every instruction */
+  unsigned long long *calls;   /*!< Calls of the subroutine at every
+                                    instruction */
+  unsigned long long *nsecs;   /*!< Nanoseconds spent in the subroutine at
+                                    every instruction, including its callees */
+  unsigned long long  total;       /*!< The number of instructions executed */
+  unsigned long long  total_nsec;  /*!< Nanoseconds of the whole run */
+  size_t              n_inst;
+  unsigned long       period;      /*!< Sampling period in instructions */
+  CallNode           *nodes;       /*!< Call graph, whose root is node 0 */
+  size_t              n_node;
+  TraceEvent         *events;      /*!< Calls in the order of their returns */
+  size_t              n_event;
+} Profile;
+
+/*!
+ * @brief Sparse heap made of lazily allocated pages
+ */
+typedef struct {
+  WsInt  **low;           /*!< Pages of the low region [0, HEAP_SIZE) */
+  WsInt   *zero_page;     /*!< Shared page of the untouched low pages */
+  WsInt   *keys;          /*!< Page numbers of the hash table */
+  WsInt  **pages;         /*!< Pages of the hash table */
+  size_t   n_bucket;
+  size_t   n_hashed;
+  WsInt    last_key;      /*!< Page number of the last hashed page found */
+  WsInt   *last_page;
+  size_t   n_page;        /*!< The number of allocated pages */
+  WsInt    lowest_page;   /*!< The lowest page number written */
+  WsInt    highest_page;  /*!< The highest page number written */
+} Heap;
+
+/*!
+ * @brief Read a heap cell, without a call if it is in the low region
+ */
+#define HEAP_READ(heap, addr) \
+  (0 <= (addr) && (addr) < (WsInt) HEAP_SIZE \
+    ? (heap)->low[(size_t) (addr) >> HEAP_PAGE_BITS][(size_t) (addr) & HEAP_PAGE_MASK] \
+    : heap_load((heap), (addr)))
+
+/*!
+ * @brief Write a heap cell, without a call if its page in the low region is
+ *        already allocated
+ */
+#define HEAP_WRITE(heap, addr, value) \
+  { \
+    if (0 <= (addr) && (addr) < (WsInt) HEAP_SIZE \
+        && (heap)->low[(size_t) (addr) >> HEAP_PAGE_BITS] != (heap)->zero_page) { \
+      (heap)->low[(size_t) (addr) >> HEAP_PAGE_BITS][(size_t) (addr) & HEAP_PAGE_MASK] = (value); \
+    } else { \
+      heap_store((heap), (addr), (value)); \
+    } \
+  }
+
+/*!
+ * @brief Input buffer of the VM
+ */
+typedef struct {
+  BsReadFunc           read;  /*!< Callback filling data, or NULL */
+  void                *arg;   /*!< First argument of read */
+  const unsigned char *ptr;   /*!< Next byte of the input */
+  const unsigned char *end;   /*!< End of the bytes available now */
+  unsigned char        data[INPUT_BUFFER_SIZE];
+} InputBuffer;
+
+/*!
+ * @brief Read a byte of the input, or EOF at the end
+ */
+#define INPUT_CHAR(in) \
+  ((in)->ptr < (in)->end ? (int) *(in)->ptr++ : input_fill(in))
+
+/*!
+ * @brief Give back the byte which was just read by INPUT_CHAR()
+ */
+#define INPUT_UNGET(in)  ((in)->ptr--)
+
+/*!
+ * @brief Output buffer of the VM
+ */
+typedef struct {
+  BsWriteFunc write;    /*!< Callback the buffer is flushed into, or NULL */
+  void  *arg;           /*!< First argument of write */
+  char  *mem;           /*!< Output flushed so far when write is NULL */
+  size_t mem_size;
+  size_t mem_capacity;
+  size_t size;
+  int    interactive;   /*!< Flush before reads */
+  char   data[OUTPUT_BUFFER_SIZE];
+} OutputBuffer;
+
+/*!
+ * @brief Append a character to the output buffer
+ */
+#define OUTPUT_CHAR(out, c) \
+  { \
+    if ((out)->size == OUTPUT_BUFFER_SIZE) { \
+      output_flush(out); \
+    } \
+    (out)->data[(out)->size++] = (char) (c); \
+  }
+
+/*!
+ * @brief Show the pending output before a read in interactive mode
+ */
+#define OUTPUT_SYNC(out) \
+  { \
+    if ((out)->interactive) { \
+      output_flush(out); \
+    } \
+  }
+
+/*
+ * Values of bignum mode are tagged: an even value is a small integer shifted
+ * left by one bit, and an odd value refers to an entry of the bignum table.
+ */
+#define BIGNUM_IS_SMALL(v)  (((v) & 1) == 0)
+#define BIGNUM_TAG(n)       ((WsInt) ((n) * 2))
+#define BIGNUM_UNTAG(v)     ((v) >> 1)
+#define BIGNUM_SMALL_MAX \
+  ((WsInt) (((unsigned long long) 1 << (sizeof(WsInt) * 8 - 2)) - 1))
+#define BIGNUM_SMALL_MIN    (-BIGNUM_SMALL_MAX - 1)
+
 typedef struct {
   const char *in_filename;
   const char *out_filename;
   int mode;
+  int fuse;
+  int opt_level;
+  int heap_stats;
+  int bignum;
+  int interactive;
+  int load_bytecode;
+  const char *cache_dir;
+  const char *batch_dir;
+  int n_jobs;
+  int tiered;
+  unsigned long tier_threshold;
+  unsigned long sample_period;
+  const char *folded_filename;
+  const char *trace_filename;
 } Param;
 
 typedef struct {
+  uint64_t  key;    /*!< Packed bits of a short label, or hash of a long label */
+  size_t    n_bit;  /*!< Length of the label */
+  uint64_t *bits;   /*!< Bits of a long label, or NULL for a short label */
+} Label;
+
+typedef struct {
+  int        is_used;
+  Label      label;
   WsAddrInt  addr;
-  int        n_undef;
-  char      *label;
+  size_t     n_undef;
+  size_t     undef_capacity;
   WsAddrInt *undef_list;
 } LabelInfo;
 
+typedef struct {
+  LabelInfo *entries;
+  size_t     n_bucket;
+  size_t     n_label;
+  uint64_t  *long_bits;           /*!< Bits of the long label being read */
+  size_t     long_bits_capacity;  /*!< The number of words of long_bits */
+} LabelTable;
+
+/*! Table of the bignums of a VM, which is defined in bignum.c */
+typedef struct BignumTable BignumTable;
+
+/*!
+ * @brief Context of a blankspace VM
+ *
+ * Everything that compiling or running a program modifies lives here, so
+ * that any number of VMs can run the same instructions side by side.
+ * Instructions are never modified by a VM.
+ */
+struct BsVM {
+  WsInt         stack[STACK_SIZE];
+  size_t        stack_idx;
+  size_t        call_stack[CALL_STACK_SIZE];
+  Heap          heap;
+  OutputBuffer  output;
+  InputBuffer   input;             /*!< Input of IO_READ_CHAR and IO_READ_NUM */
+  const char   *error;             /*!< Message of the runtime error, or NULL */
+  BignumTable  *bignums;           /*!< Bignums of bignum mode, or NULL */
+  jmp_buf       bignum_escape;     /*!< Where runtime errors of bignum mode
+                                        return to */
+  LabelTable    labels;            /*!< Labels of the program being compiled */
+  char         *literal;           /*!< Digits of the literal being compiled */
+  size_t        literal_capacity;  /*!< Allocated size of literal */
+};
+
+/*! Entry function of a shared object built by native_compile() */
+typedef int (*NativeEntry)(int interactive);
+
+/*! Status of TierEntry: the region returned to its caller */
+#define TIER_RETURNED  0
+/*! Status of TierEntry: the program halted */
+#define TIER_HALTED  1
+/*! Status of TierEntry: the program stopped on a runtime error */
+#define TIER_FAILED  2
+/*! TierContext::resume_at to run a region from its entry */
+#define TIER_NO_RESUME  ((unsigned int) -1)
+/*! Resume address of tier_run() to run a region from its entry */
+#define TIER_FROM_ENTRY  ((size_t) -1)
+
+/*!
+ * @brief State of the interpreter lent to a region compiled by
+ *        translate_region()
+ *
+ * The compiled code sees the stacks and the heap of the VM through it, and
+ * declares the same structure by print_tier_header(); keep them in sync.
+ */
+typedef struct {
+  WsInt        (*stack)[STACK_SIZE - 1];  /*!< The stack above vm->stack[0] */
+  size_t         stack_idx;
+  size_t       (*call_stack)[CALL_STACK_SIZE];  /*!< Return addresses, which
+                                                     are original indices */
+  size_t         call_stack_idx;
+  WsInt        **heap_low;                /*!< Heap::low of the VM */
+  const WsInt   *zero_page;               /*!< Heap::zero_page of the VM */
+  void          *vm;                      /*!< First argument of the callbacks */
+  WsInt        (*heap_load)(void *vm, WsInt addr);
+  void         (*heap_store)(void *vm, WsInt addr, WsInt value);
+  void         (*put_char)(void *vm, int c);
+  void         (*put_num)(void *vm, WsInt n);
+  int          (*read_char)(void *vm);
+  void         (*read_num)(void *vm, WsInt addr);
+  unsigned int   resume_at;  /*!< Label to resume at, or TIER_NO_RESUME */
+  const char    *error;      /*!< Message of the runtime error, or NULL */
+  jmp_buf        escape;     /*!< Where HALT() and runtime errors go */
+} TierContext;
+
+/*! Entry function of a region built by native_compile_region() */
+typedef int (*TierEntry)(TierContext *ctx);
+
+/*! Regions of a program compiled in the background, which is defined in tier.c */
+typedef struct Tier Tier;
+
+/*!
+ * @brief Process of the C compiler which can be cancelled by another thread
+ */
+typedef struct {
+  long pid;           /*!< Process group of the compiler, or 0 */
+  int  is_cancelled;  /*!< Whether native_cancel() was called */
+  int  n_killer;      /*!< The number of native_cancel() sending a signal,
+                           which keep the process from being reaped */
+} NativeJob;
+
+/*!
+ * @brief Instructions verified and threaded once for any number of runs
+ *
+ * Runs only read the prepared code, so VMs can share it.
+ */
+typedef struct {
+  Instruction *verified;    /*!< Instructions returned by verify() */
+  size_t       n_verified;
+  void        *threaded;    /*!< Direct-threaded code, or NULL */
+  Tier        *tier;        /*!< Regions compiled to native code, or NULL */
+} PreparedCode;
+
 
  void
 parse_arguments(Param *param, int argc, char *argv[]);
@@ -91,113 +470,375 @@ parse_arguments(Param *param, int argc, char *argv[]);
  void
 show_usage(const char *progname);
 
+ BsOptions
+options_of(const Param *param);
+
+ int
+run_program(const Param *param);
+
  int
-read_file(FILE *fp, char *code, size_t length);
+is_dirname(const char *filename);
 
+ char *
+image_filename_of(const char *in_filename, const char *out_filename);
+
+ int
+run_batch(const BsProgram *program, const Param *param);
+
+ int
+run_native(const Param *param);
+
+ int
+run_profile(const Param *param);
+
+
+ Instruction *
+build_instructions(BsVM *vm, const char *filename, SourceReader *reader, const BsOptions *options, int allow_fuse, SourceMap *map, size_t *n_inst);
+
+ int
+hash_and_rewind(SourceReader *reader, uint64_t *source_hash);
+
+
+ uint64_t
+hash_source(SourceReader *reader);
+
+ int
+make_directories(const char *dirname);
+
+ int
+save_image(const char *filename, const Instruction *code, size_t n_inst, int opt_level, uint64_t source_hash);
+
+ Instruction *
+load_image(const char *filename, int verbose, size_t *n_inst, int *opt_level, uint64_t *source_hash);
+
+ Instruction *
+wrap_instructions(Instruction *code, size_t n_inst);
 
  void
-execute(const unsigned char *bytecode);
+free_instructions(Instruction *code);
+
+ int
+open_source(SourceReader *reader, const char *filename);
 
  void
-compile(unsigned char *bytecode, size_t *bytecode_size, const char *code);
+open_source_memory(SourceReader *reader, const char *source, size_t size);
+
+ int
+rewind_source(SourceReader *reader);
+
+ char
+reader_fill(SourceReader *reader);
 
  void
-gen_stack_code(unsigned char **bytecode_ptr, const char **code_ptr);
+close_source(SourceReader *reader);
+
+
+ BsVM *
+vm_create(void);
 
  void
-gen_arith_code(unsigned char **bytecode_ptr, const char **code_ptr);
+vm_set_io(BsVM *vm, const BsIO *io);
 
  void
-gen_heap_code(unsigned char **bytecode_ptr, const char **code_ptr);
+vm_reset(BsVM *vm);
 
  void
-gen_io_code(unsigned char **bytecode_ptr, const char **code_ptr);
+vm_destroy(BsVM *vm);
 
  void
-gen_flow_code(unsigned char **bytecode_ptr, const char **code_ptr, unsigned char *base);
+prepare_code(PreparedCode *prepared, const Instruction *code, size_t n_inst, const BsOptions *options);
 
+ int
+execute_prepared(BsVM *vm, const PreparedCode *prepared);
 
  void
-process_label_define(unsigned char **bytecode_ptr, const char **code_ptr, unsigned char *base);
+free_prepared_code(PreparedCode *prepared);
+
+ int
+execute(BsVM *vm, const Instruction *base, size_t n_inst);
+
+ int
+execute_bignum(BsVM *vm, const Instruction *base, size_t n_inst);
 
  void
-process_label_jump(unsigned char **bytecode_ptr, const char **code_ptr, unsigned char *base);
+compile(BsVM *vm, Bytecode *bytecode, SourceReader *reader, SourceMap *map);
 
- LabelInfo *
-search_label(const char *label);
+ void
+free_source_map(SourceMap *map);
+
+ size_t
+operand_size(int opcode);
+
+ int
+is_jump(int opcode);
+
+ int
+unfused_opcode(int opcode);
+
+ Instruction *
+decode(const unsigned char *bytecode, size_t bytecode_size, size_t *n_inst);
+
+ size_t
+fuse_superinstructions(Instruction *code, size_t n_inst);
 
  void
-add_label(const char *_label, WsAddrInt addr);
+optimize(Instruction *code, size_t *n_inst, int level, size_t *source_map);
+
+ Instruction *
+verify(const Instruction *code, size_t n_inst, size_t *n_verified);
+
+ int
+jit_available(void);
+
+ int
+jit_execute(BsVM *vm, const Instruction *code, size_t n_inst);
+
+ int
+native_available(void);
+
+ char *
+native_cache_filename(const char *cache_dir, uint64_t source_hash, int opt_level);
+
+ int
+native_compile(const char *filename, const Instruction *code, size_t n_inst, int opt_level);
+
+ NativeEntry
+native_load(const char *filename);
+
+ int
+native_compile_region(const char *filename, const Instruction *code, size_t n_inst, size_t region, NativeJob *job);
+
+ TierEntry
+native_load_region(const char *filename);
 
  void
-add_undef_label(const char *_label, WsAddrInt pos);
+native_cancel(NativeJob *job);
+
+
+ int
+tier_available(void);
+
+ Tier *
+tier_create(const Instruction *code, size_t n_inst, const Instruction *verified, size_t n_verified, const BsOptions *options);
 
  void
-free_label_info_list(LabelInfo *label_info_list[]);
+tier_free(Tier *tier);
+
+ int
+tier_is_entry(const Tier *tier, size_t addr);
 
+ size_t
+tier_region_of(const Tier *tier, size_t addr);
+
+ TierEntry
+tier_poll(Tier *tier, size_t region);
+
+ int
+tier_run(Tier *tier, TierEntry entry, BsVM *vm, size_t resume_addr, size_t call_stack_idx);
+
+ int
+execute_profile(BsVM *vm, const Instruction *base, size_t n_inst, unsigned long period, int trace, Profile *profile);
+
+ void
+show_profile(FILE *fp, const Profile *profile, const Instruction *code, const char *filename, const SourceMap *map);
+
+ void
+write_folded(FILE *fp, const Profile *profile, const SourceMap *map);
+
+ void
+write_trace(FILE *fp, const Profile *profile, const SourceMap *map);
+
+ void
+free_profile(Profile *profile);
+
+ void
+gen_stack_code(BsVM *vm, Bytecode *bytecode, SourceReader *reader);
+
+ void
+gen_arith_code(Bytecode *bytecode, SourceReader *reader);
+
+ void
+gen_heap_code(Bytecode *bytecode, SourceReader *reader);
+
+ void
+gen_io_code(Bytecode *bytecode, SourceReader *reader);
+
+ void
+gen_flow_code(BsVM *vm, Bytecode *bytecode, SourceReader *reader);
+
+
+ void
+process_label_define(BsVM *vm, Bytecode *bytecode, SourceReader *reader);
+
+ void
+process_label_jump(BsVM *vm, Bytecode *bytecode, SourceReader *reader, int opcode);
 
  void
-stack_push(WsInt e);
+read_label(LabelTable *table, SourceReader *reader, Label *label);
+
+ LabelInfo *
+search_label(const LabelTable *table, const Label *label);
+
+ LabelInfo *
+add_label(LabelTable *table, const Label *label, WsAddrInt addr);
+
+ void
+add_undef_label(LabelInfo *info, WsAddrInt pos);
+
+ char *
+label_name(const Label *label);
+
+ void
+free_label_table(LabelTable *table);
+
+
+ void
+heap_init(Heap *heap);
+
+ void
+heap_free(Heap *heap);
 
  WsInt
-stack_pop(void);
+heap_load(Heap *heap, WsInt addr);
+
+ void
+heap_store(Heap *heap, WsInt addr, WsInt value);
 
  void
-stack_dup_n(size_t n);
+heap_show_stats(FILE *fp, const Heap *heap);
 
  void
-stack_slide(size_t n);
+heap_foreach_page(const Heap *heap, void (*visit)(const WsInt *page, void *arg), void *arg);
+
 
  void
-stack_swap(void);
+input_init(InputBuffer *in, BsReadFunc read, void *arg, const char *data, size_t size);
 
+ int
+input_fill(InputBuffer *in);
 
  int
-read_nstr(const char **code_ptr);
+input_num(InputBuffer *in, int *n);
+
+
+ void
+output_init(OutputBuffer *out, BsWriteFunc write, void *arg, int interactive);
+
+ void
+output_flush(OutputBuffer *out);
+
+ void
+output_write(OutputBuffer *out, const char *str, size_t n);
+
+ void
+output_num(OutputBuffer *out, WsInt n);
 
  char *
-read_label(const char **code_ptr);
+output_detach(OutputBuffer *out, size_t *size);
+
+
+ void
+bignum_init(BsVM *vm);
+
+ WsInt
+bignum_binary(BsVM *vm, int opcode, WsInt a, WsInt b);
+
+ WsInt
+bignum_not(BsVM *vm, WsInt v);
+
+ int
+bignum_is_negative(const BsVM *vm, WsInt v);
+
+ int
+bignum_to_ws_int(const BsVM *vm, WsInt v, WsInt *n);
+
+ WsInt
+bignum_address(BsVM *vm, WsInt v);
+
+ WsInt
+bignum_constant(BsVM *vm, WsInt n);
+
+ void
+bignum_print(BsVM *vm, WsInt v);
+
+ int
+bignum_scan(BsVM *vm, WsInt *v);
+
+ void
+bignum_collect_if_needed(BsVM *vm, const WsInt *sp, WsInt tos);
+
+ void
+bignum_free_all(BsVM *vm);
+
+
+ int
+read_nstr(SourceReader *reader);
 
 
+
+ int
+translate(FILE *fp, const Instruction *code, size_t n_inst, int opt_level, const char *entry);
+
  int
-translate(FILE *fp, const char *code);
+translate_units(const char *dirname, const Instruction *code, size_t n_inst, int opt_level);
+
+ size_t *
+find_regions(const Instruction *code, size_t n_inst);
+
+ int
+translate_region(FILE *fp, const Instruction *code, size_t n_inst, size_t region);
 
  void
-print_stack_code(FILE *fp, const char **code_ptr);
+print_inst(FILE *fp, const Instruction *code, size_t pos, const size_t *owner);
 
  void
-print_arith_code(FILE *fp, const char **code_ptr);
+print_stack_code(FILE *fp, const Instruction *inst);
 
  void
-print_heap_code(FILE *fp, const char **code_ptr);
+print_arith_code(FILE *fp, const Instruction *inst);
 
  void
-print_io_code(FILE *fp, const char **code_ptr);
+print_heap_code(FILE *fp, const Instruction *inst);
 
  void
-print_flow_code(FILE *fp, const char **code_ptr);
+print_io_code(FILE *fp, const Instruction *inst);
 
  void
-print_code_header(FILE *fp);
+print_flow_code(FILE *fp, const Instruction *inst, size_t pos, const size_t *owner);
+
+ void
+print_return_dispatch(FILE *fp, const Instruction *code, size_t n_inst, const size_t *owner);
+
+ void
+print_code_header(FILE *fp, const char *storage);
+
+ void
+print_tier_header(FILE *fp);
+
+ void
+print_globals(FILE *fp, const char *storage);
 
  void
 print_code_footer(FILE *fp);
 
+ void
+print_output_functions(FILE *fp, const char *storage);
+
 
  void
 show_bytecode(const unsigned char *bytecode, size_t bytecode_size);
 
+ const char *
+opcode_name(int opcode);
+
+ void
+print_mnemonic(FILE *fp, const Instruction *inst);
+
  void
-show_mnemonic(FILE *fp, const unsigned char *bytecode, size_t bytecode_size);
+show_mnemonic(FILE *fp, const Instruction *code, size_t n_inst);
 
  void
-filter(FILE *fp, const char *code);
+filter(FILE *fp, SourceReader *reader);
 
 void 
 reverse_filter(FILE *fp, const char *filename);
-
-extern WsInt stack[STACK_SIZE];
-extern size_t stack_idx;
-
-extern LabelInfo *label_info_list[MAX_N_LABEL];
-extern size_t n_label_info;
@@ -1,297 +1,1975 @@
 #include "blankspace.h"
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#ifdef _WIN32
+#  include <direct.h>
+#  define mkdir(path, mode)  _mkdir(path)
+#else
+#  include <sys/stat.h>
+#endif
+
+/*! Whether the subroutine at addr is outlined into a C function */
+#define IS_OUTLINED(owner, addr)  ((owner)[addr] == (addr) + 1)
+
+/* ------------------------------------------------------------------------- *
+ * Heap cell promotion                                                       *
+ * ------------------------------------------------------------------------- */
+/*! Maximum number of addresses in a CellSet before it is widened to all */
+#define CELL_SET_LIMIT  256
+
+/*!
+ * @brief Heap cell at a constant address
+ */
+typedef struct {
+  int          addr;
+  unsigned int count;  /*!< The number of accesses */
+  unsigned int cost;   /*!< The number of accesses to heap[] to keep the cell
+                            in a local variable */
+} Cell;
+
+/*!
+ * @brief Set of heap cells sorted by address, or all of the heap
+ */
+typedef struct {
+  Cell   *cells;
+  size_t  n_cell;
+  size_t  capacity;
+  int     is_all;  /*!< Whether the set has every address */
+} CellSet;
+
+/*!
+ * @brief Heap accesses of main() or of an outlined subroutine
+ *
+ * A cell is promoted to a local variable of the function if it is accessed
+ * more than twice as many times as it would be loaded from and written back
+ * into heap[] at the entry, around the calls and the accesses at unknown
+ * addresses, and at the return, since the C compiler already keeps a part of
+ * the accesses in registers.
+ * ref and mod include the callees, so that only the cells they can see are
+ * synchronized around a call.
+ */
+typedef struct {
+  CellSet       accessed;  /*!< Cells accessed directly, with the counts */
+  CellSet       stored;    /*!< Cells written directly */
+  CellSet       ref;       /*!< Cells which may be read by the function or its callees */
+  CellSet       mod;       /*!< Cells which may be written by the function or its callees */
+  unsigned int  n_sync;    /*!< The number of synchronizations of all the cells */
+  size_t       *callees;   /*!< Entries + 1 of the outlined subroutines called */
+  size_t        n_callee;
+  size_t        callee_capacity;
+} HeapUse;
+
+
+/*!
+ * @brief Find a cell in a set
+ * @param [in] set   Set of cells
+ * @param [in] addr  Address of the cell
+ * @return  Index of the cell, or of the position to insert it at
+ */
+__attribute__((pure))
+static size_t find_cell(const CellSet *set, int addr) {
+  size_t lo = 0, hi = set->n_cell;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (set->cells[mid].addr < addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+
+/*!
+ * @brief Check whether a set has a cell
+ * @param [in] set   Set of cells
+ * @param [in] addr  Address of the cell
+ * @return  TRUE if the set has the cell
+ */
+__attribute__((pure))
+static int has_cell(const CellSet *set, int addr) {
+  size_t i;
+  if (set->is_all) {
+    return TRUE;
+  }
+  i = find_cell(set, addr);
+  return i < set->n_cell && set->cells[i].addr == addr;
+}
+
+
+/*!
+ * @brief Widen a set to all of the heap
+ * @param [in,out] set  Set of cells
+ * @return  TRUE if the set is changed
+ */
+static int widen_cells(CellSet *set) {
+  if (set->is_all) {
+    return FALSE;
+  }
+  free(set->cells);
+  set->cells = NULL;
+  set->n_cell = set->capacity = 0;
+  set->is_all = TRUE;
+  return TRUE;
+}
+
+
+/*!
+ * @brief Add a cell to a set, or count an access to it
+ * @param [in,out] set   Set of cells
+ * @param [in]     addr  Address of the cell
+ * @return  TRUE if the cell is new to the set
+ */
+static int add_cell(CellSet *set, int addr) {
+  size_t i;
+  if (set->is_all) {
+    return FALSE;
+  }
+  i = find_cell(set, addr);
+  if (i < set->n_cell && set->cells[i].addr == addr) {
+    set->cells[i].count++;
+    return FALSE;
+  }
+  if (set->n_cell == CELL_SET_LIMIT) {
+    return widen_cells(set);
+  }
+  if (set->n_cell == set->capacity) {
+    set->capacity = set->capacity == 0 ? 16 : set->capacity * 2;
+    if ((set->cells = (Cell *) realloc(set->cells, set->capacity * sizeof(Cell))) == NULL) {
+      fputs("Failed to allocate memory for translator\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+  }
+  memmove(&set->cells[i + 1], &set->cells[i], (set->n_cell - i) * sizeof(Cell));
+  set->cells[i].addr = addr;
+  set->cells[i].count = 1;
+  set->cells[i].cost = 0;
+  set->n_cell++;
+  return TRUE;
+}
+
+
+/*!
+ * @brief Add all the cells of a set to another
+ * @param [in,out] dst  Set to add to
+ * @param [in]     src  Set of the cells to add
+ * @return  TRUE if dst is changed
+ */
+static int merge_cells(CellSet *dst, const CellSet *src) {
+  int is_changed = FALSE;
+  size_t i;
+  if (src->is_all) {
+    return widen_cells(dst);
+  }
+  for (i = 0; i < src->n_cell && !dst->is_all; i++) {
+    if (!has_cell(dst, src->cells[i].addr)) {
+      is_changed |= add_cell(dst, src->cells[i].addr);
+    }
+  }
+  return is_changed;
+}
+
+
+/*!
+ * @brief Check whether a cell is promoted to a local variable
+ * @param [in] use   Heap accesses of the function, or NULL
+ * @param [in] cell  Cell accessed by the function
+ * @return  TRUE if the cell is promoted
+ */
+__attribute__((pure))
+static int is_promoted_cell(const HeapUse *use, const Cell *cell) {
+  return use != NULL && !use->accessed.is_all && cell->count > 2 * cell->cost;
+}
+
+
+/*!
+ * @brief Release heap accesses
+ * @param [in,out] use  Heap accesses
+ */
+static void free_heap_use(HeapUse *use) {
+  free(use->accessed.cells);
+  free(use->stored.cells);
+  free(use->ref.cells);
+  free(use->mod.cells);
+  free(use->callees);
+  free(use);
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Stack lowering                                                            *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Value on the stack of a basic block, known at translation time
+ */
+typedef struct {
+  int    is_const;  /*!< Whether the value is a constant or a temporary */
+  int    num;       /*!< The constant, or the index of the temporary */
+  size_t origin;    /*!< Depth + 1 of the memory slot loaded into the
+                         temporary at the entry of the segment, or 0 */
+} Value;
+
+/*!
+ * @brief State of lowering a segment of a basic block
+ *
+ * The values pushed in the segment are kept in local variables of C and
+ * written into stack[] only at the end of the segment.
+ * A segment is lowered twice: first without fp, to count the temporaries
+ * and the depth of stack[] read, and then to print.
+ */
+typedef struct {
+  FILE   *fp;          /*!< Output file pointer, or NULL on the first pass */
+  int     braced;      /*!< Whether the segment is a compound statement */
+  const size_t *owner; /*!< Owners of the instructions (see Flow) */
+  HeapUse *use;        /*!< Heap accesses to collect, or NULL */
+  const HeapUse *self; /*!< Heap accesses of the function to print, or NULL */
+  HeapUse *const *uses; /*!< Heap accesses of the functions by owner, or NULL */
+  Value  *values;      /*!< Values pushed in the segment, bottom first */
+  size_t  n_value;
+  size_t  capacity;
+  Value  *loaded;      /*!< Temporaries loaded from stack[] in the segment */
+  size_t  n_loaded;
+  size_t  loaded_capacity;
+  size_t  n_consumed;  /*!< The number of entries of stack[] popped */
+  size_t  max_depth;   /*!< Maximum depth of stack[] read or popped */
+  int     n_temp;      /*!< The number of temporaries */
+  int     tier;        /*!< Whether the code runs on a TierContext */
+} Lowering;
+
+
+/*!
+ * @brief Print a line of C source code in a segment
+ * @param [in,out] lw   State of lowering
+ * @param [in]     fmt  Format string of the line without the indent
+ */
+static void emit(const Lowering *lw, const char *fmt, ...) {
+  va_list args;
+  if (lw->fp == NULL) {
+    return;
+  }
+  fputs(lw->braced ? INDENT_STR INDENT_STR : INDENT_STR, lw->fp);
+  va_start(args, fmt);
+  vfprintf(lw->fp, fmt, args);
+  va_end(args);
+  fputc('\n', lw->fp);
+}
+
+
+/*!
+ * @brief Get the C expression of a value
+ * @param [in]  value  Value
+ * @param [out] buf    Buffer of the expression
+ * @return  buf
+ */
+static const char *value_str(Value value, char buf[32]) {
+  if (!value.is_const) {
+    sprintf(buf, "t%d", value.num);
+  } else if (value.num == INT_MIN) {
+    sprintf(buf, "(%d - 1)", INT_MIN + 1);
+  } else {
+    sprintf(buf, "%d", value.num);
+  }
+  return buf;
+}
+
+
+/*!
+ * @brief Append a value to an array of values
+ * @param [in,out] values    Array of values
+ * @param [in,out] size      The number of values in the array
+ * @param [in,out] capacity  Capacity of the array
+ * @param [in]     value     Value to append
+ */
+static void append_value(Value **values, size_t *size, size_t *capacity, Value value) {
+  if (*size == *capacity) {
+    *capacity = *capacity == 0 ? 64 : *capacity * 2;
+    if ((*values = (Value *) realloc(*values, *capacity * sizeof(Value))) == NULL) {
+      fputs("Failed to allocate memory for translator\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+  }
+  (*values)[(*size)++] = value;
+}
+
+
+/*!
+ * @brief Push a value on the stack of the segment
+ * @param [in,out] lw     State of lowering
+ * @param [in]     value  Value to push
+ */
+static void push_value(Lowering *lw, Value value) {
+  append_value(&lw->values, &lw->n_value, &lw->capacity, value);
+}
+
+
+/*!
+ * @brief Allocate a new temporary
+ * @param [in,out] lw  State of lowering
+ * @return  Temporary, whose value has to be assigned by the caller
+ */
+static Value new_temp(Lowering *lw) {
+  Value value;
+  value.is_const = FALSE;
+  value.num = lw->n_temp++;
+  value.origin = 0;
+  return value;
+}
+
+
+/*!
+ * @brief Load an entry of stack[] below the segment into a temporary
+ *
+ * Since stack[] is not written until the end of the segment, an entry is
+ * loaded only once.
+ * @param [in,out] lw     State of lowering
+ * @param [in]     depth  Depth from the top of stack[] at the entry of the
+ *                        segment, from 1
+ * @return  Temporary holding the entry
+ */
+static Value load_slot(Lowering *lw, size_t depth) {
+  Value value;
+  size_t i;
+
+  for (i = 0; i < lw->n_loaded; i++) {
+    if (lw->loaded[i].origin == depth) {
+      return lw->loaded[i];
+    }
+  }
+  value = new_temp(lw);
+  value.origin = depth;
+  if (lw->max_depth < depth) {
+    lw->max_depth = depth;
+  }
+  emit(lw, "t%d = stack[stack_idx - %lu];", value.num, (unsigned long) depth);
+  append_value(&lw->loaded, &lw->n_loaded, &lw->loaded_capacity, value);
+  return value;
+}
+
+
+/*!
+ * @brief Pop a value from the stack of the segment
+ * @param [in,out] lw    State of lowering
+ * @param [in]     used  Whether the value is needed, or only discarded
+ * @return  Popped value, which is meaningless unless used
+ */
+static Value pop_value(Lowering *lw, int used) {
+  Value value = {TRUE, 0, 0};
+  if (lw->n_value > 0) {
+    return lw->values[--lw->n_value];
+  }
+  lw->n_consumed++;
+  if (used) {
+    return load_slot(lw, lw->n_consumed);
+  }
+  if (lw->max_depth < lw->n_consumed) {
+    lw->max_depth = lw->n_consumed;
+  }
+  return value;
+}
+
+
+/*!
+ * @brief Write the stack of the segment into stack[]
+ *
+ * Entries which are still in their slot of stack[] are not written again.
+ * @param [in,out] lw  State of lowering
+ */
+static void flush_values(Lowering *lw) {
+  char buf[32];
+  size_t i;
+
+  if (lw->n_value > lw->n_consumed) {
+    emit(lw, lw->tier ? "CHECK_ROOM(%lu);" : "assert(stack_idx + %lu <= LENGTHOF(stack));",
+        (unsigned long) (lw->n_value - lw->n_consumed));
+  }
+  for (i = 0; i < lw->n_value; i++) {
+    const Value *value = &lw->values[i];
+    if (i < lw->n_consumed) {
+      size_t depth = lw->n_consumed - i;
+      if (value->origin != depth) {
+        emit(lw, "stack[stack_idx - %lu] = %s;", (unsigned long) depth, value_str(*value, buf));
+      }
+    } else if (i == lw->n_consumed) {
+      emit(lw, "stack[stack_idx] = %s;", value_str(*value, buf));
+    } else {
+      emit(lw, "stack[stack_idx + %lu] = %s;", (unsigned long) (i - lw->n_consumed), value_str(*value, buf));
+    }
+  }
+  if (lw->n_value > lw->n_consumed) {
+    emit(lw, "stack_idx += %lu;", (unsigned long) (lw->n_value - lw->n_consumed));
+  } else if (lw->n_value < lw->n_consumed) {
+    emit(lw, "stack_idx -= %lu;", (unsigned long) (lw->n_consumed - lw->n_value));
+  }
+  lw->n_value = 0;
+  lw->n_consumed = 0;
+  lw->n_loaded = 0;
+}
+
+
+/*!
+ * @brief Lower a binary operator of arithmetic into a temporary
+ * @param [in,out] lw  State of lowering
+ * @param [in]     op  Operator of C
+ */
+static void lower_binary(Lowering *lw, const char *op) {
+  char lhs_buf[32], rhs_buf[32];
+  Value rhs = pop_value(lw, TRUE);
+  Value lhs = pop_value(lw, TRUE);
+  Value result = new_temp(lw);
+  if (op[0] == '/' || op[0] == '%') {
+    emit(lw, lw->tier ? "CHECK_DIVISOR(%s);" : "assert(%s != 0);", value_str(rhs, rhs_buf));
+  }
+  emit(lw, "t%d = %s %s %s;", result.num, value_str(lhs, lhs_buf), op, value_str(rhs, rhs_buf));
+  push_value(lw, result);
+}
+
+
+/*!
+ * @brief Emit a read of a heap cell
+ * @param [in] lw    State of lowering
+ * @param [in] dst   Variable to assign the cell to
+ * @param [in] addr  Expression of the address
+ */
+static void emit_heap_load(const Lowering *lw, const char *dst, const char *addr) {
+  emit(lw, "%s = HEAP_LOAD(%s);", dst, addr);
+}
+
+
+/*!
+ * @brief Emit a write of a heap cell
+ * @param [in] lw     State of lowering
+ * @param [in] addr   Expression of the address
+ * @param [in] value  Expression of the value
+ */
+static void emit_heap_store(const Lowering *lw, const char *addr, const char *value) {
+  emit(lw, "HEAP_STORE(%s, %s);", addr, value);
+}
+
+
+/*!
+ * @brief Check whether a value is a valid constant address of the heap
+ */
+__attribute__((const))
+static int is_cell_addr(Value addr) {
+  return addr.is_const && 0 <= addr.num && addr.num < HEAP_SIZE;
+}
+
+
+/*!
+ * @brief Get the promoted cell at an address
+ * @param [in] lw    State of lowering
+ * @param [in] addr  Value of the address
+ * @return  Cell, or NULL if the address is not of a promoted cell
+ */
+__attribute__((pure))
+static const Cell *promoted_cell(const Lowering *lw, Value addr) {
+  size_t i;
+  if (lw->self == NULL || !is_cell_addr(addr) || lw->self->accessed.is_all) {
+    return NULL;
+  }
+  i = find_cell(&lw->self->accessed, addr.num);
+  if (i < lw->self->accessed.n_cell && lw->self->accessed.cells[i].addr == addr.num
+      && is_promoted_cell(lw->self, &lw->self->accessed.cells[i])) {
+    return &lw->self->accessed.cells[i];
+  }
+  return NULL;
+}
+
+
+/*!
+ * @brief Collect a heap access
+ * @param [in,out] lw        State of lowering
+ * @param [in]     addr      Value of the address
+ * @param [in]     is_store  Whether the access writes the heap
+ */
+static void note_heap(Lowering *lw, Value addr, int is_store) {
+  if (lw->use == NULL) {
+    return;
+  }
+  if (is_cell_addr(addr)) {
+    add_cell(&lw->use->accessed, addr.num);
+    add_cell(&lw->use->ref, addr.num);
+    if (is_store) {
+      add_cell(&lw->use->stored, addr.num);
+      add_cell(&lw->use->mod, addr.num);
+    }
+  } else {
+    widen_cells(is_store ? &lw->use->mod : &lw->use->ref);
+    lw->use->n_sync += is_store ? 2 : 1;
+  }
+}
+
+
+/*!
+ * @brief Collect a call of an outlined subroutine
+ * @param [in,out] lw  State of lowering
+ * @param [in]     id  Entry + 1 of the subroutine
+ */
+static void note_call(Lowering *lw, size_t id) {
+  HeapUse *use = lw->use;
+  if (use == NULL) {
+    return;
+  }
+  if (use->n_callee == use->callee_capacity) {
+    use->callee_capacity = use->callee_capacity == 0 ? 16 : use->callee_capacity * 2;
+    if ((use->callees = (size_t *) realloc(use->callees, use->callee_capacity * sizeof(size_t))) == NULL) {
+      fputs("Failed to allocate memory for translator\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+  }
+  use->callees[use->n_callee++] = id;
+}
+
+
+/*!
+ * @brief Write the promoted cells stored by the function back into heap[]
+ *
+ * The cells which a callee may modify are written back as well as those it
+ * may read, since they are reloaded after the call.
+ * @param [in] lw      State of lowering
+ * @param [in] callee  Heap accesses of the callee, or NULL for all cells
+ */
+static void write_back_cells(const Lowering *lw, const HeapUse *callee) {
+  char addr[32], var[32];
+  size_t i;
+  if (lw->self == NULL || lw->self->accessed.is_all) {
+    return;
+  }
+  for (i = 0; i < lw->self->accessed.n_cell; i++) {
+    const Cell *cell = &lw->self->accessed.cells[i];
+    if (is_promoted_cell(lw->self, cell) && has_cell(&lw->self->stored, cell->addr)
+        && (callee == NULL || has_cell(&callee->ref, cell->addr) || has_cell(&callee->mod, cell->addr))) {
+      sprintf(addr, "%d", cell->addr);
+      sprintf(var, "h%d", cell->addr);
+      emit_heap_store(lw, addr, var);
+    }
+  }
+}
+
+
+/*!
+ * @brief Reload the promoted cells from heap[]
+ * @param [in] lw      State of lowering
+ * @param [in] filter  Cells to reload, or NULL for all
+ */
+static void reload_cells(const Lowering *lw, const CellSet *filter) {
+  char addr[32], var[32];
+  size_t i;
+  if (lw->self == NULL || lw->self->accessed.is_all) {
+    return;
+  }
+  for (i = 0; i < lw->self->accessed.n_cell; i++) {
+    const Cell *cell = &lw->self->accessed.cells[i];
+    if (is_promoted_cell(lw->self, cell) && (filter == NULL || has_cell(filter, cell->addr))) {
+      sprintf(addr, "%d", cell->addr);
+      sprintf(var, "h%d", cell->addr);
+      emit_heap_load(lw, var, addr);
+    }
+  }
+}
+
+
+/*!
+ * @brief Check whether an instruction can be lowered
+ *
+ * STACK_DUP_N and STACK_SLIDE with an operand out of the stack are left to
+ * the helper functions, which report it at runtime.
+ * @param [in] inst  Instruction
+ * @return  TRUE if lower_inst() can handle it
+ */
+__attribute__((pure))
+static int is_lowerable(const Instruction *inst) {
+  switch (unfused_opcode(inst->opcode)) {
+    case STACK_DUP_N:
+    case STACK_SLIDE:
+      return 0 <= inst->operand.num && inst->operand.num < STACK_SIZE;
+    default:
+      return TRUE;
+  }
+}
+
+
+/*!
+ * @brief Check whether an instruction ends a basic block
+ * @param [in] opcode  Opcode of the instruction
+ * @return  TRUE if the instruction transfers control
+ */
+__attribute__((const))
+static int is_block_end(int opcode) {
+  return is_jump(opcode) || opcode == FLOW_ENDSUB || opcode == FLOW_HALT;
+}
+
+
+/*!
+ * @brief Lower an instruction
+ * @param [in,out] lw    State of lowering
+ * @param [in]     inst  Instruction, which is not a superinstruction
+ * @param [in]     pos   Index of the instruction
+ */
+static void lower_inst(Lowering *lw, const Instruction *inst, size_t pos) {
+  char buf[32], buf2[32];
+  Value a, b, c;
+  size_t n;
+
+  switch (inst->opcode) {
+    case STACK_PUSH:
+      a.is_const = TRUE;
+      a.num = inst->operand.num;
+      a.origin = 0;
+      push_value(lw, a);
+      break;
+    case STACK_DUP:
+    case STACK_DUP_N:
+      n = inst->opcode == STACK_DUP ? 0 : (size_t) inst->operand.num;
+      if (n < lw->n_value) {
+        a = lw->values[lw->n_value - 1 - n];
+      } else {
+        a = load_slot(lw, lw->n_consumed + (n - lw->n_value) + 1);
+      }
+      push_value(lw, a);
+      break;
+    case STACK_SLIDE:
+      a = pop_value(lw, TRUE);
+      n = (size_t) inst->operand.num;
+      if (n <= lw->n_value) {
+        lw->n_value -= n;
+      } else {
+        lw->n_consumed += n - lw->n_value;
+        lw->n_value = 0;
+        if (lw->max_depth < lw->n_consumed) {
+          lw->max_depth = lw->n_consumed;
+        }
+      }
+      push_value(lw, a);
+      break;
+    case STACK_SWAP:
+      a = pop_value(lw, TRUE);
+      b = pop_value(lw, TRUE);
+      push_value(lw, a);
+      push_value(lw, b);
+      break;
+    case STACK_DISCARD:
+      pop_value(lw, FALSE);
+      break;
+    case ARITH_ADD:
+      lower_binary(lw, "+");
+      break;
+    case ARITH_SUB:
+      lower_binary(lw, "-");
+      break;
+    case ARITH_MUL:
+      lower_binary(lw, "*");
+      break;
+    case ARITH_DIV:
+      lower_binary(lw, "/");
+      break;
+    case ARITH_MOD:
+      lower_binary(lw, "%");
+      break;
+    case BIT_AND:
+      lower_binary(lw, "&");
+      break;
+    case BIT_OR:
+      lower_binary(lw, "|");
+      break;
+    case BIT_XOR:
+      lower_binary(lw, "^");
+      break;
+    case BIT_LS:
+      lower_binary(lw, "<<");
+      break;
+    case BIT_RS:
+      lower_binary(lw, ">>");
+      break;
+    case BIT_NOT:
+      a = pop_value(lw, TRUE);
+      b = new_temp(lw);
+      emit(lw, "t%d = ~%s;", b.num, value_str(a, buf));
+      push_value(lw, b);
+      break;
+    case HEAP_STORE:
+      a = pop_value(lw, TRUE);
+      b = pop_value(lw, TRUE);
+      note_heap(lw, b, TRUE);
+      if (promoted_cell(lw, b) != NULL) {
+        emit(lw, "h%d = %s;", b.num, value_str(a, buf2));
+      } else if (is_cell_addr(b)) {
+        emit_heap_store(lw, value_str(b, buf), value_str(a, buf2));
+      } else {
+        write_back_cells(lw, NULL);
+        emit_heap_store(lw, value_str(b, buf), value_str(a, buf2));
+        reload_cells(lw, NULL);
+      }
+      break;
+    case HEAP_LOAD:
+      a = pop_value(lw, TRUE);
+      note_heap(lw, a, FALSE);
+      b = new_temp(lw);
+      if (promoted_cell(lw, a) != NULL) {
+        emit(lw, "t%d = h%d;", b.num, a.num);
+      } else {
+        if (!is_cell_addr(a)) {
+          write_back_cells(lw, NULL);
+        }
+        emit_heap_load(lw, value_str(b, buf2), value_str(a, buf));
+      }
+      push_value(lw, b);
+      break;
+    case IO_PUT_CHAR:
+      emit(lw, "put_char(%s);", value_str(pop_value(lw, TRUE), buf));
+      break;
+    case IO_PUT_NUM:
+      emit(lw, "put_num(%s);", value_str(pop_value(lw, TRUE), buf));
+      break;
+    case IO_READ_CHAR:
+      a = pop_value(lw, TRUE);
+      note_heap(lw, a, TRUE);
+      emit(lw, "sync_output();");
+      if (promoted_cell(lw, a) != NULL) {
+        emit(lw, "h%d = getchar();", a.num);
+      } else if (is_cell_addr(a)) {
+        emit_heap_store(lw, value_str(a, buf), "getchar()");
+      } else {
+        write_back_cells(lw, NULL);
+        emit_heap_store(lw, value_str(a, buf), "getchar()");
+        reload_cells(lw, NULL);
+      }
+      break;
+    case IO_READ_NUM:
+      a = pop_value(lw, TRUE);
+      note_heap(lw, a, TRUE);
+      emit(lw, "sync_output();");
+      if (promoted_cell(lw, a) != NULL) {
+        /* scanf() leaves the cell as it is on failure */
+        sprintf(buf2, "h%d", a.num);
+        emit_heap_store(lw, value_str(a, buf), buf2);
+        emit(lw, "READ_NUM(%s);", buf);
+        emit_heap_load(lw, buf2, buf);
+      } else if (is_cell_addr(a)) {
+        emit(lw, "READ_NUM(%s);", value_str(a, buf));
+      } else {
+        write_back_cells(lw, NULL);
+        emit(lw, "READ_NUM(%s);", value_str(a, buf));
+        reload_cells(lw, NULL);
+      }
+      break;
+    case FLOW_GOSUB:
+      flush_values(lw);
+      if (IS_OUTLINED(lw->owner, inst->operand.addr)) {
+        const HeapUse *callee = lw->uses != NULL ? lw->uses[inst->operand.addr + 1] : NULL;
+        note_call(lw, inst->operand.addr + 1);
+        if (callee != NULL) {
+          write_back_cells(lw, callee);
+        }
+        emit(lw, lw->tier ? "sub%u(ctx);" : "sub%u();", inst->operand.addr);
+        if (callee != NULL) {
+          reload_cells(lw, &callee->mod);
+        }
+      } else {
+        emit(lw, "CALL(%u, %u);", inst->operand.addr, (unsigned int) (pos + 1));
+      }
+      break;
+    case FLOW_JUMP:
+      flush_values(lw);
+      emit(lw, "goto L%u;", inst->operand.addr);
+      break;
+    case FLOW_BEZ:
+    case FLOW_BLTZ:
+      c = pop_value(lw, TRUE);
+      flush_values(lw);
+      emit(lw, inst->opcode == FLOW_BEZ ? "if (!%s) {" : "if (%s < 0) {", value_str(c, buf));
+      emit(lw, INDENT_STR "goto L%u;", inst->operand.addr);
+      emit(lw, "}");
+      break;
+    case FLOW_ENDSUB:
+      flush_values(lw);
+      if (lw->owner[pos] != 0) {
+        if (lw->use != NULL) {
+          lw->use->n_sync++;
+        }
+        write_back_cells(lw, NULL);
+        emit(lw, "return;");
+      } else {
+        emit(lw, "RETURN();");
+      }
+      break;
+    case FLOW_HALT:
+      if (lw->tier) {
+        /* The stack and the heap outlive a TierContext */
+        flush_values(lw);
+        write_back_cells(lw, NULL);
+        emit(lw, "HALT();");
+      } else {
+        emit(lw, "exit(EXIT_SUCCESS);");
+      }
+      break;
+    default:
+      if (lw->fp != NULL) {
+        fprintf(stderr, "Undefined instruction is detected [%02x]\n", inst->opcode);
+      }
+      break;
+  }
+}
+
+
+/*!
+ * @brief Lower the instructions of a segment of a basic block once
+ * @param [in,out] lw     State of lowering
+ * @param [in]     code   Decoded instructions
+ * @param [in]     begin  Index of the first instruction of the segment
+ * @param [in]     end    Index next to the last instruction of the segment
+ */
+static void simulate_segment(Lowering *lw, const Instruction *code, size_t begin, size_t end) {
+  size_t i;
+
+  lw->n_value = lw->n_consumed = lw->n_loaded = lw->max_depth = 0;
+  lw->n_temp = 0;
+  for (i = begin; i < end; i++) {
+    Instruction inst = code[i];
+    inst.opcode = unfused_opcode(inst.opcode);
+    lower_inst(lw, &inst, i);
+  }
+  if (!is_block_end(unfused_opcode(code[end - 1].opcode))) {
+    flush_values(lw);
+  }
+}
+
+
+/*!
+ * @brief Lower a segment of a basic block into C source code
+ *
+ * A segment with temporaries is enclosed in a compound statement which
+ * declares them.
+ * The depth of stack[] the segment reads is checked at the entry.
+ * @param [in,out] fp     Output file pointer
+ * @param [in,out] lw     State of lowering, which is empty
+ * @param [in]     code   Decoded instructions
+ * @param [in]     begin  Index of the first instruction of the segment
+ * @param [in]     end    Index next to the last instruction of the segment
+ */
+static void lower_segment(FILE *fp, Lowering *lw, const Instruction *code, size_t begin, size_t end) {
+  int pass, j;
+
+  lw->fp = NULL;
+  lw->braced = FALSE;
+  for (pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      lw->fp = fp;
+      if ((lw->braced = lw->n_temp > 0)) {
+        fputs(INDENT_STR "{\n", fp);
+      }
+      for (j = 0; j < lw->n_temp; j++) {
+        fprintf(fp, j % 16 == 0 ? INDENT_STR INDENT_STR "int t%d" : ", t%d", j);
+        if (j % 16 == 15 || j == lw->n_temp - 1) {
+          fputs(";\n", fp);
+        }
+      }
+      if (lw->max_depth > 0) {
+        emit(lw, lw->tier ? "CHECK_STACK(%lu);" : "assert(stack_idx >= %lu);", (unsigned long) lw->max_depth);
+      }
+    }
+    simulate_segment(lw, code, begin, end);
+  }
+  if (lw->braced) {
+    fputs(INDENT_STR "}\n", fp);
+  }
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Subroutine outlining                                                      *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Flow of control analyzed for translation
+ *
+ * Every instruction belongs to main() or to exactly one outlined
+ * subroutine, and order lists the instructions grouped by their owner.
+ */
+typedef struct {
+  unsigned char *is_target;   /*!< Whether each instruction needs a label */
+  size_t        *owner;       /*!< Entry + 1 of the outlined subroutine each
+                                   instruction belongs to, or 0 for main() */
+  size_t        *order;       /*!< Indices of the instructions sorted by owner */
+  size_t        *start;       /*!< Offset in order of the instructions of each
+                                   owner (n_inst + 3 elements) */
+  int            has_endsub;  /*!< Whether main() has FLOW_ENDSUB */
+} Flow;
+
+
+/*!
+ * @brief Get the successors of an instruction within its subroutine
+ *
+ * FLOW_GOSUB continues at the next instruction, since the callee returns.
+ * @param [in]  code  Decoded instructions
+ * @param [in]  pos   Index of the instruction
+ * @param [out] succ  Indices of the successors
+ * @return  The number of the successors
+ */
+static int get_successors(const Instruction *code, size_t pos, size_t succ[2]) {
+  switch (unfused_opcode(code[pos].opcode)) {
+    case FLOW_JUMP:
+      succ[0] = code[pos].operand.addr;
+      return 1;
+    case FLOW_BEZ:
+    case FLOW_BLTZ:
+      succ[0] = code[pos].operand.addr;
+      succ[1] = pos + 1;
+      return 2;
+    case FLOW_ENDSUB:
+    case FLOW_HALT:
+      return 0;
+    default:
+      succ[0] = pos + 1;
+      return 1;
+  }
+}
+
+
+/*!
+ * @brief Find subroutines which can be outlined into C functions
+ *
+ * A subroutine is the code reachable from a FLOW_GOSUB target without
+ * following calls.
+ * It is outlined if it is entered only by calls to its entry, doesn't
+ * share code with another subroutine, can't run past the end of the
+ * program, and calls only outlined subroutines.
+ * Then its FLOW_ENDSUB always returns to the caller of its entry, which
+ * a C function can do natively.
+ * @param [in]  code    Decoded instructions
+ * @param [in]  n_inst  The number of instructions
+ * @param [out] owner   Entry + 1 of the outlined subroutine each instruction
+ *                      belongs to, or 0 (n_inst + 1 elements)
+ */
+static void outline_subroutines(const Instruction *code, size_t n_inst, size_t *owner) {
+  size_t *work = (size_t *) malloc((n_inst + 1) * sizeof(size_t));
+  unsigned char *rejected = (unsigned char *) calloc(n_inst + 1, sizeof(unsigned char));
+  size_t i, t, n_work, succ[2];
+  int k, n_succ, is_changed;
+
+  if (work == NULL || rejected == NULL) {
+    fputs("Failed to allocate memory for translator\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  memset(owner, 0, (n_inst + 1) * sizeof(size_t));
+  for (i = 0; i < n_inst; i++) {
+    if (code[i].opcode != FLOW_GOSUB || (t = code[i].operand.addr) >= n_inst || owner[t] == t + 1) {
+      continue;
+    }
+    if (owner[t] != 0) {
+      rejected[owner[t] - 1] = TRUE;
+      continue;
+    }
+    owner[t] = t + 1;
+    work[0] = t;
+    n_work = 1;
+    while (n_work > 0) {
+      n_succ = get_successors(code, work[--n_work], succ);
+      for (k = 0; k < n_succ; k++) {
+        if (succ[k] >= n_inst) {
+          rejected[t] = TRUE;
+        } else if (owner[succ[k]] == 0) {
+          owner[succ[k]] = t + 1;
+          work[n_work++] = succ[k];
+        } else if (owner[succ[k]] != t + 1) {
+          rejected[t] = TRUE;
+          rejected[owner[succ[k]] - 1] = TRUE;
+        }
+      }
+    }
+  }
+  /* The program starts at the top */
+  if (n_inst > 0 && owner[0] != 0) {
+    rejected[owner[0] - 1] = TRUE;
+  }
+  for (i = 0; i < n_inst; i++) {
+    n_succ = get_successors(code, i, succ);
+    for (k = 0; k < n_succ; k++) {
+      if (succ[k] < n_inst && owner[succ[k]] != 0 && owner[succ[k]] != owner[i]) {
+        rejected[owner[succ[k]] - 1] = TRUE;
+      }
+    }
+    if (code[i].opcode == FLOW_GOSUB && (t = code[i].operand.addr) < n_inst
+        && owner[t] != 0 && owner[t] != t + 1) {
+      rejected[owner[t] - 1] = TRUE;
+    }
+  }
+  do {
+    is_changed = FALSE;
+    for (i = 0; i < n_inst; i++) {
+      if (owner[i] != 0 && !rejected[owner[i] - 1] && code[i].opcode == FLOW_GOSUB
+          && ((t = code[i].operand.addr) >= n_inst || rejected[t])) {
+        rejected[owner[i] - 1] = TRUE;
+        is_changed = TRUE;
+      }
+    }
+  } while (is_changed);
+  for (i = 0; i < n_inst; i++) {
+    if (owner[i] != 0 && rejected[owner[i] - 1]) {
+      owner[i] = 0;
+    }
+  }
+  free(work);
+  free(rejected);
+}
+
+
+/*!
+ * @brief Analyze the flow of control for translation
+ * @param [out] flow     Flow of control (must be released with free_flow())
+ * @param [in]  code     Decoded instructions
+ * @param [in]  n_inst   The number of instructions
+ * @param [in]  outline  Whether to outline subroutines into C functions
+ */
+static void analyze_flow(Flow *flow, const Instruction *code, size_t n_inst, int outline) {
+  size_t i, t;
+
+  flow->is_target = (unsigned char *) calloc(n_inst + 1, sizeof(unsigned char));
+  flow->owner = (size_t *) calloc(n_inst + 1, sizeof(size_t));
+  flow->order = (size_t *) malloc((n_inst + 1) * sizeof(size_t));
+  flow->start = (size_t *) calloc(n_inst + 3, sizeof(size_t));
+  if (flow->is_target == NULL || flow->owner == NULL || flow->order == NULL || flow->start == NULL) {
+    fputs("Failed to allocate memory for translator\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  if (outline) {
+    outline_subroutines(code, n_inst, flow->owner);
+  }
+  flow->has_endsub = FALSE;
+  for (i = 0; i < n_inst; i++) {
+    if (is_jump(code[i].opcode) && code[i].opcode != FLOW_GOSUB) {
+      flow->is_target[code[i].operand.addr] = TRUE;
+    }
+    if (code[i].opcode == FLOW_GOSUB && !IS_OUTLINED(flow->owner, code[i].operand.addr)) {
+      flow->is_target[code[i].operand.addr] = TRUE;
+      flow->is_target[i + 1] = TRUE;
+    } else if (code[i].opcode == FLOW_ENDSUB && flow->owner[i] == 0) {
+      flow->has_endsub = TRUE;
+    }
+  }
+  /* Counting sort by owner */
+  for (i = 0; i < n_inst; i++) {
+    flow->start[flow->owner[i] + 1]++;
+  }
+  for (i = 1; i < n_inst + 3; i++) {
+    flow->start[i] += flow->start[i - 1];
+  }
+  for (i = 0; i < n_inst; i++) {
+    flow->order[flow->start[flow->owner[i]]++] = i;
+  }
+  memmove(&flow->start[1], &flow->start[0], (n_inst + 1) * sizeof(size_t));
+  flow->start[0] = 0;
+  /* A subroutine whose code precedes its entry jumps to the entry first */
+  for (t = 0; t < n_inst; t++) {
+    if (IS_OUTLINED(flow->owner, t) && flow->order[flow->start[t + 1]] != t) {
+      flow->is_target[t] = TRUE;
+    }
+  }
+}
+
+
+/*!
+ * @brief Release the result of analyze_flow()
+ * @param [in,out] flow  Flow of control
+ */
+static void free_flow(Flow *flow) {
+  free(flow->is_target);
+  free(flow->owner);
+  free(flow->order);
+  free(flow->start);
+}
+
+
+/*!
+ * @brief Find the end of the segment which lower_segment() lowers at once
+ * @param [in] flow  Flow of control
+ * @param [in] code  Decoded instructions
+ * @param [in] id    Entry + 1 of the subroutine, or 0 for main()
+ * @param [in] k     Offset in flow->order of the first instruction, which is
+ *                   lowerable
+ * @return  Index next to the last instruction of the segment
+ */
+__attribute__((pure))
+static size_t segment_end(const Flow *flow, const Instruction *code, size_t id, size_t k) {
+  size_t i = flow->order[k], j;
+  for (j = i + 1; k + (j - i) < flow->start[id + 1] && flow->order[k + (j - i)] == j
+      && !flow->is_target[j] && is_lowerable(&code[j])
+      && !is_block_end(unfused_opcode(code[j - 1].opcode)); j++);
+  return j;
+}
+
+
+/*!
+ * @brief Collect the heap accesses of main() and the outlined subroutines
+ *
+ * The addresses are the constants found by lowering the stack.
+ * The cells referred and modified by the callees are propagated to the
+ * callers until no set changes, and then the cost of promoting each cell is
+ * estimated.
+ * @param [in] flow    Flow of control
+ * @param [in] code    Decoded instructions
+ * @param [in] n_inst  The number of instructions
+ * @return  Heap accesses indexed by owner, NULL for the other indices
+ *          (must be released with free_heap_uses())
+ */
+static HeapUse **analyze_heap(const Flow *flow, const Instruction *code, size_t n_inst) {
+  Lowering lw = {NULL, FALSE, NULL, NULL, NULL, NULL, NULL, 0, 0, NULL, 0, 0, 0, 0, 0, FALSE};
+  HeapUse **uses = (HeapUse **) calloc(n_inst + 1, sizeof(HeapUse *));
+  size_t id, k, i, j, t;
+  int is_changed;
+
+  if (uses == NULL) {
+    fputs("Failed to allocate memory for translator\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  lw.owner = flow->owner;
+  for (id = 0; id <= n_inst; id++) {
+    if (id != 0 && !IS_OUTLINED(flow->owner, id - 1)) {
+      continue;
+    }
+    if ((uses[id] = (HeapUse *) calloc(1, sizeof(HeapUse))) == NULL) {
+      fputs("Failed to allocate memory for translator\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+    lw.use = uses[id];
+    for (k = flow->start[id]; k < flow->start[id + 1]; k += j - i) {
+      i = flow->order[k];
+      if (is_lowerable(&code[i])) {
+        j = segment_end(flow, code, id, k);
+        simulate_segment(&lw, code, i, j);
+      } else {
+        j = i + 1;
+      }
+    }
+  }
+  do {
+    is_changed = FALSE;
+    for (i = 0; i < n_inst; i++) {
+      t = code[i].operand.addr;
+      if (code[i].opcode == FLOW_GOSUB && IS_OUTLINED(flow->owner, t)) {
+        is_changed |= merge_cells(&uses[flow->owner[i]]->ref, &uses[t + 1]->ref);
+        is_changed |= merge_cells(&uses[flow->owner[i]]->mod, &uses[t + 1]->mod);
+      }
+    }
+  } while (is_changed);
+  for (id = 0; id <= n_inst; id++) {
+    HeapUse *use = uses[id];
+    if (use == NULL) {
+      continue;
+    }
+    for (i = 0; i < use->accessed.n_cell; i++) {
+      Cell *cell = &use->accessed.cells[i];
+      cell->cost = 1 + use->n_sync;
+      for (j = 0; j < use->n_callee; j++) {
+        const HeapUse *callee = uses[use->callees[j]];
+        cell->cost += (unsigned int) (has_cell(&callee->ref, cell->addr) || has_cell(&callee->mod, cell->addr))
+          + (unsigned int) has_cell(&callee->mod, cell->addr);
+      }
+    }
+  }
+  free(lw.values);
+  free(lw.loaded);
+  return uses;
+}
+
+
+/*!
+ * @brief Release the result of analyze_heap()
+ * @param [in,out] uses    Heap accesses indexed by owner
+ * @param [in]     n_inst  The number of instructions
+ */
+static void free_heap_uses(HeapUse **uses, size_t n_inst) {
+  size_t id;
+  if (uses == NULL) {
+    return;
+  }
+  for (id = 0; id <= n_inst; id++) {
+    if (uses[id] != NULL) {
+      free_heap_use(uses[id]);
+    }
+  }
+  free(uses);
+}
+
 
 /* ------------------------------------------------------------------------- *
  * Blankspace translator                                                     *
  * ------------------------------------------------------------------------- */
 /*!
- * @brief Translate blankspace source code into C source code
- * @param [in,out] fp    output file pointer
- * @param [in]     code  Pointer to Blankspace source code buffer
- * @return Status-code
+ * @brief Print the instructions of main() or of an outlined subroutine
+ *
+ * With lower_stack, every basic block is lowered by lower_segment(), so that
+ * the C compiler can keep the stack in registers.
+ * @param [in,out] fp           Output file pointer
+ * @param [in]     flow         Flow of control
+ * @param [in]     code         Decoded instructions
+ * @param [in]     id           Entry + 1 of the subroutine, or 0 for main()
+ * @param [in]     lower_stack  Whether to lower the stack into local variables
+ * @param [in,out] lw           State of lowering
+ */
+static void print_body(FILE *fp, const Flow *flow, const Instruction *code, size_t id, int lower_stack, Lowering *lw) {
+  size_t k, i, j;
+
+  for (k = flow->start[id]; k < flow->start[id + 1]; k += j - i) {
+    i = flow->order[k];
+    if (flow->is_target[i]) {
+      fprintf(fp, "\nL%u:\n", (unsigned int) i);
+    }
+    if (lower_stack && is_lowerable(&code[i])) {
+      j = segment_end(flow, code, id, k);
+      lower_segment(fp, lw, code, i, j);
+    } else {
+      print_inst(fp, &code[i], i, flow->owner);
+      j = i + 1;
+    }
+  }
+}
+
+
+/*!
+ * @brief Print the jump to the label a function on a TierContext resumes at
+ *
+ * The interpreter resumes a function at the header of a loop, whose label
+ * is looked up among all the labels of the function.
+ * @param [in,out] fp    Output file pointer
+ * @param [in]     flow  Flow of control
+ * @param [in]     id    Entry + 1 of the subroutine, or 0 for main()
+ */
+static void print_resume_points(FILE *fp, const Flow *flow, size_t id) {
+  size_t k;
+  int has_label = FALSE;
+
+  for (k = flow->start[id]; k < flow->start[id + 1] && !has_label; k++) {
+    has_label = flow->is_target[flow->order[k]];
+  }
+  if (!has_label) {
+    return;
+  }
+  fputs(
+      INDENT_STR "if (ctx->resume_at != TIER_NO_RESUME) {\n"
+      INDENT_STR INDENT_STR "unsigned int at = ctx->resume_at;\n"
+      INDENT_STR INDENT_STR "ctx->resume_at = TIER_NO_RESUME;\n"
+      INDENT_STR INDENT_STR "switch (at) {\n", fp);
+  for (k = flow->start[id]; k < flow->start[id + 1]; k++) {
+    if (flow->is_target[flow->order[k]]) {
+      fprintf(fp,
+          INDENT_STR INDENT_STR INDENT_STR "case %u:\n"
+          INDENT_STR INDENT_STR INDENT_STR INDENT_STR "goto L%u;\n",
+          (unsigned int) flow->order[k], (unsigned int) flow->order[k]);
+    }
+  }
+  fputs(
+      INDENT_STR INDENT_STR "}\n"
+      INDENT_STR "}\n", fp);
+}
+
+
+/*!
+ * @brief Print the declarations of the promoted cells of a function
+ *
+ * The cells are loaded from heap[] at the entry of the function.
+ * @param [in,out] fp    Output file pointer
+ * @param [in]     use   Heap accesses of the function, or NULL
+ * @param [in]     tier  Whether the code runs on a TierContext
+ */
+static void print_cell_declarations(FILE *fp, const HeapUse *use, int tier) {
+  size_t i;
+  int n = 0;
+
+  if (use == NULL || use->accessed.is_all) {
+    return;
+  }
+  for (i = 0; i < use->accessed.n_cell; i++) {
+    const Cell *cell = &use->accessed.cells[i];
+    if (is_promoted_cell(use, cell)) {
+      if (tier) {
+        fprintf(fp, n++ % 8 == 0 ? INDENT_STR "int h%d = HEAP_LOAD(%d)" : ", h%d = HEAP_LOAD(%d)", cell->addr, cell->addr);
+      } else {
+        fprintf(fp, n++ % 8 == 0 ? INDENT_STR "int h%d = heap[%d]" : ", h%d = heap[%d]", cell->addr, cell->addr);
+      }
+      if (n % 8 == 0) {
+        fputs(";\n", fp);
+      }
+    }
+  }
+  if (n % 8 != 0) {
+    fputs(";\n", fp);
+  }
+}
+
+
+/*!
+ * @brief Print main() of translated C source code
+ *
+ * With an entry name, main() is printed as a function of that name which
+ * takes the initial value of is_interactive, so that the code can be built
+ * as a shared object.
+ * @param [in,out] fp           Output file pointer
+ * @param [in]     flow         Flow of control
+ * @param [in]     code         Decoded instructions
+ * @param [in]     n_inst       The number of instructions
+ * @param [in]     entry        Name of the entry function, or NULL for main()
+ * @param [in]     lower_stack  Whether to lower the stack into local variables
+ * @param [in,out] lw           State of lowering
+ */
+static void print_main(FILE *fp, const Flow *flow, const Instruction *code, size_t n_inst, const char *entry, int lower_stack, Lowering *lw) {
+  lw->self = lw->uses != NULL ? lw->uses[0] : NULL;
+  if (lw->tier) {
+    fputs("static int run_main(TierContext *ctx)\n{\n", fp);
+  } else if (entry == NULL) {
+    fputs("int main(void)\n{\n", fp);
+  } else {
+    fprintf(fp, "int %s(int interactive)\n{\n", entry);
+  }
+  print_cell_declarations(fp, lw->self, lw->tier);
+  if (lw->tier) {
+    print_resume_points(fp, flow, 0);
+  } else {
+    if (entry != NULL) {
+      fputs(INDENT_STR "is_interactive = interactive;\n", fp);
+    }
+    fputs(
+        INDENT_STR "is_interactive |= isatty(fileno(stdout));\n"
+        INDENT_STR "atexit(flush_output);\n", fp);
+  }
+  print_body(fp, flow, code, 0, lower_stack, lw);
+  if (flow->is_target[n_inst]) {
+    fprintf(fp, "\nL%u:\n", (unsigned int) n_inst);
+  }
+  if (flow->has_endsub) {
+    print_return_dispatch(fp, code, n_inst, flow->owner);
+  }
+  fputs(
+      "\n"
+      INDENT_STR "return EXIT_SUCCESS;\n"
+      "}\n\n\n", fp);
+}
+
+
+/*!
+ * @brief Print an outlined subroutine as a C function
+ * @param [in,out] fp           Output file pointer
+ * @param [in]     flow         Flow of control
+ * @param [in]     code         Decoded instructions
+ * @param [in]     entry        Index of the entry of the subroutine
+ * @param [in]     storage      Storage class of the function
+ * @param [in]     lower_stack  Whether to lower the stack into local variables
+ * @param [in,out] lw           State of lowering
+ */
+static void print_subroutine(FILE *fp, const Flow *flow, const Instruction *code, size_t entry, const char *storage, int lower_stack, Lowering *lw) {
+  lw->self = lw->uses != NULL ? lw->uses[entry + 1] : NULL;
+  fprintf(fp, lw->tier ? "%svoid sub%u(TierContext *ctx)\n{\n" : "%svoid sub%u(void)\n{\n", storage, (unsigned int) entry);
+  print_cell_declarations(fp, lw->self, lw->tier);
+  if (lw->tier) {
+    print_resume_points(fp, flow, entry + 1);
+  }
+  if (flow->order[flow->start[entry + 1]] != entry) {
+    fprintf(fp, INDENT_STR "goto L%u;\n", (unsigned int) entry);
+  }
+  print_body(fp, flow, code, entry + 1, lower_stack, lw);
+  fputs("}\n\n\n", fp);
+}
+
+
+/*!
+ * @brief Print the prototypes of the outlined subroutines
+ * @param [in,out] fp       Output file pointer
+ * @param [in]     flow     Flow of control
+ * @param [in]     n_inst   The number of instructions
+ * @param [in]     storage  Storage class of the functions
+ */
+static void print_subroutine_prototypes(FILE *fp, const Flow *flow, size_t n_inst, const char *storage) {
+  size_t i;
+  for (i = 0; i < n_inst; i++) {
+    if (IS_OUTLINED(flow->owner, i)) {
+      fprintf(fp, "%svoid sub%u(void);\n", storage, (unsigned int) i);
+    }
+  }
+  fputs("\n\n", fp);
+}
+
+
+/*!
+ * @brief Translate decoded blankspace instructions into C source code
+ *
+ * With opt_level 1 or higher, the stack is lowered into local variables and
+ * subroutines are outlined into C functions.
+ * With an entry name, the program starts at the function of that name
+ * instead of main() (see print_main()).
+ * @param [in,out] fp         output file pointer
+ * @param [in]     code       Decoded instructions terminated with FLOW_HALT
+ * @param [in]     n_inst     The number of instructions
+ * @param [in]     opt_level  Optimization level
+ * @param [in]     entry      Name of the entry function, or NULL for main()
+ * @return Status-code
+ */
+int translate(FILE *fp, const Instruction *code, size_t n_inst, int opt_level, const char *entry) {
+  Lowering lw = {NULL, FALSE, NULL, NULL, NULL, NULL, NULL, 0, 0, NULL, 0, 0, 0, 0, 0, FALSE};
+  Flow flow;
+  HeapUse **uses = NULL;
+  size_t i;
+
+  analyze_flow(&flow, code, n_inst, opt_level >= 1);
+  if (opt_level >= 1) {
+    uses = analyze_heap(&flow, code, n_inst);
+  }
+  lw.owner = flow.owner;
+  lw.uses = uses;
+  print_code_header(fp, "static ");
+  print_globals(fp, "static ");
+  print_subroutine_prototypes(fp, &flow, n_inst, "static ");
+  print_main(fp, &flow, code, n_inst, entry, opt_level >= 1, &lw);
+  for (i = 0; i < n_inst; i++) {
+    if (IS_OUTLINED(flow.owner, i)) {
+      print_subroutine(fp, &flow, code, i, "static ", opt_level >= 1, &lw);
+    }
+  }
+  print_code_footer(fp);
+  print_output_functions(fp, "static ");
+  free(lw.values);
+  free(lw.loaded);
+  free_heap_uses(uses, n_inst);
+  free_flow(&flow);
+  return TRUE;
+}
+
+
+/*!
+ * @brief Open a file of translated C source code in a directory
+ * @param [in] dirname  Name of the directory
+ * @param [in] name     Name of the file
+ * @return  File pointer, or NULL on failure
+ */
+static FILE *open_unit(const char *dirname, const char *name) {
+  size_t len = strlen(dirname);
+  char *filename = (char *) malloc(len + strlen(name) + 2);
+  FILE *fp;
+
+  if (filename == NULL) {
+    fputs("Failed to allocate memory for translator\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(filename, dirname);
+  if (len > 0 && filename[len - 1] != '/' && filename[len - 1] != '\\') {
+    strcat(filename, "/");
+  }
+  strcat(filename, name);
+  if ((fp = fopen(filename, "w")) == NULL) {
+    fprintf(stderr, "Unable to open file: %s\n", filename);
+  }
+  free(filename);
+  return fp;
+}
+
+
+/*!
+ * @brief Translate decoded blankspace instructions into C source code split
+ *        into translation units
+ *
+ * The directory gets program.h shared by all the units, main.c, unitN.c
+ * with the outlined subroutines of about TRANSLATION_UNIT_SIZE instructions
+ * each, and a Makefile, so that the units can be compiled in parallel with
+ * make -j.
+ * @param [in] dirname    Name of the directory, which is created if missing
+ * @param [in] code       Decoded instructions terminated with FLOW_HALT
+ * @param [in] n_inst     The number of instructions
+ * @param [in] opt_level  Optimization level
+ * @return Status-code
+ */
+int translate_units(const char *dirname, const Instruction *code, size_t n_inst, int opt_level) {
+  Lowering lw = {NULL, FALSE, NULL, NULL, NULL, NULL, NULL, 0, 0, NULL, 0, 0, 0, 0, 0, FALSE};
+  Flow flow;
+  HeapUse **uses = NULL;
+  FILE *fp;
+  char name[64];
+  size_t i, unit_size = 0;
+  unsigned int j, n_unit = 0;
+
+  if (mkdir(dirname, 0777) != 0 && errno != EEXIST) {
+    fprintf(stderr, "Unable to create directory: %s\n", dirname);
+    return FALSE;
+  }
+  analyze_flow(&flow, code, n_inst, opt_level >= 1);
+  if (opt_level >= 1) {
+    uses = analyze_heap(&flow, code, n_inst);
+  }
+  lw.owner = flow.owner;
+  lw.uses = uses;
+
+  if ((fp = open_unit(dirname, "program.h")) == NULL) {
+    free_heap_uses(uses, n_inst);
+    free_flow(&flow);
+    return FALSE;
+  }
+  fputs("#ifndef PROGRAM_H\n#define PROGRAM_H\n\n", fp);
+  print_code_header(fp, "");
+  print_globals(fp, "extern ");
+  print_subroutine_prototypes(fp, &flow, n_inst, "");
+  print_code_footer(fp);
+  fputs("\n#endif\n", fp);
+  fclose(fp);
+
+  if ((fp = open_unit(dirname, "main.c")) == NULL) {
+    free_heap_uses(uses, n_inst);
+    free_flow(&flow);
+    return FALSE;
+  }
+  fputs("#include \"program.h\"\n\n", fp);
+  print_globals(fp, "");
+  print_main(fp, &flow, code, n_inst, NULL, opt_level >= 1, &lw);
+  print_output_functions(fp, "");
+  fclose(fp);
+
+  fp = NULL;
+  for (i = 0; i < n_inst; i++) {
+    if (!IS_OUTLINED(flow.owner, i)) {
+      continue;
+    }
+    if (fp == NULL) {
+      sprintf(name, "unit%u.c", n_unit++);
+      if ((fp = open_unit(dirname, name)) == NULL) {
+        free_heap_uses(uses, n_inst);
+        free_flow(&flow);
+        return FALSE;
+      }
+      fputs("#include \"program.h\"\n\n", fp);
+      unit_size = 0;
+    }
+    print_subroutine(fp, &flow, code, i, "", opt_level >= 1, &lw);
+    unit_size += flow.start[i + 2] - flow.start[i + 1];
+    if (unit_size >= TRANSLATION_UNIT_SIZE) {
+      fclose(fp);
+      fp = NULL;
+    }
+  }
+  if (fp != NULL) {
+    fclose(fp);
+  }
+
+  if ((fp = open_unit(dirname, "Makefile")) == NULL) {
+    free_heap_uses(uses, n_inst);
+    free_flow(&flow);
+    return FALSE;
+  }
+  fputs(
+      "CFLAGS  ?= -O2\n"
+      "PROGRAM ?= program\n"
+      "OBJS    := main.o", fp);
+  for (j = 0; j < n_unit; j++) {
+    fprintf(fp, " unit%u.o", j);
+  }
+  fputs(
+      "\n\n"
+      ".PHONY: all clean\n\n"
+      "all: $(PROGRAM)\n\n"
+      "$(PROGRAM): $(OBJS)\n"
+      "\t$(CC) $(CFLAGS) $(LDFLAGS) $^ -o $@\n\n"
+      "$(OBJS): program.h\n\n"
+      "clean:\n"
+      "\t$(RM) $(PROGRAM) $(OBJS)\n", fp);
+  fclose(fp);
+  free(lw.values);
+  free(lw.loaded);
+  free_heap_uses(uses, n_inst);
+  free_flow(&flow);
+  return TRUE;
+}
+
+
+/*!
+ * @brief Find the regions which translate_region() can translate
+ * @param [in] code    Decoded instructions terminated with FLOW_HALT
+ * @param [in] n_inst  The number of instructions
+ * @return  Region of each instruction, which is the entry + 1 of the
+ *          outlined subroutine it belongs to, or 0 for main() (n_inst + 1
+ *          elements, must be freed by the caller)
  */
-int translate(FILE *fp, const char *code) {
-  print_code_header(fp);
-  for (; *code != '\0'; code++) {
-    switch (*code) {
-      case ' ':   /* Stack Manipulation */
-        print_stack_code(fp, &code);
-        break;
-      case '\t':  /* Arithmetic, Heap Access or I/O */
-        switch (*++code) {
-          case ' ':  /* Arithmetic */
-            print_arith_code(fp, &code);
-            break;
-          case '\t':  /* Heap Access */
-            print_heap_code(fp, &code);
-            break;
-          case '\n':  /* I/O */
-            print_io_code(fp, &code);
-            break;
-        }
-        break;
-      case '\n':  /* Flow Control */
-        print_flow_code(fp, &code);
-        break;
+size_t *find_regions(const Instruction *code, size_t n_inst) {
+  size_t *owner = (size_t *) malloc((n_inst + 1) * sizeof(size_t));
+  if (owner == NULL) {
+    fputs("Failed to allocate memory for translator\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  outline_subroutines(code, n_inst, owner);
+  return owner;
+}
+
+
+/*!
+ * @brief Translate a region of a program into C source code which runs on
+ *        the TierContext of an interpreter
+ *
+ * The region is main() or an outlined subroutine, and is translated with
+ * the outlined subroutines it calls.
+ * The entry function TIER_ENTRY runs it from its entry, or from the label
+ * of ctx->resume_at.
+ * @param [in,out] fp      Output file pointer
+ * @param [in]     code    Decoded instructions terminated with FLOW_HALT,
+ *                         without superinstructions
+ * @param [in]     n_inst  The number of instructions
+ * @param [in]     region  Region to translate (see find_regions())
+ * @return  TRUE on success, or FALSE if the region can't be translated
+ */
+int translate_region(FILE *fp, const Instruction *code, size_t n_inst, size_t region) {
+  Lowering lw = {NULL, FALSE, NULL, NULL, NULL, NULL, NULL, 0, 0, NULL, 0, 0, 0, 0, 0, TRUE};
+  Flow flow;
+  HeapUse **uses;
+  unsigned char *is_member = (unsigned char *) calloc(n_inst + 2, sizeof(unsigned char));
+  size_t *work = (size_t *) malloc((n_inst + 2) * sizeof(size_t));
+  size_t i, k, t, id, n_work;
+  int ok = TRUE;
+
+  if (is_member == NULL || work == NULL) {
+    fputs("Failed to allocate memory for translator\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  analyze_flow(&flow, code, n_inst, TRUE);
+  if (region > n_inst || (region != 0 && !IS_OUTLINED(flow.owner, region - 1))) {
+    ok = FALSE;
+  }
+  /* The outlined subroutines are called as C functions of the region */
+  is_member[region] = TRUE;
+  work[0] = region;
+  n_work = ok ? 1 : 0;
+  while (n_work > 0 && ok) {
+    id = work[--n_work];
+    for (k = flow.start[id]; k < flow.start[id + 1]; k++) {
+      i = flow.order[k];
+      if (!is_lowerable(&code[i])) {
+        ok = FALSE;
+      } else if (code[i].opcode == FLOW_GOSUB && (t = code[i].operand.addr) < n_inst
+          && IS_OUTLINED(flow.owner, t) && !is_member[t + 1]) {
+        is_member[t + 1] = TRUE;
+        work[n_work++] = t + 1;
+      }
     }
   }
-  print_code_footer(fp);
-  return TRUE;
+  if (ok) {
+    uses = analyze_heap(&flow, code, n_inst);
+    lw.owner = flow.owner;
+    lw.uses = uses;
+    print_tier_header(fp);
+    if (is_member[0]) {
+      fputs("static int run_main(TierContext *ctx);\n", fp);
+    }
+    for (i = 0; i < n_inst; i++) {
+      if (is_member[i + 1]) {
+        fprintf(fp, "static void sub%u(TierContext *ctx);\n", (unsigned int) i);
+      }
+    }
+    fputs("\n\n", fp);
+    if (is_member[0]) {
+      print_main(fp, &flow, code, n_inst, NULL, TRUE, &lw);
+    }
+    for (i = 0; i < n_inst; i++) {
+      if (is_member[i + 1]) {
+        print_subroutine(fp, &flow, code, i, "static ", TRUE, &lw);
+      }
+    }
+    fputs(
+        "int " TIER_ENTRY "(TierContext *ctx)\n"
+        "{\n"
+        INDENT_STR "switch (setjmp(ctx->escape)) {\n"
+        INDENT_STR INDENT_STR "case 0:\n"
+        INDENT_STR INDENT_STR INDENT_STR "break;\n"
+        INDENT_STR INDENT_STR "case TIER_HALTED:\n"
+        INDENT_STR INDENT_STR INDENT_STR "return TIER_HALTED;\n"
+        INDENT_STR INDENT_STR "default:\n"
+        INDENT_STR INDENT_STR INDENT_STR "return TIER_FAILED;\n"
+        INDENT_STR "}\n", fp);
+    if (region == 0) {
+      fputs(
+          INDENT_STR "run_main(ctx);\n"
+          INDENT_STR "return TIER_HALTED;\n"
+          "}\n", fp);
+    } else {
+      fprintf(fp,
+          INDENT_STR "sub%u(ctx);\n"
+          INDENT_STR "return TIER_RETURNED;\n"
+          "}\n", (unsigned int) (region - 1));
+    }
+    free(lw.values);
+    free(lw.loaded);
+    free_heap_uses(uses, n_inst);
+  }
+  free(is_member);
+  free(work);
+  free_flow(&flow);
+  return ok;
+}
+
+
+/*!
+ * @brief Print C source code of an instruction which uses the stack helpers
+ * @param [in,out] fp     output file pointer
+ * @param [in]     code   Instruction to translate
+ * @param [in]     pos    Index of the instruction
+ * @param [in]     owner  Owners of the instructions (see print_flow_code())
+ */
+void print_inst(FILE *fp, const Instruction *code, size_t pos, const size_t *owner) {
+  Instruction inst = *code;
+  inst.opcode = unfused_opcode(inst.opcode);
+  switch (inst.opcode) {
+    case STACK_PUSH:
+    case STACK_DUP_N:
+    case STACK_DUP:
+    case STACK_SLIDE:
+    case STACK_SWAP:
+    case STACK_DISCARD:
+      print_stack_code(fp, &inst);
+      break;
+    case ARITH_ADD:
+    case ARITH_SUB:
+    case ARITH_MUL:
+    case ARITH_DIV:
+    case ARITH_MOD:
+    case BIT_AND:
+    case BIT_OR:
+    case BIT_XOR:
+    case BIT_LS:
+    case BIT_RS:
+    case BIT_NOT:
+      print_arith_code(fp, &inst);
+      break;
+    case HEAP_STORE:
+    case HEAP_LOAD:
+      print_heap_code(fp, &inst);
+      break;
+    case IO_PUT_CHAR:
+    case IO_PUT_NUM:
+    case IO_READ_CHAR:
+    case IO_READ_NUM:
+      print_io_code(fp, &inst);
+      break;
+    default:
+      print_flow_code(fp, &inst, pos, owner);
+      break;
+  }
 }
 
 
 /*!
  * @brief Print C source code about stack manipulation
  * @param [in,out] fp    output file pointer
- * @param [in]     code  Pointer to Blankspace source code pointer
+ * @param [in]     inst  Instruction to translate
  */
-void print_stack_code(FILE *fp, const char **code_ptr) {
-  const char *code = *code_ptr;
-  switch (*++code) {
-    case ' ':
-      fprintf(fp, INDENT_STR "push(%d);\n", read_nstr(&code));
+void print_stack_code(FILE *fp, const Instruction *inst) {
+  switch (inst->opcode) {
+    case STACK_PUSH:
+      fprintf(fp, INDENT_STR "push(%d);\n", inst->operand.num);
       break;
-    case '\t':
-      switch (*++code) {
-        case ' ':
-          fprintf(fp, INDENT_STR "dup_n(%d);\n", read_nstr(&code));
-          break;
-        case '\t':
-          fputs("Undefined Stack manipulation command is detected: [S][TT]\n", stderr);
-          break;
-        case '\n':
-          fprintf(fp, INDENT_STR "slide(%d);\n", read_nstr(&code));
-          break;
-      }
+    case STACK_DUP_N:
+      fprintf(fp, INDENT_STR "dup_n(%d);\n", inst->operand.num);
       break;
-    case '\n':
-      switch (*++code) {
-        case ' ':
-          fputs(INDENT_STR "dup_n(0);\n", fp);
-          break;
-        case '\t':
-          fputs(INDENT_STR "swap();\n", fp);
-          break;
-        case '\n':
-          fputs(INDENT_STR "pop();\n", fp);
-          break;
-      }
+    case STACK_DUP:
+      fputs(INDENT_STR "dup_n(0);\n", fp);
+      break;
+    case STACK_SLIDE:
+      fprintf(fp, INDENT_STR "slide(%d);\n", inst->operand.num);
+      break;
+    case STACK_SWAP:
+      fputs(INDENT_STR "swap();\n", fp);
+      break;
+    case STACK_DISCARD:
+      fputs(INDENT_STR "pop();\n", fp);
       break;
   }
-  *code_ptr = code;
 }
 
 
 /*!
  * @brief Print C source code about arithmetic
  * @param [in,out] fp    output file pointer
- * @param [in]     code  Pointer to Blankspace source code pointer
- */
-void print_arith_code(FILE *fp, const char **code_ptr) {
-  const char *code = *code_ptr;
-  switch (*++code) {
-    case ' ':
-      switch (*++code) {
-        case ' ':
-          fputs(INDENT_STR "arith_add();\n", fp);
-          break;
-        case '\t':
-          fputs(INDENT_STR "arith_sub();\n", fp);
-          break;
-        case '\n':
-          fputs(INDENT_STR "arith_mul();\n", fp);
-          break;
-      }
+ * @param [in]     inst  Instruction to translate
+ */
+void print_arith_code(FILE *fp, const Instruction *inst) {
+  switch (inst->opcode) {
+    case ARITH_ADD:
+      fputs(INDENT_STR "arith_add();\n", fp);
       break;
-    case '\t':
-      switch (*++code) {
-        case ' ':
-          fputs(INDENT_STR "arith_div();\n", fp);
-          break;
-        case '\t':
-          fputs(INDENT_STR "arith_mod();\n", fp);
-          break;
-        case '\n':
-          fputs("Undefined arithmetic command is detected: [TS][TN]\n", stderr);
-          break;
-      }
+    case ARITH_SUB:
+      fputs(INDENT_STR "arith_sub();\n", fp);
       break;
-    case '\n':
-      switch (*++code) {
-        case ' ':
-          switch (*++code) {
-            case ' ':
-              fputs(INDENT_STR "arith_and();\n", fp);
-              break;
-            case '\t':
-              fputs(INDENT_STR "arith_or();\n", fp);
-              break;
-            case '\n':
-              fputs(INDENT_STR "arith_xor();\n", fp);
-              break;
-          }
-          break;
-        case '\t':
-          switch (*++code) {
-            case ' ':
-              fputs(INDENT_STR "arith_ls();\n", fp);
-              break;
-            case '\t':
-              fputs(INDENT_STR "arith_rs();\n", fp);
-              break;
-            case '\n':
-              fputs(INDENT_STR "arith_not();\n", fp);
-              break;
-          }
-          break;
-        case '\n':
-          fputs("Undefined arithmetic command is detected: [TS][NN]\n", stderr);
-          break;
-      }
-      fputs("Undefined arithmetic command is detected: [TS][N]\n", stderr);
+    case ARITH_MUL:
+      fputs(INDENT_STR "arith_mul();\n", fp);
+      break;
+    case ARITH_DIV:
+      fputs(INDENT_STR "arith_div();\n", fp);
+      break;
+    case ARITH_MOD:
+      fputs(INDENT_STR "arith_mod();\n", fp);
+      break;
+    case BIT_AND:
+      fputs(INDENT_STR "arith_and();\n", fp);
+      break;
+    case BIT_OR:
+      fputs(INDENT_STR "arith_or();\n", fp);
+      break;
+    case BIT_XOR:
+      fputs(INDENT_STR "arith_xor();\n", fp);
+      break;
+    case BIT_LS:
+      fputs(INDENT_STR "arith_ls();\n", fp);
+      break;
+    case BIT_RS:
+      fputs(INDENT_STR "arith_rs();\n", fp);
+      break;
+    case BIT_NOT:
+      fputs(INDENT_STR "arith_not();\n", fp);
       break;
   }
-  *code_ptr = code;
 }
 
 
 /*!
  * @brief Print C source code about heap access
  * @param [in,out] fp    output file pointer
- * @param [in]     code  Pointer to Blankspace source code pointer
+ * @param [in]     inst  Instruction to translate
  */
-void print_heap_code(FILE *fp, const char **code_ptr) {
-  const char *code = *code_ptr;
-  switch (*++code) {
-    case ' ':
+void print_heap_code(FILE *fp, const Instruction *inst) {
+  switch (inst->opcode) {
+    case HEAP_STORE:
       fputs(INDENT_STR "heap_store();\n", fp);
       break;
-    case '\t':
+    case HEAP_LOAD:
       fputs(INDENT_STR "heap_read();\n", fp);
-    break;
-    case '\n':
-      fputs("Undefined heap access command is detected: [TT][N]\n", stderr);
       break;
   }
-  *code_ptr = code;
 }
 
 
 /*!
  * @brief Print C source code about flow control
- * @param [in,out] fp    output file pointer
- * @param [in]     code  Pointer to Blankspace source code pointer
- */
-void print_flow_code(FILE *fp, const char **code_ptr) {
-  const char *code = *code_ptr;
-  switch (*++code) {
-    case ' ':
-      switch (*++code) {
-        case ' ':
-          fprintf(fp, "\n%s:\n", read_label(&code));
-          break;
-        case '\t':
-          fprintf(fp,
-              INDENT_STR "if (!setjmp(call_stack[call_stack_idx++])) {\n"
-              INDENT_STR INDENT_STR "goto %s;\n"
-              INDENT_STR "}\n",
-              read_label(&code));
-          break;
-        case '\n':
-          fprintf(fp, INDENT_STR "goto %s;\n", read_label(&code));
-          break;
+ *
+ * FLOW_GOSUB pushes the label of the next instruction as its return
+ * address, and FLOW_ENDSUB jumps back to it by CALL() and RETURN() of the
+ * header, unless the subroutine is outlined into a C function.
+ * @param [in,out] fp     output file pointer
+ * @param [in]     inst   Instruction to translate
+ * @param [in]     pos    Index of the instruction
+ * @param [in]     owner  Entry + 1 of the outlined subroutine each
+ *                        instruction belongs to, or 0 for main()
+ */
+void print_flow_code(FILE *fp, const Instruction *inst, size_t pos, const size_t *owner) {
+  switch (inst->opcode) {
+    case FLOW_GOSUB:
+      if (IS_OUTLINED(owner, inst->operand.addr)) {
+        fprintf(fp, INDENT_STR "sub%u();\n", inst->operand.addr);
+      } else {
+        fprintf(fp, INDENT_STR "CALL(%u, %u);\n", inst->operand.addr, (unsigned int) (pos + 1));
       }
       break;
-    case '\t':
-      switch (*++code) {
-        case ' ':
-          fprintf(fp,
-              INDENT_STR "if (!pop()) {\n"
-              INDENT_STR INDENT_STR "goto %s;\n"
-              INDENT_STR "}\n",
-              read_label(&code));
-          break;
-        case '\t':
-          fprintf(fp,
-              INDENT_STR "if (pop() < 0) {\n"
-              INDENT_STR INDENT_STR "goto %s;\n"
-              INDENT_STR "}\n",
-              read_label(&code));
-          break;
-        case '\n':
-          fputs(INDENT_STR "longjmp(call_stack[--call_stack_idx], 1);\n", fp);
-          break;
-      }
+    case FLOW_JUMP:
+      fprintf(fp, INDENT_STR "goto L%u;\n", inst->operand.addr);
       break;
-    case '\n':
-      if (*++code == '\n') {
-        fputs(INDENT_STR "exit(EXIT_SUCCESS);\n", fp);
-      } else {
-        fputs("Undefined flow control command is detected: [N][S/T]\n", stderr);
-      }
+    case FLOW_BEZ:
+      fprintf(fp,
+          INDENT_STR "if (!pop()) {\n"
+          INDENT_STR INDENT_STR "goto L%u;\n"
+          INDENT_STR "}\n",
+          inst->operand.addr);
+      break;
+    case FLOW_BLTZ:
+      fprintf(fp,
+          INDENT_STR "if (pop() < 0) {\n"
+          INDENT_STR INDENT_STR "goto L%u;\n"
+          INDENT_STR "}\n",
+          inst->operand.addr);
+      break;
+    case FLOW_ENDSUB:
+      fputs(owner[pos] != 0 ? INDENT_STR "return;\n" : INDENT_STR "RETURN();\n", fp);
+      break;
+    case FLOW_HALT:
+      fputs(INDENT_STR "exit(EXIT_SUCCESS);\n", fp);
+      break;
+    default:
+      fprintf(stderr, "Undefined instruction is detected [%02x]\n", inst->opcode);
       break;
   }
-  *code_ptr = code;
 }
 
 
 /*!
  * @brief Print C source code about I/O
  * @param [in,out] fp    output file pointer
- * @param [in]     code  Pointer to Blankspace source code pointer
- */
-void print_io_code(FILE *fp, const char **code_ptr) {
-  const char *code = *code_ptr;
-  switch (*++code) {
-    case ' ':
-      switch (*++code) {
-        case ' ':
-          fputs(INDENT_STR "putchar(pop());\n", fp);
-          break;
-        case '\t':
-          fputs(INDENT_STR "printf(\"%d\", pop());\n", fp);
-          break;
-        case '\n':
-          fputs("Undefined I/O command is detected: [TN][SN]\n", stderr);
-          break;
-      }
+ * @param [in]     inst  Instruction to translate
+ */
+void print_io_code(FILE *fp, const Instruction *inst) {
+  switch (inst->opcode) {
+    case IO_PUT_CHAR:
+      fputs(INDENT_STR "put_char(pop());\n", fp);
       break;
-    case '\t':
-      switch (*++code) {
-        case ' ':
-          fputs(
-              INDENT_STR "fflush(stdout);\n"
-              INDENT_STR "heap[pop()] = getchar();\n",
-              fp);
-          break;
-        case '\t':
-          fputs(
-              INDENT_STR "fflush(stdout);\n"
-              INDENT_STR "scanf(\"%d\", &heap[pop()]);\n",
-              fp);
-          break;
-        case '\n':
-          fputs("Undefined I/O command is detected: [TN][TN]\n", stderr);
-          break;
-      }
+    case IO_PUT_NUM:
+      fputs(INDENT_STR "put_num(pop());\n", fp);
       break;
-    case '\n':
-      fputs("Undefined I/O command is detected: [TN][N]\n", stderr);
+    case IO_READ_CHAR:
+      fputs(
+          INDENT_STR "sync_output();\n"
+          INDENT_STR "*heap_cell(pop()) = getchar();\n",
+          fp);
+      break;
+    case IO_READ_NUM:
+      fputs(
+          INDENT_STR "sync_output();\n"
+          INDENT_STR "scanf(\"%d\", heap_cell(pop()));\n",
+          fp);
       break;
   }
-  *code_ptr = code;
 }
 
 
 /*!
- * @brief Print the header of translated C-source code
+ * @brief Print the dispatcher of RETURN() without computed goto
+ *
+ * It is a switch from the return address, which is the index of the
+ * instruction after a FLOW_GOSUB, to the label of that instruction.
+ * @param [in,out] fp      Output file pointer
+ * @param [in]     code    Decoded instructions
+ * @param [in]     n_inst  The number of instructions
+ * @param [in]     owner   Owners of the instructions (see print_flow_code())
+ */
+void print_return_dispatch(FILE *fp, const Instruction *code, size_t n_inst, const size_t *owner) {
+  size_t i;
+  fputs(
+      "#ifndef USE_COMPUTED_GOTO\n"
+      INDENT_STR "return EXIT_SUCCESS;\n\n"
+      "dispatch_return:\n"
+      INDENT_STR "switch (pop_return()) {\n", fp);
+  for (i = 0; i < n_inst; i++) {
+    if (code[i].opcode == FLOW_GOSUB && !IS_OUTLINED(owner, code[i].operand.addr)) {
+      fprintf(fp,
+          INDENT_STR INDENT_STR "case %u:\n"
+          INDENT_STR INDENT_STR INDENT_STR "goto L%u;\n",
+          (unsigned int) (i + 1), (unsigned int) (i + 1));
+    }
+  }
+  fputs(
+      INDENT_STR INDENT_STR "default:\n"
+      INDENT_STR INDENT_STR INDENT_STR "abort();\n"
+      INDENT_STR "}\n"
+      "#endif\n", fp);
+}
+
+
+/*!
+ * @brief Print the includes and the macros which every kind of translated
+ *        C-source code starts with
  * @param [in,out] fp  Output file pointer
  */
-void print_code_header(FILE *fp) {
+static void print_common_header(FILE *fp) {
   fputs(
       "#include <assert.h>\n"
-      "#include <setjmp.h>\n"
       "#include <stdio.h>\n"
-      "#include <stdlib.h>\n\n", fp);
+      "#include <stdlib.h>\n"
+      "#include <string.h>\n"
+      "#ifdef _MSC_VER\n"
+      "#  include <io.h>\n"
+      "#  define isatty(fd)  _isatty(fd)\n"
+      "#  define fileno(fp)  _fileno(fp)\n"
+      "#else\n"
+      "#  include <unistd.h>\n"
+      "#endif\n\n", fp);
   fputs(
       "#ifndef __cplusplus\n"
       "#  if defined(_MSC_VER)\n"
@@ -302,10 +1980,27 @@ void print_code_header(FILE *fp) {
       "#    define __inline\n"
       "#  endif\n"
       "#endif\n\n", fp);
+  fputs(
+      "/* Return to the caller by labels as values of GNU C, or by a switch */\n"
+      "#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)\n"
+      "#  define USE_COMPUTED_GOTO\n"
+      "typedef void *ReturnAddress;\n"
+      "#  define CALL(target, next)  do { push_return(&&L ## next); goto L ## target; } while (0)\n"
+      "#  define RETURN()            goto *pop_return()\n"
+      "#else\n"
+      "typedef unsigned int ReturnAddress;\n"
+      "#  define CALL(target, next)  do { push_return(next); goto L ## target; } while (0)\n"
+      "#  define RETURN()            goto dispatch_return\n"
+      "#endif\n\n", fp);
   fprintf(fp,
       "#define STACK_SIZE %d\n"
       "#define HEAP_SIZE %d\n"
-      "#define CALL_STACK_SIZE %d\n\n"
+      "#define CALL_STACK_SIZE %d\n"
+      "#define OUTPUT_BUFFER_SIZE %d\n"
+      "/* Define as 1 to flush the output before every read */\n"
+      "#ifndef INTERACTIVE\n"
+      "#  define INTERACTIVE 0\n"
+      "#endif\n\n"
       "#define LENGTHOF(array) (sizeof(array) / sizeof((array)[0]))\n"
       "#define SWAP(type, a, b) \\\n"
       INDENT_STR "do { \\\n"
@@ -313,7 +2008,18 @@ void print_code_header(FILE *fp) {
       INDENT_STR INDENT_STR "*(a) = *(b); \\\n"
       INDENT_STR INDENT_STR "*(b) = __tmp_swap_var__; \\\n"
       INDENT_STR "} while (0)\n\n",
-      STACK_SIZE, HEAP_SIZE, CALL_STACK_SIZE);
+      STACK_SIZE, HEAP_SIZE, CALL_STACK_SIZE, OUTPUT_BUFFER_SIZE);
+}
+
+
+/*!
+ * @brief Print the header of translated C-source code
+ * @param [in,out] fp       Output file pointer
+ * @param [in]     storage  Storage class of the functions which are not
+ *                          inline, "static " for a single file
+ */
+void print_code_header(FILE *fp, const char *storage) {
+  print_common_header(fp);
   fputs(
       "inline static int  pop(void);\n"
       "inline static void push(int e);\n"
@@ -325,29 +2031,169 @@ void print_code_header(FILE *fp) {
       "inline static void arith_sub(void);\n"
       "inline static void arith_mul(void);\n"
       "inline static void arith_div(void);\n"
-      "inline static void arith_mod(void);\n", fp);
-  fputs(
+      "inline static void arith_mod(void);\n"
+      "inline static void arith_and(void);\n"
+      "inline static void arith_or(void);\n"
+      "inline static void arith_xor(void);\n"
+      "inline static void arith_ls(void);\n"
+      "inline static void arith_rs(void);\n"
+      "inline static void arith_not(void);\n", fp);
+  fprintf(fp,
       "inline static void heap_store(void);\n"
-      "inline static void heap_read(void);\n\n", fp);
+      "inline static void heap_read(void);\n"
+      "inline static int *heap_cell(int addr);\n"
+      "%sint *far_heap_cell(int addr);\n\n"
+      "#define HEAP_LOAD(addr)          (*heap_cell(addr))\n"
+      "#define HEAP_STORE(addr, value)  (*heap_cell(addr) = (value))\n"
+      "#define READ_NUM(addr)           scanf(\"%%d\", heap_cell(addr))\n\n",
+      storage);
   fputs(
-      "static int stack[STACK_SIZE];\n"
-      "static int heap[HEAP_SIZE];\n"
-      "static jmp_buf call_stack[CALL_STACK_SIZE];\n"
-      "static size_t stack_idx = 0;\n"
-      "static size_t call_stack_idx = 0;\n\n\n", fp);
-  fputs(
-      "int main(void)\n"
-      "{\n", fp);
+      "inline static void push_return(ReturnAddress addr);\n"
+      "inline static ReturnAddress pop_return(void);\n", fp);
+  fprintf(fp,
+      "inline static void put_char(int c);\n"
+      "%svoid put_num(int n);\n"
+      "%svoid flush_output(void);\n"
+      "inline static void sync_output(void);\n\n",
+      storage, storage);
 }
+
+
 /*!
- * @brief Print the footer of translated C-source code
+ * @brief Print the header of C-source code which runs on a TierContext
+ *
+ * The state of the program is the one of the interpreter, reached through
+ * the macros below, and return addresses on the call stack are indices of
+ * instructions, which both sides understand, instead of labels as values.
+ * TierContext must be laid out exactly as in blankspace.h.
  * @param [in,out] fp  Output file pointer
  */
-void print_code_footer(FILE *fp) {
+void print_tier_header(FILE *fp) {
+  fputs("#define NO_COMPUTED_GOTO\n", fp);
+  print_common_header(fp);
+  fprintf(fp,
+      "#include <setjmp.h>\n\n"
+      "typedef struct {\n"
+      INDENT_STR "int (*stack)[STACK_SIZE - 1];\n"
+      INDENT_STR "size_t stack_idx;\n"
+      INDENT_STR "size_t (*call_stack)[CALL_STACK_SIZE];\n"
+      INDENT_STR "size_t call_stack_idx;\n"
+      INDENT_STR "int **heap_low;\n"
+      INDENT_STR "const int *zero_page;\n"
+      INDENT_STR "void *vm;\n"
+      INDENT_STR "int (*heap_load)(void *vm, int addr);\n"
+      INDENT_STR "void (*heap_store)(void *vm, int addr, int value);\n"
+      INDENT_STR "void (*put_char)(void *vm, int c);\n"
+      INDENT_STR "void (*put_num)(void *vm, int n);\n"
+      INDENT_STR "int (*read_char)(void *vm);\n"
+      INDENT_STR "void (*read_num)(void *vm, int addr);\n"
+      INDENT_STR "unsigned int resume_at;\n"
+      INDENT_STR "const char *error;\n"
+      INDENT_STR "jmp_buf escape;\n"
+      "} TierContext;\n\n"
+      "#define TIER_RETURNED  %d\n"
+      "#define TIER_HALTED    %d\n"
+      "#define TIER_FAILED    %d\n"
+      "#define TIER_NO_RESUME %uu\n"
+      "#define HEAP_PAGE_BITS %d\n\n",
+      TIER_RETURNED, TIER_HALTED, TIER_FAILED, TIER_NO_RESUME, HEAP_PAGE_BITS);
   fputs(
-      "\n"
-      INDENT_STR "return EXIT_SUCCESS;\n"
+      "#define stack           (*ctx->stack)\n"
+      "#define stack_idx       (ctx->stack_idx)\n"
+      "#define call_stack      (*ctx->call_stack)\n"
+      "#define call_stack_idx  (ctx->call_stack_idx)\n"
+      "#define push_return(addr) \\\n"
+      INDENT_STR "(call_stack_idx < LENGTHOF(call_stack) \\\n"
+      INDENT_STR INDENT_STR "? (void) (call_stack[call_stack_idx++] = (addr)) : fail(ctx, \"Call stack overflow\"))\n"
+      "#define pop_return() \\\n"
+      INDENT_STR "(call_stack_idx > 0 \\\n"
+      INDENT_STR INDENT_STR "? (ReturnAddress) call_stack[--call_stack_idx] : (fail(ctx, \"Call stack underflow\"), (ReturnAddress) 0))\n\n", fp);
+  fputs(
+      "/* The callbacks of reads show the pending output by themselves */\n"
+      "#undef getchar\n"
+      "#define getchar()       ctx->read_char(ctx->vm)\n"
+      "#define put_char(c)     ctx->put_char(ctx->vm, (c))\n"
+      "#define put_num(n)      ctx->put_num(ctx->vm, (n))\n"
+      "#define READ_NUM(addr)  ctx->read_num(ctx->vm, (addr))\n"
+      "#define sync_output()   ((void) 0)\n\n", fp);
+  fputs(
+      "#define CHECK_STACK(n) \\\n"
+      INDENT_STR "do { \\\n"
+      INDENT_STR INDENT_STR "if (stack_idx < (n)) { \\\n"
+      INDENT_STR INDENT_STR INDENT_STR "fail(ctx, \"Stack underflow\"); \\\n"
+      INDENT_STR INDENT_STR "} \\\n"
+      INDENT_STR "} while (0)\n"
+      "#define CHECK_ROOM(n) \\\n"
+      INDENT_STR "do { \\\n"
+      INDENT_STR INDENT_STR "if (stack_idx + (n) > LENGTHOF(stack)) { \\\n"
+      INDENT_STR INDENT_STR INDENT_STR "fail(ctx, \"Stack overflow\"); \\\n"
+      INDENT_STR INDENT_STR "} \\\n"
+      INDENT_STR "} while (0)\n"
+      "#define CHECK_DIVISOR(n) \\\n"
+      INDENT_STR "do { \\\n"
+      INDENT_STR INDENT_STR "if ((n) == 0) { \\\n"
+      INDENT_STR INDENT_STR INDENT_STR "fail(ctx, \"Zero division\"); \\\n"
+      INDENT_STR INDENT_STR "} \\\n"
+      INDENT_STR "} while (0)\n"
+      "#define HALT()                   longjmp(ctx->escape, TIER_HALTED)\n"
+      "#define HEAP_LOAD(addr)          load_cell(ctx, (addr))\n"
+      "#define HEAP_STORE(addr, value)  store_cell(ctx, (addr), (value))\n\n\n", fp);
+  fputs(
+      "static void fail(TierContext *ctx, const char *error)\n"
+      "{\n"
+      INDENT_STR "ctx->error = error;\n"
+      INDENT_STR "longjmp(ctx->escape, TIER_FAILED);\n"
+      "}\n\n\n"
+      "inline static int load_cell(TierContext *ctx, int addr)\n"
+      "{\n"
+      INDENT_STR "if (0 <= addr && addr < HEAP_SIZE) {\n"
+      INDENT_STR INDENT_STR "return ctx->heap_low[addr >> HEAP_PAGE_BITS][addr & ((1 << HEAP_PAGE_BITS) - 1)];\n"
+      INDENT_STR "}\n"
+      INDENT_STR "return ctx->heap_load(ctx->vm, addr);\n"
+      "}\n\n\n"
+      "inline static void store_cell(TierContext *ctx, int addr, int value)\n"
+      "{\n"
+      INDENT_STR "if (0 <= addr && addr < HEAP_SIZE && ctx->heap_low[addr >> HEAP_PAGE_BITS] != ctx->zero_page) {\n"
+      INDENT_STR INDENT_STR "ctx->heap_low[addr >> HEAP_PAGE_BITS][addr & ((1 << HEAP_PAGE_BITS) - 1)] = value;\n"
+      INDENT_STR "} else {\n"
+      INDENT_STR INDENT_STR "ctx->heap_store(ctx->vm, addr, value);\n"
+      INDENT_STR "}\n"
       "}\n\n\n", fp);
+}
+
+
+/*!
+ * @brief Print the global variables of translated C-source code
+ * @param [in,out] fp       Output file pointer
+ * @param [in]     storage  Storage class of the variables; "extern " prints
+ *                          declarations instead of definitions
+ */
+void print_globals(FILE *fp, const char *storage) {
+  int is_extern = !strcmp(storage, "extern ");
+  fprintf(fp,
+      "%sint stack[STACK_SIZE];\n"
+      "%sint heap[HEAP_SIZE];\n"
+      "%sReturnAddress call_stack[CALL_STACK_SIZE];\n"
+      "%ssize_t stack_idx%s;\n"
+      "%ssize_t call_stack_idx%s;\n"
+      "%schar output_buffer[OUTPUT_BUFFER_SIZE];\n"
+      "%ssize_t output_size%s;\n"
+      "%sint is_interactive%s;\n\n\n",
+      storage, storage, storage,
+      storage, is_extern ? "" : " = 0",
+      storage, is_extern ? "" : " = 0",
+      storage,
+      storage, is_extern ? "" : " = 0",
+      storage, is_extern ? "" : " = INTERACTIVE");
+}
+
+
+/*!
+ * @brief Print the definitions of the inline helper functions of translated
+ *        C-source code
+ * @param [in,out] fp  Output file pointer
+ */
+void print_code_footer(FILE *fp) {
   fputs(
       "inline static int pop(void)\n"
       "{\n"
@@ -417,76 +2263,198 @@ void print_code_footer(FILE *fp) {
       INDENT_STR "assert(stack[stack_idx] != 0);\n"
       INDENT_STR "stack[stack_idx - 1] %= stack[stack_idx];\n"
       "}\n\n\n", fp);
+  fputs(
+      "inline static void arith_and(void)\n"
+      "{\n"
+      INDENT_STR "assert(stack_idx > 1);\n"
+      INDENT_STR "stack_idx--;\n"
+      INDENT_STR "stack[stack_idx - 1] &= stack[stack_idx];\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static void arith_or(void)\n"
+      "{\n"
+      INDENT_STR "assert(stack_idx > 1);\n"
+      INDENT_STR "stack_idx--;\n"
+      INDENT_STR "stack[stack_idx - 1] |= stack[stack_idx];\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static void arith_xor(void)\n"
+      "{\n"
+      INDENT_STR "assert(stack_idx > 1);\n"
+      INDENT_STR "stack_idx--;\n"
+      INDENT_STR "stack[stack_idx - 1] ^= stack[stack_idx];\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static void arith_ls(void)\n"
+      "{\n"
+      INDENT_STR "assert(stack_idx > 1);\n"
+      INDENT_STR "stack_idx--;\n"
+      INDENT_STR "stack[stack_idx - 1] <<= stack[stack_idx];\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static void arith_rs(void)\n"
+      "{\n"
+      INDENT_STR "assert(stack_idx > 1);\n"
+      INDENT_STR "stack_idx--;\n"
+      INDENT_STR "stack[stack_idx - 1] >>= stack[stack_idx];\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static void arith_not(void)\n"
+      "{\n"
+      INDENT_STR "assert(stack_idx > 0);\n"
+      INDENT_STR "stack[stack_idx - 1] = ~stack[stack_idx - 1];\n"
+      "}\n\n\n", fp);
   fputs(
       "inline static void heap_store(void)\n"
       "{\n"
       INDENT_STR "int value = pop();\n"
       INDENT_STR "int addr  = pop();\n"
-      INDENT_STR "assert(0 <= addr && addr < (int) LENGTHOF(heap));\n"
-      INDENT_STR "heap[addr] = value;\n"
+      INDENT_STR "*heap_cell(addr) = value;\n"
       "}\n\n\n", fp);
   fputs(
       "inline static void heap_read(void)\n"
       "{\n"
       INDENT_STR "int addr = pop();\n"
-      INDENT_STR "assert(0 <= addr && addr < (int) LENGTHOF(heap));\n"
-      INDENT_STR "push(heap[addr]);\n"
+      INDENT_STR "push(*heap_cell(addr));\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static int *heap_cell(int addr)\n"
+      "{\n"
+      INDENT_STR "return 0 <= addr && addr < HEAP_SIZE ? &heap[addr] : far_heap_cell(addr);\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static void push_return(ReturnAddress addr)\n"
+      "{\n"
+      INDENT_STR "assert(call_stack_idx < LENGTHOF(call_stack));\n"
+      INDENT_STR "call_stack[call_stack_idx++] = addr;\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static ReturnAddress pop_return(void)\n"
+      "{\n"
+      INDENT_STR "assert(call_stack_idx > 0);\n"
+      INDENT_STR "return call_stack[--call_stack_idx];\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static void put_char(int c)\n"
+      "{\n"
+      INDENT_STR "if (output_size == sizeof(output_buffer)) {\n"
+      INDENT_STR INDENT_STR "flush_output();\n"
+      INDENT_STR "}\n"
+      INDENT_STR "output_buffer[output_size++] = (char) c;\n"
+      "}\n\n\n", fp);
+  fputs(
+      "inline static void sync_output(void)\n"
+      "{\n"
+      INDENT_STR "if (is_interactive) {\n"
+      INDENT_STR INDENT_STR "flush_output();\n"
+      INDENT_STR INDENT_STR "fflush(stdout);\n"
+      INDENT_STR "}\n"
       "}\n", fp);
 }
 
 
 /*!
- * @brief Read integer and seek program pointer.
- * @param [in,out] code_ptr  Program pointer
+ * @brief Print the output functions and the heap beyond heap[] of translated
+ *        C-source code, which are not inline
+ *
+ * Cells out of the range of heap[] are kept in a hash table, so that
+ * negative and huge addresses work as they do in the interpreter.
+ * @param [in,out] fp       Output file pointer
+ * @param [in]     storage  Storage class of the functions
+ */
+void print_output_functions(FILE *fp, const char *storage) {
+  fprintf(fp,
+      "\n\n"
+      "%svoid put_num(int n)\n"
+      "{\n"
+      INDENT_STR "char buf[sizeof(int) * 3 + 2];\n"
+      INDENT_STR "char *p = buf + sizeof(buf);\n"
+      INDENT_STR "unsigned int m = n < 0 ? 0u - (unsigned int) n : (unsigned int) n;\n"
+      INDENT_STR "do {\n"
+      INDENT_STR INDENT_STR "*--p = (char) ('0' + m %% 10);\n"
+      INDENT_STR INDENT_STR "m /= 10;\n"
+      INDENT_STR "} while (m != 0);\n"
+      INDENT_STR "if (n < 0) {\n"
+      INDENT_STR INDENT_STR "*--p = '-';\n"
+      INDENT_STR "}\n"
+      INDENT_STR "if (output_size + (size_t) (buf + sizeof(buf) - p) > sizeof(output_buffer)) {\n"
+      INDENT_STR INDENT_STR "flush_output();\n"
+      INDENT_STR "}\n"
+      INDENT_STR "memcpy(&output_buffer[output_size], p, (size_t) (buf + sizeof(buf) - p));\n"
+      INDENT_STR "output_size += (size_t) (buf + sizeof(buf) - p);\n"
+      "}\n\n\n", storage);
+  fprintf(fp,
+      "%svoid flush_output(void)\n"
+      "{\n"
+      INDENT_STR "fwrite(output_buffer, 1, output_size, stdout);\n"
+      INDENT_STR "output_size = 0;\n"
+      "}\n", storage);
+  fprintf(fp,
+      "\n\n"
+      "%sint *far_heap_cell(int addr)\n"
+      "{\n"
+      INDENT_STR "typedef struct {\n"
+      INDENT_STR INDENT_STR "int addr;\n"
+      INDENT_STR INDENT_STR "int value;\n"
+      INDENT_STR INDENT_STR "int is_used;\n"
+      INDENT_STR "} FarCell;\n"
+      INDENT_STR "static FarCell *cells = NULL;\n"
+      INDENT_STR "static size_t n_cell = 0, capacity = 0;\n"
+      INDENT_STR "size_t i;\n"
+      INDENT_STR "if (2 * (n_cell + 1) > capacity) {\n"
+      INDENT_STR INDENT_STR "FarCell *old_cells = cells;\n"
+      INDENT_STR INDENT_STR "size_t old_capacity = capacity;\n"
+      INDENT_STR INDENT_STR "capacity = capacity == 0 ? 256 : capacity * 2;\n"
+      INDENT_STR INDENT_STR "if ((cells = calloc(capacity, sizeof(*cells))) == NULL) {\n"
+      INDENT_STR INDENT_STR INDENT_STR "fputs(\"Out of memory\\n\", stderr);\n"
+      INDENT_STR INDENT_STR INDENT_STR "exit(EXIT_FAILURE);\n"
+      INDENT_STR INDENT_STR "}\n"
+      INDENT_STR INDENT_STR "n_cell = 0;\n"
+      INDENT_STR INDENT_STR "for (i = 0; i < old_capacity; i++) {\n"
+      INDENT_STR INDENT_STR INDENT_STR "if (old_cells[i].is_used) {\n"
+      INDENT_STR INDENT_STR INDENT_STR INDENT_STR "*far_heap_cell(old_cells[i].addr) = old_cells[i].value;\n"
+      INDENT_STR INDENT_STR INDENT_STR "}\n"
+      INDENT_STR INDENT_STR "}\n"
+      INDENT_STR INDENT_STR "free(old_cells);\n"
+      INDENT_STR "}\n"
+      INDENT_STR "for (i = ((unsigned int) addr * 2654435761u) & (capacity - 1); cells[i].is_used; i = (i + 1) & (capacity - 1)) {\n"
+      INDENT_STR INDENT_STR "if (cells[i].addr == addr) {\n"
+      INDENT_STR INDENT_STR INDENT_STR "return &cells[i].value;\n"
+      INDENT_STR INDENT_STR "}\n"
+      INDENT_STR "}\n"
+      INDENT_STR "cells[i].addr = addr;\n"
+      INDENT_STR "cells[i].is_used = 1;\n"
+      INDENT_STR "n_cell++;\n"
+      INDENT_STR "return &cells[i].value;\n"
+      "}\n", storage);
+}
+
+
+/*!
+ * @brief Read integer from source code
+ * @param [in,out] reader  Reader of blankspace source code
  * @return  An integer parsed from source code
  */
-int read_nstr(const char **code_ptr) {
-  const char *code = *code_ptr;
+int read_nstr(SourceReader *reader) {
   int is_positive = 1;
-  int sum = 0;
-  switch (*++code) {
+  unsigned int sum = 0;
+  char ch;
+  switch (READER_NEXT(reader)) {
     case '\t':
       is_positive = 0;
       break;
     case '\n':
-      *code_ptr = code;
+    case '\0':
       return 0;
   }
-  while (*++code != '\n') {
+  /* Bits beyond the width of int wrap around instead of overflowing */
+  while ((ch = READER_NEXT(reader)) != '\n' && ch != '\0') {
     sum <<= 1;
-    if (*code == '\t') {
+    if (ch == '\t') {
       sum++;
     }
   }
-  *code_ptr = code;
-  return is_positive ? sum : -sum;
-}
-
-
-/*!
- * @brief Read label and convert it into strings.
- * @param [in,out] code_ptr  Program pointer
- * @return  Converted label
- */
-char* read_label(const char **code_ptr) {
-  static char label_name[MAX_LABEL_LENGTH];
-  char *ptr = label_name;
-  const char *code = *code_ptr;
-  char ch;
-
-  while ((ch = *++code) != '\n') {
-    switch (ch) {
-      case ' ':
-        *ptr++ = 'S';
-        break;
-      case '\t':
-        *ptr++ = 'T';
-        break;
-    }
-  }
-  *ptr = '\0';
-  *code_ptr = code;
-  return label_name;
+  return (int) (is_positive ? sum : 0u - sum);
 }
 
 
@@ -519,133 +2487,114 @@ void show_bytecode(const unsigned char *bytecode, size_t bytecode_size) {
 
 
 /*!
- * @brief Show the byte code in mnemonic format.
- * @param [in] fp             Output file pointer
- * @param [in] bytecode       Blankspace byte code
- * @param [in] bytecode_size  Size of blankspace byte code
+ * @brief Get the mnemonic of an opcode
+ * @param [in] opcode  Opcode of the instruction
+ * @return  Mnemonic, or NULL if the opcode is undefined
  */
-void show_mnemonic(FILE *fp, const unsigned char *bytecode, size_t bytecode_size) {
-  const unsigned char *end;
-  const unsigned char *base = bytecode;
-  for (end = bytecode + bytecode_size; bytecode < end; bytecode++) {
-    fprintf(fp, "%04d: ", (int) ADDR_DIFF(bytecode, base));
-    switch (*bytecode) {
-      case STACK_PUSH:
-        bytecode++;
-        fprintf(fp, "STACK_PUSH %d\n", *((const WsInt *) bytecode));
-        bytecode += sizeof(WsInt) - 1;
-        break;
-      case STACK_DUP_N:
-        bytecode++;
-        fprintf(fp, "STACK_DUP_N %d\n", *((const WsInt *) bytecode));
-        bytecode += sizeof(WsInt) - 1;
-        break;
-      case STACK_DUP:
-        fprintf(fp, "STACK_DUP\n");
-        break;
-      case STACK_SLIDE:
-        bytecode++;
-        fprintf(fp, "STACK_SLIDE %d\n", *((const WsInt *) bytecode));
-        bytecode += sizeof(WsInt) - 1;
-        break;
-      case STACK_SWAP:
-        fputs("STACK_SWAP\n", fp);
-        break;
-      case STACK_DISCARD:
-        fputs("STACK_POP\n", fp);
-        break;
-      case ARITH_ADD:
-        fputs("ARITH_ADD\n", fp);
-        break;
-      case ARITH_SUB:
-        fputs("ARITH_SUB\n", fp);
-        break;
-      case ARITH_MUL:
-        fputs("ARITH_MUL\n", fp);
-        break;
-      case ARITH_DIV:
-        fputs("ARITH_DIV\n", fp);
-        break;
-      case ARITH_MOD:
-        fputs("ARITH_MOD\n", fp);
-        break;
-      case BIT_AND:
-        fputs("BIT_AND\n", fp);
-        break;
-      case BIT_OR:
-        fputs("BIT_OR\n", fp);
-        break;
-      case BIT_XOR:
-        fputs("BIT_XOR\n", fp);
-        break;
-      case BIT_LS:
-        fputs("BIT_LS\n", fp);
-        break;
-      case BIT_RS:
-        fputs("BIT_RS\n", fp);
-        break;
-      case BIT_NOT:
-        fputs("BIT_NOT\n", fp);
-        break;
-      case HEAP_STORE:
-        fputs("HEAP_STORE\n", fp);
-        break;
-      case HEAP_LOAD:
-        fputs("HEAP_LOAD\n", fp);
-        break;
-      case FLOW_GOSUB:
-        bytecode++;
-        fprintf(fp, "FLOW_GOSUB %u\n", *((const WsAddrInt *) bytecode));
-        bytecode += sizeof(WsAddrInt) - 1;
-        break;
-      case FLOW_JUMP:
-        bytecode++;
-        fprintf(fp, "FLOW_JUMP %u\n", *((const WsAddrInt *) bytecode));
-        bytecode += sizeof(WsAddrInt) - 1;
-        break;
-      case FLOW_BEZ:
-        bytecode++;
-        fprintf(fp, "FLOW_BEZ %u\n", *((const WsAddrInt *) bytecode));
-        bytecode += sizeof(WsAddrInt) - 1;
-        break;
-      case FLOW_BLTZ:
-        bytecode++;
-        fprintf(fp, "FLOW_BLTZ %u\n", *((const WsAddrInt *) bytecode));
-        bytecode += sizeof(WsAddrInt) - 1;
-        break;
-      case FLOW_HALT:
-        fputs("FLOW_HALT\n", fp);
-        break;
-      case FLOW_ENDSUB:
-        fputs("FLOW_ENDSUB\n", fp);
-        break;
-      case IO_PUT_CHAR:
-        fputs("IO_PUT_CHAR\n", fp);
-        break;
-      case IO_PUT_NUM:
-        fputs("IO_PUT_NUM\n", fp);
-        break;
-      case IO_READ_CHAR:
-        fputs("IO_READ_CHAR\n", fp);
-        break;
-      case IO_READ_NUM:
-        fputs("IO_READ_NUM\n", fp);
-        break;
-      default:
-        fprintf(fp, "UNDEFINED_INSTRUCTION [0x%02x]\n", *bytecode);
-    }
+__attribute__((const))
+const char *opcode_name(int opcode) {
+  switch (opcode) {
+    case STACK_PUSH:      return "STACK_PUSH";
+    case STACK_DUP_N:     return "STACK_DUP_N";
+    case STACK_DUP:       return "STACK_DUP";
+    case STACK_SLIDE:     return "STACK_SLIDE";
+    case STACK_SWAP:      return "STACK_SWAP";
+    case STACK_DISCARD:   return "STACK_POP";
+    case ARITH_ADD:       return "ARITH_ADD";
+    case ARITH_SUB:       return "ARITH_SUB";
+    case ARITH_MUL:       return "ARITH_MUL";
+    case ARITH_DIV:       return "ARITH_DIV";
+    case ARITH_MOD:       return "ARITH_MOD";
+    case BIT_AND:         return "BIT_AND";
+    case BIT_OR:          return "BIT_OR";
+    case BIT_XOR:         return "BIT_XOR";
+    case BIT_LS:          return "BIT_LS";
+    case BIT_RS:          return "BIT_RS";
+    case BIT_NOT:         return "BIT_NOT";
+    case HEAP_STORE:      return "HEAP_STORE";
+    case HEAP_LOAD:       return "HEAP_LOAD";
+    case FLOW_GOSUB:      return "FLOW_GOSUB";
+    case FLOW_JUMP:       return "FLOW_JUMP";
+    case FLOW_BEZ:        return "FLOW_BEZ";
+    case FLOW_BLTZ:       return "FLOW_BLTZ";
+    case FLOW_HALT:       return "FLOW_HALT";
+    case FLOW_ENDSUB:     return "FLOW_ENDSUB";
+    case IO_PUT_CHAR:     return "IO_PUT_CHAR";
+    case IO_PUT_NUM:      return "IO_PUT_NUM";
+    case IO_READ_CHAR:    return "IO_READ_CHAR";
+    case IO_READ_NUM:     return "IO_READ_NUM";
+    case FUSED_PUSH_ADD:  return "FUSED_PUSH_ADD";
+    case FUSED_DUP_BEZ:   return "FUSED_DUP_BEZ";
+    case FUSED_SUB_BLTZ:  return "FUSED_SUB_BLTZ";
+    case FUSED_PUSH_LOAD: return "FUSED_PUSH_LOAD";
+    case CHECK_STACK:     return "CHECK_STACK";
+    case CHECK_ROOM:      return "CHECK_ROOM";
+    default:              return NULL;
+  }
+}
+
+
+/*!
+ * @brief Print an instruction in mnemonic format, without a newline
+ * @param [in] fp    Output file pointer
+ * @param [in] inst  Instruction
+ */
+void print_mnemonic(FILE *fp, const Instruction *inst) {
+  const char *name = opcode_name(inst->opcode);
+
+  if (name == NULL) {
+    fprintf(fp, "UNDEFINED_INSTRUCTION [0x%02x]", inst->opcode);
+    return;
+  }
+  switch (inst->opcode) {
+    case STACK_PUSH:
+    case STACK_DUP_N:
+    case STACK_SLIDE:
+    case FUSED_PUSH_ADD:
+    case FUSED_PUSH_LOAD:
+    case CHECK_STACK:
+    case CHECK_ROOM:
+      fprintf(fp, "%s %d", name, inst->operand.num);
+      break;
+    case FLOW_GOSUB:
+    case FLOW_JUMP:
+    case FLOW_BEZ:
+    case FLOW_BLTZ:
+    case FUSED_DUP_BEZ:
+    case FUSED_SUB_BLTZ:
+      fprintf(fp, "%s %u", name, inst->operand.addr);
+      break;
+    default:
+      fputs(name, fp);
+  }
+}
+
+
+/*!
+ * @brief Show the decoded instructions in mnemonic format.
+ * @param [in] fp      Output file pointer
+ * @param [in] code    Decoded blankspace instructions
+ * @param [in] n_inst  The number of instructions
+ */
+void show_mnemonic(FILE *fp, const Instruction *code, size_t n_inst) {
+  size_t i;
+  for (i = 0; i < n_inst; i++) {
+    fprintf(fp, "%04d: ", (int) i);
+    print_mnemonic(fp, &code[i]);
+    fputc('\n', fp);
   }
 }
 
 
 /*!
  * @brief Visualize the source code using S and T instead of space or tab.
- * @param [in,out] fp    Output file pointer
- * @param [in]     code  Blankspace source code
+ * @param [in,out] fp      Output file pointer
+ * @param [in,out] reader  Reader of blankspace source code
  */
-void filter(FILE *fp, const char *code) {
-  for (; *code != '\0'; code++) {
-    switch (*code) {
+void filter(FILE *fp, SourceReader *reader) {
+  char ch;
+  while ((ch = READER_NEXT(reader)) != '\0') {
+    switch (ch) {
       case ' ':
         fputc('S', fp);
         break;
@@ -0,0 +1,127 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Decoder                                                                   *
+ * ------------------------------------------------------------------------- */
+#define UNDEF_INDEX  ((size_t) -1)
+
+
+/*!
+ * @brief Get the size of the operand which follows given opcode in bytecode
+ * @param [in] opcode  Opcode of the instruction
+ * @return  Size of the operand in bytes
+ */
+__attribute__((const))
+size_t operand_size(int opcode) {
+  switch (opcode) {
+    case STACK_PUSH:
+    case STACK_DUP_N:
+    case STACK_SLIDE:
+      return sizeof(WsInt);
+    case FLOW_GOSUB:
+    case FLOW_JUMP:
+    case FLOW_BEZ:
+    case FLOW_BLTZ:
+      return sizeof(WsAddrInt);
+    default:
+      return 0;
+  }
+}
+
+
+/*!
+ * @brief Check whether given opcode takes a jump target as its operand
+ * @param [in] opcode  Opcode of the instruction
+ * @return  TRUE if the operand is an instruction index, otherwise FALSE
+ */
+__attribute__((const))
+int is_jump(int opcode) {
+  switch (opcode) {
+    case FLOW_GOSUB:
+    case FLOW_JUMP:
+    case FLOW_BEZ:
+    case FLOW_BLTZ:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+
+/*!
+ * @brief Get the opcode of the first instruction of a superinstruction
+ *
+ * Since a fused instruction keeps the second instruction of the pair right
+ * after itself, a backend can execute the first one in place of the fused
+ * one and fall through to the second.
+ * @param [in] opcode  Opcode of the instruction
+ * @return  Opcode of the first instruction of the pair, or given opcode if
+ *          it is not a superinstruction
+ */
+__attribute__((const))
+int unfused_opcode(int opcode) {
+  switch (opcode) {
+    case FUSED_PUSH_ADD:
+    case FUSED_PUSH_LOAD:
+      return STACK_PUSH;
+    case FUSED_DUP_BEZ:
+      return STACK_DUP;
+    case FUSED_SUB_BLTZ:
+      return ARITH_SUB;
+    default:
+      return opcode;
+  }
+}
+
+
+/*!
+ * @brief Decode byte-packed bytecode into an array of instruction records
+ *
+ * Every instruction becomes one fixed-width, naturally aligned record and
+ * every jump target is converted from a byte offset into an index of the
+ * record array.
+ * The array is terminated with an extra FLOW_HALT record, which is not
+ * counted in n_inst.
+ * @param [in]  bytecode       Bytecode of blankspace
+ * @param [in]  bytecode_size  Size of the bytecode
+ * @param [out] n_inst         The number of decoded instructions
+ * @return  Instruction records (must be freed by the caller)
+ */
+Instruction *decode(const unsigned char *bytecode, size_t bytecode_size, size_t *n_inst) {
+  size_t *inst_idx = (size_t *) malloc((bytecode_size + 1) * sizeof(size_t));
+  Instruction *code;
+  size_t i, n = 0;
+
+  if (inst_idx == NULL) {
+    fputs("Failed to allocate memory for instructions\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < bytecode_size; i++) {
+    inst_idx[i] = UNDEF_INDEX;
+  }
+  for (i = 0; i < bytecode_size; i += operand_size(bytecode[i]) + 1) {
+    inst_idx[i] = n++;
+  }
+  inst_idx[bytecode_size] = n;
+
+  if ((code = (Instruction *) calloc(n + 1, sizeof(Instruction))) == NULL) {
+    fputs("Failed to allocate memory for instructions\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < bytecode_size; i += operand_size(bytecode[i]) + 1) {
+    Instruction *inst = &code[inst_idx[i]];
+    WsAddrInt addr;
+    inst->opcode = bytecode[i];
+    if (is_jump(bytecode[i])) {
+      memcpy(&addr, &bytecode[i + 1], sizeof(WsAddrInt));
+      inst->operand.addr = (WsAddrInt) (addr <= bytecode_size && inst_idx[addr] != UNDEF_INDEX
+        ? inst_idx[addr] : n);
+    } else if (operand_size(bytecode[i]) == sizeof(WsInt)) {
+      memcpy(&inst->operand.num, &bytecode[i + 1], sizeof(WsInt));
+    }
+  }
+  code[n].opcode = FLOW_HALT;
+  free(inst_idx);
+  *n_inst = n;
+  return code;
+}
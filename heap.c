@@ -0,0 +1,284 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Heap                                                                      *
+ * ------------------------------------------------------------------------- */
+/*! The number of pages of the low region */
+#define N_LOW_PAGE  ((HEAP_SIZE + HEAP_PAGE_SIZE - 1) / HEAP_PAGE_SIZE)
+/*! Initial number of buckets of the page hash table (must be a power of 2) */
+#define INITIAL_N_BUCKET  64
+
+/*! Page of zeros shared by all the untouched pages of the low region */
+static WsInt zero_page[HEAP_PAGE_SIZE];
+
+
+/*!
+ * @brief Get the page number of an address
+ */
+__attribute__((const))
+static WsInt page_of(WsInt addr) {
+  return addr >> HEAP_PAGE_BITS;
+}
+
+
+/*!
+ * @brief Get the bucket of a page number in the page hash table
+ */
+__attribute__((const))
+static size_t hash_page(WsInt page, size_t n_bucket) {
+  unsigned long x = (unsigned long) page;
+  /* Mix the upper bits in, since pages of large addresses differ only there */
+  x ^= (x >> 16) >> 16;
+  x ^= x >> 16;
+  x *= 0x45d9f3bUL;
+  x ^= x >> 16;
+  return (size_t) x & (n_bucket - 1);
+}
+
+
+/*!
+ * @brief Allocate a page filled with zeros
+ */
+static WsInt *alloc_page(Heap *heap) {
+  WsInt *page = (WsInt *) calloc(HEAP_PAGE_SIZE, sizeof(WsInt));
+  if (page == NULL) {
+    fputs("Failed to allocate memory for heap\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  heap->n_page++;
+  return page;
+}
+
+
+/*!
+ * @brief Double the number of buckets of the page hash table
+ */
+static void grow_page_table(Heap *heap) {
+  size_t n_bucket = heap->n_bucket == 0 ? INITIAL_N_BUCKET : heap->n_bucket * 2;
+  WsInt *keys = (WsInt *) calloc(n_bucket, sizeof(WsInt));
+  WsInt **pages = (WsInt **) calloc(n_bucket, sizeof(WsInt *));
+  size_t i;
+
+  if (keys == NULL || pages == NULL) {
+    fputs("Failed to allocate memory for heap\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < heap->n_bucket; i++) {
+    size_t j;
+    if (heap->pages[i] == NULL) {
+      continue;
+    }
+    for (j = hash_page(heap->keys[i], n_bucket); pages[j] != NULL; j = (j + 1) & (n_bucket - 1));
+    keys[j] = heap->keys[i];
+    pages[j] = heap->pages[i];
+  }
+  free(heap->keys);
+  free(heap->pages);
+  heap->keys = keys;
+  heap->pages = pages;
+  heap->n_bucket = n_bucket;
+}
+
+
+/*!
+ * @brief Find the page which contains given address outside the low region
+ * @param [in,out] heap      Heap
+ * @param [in]     addr      Address
+ * @param [in]     allocate  TRUE to allocate the page if it doesn't exist
+ * @return  The page, or NULL if it doesn't exist and allocate is FALSE
+ */
+static WsInt *find_hashed_page(Heap *heap, WsInt addr, int allocate) {
+  WsInt page = page_of(addr);
+  size_t i;
+
+  if (heap->last_page != NULL && heap->last_key == page) {
+    return heap->last_page;
+  }
+  if (heap->n_bucket != 0) {
+    for (i = hash_page(page, heap->n_bucket); heap->pages[i] != NULL; i = (i + 1) & (heap->n_bucket - 1)) {
+      if (heap->keys[i] == page) {
+        heap->last_key = page;
+        return heap->last_page = heap->pages[i];
+      }
+    }
+  }
+  if (!allocate) {
+    return NULL;
+  }
+  /* Keep the load factor at most 1/2 */
+  if (2 * (heap->n_hashed + 1) > heap->n_bucket) {
+    grow_page_table(heap);
+  }
+  for (i = hash_page(page, heap->n_bucket); heap->pages[i] != NULL; i = (i + 1) & (heap->n_bucket - 1));
+  heap->keys[i] = page;
+  heap->pages[i] = alloc_page(heap);
+  heap->n_hashed++;
+  heap->last_key = page;
+  return heap->last_page = heap->pages[i];
+}
+
+
+/*!
+ * @brief Record that the page of given address has been written
+ */
+static void touch(Heap *heap, WsInt addr) {
+  WsInt page = page_of(addr);
+  if (heap->n_page == 1 || page < heap->lowest_page) {
+    heap->lowest_page = page;
+  }
+  if (heap->n_page == 1 || page > heap->highest_page) {
+    heap->highest_page = page;
+  }
+}
+
+
+/*!
+ * @brief Initialize an empty heap
+ *
+ * The heap is split into pages of HEAP_PAGE_SIZE cells, which are allocated
+ * when they are written for the first time.
+ * The pages of the low region [0, HEAP_SIZE) are indexed directly by their
+ * page number, and the other pages, including the ones of negative
+ * addresses, are looked up from a hash table.
+ * @param [out] heap  Heap to initialize
+ */
+void heap_init(Heap *heap) {
+  size_t i;
+  if ((heap->low = (WsInt **) malloc(N_LOW_PAGE * sizeof(WsInt *))) == NULL) {
+    fputs("Failed to allocate memory for heap\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < N_LOW_PAGE; i++) {
+    heap->low[i] = zero_page;
+  }
+  heap->zero_page = zero_page;
+  heap->keys = NULL;
+  heap->pages = NULL;
+  heap->n_bucket = 0;
+  heap->n_hashed = 0;
+  heap->last_key = 0;
+  heap->last_page = NULL;
+  heap->n_page = 0;
+  heap->lowest_page = 0;
+  heap->highest_page = 0;
+}
+
+
+/*!
+ * @brief Free all the pages of a heap
+ * @param [in,out] heap  Heap to free
+ */
+void heap_free(Heap *heap) {
+  size_t i;
+  for (i = 0; i < N_LOW_PAGE; i++) {
+    if (heap->low[i] != zero_page) {
+      free(heap->low[i]);
+    }
+  }
+  for (i = 0; i < heap->n_bucket; i++) {
+    free(heap->pages[i]);
+  }
+  free(heap->low);
+  free(heap->keys);
+  free(heap->pages);
+  heap->low = NULL;
+  heap->keys = NULL;
+  heap->pages = NULL;
+  heap->n_bucket = heap->n_hashed = 0;
+  heap->last_page = NULL;
+}
+
+
+/*!
+ * @brief Read a cell of the heap
+ *
+ * A cell which has never been written reads as 0 and no page is allocated.
+ * HEAP_READ() should be used in hot paths, which reads the low region
+ * without a call.
+ * @param [in,out] heap  Heap
+ * @param [in]     addr  Address of the cell
+ * @return  Value of the cell
+ */
+WsInt heap_load(Heap *heap, WsInt addr) {
+  const WsInt *page;
+  if (0 <= addr && addr < (WsInt) HEAP_SIZE) {
+    page = heap->low[(size_t) addr >> HEAP_PAGE_BITS];
+  } else if ((page = find_hashed_page(heap, addr, FALSE)) == NULL) {
+    return 0;
+  }
+  return page[(size_t) addr & HEAP_PAGE_MASK];
+}
+
+
+/*!
+ * @brief Write a cell of the heap, allocating its page if necessary
+ *
+ * HEAP_WRITE() should be used in hot paths, which writes into an allocated
+ * page of the low region without a call.
+ * @param [in,out] heap   Heap
+ * @param [in]     addr   Address of the cell
+ * @param [in]     value  Value to write
+ */
+void heap_store(Heap *heap, WsInt addr, WsInt value) {
+  WsInt *page;
+  if (0 <= addr && addr < (WsInt) HEAP_SIZE) {
+    WsInt **slot = &heap->low[(size_t) addr >> HEAP_PAGE_BITS];
+    if (*slot == zero_page) {
+      *slot = alloc_page(heap);
+      touch(heap, addr);
+    }
+    page = *slot;
+  } else {
+    size_t n_page = heap->n_page;
+    page = find_hashed_page(heap, addr, TRUE);
+    if (heap->n_page != n_page) {
+      touch(heap, addr);
+    }
+  }
+  page[(size_t) addr & HEAP_PAGE_MASK] = value;
+}
+
+
+/*!
+ * @brief Show the statistics of a heap
+ * @param [out] fp    Output stream
+ * @param [in]  heap  Heap
+ */
+void heap_show_stats(FILE *fp, const Heap *heap) {
+  fprintf(fp, "Heap statistics\n");
+  fprintf(fp, "  page size       : %lu cells\n", (unsigned long) HEAP_PAGE_SIZE);
+  fprintf(fp, "  pages touched   : %lu (%lu in the low region, %lu hashed)\n",
+      (unsigned long) heap->n_page,
+      (unsigned long) (heap->n_page - heap->n_hashed),
+      (unsigned long) heap->n_hashed);
+  fprintf(fp, "  memory          : %lu bytes\n",
+      (unsigned long) (heap->n_page * HEAP_PAGE_SIZE * sizeof(WsInt)));
+  if (heap->n_page == 0) {
+    fprintf(fp, "  high-water mark : (none)\n");
+  } else {
+    fprintf(fp, "  low-water mark  : %ld\n", (long) heap->lowest_page * (long) HEAP_PAGE_SIZE);
+    fprintf(fp, "  high-water mark : %ld\n", ((long) heap->highest_page + 1) * (long) HEAP_PAGE_SIZE - 1);
+  }
+}
+
+
+/*!
+ * @brief Call a function for every allocated page of a heap
+ * @param [in] heap   Heap
+ * @param [in] visit  Function called with each page of HEAP_PAGE_SIZE cells
+ *                    and arg
+ * @param [in] arg    Argument passed through to visit
+ */
+void heap_foreach_page(const Heap *heap, void (*visit)(const WsInt *page, void *arg), void *arg) {
+  size_t i;
+  for (i = 0; i < N_LOW_PAGE; i++) {
+    if (heap->low[i] != zero_page) {
+      visit(heap->low[i], arg);
+    }
+  }
+  for (i = 0; i < heap->n_bucket; i++) {
+    if (heap->pages[i] != NULL) {
+      visit(heap->pages[i], arg);
+    }
+  }
+}
@@ -0,0 +1,398 @@
+#include "blankspace.h"
+#include <errno.h>
+#ifdef _WIN32
+#  include <direct.h>
+#  include <process.h>
+#  define getpid()  _getpid()
+#  define mkdir(path, mode)  _mkdir(path)
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+/* ------------------------------------------------------------------------- *
+ * Bytecode image                                                            *
+ * ------------------------------------------------------------------------- */
+/*! Magic number at the head of an image */
+#define IMAGE_MAGIC  "BSC\x1a"
+/*! Version of the image format; bump it whenever opcodes or the layout change */
+#define IMAGE_VERSION  1
+/*! Written in native byte order to reject an image of the other one */
+#define IMAGE_BYTE_ORDER  0x01020304U
+
+/*!
+ * @brief Header of a bytecode image
+ *
+ * The header is followed by n_inst + 1 instruction records, the last of
+ * which is FLOW_HALT.
+ * Jump targets are indices of the records, so the image needs no
+ * relocation and can be executed right where it is mapped.
+ * Every instruction array returned by load_image() and wrap_instructions()
+ * is preceded by a header: the one of the mapped file, or an in-memory one
+ * without the magic number, which tells free_instructions() that the
+ * instructions are allocated.
+ */
+typedef struct {
+  char     magic[4];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t ws_int_size;       /*!< sizeof(WsInt) of the writer */
+  uint32_t ws_addr_int_size;  /*!< sizeof(WsAddrInt) of the writer */
+  uint32_t instruction_size;  /*!< sizeof(Instruction) of the writer */
+  uint32_t opt_level;         /*!< Optimization level of the instructions */
+  uint32_t reserved;
+  uint64_t source_hash;       /*!< hash_source() of the source code */
+  uint64_t n_inst;
+} ImageHeader;
+
+
+/*!
+ * @brief Get the header in front of instructions
+ */
+static ImageHeader *header_of(Instruction *code) {
+  return (ImageHeader *) (void *) ((unsigned char *) code - sizeof(ImageHeader));
+}
+
+
+/*!
+ * @brief Release an image read by load_image()
+ * @param [in] image  Image
+ * @param [in] size   Size of the image
+ */
+static void unmap_image(void *image, size_t size) {
+#ifdef _WIN32
+  (void) size;
+  free(image);
+#else
+  munmap(image, size);
+#endif
+}
+
+
+/*!
+ * @brief Hash the whitespaces of blankspace source code
+ *
+ * Comments don't affect the hash, since they are dropped by the reader.
+ * @param [in,out] reader  Reader of blankspace source code, which is
+ *                         consumed to the end
+ * @return  64-bit hash of the source code
+ */
+uint64_t hash_source(SourceReader *reader) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL;
+  uint64_t n_total = 0;
+
+  while (reader_fill(reader) != '\0') {
+    const char *p = reader->buf;
+    size_t n = reader->len;
+    n_total += n;
+    for (; n >= 8; p += 8, n -= 8) {
+      uint64_t w;
+      memcpy(&w, p, 8);
+      h = (h ^ w) * 0xff51afd7ed558ccdULL;
+      h ^= h >> 32;
+    }
+    for (; n > 0; p++, n--) {
+      h = (h ^ (unsigned char) *p) * 0x100000001b3ULL;
+    }
+  }
+  h ^= n_total;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  return h ^ (h >> 29);
+}
+
+
+/*!
+ * @brief Check whether a header was written by a compatible build
+ */
+__attribute__((pure))
+static int is_compatible(const ImageHeader *header) {
+  return !memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic))
+    && header->version == IMAGE_VERSION
+    && header->byte_order == IMAGE_BYTE_ORDER
+    && header->ws_int_size == sizeof(WsInt)
+    && header->ws_addr_int_size == sizeof(WsAddrInt)
+    && header->instruction_size == sizeof(Instruction);
+}
+
+
+/*!
+ * @brief Check whether an opcode is one which decode() produces
+ *
+ * Labels, superinstructions and stack checks never appear in an image.
+ */
+__attribute__((const))
+static int is_image_opcode(int opcode) {
+  return FLOW_HALT <= opcode && opcode <= BIT_NOT && opcode != FLOW_LABEL;
+}
+
+
+/*!
+ * @brief Check that every record of an image can be executed safely
+ */
+__attribute__((pure))
+static int is_valid_code(const Instruction *code, size_t n_inst) {
+  size_t i;
+  for (i = 0; i < n_inst; i++) {
+    if (!is_image_opcode(code[i].opcode)
+        || (is_jump(code[i].opcode) && code[i].operand.addr > n_inst)) {
+      return FALSE;
+    }
+  }
+  return code[n_inst].opcode == FLOW_HALT;
+}
+
+
+/*!
+ * @brief Create a directory and its missing parents, as mkdir -p does
+ * @param [in] dirname  Name of the directory
+ * @return  TRUE if the directory exists at the end
+ */
+int make_directories(const char *dirname) {
+  char *path = (char *) malloc(strlen(dirname) + 1);
+  char *p;
+  int ok;
+
+  if (path == NULL) {
+    fputs("Failed to allocate memory for directory name\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(path, dirname);
+  for (p = path + 1; *p != '\0'; p++) {
+    if (*p == '/') {
+      *p = '\0';
+      mkdir(path, 0777);
+      *p = '/';
+    }
+  }
+  ok = mkdir(path, 0777) == 0 || errno == EEXIST;
+  free(path);
+  return ok;
+}
+
+
+/*!
+ * @brief Create the directory of a file unless it exists
+ * @param [in] filename  Name of the file
+ */
+static void make_parent_directory(const char *filename) {
+  const char *sep = strrchr(filename, '/');
+  char *dirname;
+
+  if (sep == NULL || sep == filename) {
+    return;
+  }
+  if ((dirname = (char *) malloc((size_t) (sep - filename) + 1)) == NULL) {
+    fputs("Failed to allocate memory for bytecode image\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  memcpy(dirname, filename, (size_t) (sep - filename));
+  dirname[sep - filename] = '\0';
+  make_directories(dirname);
+  free(dirname);
+}
+
+
+/*!
+ * @brief Write instructions into a bytecode image
+ *
+ * The image is written into a temporary file which is renamed at the end,
+ * so that a concurrent reader never sees a partial image.
+ * The directory of the image is created unless it exists.
+ * @param [in] filename     Name of the image file
+ * @param [in] code         Instructions terminated with FLOW_HALT, which
+ *                          must not contain superinstructions
+ * @param [in] n_inst       The number of instructions
+ * @param [in] opt_level    Optimization level of the instructions
+ * @param [in] source_hash  hash_source() of the source code
+ * @return  TRUE on success, otherwise FALSE
+ */
+int save_image(const char *filename, const Instruction *code, size_t n_inst, int opt_level, uint64_t source_hash) {
+  ImageHeader header;
+  size_t len = strlen(filename);
+  char *tmp_filename = (char *) malloc(len + 32);
+  FILE *fp;
+  int ok;
+
+  if (tmp_filename == NULL) {
+    fputs("Failed to allocate memory for bytecode image\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+  header.version = IMAGE_VERSION;
+  header.byte_order = IMAGE_BYTE_ORDER;
+  header.ws_int_size = (uint32_t) sizeof(WsInt);
+  header.ws_addr_int_size = (uint32_t) sizeof(WsAddrInt);
+  header.instruction_size = (uint32_t) sizeof(Instruction);
+  header.opt_level = (uint32_t) opt_level;
+  header.source_hash = source_hash;
+  header.n_inst = (uint64_t) n_inst;
+
+  make_parent_directory(filename);
+  sprintf(tmp_filename, "%s.%ld.tmp", filename, (long) getpid());
+  if ((fp = fopen(tmp_filename, "wb")) == NULL) {
+    fprintf(stderr, "Unable to open file: %s\n", tmp_filename);
+    free(tmp_filename);
+    return FALSE;
+  }
+  ok = fwrite(&header, sizeof(header), 1, fp) == 1
+    && fwrite(code, sizeof(Instruction), n_inst + 1, fp) == n_inst + 1;
+  ok = fclose(fp) == 0 && ok;
+#ifdef _WIN32
+  /* rename() of MSVCRT doesn't replace an existing file */
+  remove(filename);
+#endif
+  if (!ok || rename(tmp_filename, filename) != 0) {
+    fprintf(stderr, "Failed to write bytecode image: %s\n", filename);
+    remove(tmp_filename);
+    free(tmp_filename);
+    return FALSE;
+  }
+  free(tmp_filename);
+  return TRUE;
+}
+
+
+/*!
+ * @brief Map a bytecode image into memory
+ *
+ * The instructions are used in place: the image is mapped copy-on-write,
+ * so they can be modified without touching the file.
+ * The returned instructions must be released with free_instructions().
+ * @param [in]  filename     Name of the image file
+ * @param [in]  verbose      TRUE to report why the image can't be used
+ * @param [out] n_inst       The number of instructions
+ * @param [out] opt_level    Optimization level of the instructions
+ * @param [out] source_hash  hash_source() of the source code
+ * @return  Instructions terminated with FLOW_HALT, or NULL if the image
+ *          doesn't exist or can't be used by this build
+ */
+Instruction *load_image(const char *filename, int verbose, size_t *n_inst, int *opt_level, uint64_t *source_hash) {
+  ImageHeader *header;
+  Instruction *code;
+  void *image;
+  size_t size;
+#ifdef _WIN32
+  FILE *fp = fopen(filename, "rb");
+  long file_size;
+
+  if (fp == NULL) {
+    if (verbose) {
+      fprintf(stderr, "Unable to open file: %s\n", filename);
+    }
+    return NULL;
+  }
+  if (fseek(fp, 0, SEEK_END) != 0 || (file_size = ftell(fp)) < 0 || fseek(fp, 0, SEEK_SET) != 0) {
+    fclose(fp);
+    return NULL;
+  }
+  size = (size_t) file_size;
+  if ((image = malloc(size + 1)) == NULL) {
+    fputs("Failed to allocate memory for bytecode image\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  if (fread(image, 1, size, fp) != size) {
+    size = 0;
+  }
+  fclose(fp);
+#else
+  struct stat st;
+  int fd = open(filename, O_RDONLY);
+
+  if (fd == -1) {
+    if (verbose) {
+      fprintf(stderr, "Unable to open file: %s\n", filename);
+    }
+    return NULL;
+  }
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t) st.st_size < sizeof(ImageHeader)) {
+    close(fd);
+    if (verbose) {
+      fprintf(stderr, "Not a bytecode image: %s\n", filename);
+    }
+    return NULL;
+  }
+  size = (size_t) st.st_size;
+  image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    if (verbose) {
+      fprintf(stderr, "Unable to map file: %s\n", filename);
+    }
+    return NULL;
+  }
+#endif
+
+  header = (ImageHeader *) image;
+  code = (Instruction *) (void *) ((unsigned char *) image + sizeof(ImageHeader));
+  if (size < sizeof(ImageHeader) || !is_compatible(header)) {
+    if (verbose) {
+      fprintf(stderr, "Bytecode image is not compatible with this build: %s\n", filename);
+    }
+    unmap_image(image, size);
+    return NULL;
+  }
+  if ((size - sizeof(ImageHeader)) / sizeof(Instruction) != header->n_inst + 1
+      || (size - sizeof(ImageHeader)) % sizeof(Instruction) != 0
+      || !is_valid_code(code, (size_t) header->n_inst)) {
+    if (verbose) {
+      fprintf(stderr, "Bytecode image is broken: %s\n", filename);
+    }
+    unmap_image(image, size);
+    return NULL;
+  }
+  *n_inst = (size_t) header->n_inst;
+  *opt_level = (int) header->opt_level;
+  *source_hash = header->source_hash;
+  return code;
+}
+
+
+/*!
+ * @brief Move allocated instructions behind a header of their own
+ *
+ * The instructions are released with free_instructions() then, as the ones
+ * of an image are.
+ * @param [in] code    Instructions terminated with FLOW_HALT, which are
+ *                     freed
+ * @param [in] n_inst  The number of instructions
+ * @return  Instructions in the same order
+ */
+Instruction *wrap_instructions(Instruction *code, size_t n_inst) {
+  size_t size = (n_inst + 1) * sizeof(Instruction);
+  unsigned char *image = (unsigned char *) malloc(sizeof(ImageHeader) + size);
+  Instruction *wrapped;
+
+  if (image == NULL) {
+    fputs("Failed to allocate memory for instructions\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  memset(image, 0, sizeof(ImageHeader));
+  ((ImageHeader *) (void *) image)->n_inst = (uint64_t) n_inst;
+  wrapped = (Instruction *) (void *) (image + sizeof(ImageHeader));
+  memcpy(wrapped, code, size);
+  free(code);
+  return wrapped;
+}
+
+
+/*!
+ * @brief Release instructions returned by load_image() or
+ *        wrap_instructions()
+ * @param [in] code  Instructions, or NULL
+ */
+void free_instructions(Instruction *code) {
+  ImageHeader *header;
+
+  if (code == NULL) {
+    return;
+  }
+  header = header_of(code);
+  if (!memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic))) {
+    unmap_image(header, sizeof(ImageHeader) + ((size_t) header->n_inst + 1) * sizeof(Instruction));
+  } else {
+    free(header);
+  }
+}
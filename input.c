@@ -0,0 +1,80 @@
+#include "blankspace.h"
+#include <ctype.h>
+
+/* ------------------------------------------------------------------------- *
+ * Input buffer                                                              *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Initialize the input buffer of a VM
+ *
+ * The input is taken from the callback if it is given, otherwise from the
+ * memory, which is read in place.
+ * @param [out] in    Input buffer
+ * @param [in]  read  Callback supplying the input, or NULL
+ * @param [in]  arg   First argument of read
+ * @param [in]  data  Whole input in memory, used if read is NULL
+ * @param [in]  size  Size of data
+ */
+void input_init(InputBuffer *in, BsReadFunc read, void *arg, const char *data, size_t size) {
+  in->read = read;
+  in->arg = arg;
+  if (read == NULL && data != NULL) {
+    in->ptr = (const unsigned char *) data;
+    in->end = in->ptr + size;
+  } else {
+    in->ptr = in->end = in->data;
+  }
+}
+
+
+/*!
+ * @brief Refill the input buffer from the callback
+ *
+ * INPUT_CHAR() calls this function when the buffer is exhausted.
+ * @param [in,out] in  Input buffer
+ * @return  The next byte, or EOF at the end of input
+ */
+int input_fill(InputBuffer *in) {
+  size_t n;
+  if (in->read == NULL || (n = in->read(in->arg, (char *) in->data, sizeof(in->data))) == 0) {
+    return EOF;
+  }
+  in->ptr = in->data + 1;
+  in->end = in->data + n;
+  return in->data[0];
+}
+
+
+/*!
+ * @brief Read a decimal integer like scanf("%d")
+ *
+ * Leading whitespaces are skipped, and the byte after the digits is left
+ * in the buffer.
+ * @param [in,out] in  Input buffer
+ * @param [out]    n   Integer read
+ * @return  TRUE if an integer is read, otherwise FALSE
+ */
+int input_num(InputBuffer *in, int *n) {
+  unsigned int m = 0;
+  int c, is_negative = FALSE;
+
+  while ((c = INPUT_CHAR(in)) != EOF && isspace(c));
+  if (c == '-' || c == '+') {
+    is_negative = c == '-';
+    c = INPUT_CHAR(in);
+  }
+  if (c == EOF || !isdigit(c)) {
+    if (c != EOF) {
+      INPUT_UNGET(in);
+    }
+    return FALSE;
+  }
+  for (; c != EOF && isdigit(c); c = INPUT_CHAR(in)) {
+    m = m * 10 + (unsigned int) (c - '0');
+  }
+  if (c != EOF) {
+    INPUT_UNGET(in);
+  }
+  *n = (int) (is_negative ? 0U - m : m);
+  return TRUE;
+}
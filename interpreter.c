@@ -3,160 +3,1046 @@
 /* ------------------------------------------------------------------------- *
  * Interpreter                                                               *
  * ------------------------------------------------------------------------- */
+#if defined(__GNUC__) && !defined(NO_THREADED_CODE)
+#  define USE_THREADED_CODE
+#endif
+
+#ifdef USE_THREADED_CODE
+/*!
+ * @brief An instruction of direct-threaded code
+ *
+ * Same as Instruction, except that the opcode is replaced with the address
+ * of its handler.
+ */
+typedef struct {
+  const void *handler;
+  Operand     operand;
+} ThreadedInstruction;
+
+#  define CASE(opcode)  L_##opcode
+#  define DEFAULT       L_UNDEFINED
+#  define DISPATCH()    goto *ip->handler
+#  define OPCODE        (verified[ip - code].opcode)
+#else
+#  define CASE(opcode)  case opcode
+#  define DEFAULT       default
+#  define DISPATCH()    continue
+#  define OPCODE        (ip->opcode)
+#endif
+#define NEXT()        { ip++; DISPATCH(); }
+#define NEXT2()       { ip += 2; DISPATCH(); }
+#define OPERAND_NUM   (ip->operand.num)
+#define OPERAND_ADDR  (ip->operand.addr)
+#define RETURN_ADDR   ((size_t) (ip - code) + 1)
+#define JUMP(addr)    { ip = &code[addr]; DISPATCH(); }
+
+/*
+ * The top of the stack is cached in the local variable tos and the stack
+ * pointer is kept in the local variable sp, so that the handlers don't touch
+ * vm->stack_idx.  vm->stack[0] is reserved for the value spilled by the first
+ * push, therefore sp - vm->stack equals the number of elements on the stack.
+ * The handlers don't check the depth of the stack; verify() puts CHECK_STACK
+ * and CHECK_ROOM at the entry of the blocks which can't be proven safe.
+ */
+
+
+#ifdef USE_THREADED_CODE
+/*!
+ * @brief Convert instruction records into direct-threaded code
+ *
+ * Every opcode is replaced with the address of its handler, so that the
+ * handlers can dispatch the next instruction by themselves.
+ * The records themselves are left untouched.
+ * @param [in] code       Instruction records terminated with FLOW_HALT
+ * @param [in] n_inst     The number of instructions
+ * @param [in] handlers   Handler addresses indexed by opcode
+ * @param [in] n_handler  The number of elements of handlers
+ * @param [in] undefined  Handler address for undefined instructions
+ * @return  Threaded code (must be freed by the caller)
+ */
+static ThreadedInstruction *thread_code(
+    const Instruction *code,
+    size_t n_inst,
+    const void *const handlers[],
+    size_t n_handler,
+    const void *undefined) {
+  ThreadedInstruction *threaded = (ThreadedInstruction *) malloc((n_inst + 1) * sizeof(ThreadedInstruction));
+  size_t i;
+
+  if (threaded == NULL) {
+    fputs("Failed to allocate memory for threaded code\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i <= n_inst; i++) {
+    if (code[i].opcode < 0 || (size_t) code[i].opcode >= n_handler || handlers[code[i].opcode] == NULL) {
+      threaded[i].handler = undefined;
+    } else {
+      threaded[i].handler = handlers[code[i].opcode];
+    }
+    threaded[i].operand = code[i].operand;
+  }
+  return threaded;
+}
+
+
+/*!
+ * @brief Replace the handlers of the safe points of tiered execution
+ *
+ * The safe points are the calls to the entries of the regions and the
+ * back-edges, whose targets are the headers of loops.
+ * @param [in,out] threaded   Threaded code of prepared
+ * @param [in]     prepared   Prepared code with a tier
+ * @param [in]     handlers   Handler addresses of the safe points indexed
+ *                            by opcode
+ * @param [in]     n_handler  The number of elements of handlers
+ */
+static void thread_safe_points(
+    ThreadedInstruction *threaded,
+    const PreparedCode *prepared,
+    const void *const handlers[],
+    size_t n_handler) {
+  size_t i;
+
+  for (i = 0; i < prepared->n_verified; i++) {
+    const Instruction *inst = &prepared->verified[i];
+    if (inst->opcode < 0 || (size_t) inst->opcode >= n_handler || handlers[inst->opcode] == NULL) {
+      continue;
+    }
+    if (inst->opcode == FLOW_GOSUB ? tier_is_entry(prepared->tier, inst->operand.addr) : inst->operand.addr <= i) {
+      threaded[i].handler = handlers[inst->opcode];
+    }
+  }
+}
+#endif
+
+
+#ifdef USE_THREADED_CODE
+/* Labels as values are a GNU extension */
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+/*!
+ * @brief Run prepared code, or thread it if threaded is given
+ *
+ * If the compiler supports labels as values, the instructions are converted
+ * into direct-threaded code and each handler jumps to the next one by itself.
+ * The addresses of the handlers are only known here, so the conversion is
+ * done by this function as well.
+ * Otherwise the portable switch dispatch loop is used.
+ * The top of the stack and the stack pointer are kept in local variables
+ * during execution.
+ * The instructions are verified beforehand, so that the stack is only
+ * checked at the entry of the blocks which verify() couldn't prove safe.
+ * @param [in,out] vm        VM to run the code on, or NULL to thread it
+ * @param [in]     prepared  Prepared code
+ * @param [out]    threaded  Threaded code of prepared (must be freed by the
+ *                           caller), or NULL to run it
+ * @return  TRUE if the program halts, or FALSE if it stops on a runtime
+ *          error, whose message is left in vm->error
+ */
+static int interpret(BsVM *vm, const PreparedCode *prepared, void **threaded) {
+  const Instruction *verified = prepared->verified;
+  size_t *call_stack;
+  size_t call_stack_idx = 0;
+  WsInt *sp;
+  WsInt tos = 0;
+  WsInt a = 0;
+  int n = 0;
+#ifdef USE_THREADED_CODE
+  Tier *tier = prepared->tier;
+  TierEntry entry;
+  static const void *const tier_handlers[] = {
+    [FLOW_GOSUB] = &&L_TIER_GOSUB,
+    [FLOW_JUMP] = &&L_TIER_JUMP,
+    [FLOW_BEZ] = &&L_TIER_BEZ,
+    [FLOW_BLTZ] = &&L_TIER_BLTZ,
+    [FUSED_DUP_BEZ] = &&L_TIER_DUP_BEZ,
+    [FUSED_SUB_BLTZ] = &&L_TIER_SUB_BLTZ
+  };
+  static const void *const handlers[] = {
+    [FLOW_HALT] = &&L_FLOW_HALT,
+    [STACK_PUSH] = &&L_STACK_PUSH,
+    [STACK_DUP_N] = &&L_STACK_DUP_N,
+    [STACK_DUP] = &&L_STACK_DUP,
+    [STACK_SLIDE] = &&L_STACK_SLIDE,
+    [STACK_SWAP] = &&L_STACK_SWAP,
+    [STACK_DISCARD] = &&L_STACK_DISCARD,
+    [ARITH_ADD] = &&L_ARITH_ADD,
+    [ARITH_SUB] = &&L_ARITH_SUB,
+    [ARITH_MUL] = &&L_ARITH_MUL,
+    [ARITH_DIV] = &&L_ARITH_DIV,
+    [ARITH_MOD] = &&L_ARITH_MOD,
+    [HEAP_STORE] = &&L_HEAP_STORE,
+    [HEAP_LOAD] = &&L_HEAP_LOAD,
+    [FLOW_GOSUB] = &&L_FLOW_GOSUB,
+    [FLOW_JUMP] = &&L_FLOW_JUMP,
+    [FLOW_BEZ] = &&L_FLOW_BEZ,
+    [FLOW_BLTZ] = &&L_FLOW_BLTZ,
+    [FLOW_ENDSUB] = &&L_FLOW_ENDSUB,
+    [IO_PUT_CHAR] = &&L_IO_PUT_CHAR,
+    [IO_PUT_NUM] = &&L_IO_PUT_NUM,
+    [IO_READ_CHAR] = &&L_IO_READ_CHAR,
+    [IO_READ_NUM] = &&L_IO_READ_NUM,
+    [BIT_AND] = &&L_BIT_AND,
+    [BIT_OR] = &&L_BIT_OR,
+    [BIT_XOR] = &&L_BIT_XOR,
+    [BIT_LS] = &&L_BIT_LS,
+    [BIT_RS] = &&L_BIT_RS,
+    [BIT_NOT] = &&L_BIT_NOT,
+    [FUSED_PUSH_ADD] = &&L_FUSED_PUSH_ADD,
+    [FUSED_DUP_BEZ] = &&L_FUSED_DUP_BEZ,
+    [FUSED_SUB_BLTZ] = &&L_FUSED_SUB_BLTZ,
+    [FUSED_PUSH_LOAD] = &&L_FUSED_PUSH_LOAD,
+    [CHECK_STACK] = &&L_CHECK_STACK,
+    [CHECK_ROOM] = &&L_CHECK_ROOM
+  };
+  const ThreadedInstruction *code = (const ThreadedInstruction *) prepared->threaded;
+  const ThreadedInstruction *ip = code;
+
+  if (threaded != NULL) {
+    *threaded = thread_code(verified, prepared->n_verified, handlers, LENGTHOF(handlers), &&L_UNDEFINED);
+    if (tier != NULL) {
+      thread_safe_points((ThreadedInstruction *) *threaded, prepared, tier_handlers, LENGTHOF(tier_handlers));
+    }
+    return TRUE;
+  }
+  call_stack = vm->call_stack;
+  sp = vm->stack;
+  vm->error = NULL;
+  DISPATCH();
+  {
+    {
+#else
+  const Instruction *code = verified;
+  const Instruction *ip = code;
+
+  (void) threaded;
+  call_stack = vm->call_stack;
+  sp = vm->stack;
+  vm->error = NULL;
+  for (;;) {
+    switch (ip->opcode) {
+#endif
+      CASE(STACK_PUSH):
+        *sp++ = tos;
+        tos = OPERAND_NUM;
+        NEXT();
+      CASE(STACK_DUP_N):
+        a = OPERAND_NUM == 0 ? tos : sp[-OPERAND_NUM];
+        *sp++ = tos;
+        tos = a;
+        NEXT();
+      CASE(STACK_DUP):
+        *sp++ = tos;
+        NEXT();
+      CASE(STACK_SLIDE):
+        sp -= OPERAND_NUM;
+        NEXT();
+      CASE(STACK_SWAP):
+        a = sp[-1];
+        sp[-1] = tos;
+        tos = a;
+        NEXT();
+      CASE(STACK_DISCARD):
+        tos = *--sp;
+        NEXT();
+      CASE(ARITH_ADD):
+        tos = *--sp + tos;
+        NEXT();
+      CASE(ARITH_SUB):
+        tos = *--sp - tos;
+        NEXT();
+      CASE(ARITH_MUL):
+        tos = *--sp * tos;
+        NEXT();
+      CASE(ARITH_DIV):
+        if (tos == 0) {
+          goto zero_division;
+        }
+        tos = *--sp / tos;
+        NEXT();
+      CASE(ARITH_MOD):
+        if (tos == 0) {
+          goto zero_division;
+        }
+        tos = *--sp % tos;
+        NEXT();
+      CASE(BIT_AND):
+        tos = *--sp & tos;
+        NEXT();
+      CASE(BIT_OR):
+        tos = *--sp | tos;
+        NEXT();
+      CASE(BIT_XOR):
+        tos = *--sp ^ tos;
+        NEXT();
+      CASE(BIT_LS):
+        tos = *--sp << tos;
+        NEXT();
+      CASE(BIT_RS):
+        tos = *--sp >> tos;
+        NEXT();
+      CASE(BIT_NOT):
+        tos = ~tos;
+        NEXT();
+      CASE(HEAP_STORE):
+        a = sp[-1];
+        HEAP_WRITE(&vm->heap, a, tos);
+        sp -= 2;
+        tos = *sp;
+        NEXT();
+      CASE(HEAP_LOAD):
+        tos = HEAP_READ(&vm->heap, tos);
+        NEXT();
+      CASE(FLOW_GOSUB):
+        if (call_stack_idx == LENGTHOF(vm->call_stack)) {
+          goto call_stack_overflow;
+        }
+        call_stack[call_stack_idx++] = RETURN_ADDR;
+        JUMP(OPERAND_ADDR);
+      CASE(FLOW_JUMP):
+        JUMP(OPERAND_ADDR);
+      CASE(FLOW_BEZ):
+        a = tos;
+        tos = *--sp;
+        if (!a) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT();
+      CASE(FLOW_BLTZ):
+        a = tos;
+        tos = *--sp;
+        if (a < 0) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT();
+      CASE(FLOW_ENDSUB):
+        if (call_stack_idx == 0) {
+          goto call_stack_underflow;
+        }
+        JUMP(call_stack[--call_stack_idx]);
+      CASE(IO_PUT_CHAR):
+        OUTPUT_CHAR(&vm->output, tos);
+        tos = *--sp;
+        NEXT();
+      CASE(IO_PUT_NUM):
+        output_num(&vm->output, tos);
+        tos = *--sp;
+        NEXT();
+      CASE(IO_READ_CHAR):
+        a = tos;
+        tos = *--sp;
+        OUTPUT_SYNC(&vm->output);
+        HEAP_WRITE(&vm->heap, a, INPUT_CHAR(&vm->input));
+        NEXT();
+      CASE(IO_READ_NUM):
+        a = tos;
+        tos = *--sp;
+        OUTPUT_SYNC(&vm->output);
+        if (input_num(&vm->input, &n)) {
+          HEAP_WRITE(&vm->heap, a, n);
+        }
+        NEXT();
+      CASE(FUSED_PUSH_ADD):
+        tos += OPERAND_NUM;
+        NEXT2();
+      CASE(FUSED_DUP_BEZ):
+        if (!tos) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT2();
+      CASE(FUSED_SUB_BLTZ):
+        a = *--sp - tos;
+        tos = *--sp;
+        if (a < 0) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT2();
+      CASE(FUSED_PUSH_LOAD):
+        *sp++ = tos;
+        tos = HEAP_READ(&vm->heap, OPERAND_NUM);
+        NEXT2();
+      CASE(CHECK_STACK):
+        if (sp - vm->stack < OPERAND_NUM) {
+          goto stack_underflow;
+        }
+        NEXT();
+      CASE(CHECK_ROOM):
+        if (vm->stack + LENGTHOF(vm->stack) - sp < OPERAND_NUM) {
+          goto stack_overflow;
+        }
+        NEXT();
+#ifdef USE_THREADED_CODE
+      /*
+       * Safe points of tiered execution, which switch to a compiled region
+       * with the stack spilled into vm->stack.
+       * The spill needs a slot above the stack.
+       */
+      L_TIER_GOSUB:
+        entry = tier_poll(tier, tier_region_of(tier, OPERAND_ADDR));
+        if (entry == NULL || sp - vm->stack >= (long) STACK_SIZE) {
+          goto L_FLOW_GOSUB;
+        }
+        *sp = tos;
+        vm->stack_idx = (size_t) (sp - vm->stack);
+        n = tier_run(tier, entry, vm, TIER_FROM_ENTRY, call_stack_idx);
+        sp = vm->stack + vm->stack_idx;
+        tos = *sp;
+        if (n != TIER_RETURNED) {
+          goto halt;
+        }
+        NEXT();
+      L_TIER_JUMP:
+        ip = &code[OPERAND_ADDR];
+        goto loop_header;
+      L_TIER_BEZ:
+        a = tos;
+        tos = *--sp;
+        if (!a) {
+          ip = &code[OPERAND_ADDR];
+          goto loop_header;
+        }
+        NEXT();
+      L_TIER_BLTZ:
+        a = tos;
+        tos = *--sp;
+        if (a < 0) {
+          ip = &code[OPERAND_ADDR];
+          goto loop_header;
+        }
+        NEXT();
+      L_TIER_DUP_BEZ:
+        if (!tos) {
+          ip = &code[OPERAND_ADDR];
+          goto loop_header;
+        }
+        NEXT2();
+      L_TIER_SUB_BLTZ:
+        a = *--sp - tos;
+        tos = *--sp;
+        if (a < 0) {
+          ip = &code[OPERAND_ADDR];
+          goto loop_header;
+        }
+        NEXT2();
+      loop_header:
+        entry = tier_poll(tier, tier_region_of(tier, (size_t) (ip - code)));
+        if (entry == NULL || sp - vm->stack >= (long) STACK_SIZE) {
+          DISPATCH();
+        }
+        *sp = tos;
+        vm->stack_idx = (size_t) (sp - vm->stack);
+        n = tier_run(tier, entry, vm, (size_t) (ip - code), call_stack_idx);
+        sp = vm->stack + vm->stack_idx;
+        tos = *sp;
+        if (n != TIER_RETURNED) {
+          goto halt;
+        }
+        /* The region returned from the subroutine the loop is in */
+        if (call_stack_idx == 0) {
+          goto call_stack_underflow;
+        }
+        JUMP(call_stack[--call_stack_idx]);
+#endif
+      CASE(FLOW_HALT):
+        goto halt;
+      DEFAULT:
+        fprintf(stderr, "Undefined instruction is detected [%02x]\n", OPCODE);
+        NEXT();
+    }
+  }
+halt:
+  vm->stack_idx = (size_t) (sp - vm->stack);
+  output_flush(&vm->output);
+  return vm->error == NULL;
+  /* Kept out of the handlers, so that they stay small */
+stack_underflow:
+  vm->error = "Stack underflow";
+  goto halt;
+stack_overflow:
+  vm->error = "Stack overflow";
+  goto halt;
+zero_division:
+  vm->error = "Zero division";
+  goto halt;
+call_stack_overflow:
+  vm->error = "Call stack overflow";
+  goto halt;
+call_stack_underflow:
+  vm->error = "Call stack underflow";
+  goto halt;
+}
+#ifdef USE_THREADED_CODE
+#  pragma GCC diagnostic pop
+#endif
+
+
+/*!
+ * @brief Verify and thread instructions for execute_prepared()
+ *
+ * With BS_TIERED, the hot regions are compiled to native code while the
+ * prepared code runs, which needs direct-threaded code.
+ * @param [out] prepared  Prepared code (must be released with
+ *                        free_prepared_code())
+ * @param [in]  code      Instruction records terminated with FLOW_HALT
+ * @param [in]  n_inst    The number of instructions
+ * @param [in]  options   Options of the program, or NULL
+ */
+void prepare_code(PreparedCode *prepared, const Instruction *code, size_t n_inst, const BsOptions *options) {
+  prepared->verified = verify(code, n_inst, &prepared->n_verified);
+  prepared->threaded = NULL;
+  prepared->tier = NULL;
+#ifdef USE_THREADED_CODE
+  if (options != NULL && (options->flags & BS_TIERED)) {
+    prepared->tier = tier_create(code, n_inst, prepared->verified, prepared->n_verified, options);
+  }
+  interpret(NULL, prepared, &prepared->threaded);
+#else
+  (void) options;
+#endif
+}
+
+
+/*!
+ * @brief Execute prepared code
+ * @param [in,out] vm        VM to run the code on
+ * @param [in]     prepared  Code prepared by prepare_code()
+ * @return  TRUE if the program halts, or FALSE if it stops on a runtime
+ *          error, whose message is left in vm->error
+ */
+int execute_prepared(BsVM *vm, const PreparedCode *prepared) {
+  return interpret(vm, prepared, NULL);
+}
+
+
+/*!
+ * @brief Release code prepared by prepare_code()
+ * @param [in,out] prepared  Prepared code
+ */
+void free_prepared_code(PreparedCode *prepared) {
+  tier_free(prepared->tier);
+  free(prepared->threaded);
+  free(prepared->verified);
+  prepared->threaded = NULL;
+  prepared->verified = NULL;
+  prepared->tier = NULL;
+}
+
+
 /*!
  * @brief Execute blankspace
- * @param [in] bytecode  Bytecode of blankspace
+ *
+ * The instructions are prepared for this run only; use prepare_code() and
+ * execute_prepared() to run them many times.
+ * @param [in,out] vm      VM to run the instructions on
+ * @param [in]     base    Instruction records terminated with FLOW_HALT
+ * @param [in]     n_inst  The number of instructions
+ * @return  TRUE if the program halts, or FALSE if it stops on a runtime
+ *          error, whose message is left in vm->error
+ */
+int execute(BsVM *vm, const Instruction *base, size_t n_inst) {
+  PreparedCode prepared;
+  int ok;
+  prepare_code(&prepared, base, n_inst, NULL);
+  ok = execute_prepared(vm, &prepared);
+  free_prepared_code(&prepared);
+  return ok;
+}
+
+
+/*! Heap address of a tagged value */
+#define ADDRESS(v)  (BIGNUM_IS_SMALL(v) ? BIGNUM_UNTAG(v) : bignum_address(vm, v))
+/*! Compute a binary operator on the slow path and collect garbage if needed */
+#define BIGNUM_SLOW_BINARY(opcode) \
+  { \
+    tos = bignum_binary(vm, opcode, a, tos); \
+    bignum_collect_if_needed(vm, sp, tos); \
+    NEXT(); \
+  }
+
+
+/*!
+ * @brief Replace the operands of STACK_PUSH with tagged values
+ * @param [in,out] vm      VM which owns the bignums of the constants
+ * @param [in,out] code    Instruction records terminated with FLOW_HALT
+ * @param [in]     n_inst  The number of instructions
+ * @return  code
+ */
+static Instruction *tag_constants(BsVM *vm, Instruction *code, size_t n_inst) {
+  size_t i;
+  bignum_init(vm);
+  for (i = 0; i < n_inst; i++) {
+    if (code[i].opcode == STACK_PUSH) {
+      code[i].operand.num = bignum_constant(vm, code[i].operand.num);
+    }
+  }
+  return code;
+}
+
+
+#ifdef USE_THREADED_CODE
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+/*!
+ * @brief Run prepared code with arbitrary-precision integers, or thread it
+ *        if threaded is given
+ *
+ * Same as interpret(), except that the values on the stack and the heap are
+ * tagged.
+ * Small integers are computed inline, and the handlers fall back to the
+ * bignum functions only when an operand is a bignum or the result
+ * overflows.
+ * Superinstructions are not supported.
+ * @param [in,out] vm        VM to run the code on, or NULL to thread it
+ * @param [in]     prepared  Prepared code with tagged constants
+ * @param [out]    threaded  Threaded code of prepared (must be freed by the
+ *                           caller), or NULL to run it
+ * @return  TRUE if the program halts, or FALSE if it stops on a runtime
+ *          error, whose message is left in vm->error
  */
-void execute(const unsigned char *bytecode) {
-  static int heap[HEAP_SIZE] = {0};
-  static size_t call_stack[CALL_STACK_SIZE] = {0};
+static int interpret_bignum(BsVM *vm, const PreparedCode *prepared, void **threaded) {
+  const Instruction *verified = prepared->verified;
+  size_t *call_stack;
   size_t call_stack_idx = 0;
-  const unsigned char *base = bytecode;
-  int a = 0, b = 0;
-  for (; *bytecode; bytecode++) {
-    switch (*bytecode) {
-      case STACK_PUSH:
-        bytecode++;
-        stack_push(*((const WsInt *) bytecode));
-        bytecode += sizeof(WsInt) - 1;
-        break;
-      case STACK_DUP_N:
-        bytecode++;
-        stack_dup_n((size_t) *((const WsInt *) bytecode));
-        bytecode += sizeof(WsInt) - 1;
-        break;
-      case STACK_DUP:
-        stack_dup_n(0);
-        break;
-      case STACK_SLIDE:
-        bytecode++;
-        stack_slide((size_t) *((const WsInt *) bytecode));
-        bytecode += sizeof(WsInt) - 1;
-        break;
-      case STACK_SWAP:
-        stack_swap();
-        break;
-      case STACK_DISCARD:
-        stack_pop();
-        break;
-      case ARITH_ADD:
-        a = stack_pop();
-        b = stack_pop();
-        stack_push(b + a);
-        break;
-      case ARITH_SUB:
-        a = stack_pop();
-        b = stack_pop();
-        stack_push(b - a);
-        break;
-      case ARITH_MUL:
-        a = stack_pop();
-        b = stack_pop();
-        stack_push(b * a);
-        break;
-      case ARITH_DIV:
-        a = stack_pop();
-        b = stack_pop();
-        assert(b != 0);
-        stack_push(b / a);
-        break;
-      case ARITH_MOD:
-        a = stack_pop();
-        b = stack_pop();
-        assert(b != 0);
-        stack_push(b % a);
-        break;
-      case BIT_AND:
-        a = stack_pop();
-        b = stack_pop();
-        stack_push(b & a);
-        break;
-      case BIT_OR:
-        a = stack_pop();
-        b = stack_pop();
-        stack_push(b | a);
-        break;
-      case BIT_XOR:
-        a = stack_pop();
-        b = stack_pop();
-        stack_push(b ^ a);
-        break;
-      case BIT_LS:
-        a = stack_pop();
-        b = stack_pop();
-        stack_push(b << a);
-        break;
-      case BIT_RS:
-        a = stack_pop();
-        b = stack_pop();
-        stack_push(b >> a);
-        break;
-      case BIT_NOT:
-        a = stack_pop();
-        stack_push(~a);
-        break;
-      case HEAP_STORE:
-        a = stack_pop();
-        b = stack_pop();
-        assert(0 <= b && b < (int) LENGTHOF(heap));
-        heap[b] = a;
-        break;
-      case HEAP_LOAD:
-        a = stack_pop();
-        assert(0 <= a && a < (int) LENGTHOF(heap));
-        stack_push(heap[a]);
-        break;
-      case FLOW_GOSUB:
-        call_stack[call_stack_idx++] = (size_t) (ADDR_DIFF(bytecode, base)) + sizeof(WsAddrInt);
-        bytecode++;
-        bytecode = &base[*((const WsAddrInt *) bytecode)] - 1;
-        break;
-      case FLOW_JUMP:
-        bytecode++;
-        bytecode = &base[*((const WsAddrInt *) bytecode)] - 1;
-        break;
-      case FLOW_BEZ:
-        if (!stack_pop()) {
-          bytecode++;
-          bytecode = &base[*((const WsAddrInt *) bytecode)] - 1;
-        } else {
-          bytecode += sizeof(WsAddrInt);
+  WsInt *sp;
+  WsInt tos = 0;
+  WsInt a = 0;
+  WsInt b = 0;
+#ifdef USE_THREADED_CODE
+  static const void *const handlers[] = {
+    [FLOW_HALT] = &&L_FLOW_HALT,
+    [STACK_PUSH] = &&L_STACK_PUSH,
+    [STACK_DUP_N] = &&L_STACK_DUP_N,
+    [STACK_DUP] = &&L_STACK_DUP,
+    [STACK_SLIDE] = &&L_STACK_SLIDE,
+    [STACK_SWAP] = &&L_STACK_SWAP,
+    [STACK_DISCARD] = &&L_STACK_DISCARD,
+    [ARITH_ADD] = &&L_ARITH_ADD,
+    [ARITH_SUB] = &&L_ARITH_SUB,
+    [ARITH_MUL] = &&L_ARITH_MUL,
+    [ARITH_DIV] = &&L_ARITH_DIV,
+    [ARITH_MOD] = &&L_ARITH_MOD,
+    [HEAP_STORE] = &&L_HEAP_STORE,
+    [HEAP_LOAD] = &&L_HEAP_LOAD,
+    [FLOW_GOSUB] = &&L_FLOW_GOSUB,
+    [FLOW_JUMP] = &&L_FLOW_JUMP,
+    [FLOW_BEZ] = &&L_FLOW_BEZ,
+    [FLOW_BLTZ] = &&L_FLOW_BLTZ,
+    [FLOW_ENDSUB] = &&L_FLOW_ENDSUB,
+    [IO_PUT_CHAR] = &&L_IO_PUT_CHAR,
+    [IO_PUT_NUM] = &&L_IO_PUT_NUM,
+    [IO_READ_CHAR] = &&L_IO_READ_CHAR,
+    [IO_READ_NUM] = &&L_IO_READ_NUM,
+    [BIT_AND] = &&L_BIT_AND,
+    [BIT_OR] = &&L_BIT_OR,
+    [BIT_XOR] = &&L_BIT_XOR,
+    [BIT_LS] = &&L_BIT_LS,
+    [BIT_RS] = &&L_BIT_RS,
+    [BIT_NOT] = &&L_BIT_NOT,
+    [CHECK_STACK] = &&L_CHECK_STACK,
+    [CHECK_ROOM] = &&L_CHECK_ROOM
+  };
+  const ThreadedInstruction *code = (const ThreadedInstruction *) prepared->threaded;
+  const ThreadedInstruction *ip = code;
+
+  if (threaded != NULL) {
+    *threaded = thread_code(verified, prepared->n_verified, handlers, LENGTHOF(handlers), &&L_UNDEFINED);
+    return TRUE;
+  }
+  call_stack = vm->call_stack;
+  sp = vm->stack;
+  vm->error = NULL;
+  DISPATCH();
+  {
+    {
+#else
+  const Instruction *code = verified;
+  const Instruction *ip = code;
+
+  (void) threaded;
+  call_stack = vm->call_stack;
+  sp = vm->stack;
+  vm->error = NULL;
+  for (;;) {
+    switch (ip->opcode) {
+#endif
+      CASE(STACK_PUSH):
+        *sp++ = tos;
+        tos = OPERAND_NUM;
+        NEXT();
+      CASE(STACK_DUP_N):
+        a = OPERAND_NUM == 0 ? tos : sp[-OPERAND_NUM];
+        *sp++ = tos;
+        tos = a;
+        NEXT();
+      CASE(STACK_DUP):
+        *sp++ = tos;
+        NEXT();
+      CASE(STACK_SLIDE):
+        sp -= OPERAND_NUM;
+        NEXT();
+      CASE(STACK_SWAP):
+        a = sp[-1];
+        sp[-1] = tos;
+        tos = a;
+        NEXT();
+      CASE(STACK_DISCARD):
+        tos = *--sp;
+        NEXT();
+      CASE(ARITH_ADD):
+        a = *--sp;
+        if (BIGNUM_IS_SMALL(a | tos) && !__builtin_add_overflow(a, tos, &b)) {
+          tos = b;
+          NEXT();
         }
-        break;
-      case FLOW_BLTZ:
-        if (stack_pop() < 0) {
-          bytecode++;
-          bytecode = &base[*((const WsAddrInt *) bytecode)] - 1;
-        } else {
-          bytecode += sizeof(WsAddrInt);
+        BIGNUM_SLOW_BINARY(ARITH_ADD);
+      CASE(ARITH_SUB):
+        a = *--sp;
+        if (BIGNUM_IS_SMALL(a | tos) && !__builtin_sub_overflow(a, tos, &b)) {
+          tos = b;
+          NEXT();
         }
-        break;
-      case FLOW_ENDSUB:
-        bytecode = &base[call_stack[--call_stack_idx]];
-        break;
-      case IO_PUT_CHAR:
-        putchar(stack_pop());
-        break;
-      case IO_PUT_NUM:
-        printf("%d", stack_pop());
-        break;
-      case IO_READ_CHAR:
-        a = stack_pop();
-        assert(0 <= a && a < (int) LENGTHOF(heap));
-        fflush(stdout);
-        heap[a] = getchar();
-        break;
-      case IO_READ_NUM:
-        a = stack_pop();
-        assert(0 <= a && a < (int) LENGTHOF(heap));
-        fflush(stdout);
-        scanf("%d", &heap[a]);
-        break;
-      case FLOW_HALT:
-        printf("HALT\n");
-        break;
-      default:
-        fprintf(stderr, "Undefined instruction is detected [%02x]\n", *bytecode);
+        BIGNUM_SLOW_BINARY(ARITH_SUB);
+      CASE(ARITH_MUL):
+        a = *--sp;
+        if (BIGNUM_IS_SMALL(a | tos) && !__builtin_mul_overflow(BIGNUM_UNTAG(a), tos, &b)) {
+          tos = b;
+          NEXT();
+        }
+        BIGNUM_SLOW_BINARY(ARITH_MUL);
+      CASE(ARITH_DIV):
+        if (tos == 0) {
+          goto zero_division;
+        }
+        a = *--sp;
+        /* Only BIGNUM_SMALL_MIN / -1 overflows */
+        if (BIGNUM_IS_SMALL(a | tos) && tos != 0
+            && (b = BIGNUM_UNTAG(a) / BIGNUM_UNTAG(tos)) <= BIGNUM_SMALL_MAX) {
+          tos = BIGNUM_TAG(b);
+          NEXT();
+        }
+        BIGNUM_SLOW_BINARY(ARITH_DIV);
+      CASE(ARITH_MOD):
+        if (tos == 0) {
+          goto zero_division;
+        }
+        a = *--sp;
+        if (BIGNUM_IS_SMALL(a | tos) && tos != 0) {
+          tos = BIGNUM_TAG(BIGNUM_UNTAG(a) % BIGNUM_UNTAG(tos));
+          NEXT();
+        }
+        BIGNUM_SLOW_BINARY(ARITH_MOD);
+      CASE(BIT_AND):
+        a = *--sp;
+        if (BIGNUM_IS_SMALL(a | tos)) {
+          tos &= a;
+          NEXT();
+        }
+        BIGNUM_SLOW_BINARY(BIT_AND);
+      CASE(BIT_OR):
+        a = *--sp;
+        if (BIGNUM_IS_SMALL(a | tos)) {
+          tos |= a;
+          NEXT();
+        }
+        BIGNUM_SLOW_BINARY(BIT_OR);
+      CASE(BIT_XOR):
+        a = *--sp;
+        if (BIGNUM_IS_SMALL(a | tos)) {
+          tos ^= a;
+          NEXT();
+        }
+        BIGNUM_SLOW_BINARY(BIT_XOR);
+      CASE(BIT_LS):
+        a = *--sp;
+        if (BIGNUM_IS_SMALL(a | tos) && 0 <= tos && tos < BIGNUM_TAG(sizeof(WsInt) * 8 - 1)
+            && !__builtin_mul_overflow(a, (WsInt) 1 << BIGNUM_UNTAG(tos), &b)) {
+          tos = b;
+          NEXT();
+        }
+        BIGNUM_SLOW_BINARY(BIT_LS);
+      CASE(BIT_RS):
+        a = *--sp;
+        if (BIGNUM_IS_SMALL(a | tos) && 0 <= tos) {
+          b = BIGNUM_UNTAG(tos) < (WsInt) (sizeof(WsInt) * 8 - 1) ? BIGNUM_UNTAG(tos) : (WsInt) (sizeof(WsInt) * 8 - 1);
+          tos = BIGNUM_TAG(BIGNUM_UNTAG(a) >> b);
+          NEXT();
+        }
+        BIGNUM_SLOW_BINARY(BIT_RS);
+      CASE(BIT_NOT):
+        if (BIGNUM_IS_SMALL(tos)) {
+          tos ^= ~(WsInt) 1;
+          NEXT();
+        }
+        tos = bignum_not(vm, tos);
+        bignum_collect_if_needed(vm, sp, tos);
+        NEXT();
+      CASE(HEAP_STORE):
+        a = ADDRESS(sp[-1]);
+        HEAP_WRITE(&vm->heap, a, tos);
+        sp -= 2;
+        tos = *sp;
+        NEXT();
+      CASE(HEAP_LOAD):
+        a = ADDRESS(tos);
+        tos = HEAP_READ(&vm->heap, a);
+        NEXT();
+      CASE(FLOW_GOSUB):
+        if (call_stack_idx == LENGTHOF(vm->call_stack)) {
+          goto call_stack_overflow;
+        }
+        call_stack[call_stack_idx++] = RETURN_ADDR;
+        JUMP(OPERAND_ADDR);
+      CASE(FLOW_JUMP):
+        JUMP(OPERAND_ADDR);
+      CASE(FLOW_BEZ):
+        a = tos;
+        tos = *--sp;
+        if (!a) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT();
+      CASE(FLOW_BLTZ):
+        a = tos;
+        tos = *--sp;
+        if (BIGNUM_IS_SMALL(a) ? a < 0 : bignum_is_negative(vm, a)) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT();
+      CASE(FLOW_ENDSUB):
+        if (call_stack_idx == 0) {
+          goto call_stack_underflow;
+        }
+        JUMP(call_stack[--call_stack_idx]);
+      CASE(IO_PUT_CHAR):
+        bignum_to_ws_int(vm, tos, &a);
+        OUTPUT_CHAR(&vm->output, a);
+        tos = *--sp;
+        NEXT();
+      CASE(IO_PUT_NUM):
+        bignum_print(vm, tos);
+        tos = *--sp;
+        NEXT();
+      CASE(IO_READ_CHAR):
+        a = ADDRESS(tos);
+        tos = *--sp;
+        OUTPUT_SYNC(&vm->output);
+        HEAP_WRITE(&vm->heap, a, BIGNUM_TAG(INPUT_CHAR(&vm->input)));
+        NEXT();
+      CASE(IO_READ_NUM):
+        a = ADDRESS(tos);
+        tos = *--sp;
+        OUTPUT_SYNC(&vm->output);
+        if (bignum_scan(vm, &b)) {
+          HEAP_WRITE(&vm->heap, a, b);
+          bignum_collect_if_needed(vm, sp, tos);
+        }
+        NEXT();
+      CASE(CHECK_STACK):
+        if (sp - vm->stack < OPERAND_NUM) {
+          goto stack_underflow;
+        }
+        NEXT();
+      CASE(CHECK_ROOM):
+        if (vm->stack + LENGTHOF(vm->stack) - sp < OPERAND_NUM) {
+          goto stack_overflow;
+        }
+        NEXT();
+      CASE(FLOW_HALT):
+        goto halt;
+      DEFAULT:
+        fprintf(stderr, "Undefined instruction is detected [%02x]\n", OPCODE);
+        NEXT();
+    }
+  }
+halt:
+  vm->stack_idx = (size_t) (sp - vm->stack);
+  output_flush(&vm->output);
+  return vm->error == NULL;
+stack_underflow:
+  vm->error = "Stack underflow";
+  goto halt;
+stack_overflow:
+  vm->error = "Stack overflow";
+  goto halt;
+zero_division:
+  vm->error = "Zero division";
+  goto halt;
+call_stack_overflow:
+  vm->error = "Call stack overflow";
+  goto halt;
+call_stack_underflow:
+  vm->error = "Call stack underflow";
+  goto halt;
+}
+#ifdef USE_THREADED_CODE
+#  pragma GCC diagnostic pop
+#endif
+
+
+/*!
+ * @brief Execute blankspace with arbitrary-precision integers
+ *
+ * The runtime errors detected by the bignum functions return here by
+ * longjmp(), out of interpret_bignum().
+ * @param [in,out] vm      VM to run the instructions on
+ * @param [in]     base    Instruction records terminated with FLOW_HALT
+ * @param [in]     n_inst  The number of instructions
+ * @return  TRUE if the program halts, or FALSE if it stops on a runtime
+ *          error, whose message is left in vm->error
+ */
+int execute_bignum(BsVM *vm, const Instruction *base, size_t n_inst) {
+  PreparedCode prepared;
+  int ok;
+
+  prepared.verified = verify(base, n_inst, &prepared.n_verified);
+  prepared.threaded = NULL;
+  prepared.tier = NULL;
+  tag_constants(vm, prepared.verified, prepared.n_verified);
+#ifdef USE_THREADED_CODE
+  interpret_bignum(NULL, &prepared, &prepared.threaded);
+#endif
+  if (setjmp(vm->bignum_escape) == 0) {
+    ok = interpret_bignum(vm, &prepared, NULL);
+  } else {
+    /* bignum_error() left the message in vm->error */
+    vm->stack_idx = 0;
+    output_flush(&vm->output);
+    ok = FALSE;
+  }
+  free_prepared_code(&prepared);
+  return ok;
+}
+
+
+/*! Initial capacity of the bytecode buffer */
+#define INITIAL_BYTECODE_CAPACITY  4096
+/*! Initial capacity of a source map */
+#define INITIAL_SOURCE_MAP_CAPACITY  1024
+/*! Bits per chunk of a literal which doesn't fit in WsInt */
+#define LITERAL_CHUNK_BITS  16
+
+/*!
+ * @brief Make room for n more bytes in the bytecode buffer
+ */
+static unsigned char *reserve_bytecode(Bytecode *bytecode, size_t n) {
+  if (bytecode->size + n > bytecode->capacity) {
+    size_t capacity = bytecode->capacity == 0 ? INITIAL_BYTECODE_CAPACITY : bytecode->capacity;
+    unsigned char *data;
+    while (capacity < bytecode->size + n) {
+      capacity *= 2;
+    }
+    if ((data = (unsigned char *) realloc(bytecode->data, capacity)) == NULL) {
+      fputs("Failed to allocate memory for bytecode\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+    bytecode->data = data;
+    bytecode->capacity = capacity;
+  }
+  return &bytecode->data[bytecode->size];
+}
+
+
+/*!
+ * @brief Emit an instruction without operand
+ */
+static void emit_opcode(Bytecode *bytecode, int opcode) {
+  *reserve_bytecode(bytecode, 1) = (unsigned char) opcode;
+  bytecode->size++;
+}
+
+
+/*!
+ * @brief Emit an instruction with a number operand
+ */
+static void emit_num(Bytecode *bytecode, int opcode, WsInt n) {
+  unsigned char *p = reserve_bytecode(bytecode, 1 + sizeof(WsInt));
+  *p = (unsigned char) opcode;
+  memcpy(p + 1, &n, sizeof(WsInt));
+  bytecode->size += 1 + sizeof(WsInt);
+}
+
+
+/*!
+ * @brief Emit an instruction with a jump address operand
+ */
+static void emit_addr(Bytecode *bytecode, int opcode, WsAddrInt addr) {
+  unsigned char *p = reserve_bytecode(bytecode, 1 + sizeof(WsAddrInt));
+  *p = (unsigned char) opcode;
+  memcpy(p + 1, &addr, sizeof(WsAddrInt));
+  bytecode->size += 1 + sizeof(WsAddrInt);
+}
+
+
+/*!
+ * @brief Record the source offset of the instructions emitted by a command
+ * @param [in,out] map       Source map
+ * @param [in]     bytecode  Bytecode buffer
+ * @param [in]     start     Size of the bytecode before the command
+ * @param [in]     offset    Source offset of the command
+ */
+static void map_source(SourceMap *map, const Bytecode *bytecode, size_t start, size_t offset) {
+  size_t i;
+  for (i = start; i < bytecode->size; i += operand_size(bytecode->data[i]) + 1) {
+    if (map->n_inst == map->capacity) {
+      map->capacity = map->capacity == 0 ? INITIAL_SOURCE_MAP_CAPACITY : map->capacity * 2;
+      if ((map->offsets = (size_t *) realloc(map->offsets, map->capacity * sizeof(size_t))) == NULL) {
+        fputs("Failed to allocate memory for source map\n", stderr);
+        exit(EXIT_FAILURE);
+      }
+    }
+    map->offsets[map->n_inst++] = offset;
+  }
+}
+
+
+/*!
+ * @brief Compare labels of a source map by offset
+ */
+static int compare_source_labels(const void *p, const void *q) {
+  const SourceLabel *x = (const SourceLabel *) p;
+  const SourceLabel *y = (const SourceLabel *) q;
+  return x->offset < y->offset ? -1 : x->offset > y->offset;
+}
+
+
+/*!
+ * @brief Record the labels defined in source code into a source map
+ *
+ * A label is located by the source offset of the instruction at it, which
+ * survives optimize() unlike its index.
+ * A label at the end of the program, where no instruction is, is left out.
+ * @param [in,out] map       Source map of the instructions of bytecode
+ * @param [in]     table     Label table
+ * @param [in]     bytecode  Bytecode buffer
+ */
+static void map_labels(SourceMap *map, const LabelTable *table, const Bytecode *bytecode) {
+  size_t i, j, pos = 0, n = 0;
+
+  if ((map->labels = (SourceLabel *) malloc((table->n_label + 1) * sizeof(SourceLabel))) == NULL) {
+    fputs("Failed to allocate memory for source map\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  /* Sort by the address in bytecode first, which is in the same order */
+  for (i = 0; i < table->n_bucket; i++) {
+    if (table->entries[i].is_used && table->entries[i].addr != UNDEF_ADDR) {
+      map->labels[n].offset = table->entries[i].addr;
+      map->labels[n].name = label_name(&table->entries[i].label);
+      n++;
+    }
+  }
+  qsort(map->labels, n, sizeof(SourceLabel), compare_source_labels);
+  map->n_label = 0;
+  for (i = j = 0; j < n; j++) {
+    for (; pos < map->labels[j].offset && pos < bytecode->size; i++) {
+      pos += operand_size(bytecode->data[pos]) + 1;
+    }
+    if (pos == map->labels[j].offset && i < map->n_inst) {
+      map->labels[map->n_label].name = map->labels[j].name;
+      map->labels[map->n_label++].offset = map->offsets[i];
+    } else {
+      free(map->labels[j].name);
     }
   }
 }
@@ -164,120 +1050,223 @@ void execute(const unsigned char *bytecode) {
 
 /*!
  * @brief Compile blankspace source code into bytecode
- * @param [out] bytecode  Bytecode buffer
- * @param [in]  code      Brainfuck source code
+ *
+ * The source code is consumed from the reader as it is compiled, and the
+ * bytecode buffer grows with the program.
+ * A jump to a label which is never defined goes to the end of the program.
+ * The labels and literals are kept in the VM only while compiling, so the
+ * bytecode doesn't depend on the VM.
+ * If a source map is given, the source offset of every instruction is
+ * recorded into it, in the order of decode(), together with the labels.
+ * @param [in,out] vm        VM
+ * @param [out]    bytecode  Bytecode buffer (its data must be freed by the
+ *                           caller)
+ * @param [in,out] reader    Reader of blankspace source code
+ * @param [out]    map       Source map (must be released with
+ *                           free_source_map()), or NULL
  */
-void compile(unsigned char *bytecode, size_t *bytecode_size, const char *code) {
-  unsigned char *base = bytecode;
-  for (; *code != '\0'; code++) {
-    switch (*code) {
+void compile(BsVM *vm, Bytecode *bytecode, SourceReader *reader, SourceMap *map) {
+  size_t start, offset;
+  char ch;
+  bytecode->data = NULL;
+  bytecode->size = bytecode->capacity = 0;
+  if (map != NULL) {
+    map->offsets = NULL;
+    map->n_inst = map->capacity = 0;
+    map->labels = NULL;
+    map->n_label = 0;
+  }
+  while ((ch = READER_NEXT(reader)) != '\0') {
+    start = bytecode->size;
+    offset = READER_OFFSET(reader) - 1;
+    switch (ch) {
       case ' ':   /* Stack Manipulation */
-        gen_stack_code(&bytecode, &code);
+        gen_stack_code(vm, bytecode, reader);
         break;
       case '\t':  /* Arithmetic, Heap Access or I/O */
-        switch (*++code) {
+        switch (READER_NEXT(reader)) {
           case ' ':  /* Arithmetic */
-            gen_arith_code(&bytecode, &code);
+            gen_arith_code(bytecode, reader);
             break;
           case '\t':  /* Heap Access */
-            gen_heap_code(&bytecode, &code);
+            gen_heap_code(bytecode, reader);
             break;
           case '\n':  /* I/O */
-            gen_io_code(&bytecode, &code);
+            gen_io_code(bytecode, reader);
             break;
         }
         break;
       case '\n':  /* Flow Control */
-        gen_flow_code(&bytecode, &code, base);
+        gen_flow_code(vm, bytecode, reader);
         break;
     }
+    if (map != NULL) {
+      map_source(map, bytecode, start, offset);
+    }
+  }
+  if (map != NULL) {
+    map_labels(map, &vm->labels, bytecode);
+  }
+  free_label_table(&vm->labels);
+  free(vm->literal);
+  vm->literal = NULL;
+  vm->literal_capacity = 0;
+}
+
+
+/*!
+ * @brief Release a source map recorded by compile()
+ * @param [in,out] map  Source map
+ */
+void free_source_map(SourceMap *map) {
+  size_t i;
+  for (i = 0; i < map->n_label; i++) {
+    free(map->labels[i].name);
+  }
+  free(map->labels);
+  free(map->offsets);
+  map->labels = NULL;
+  map->offsets = NULL;
+  map->n_label = map->n_inst = map->capacity = 0;
+}
+
+
+/*!
+ * @brief Generate bytecode of STACK_PUSH
+ *
+ * A literal which doesn't fit in WsInt is built up from chunks of
+ * LITERAL_CHUNK_BITS bits by multiplication and addition, so that bignum
+ * mode gets its exact value.
+ * Other modes get the value wrapped around, as they would have by
+ * overflowing arithmetic.
+ * @param [in,out] vm        VM
+ * @param [out]    bytecode  Bytecode buffer
+ * @param [in,out] reader    Reader of blankspace source code
+ */
+static void gen_push_code(BsVM *vm, Bytecode *bytecode, SourceReader *reader) {
+  char sign = READER_NEXT(reader);
+  const char *digit;
+  size_t n_bit = 0;
+  WsInt chunk = 0;
+  int is_first = TRUE;
+  char ch;
+
+  if (sign != ' ' && sign != '\t') {
+    emit_num(bytecode, STACK_PUSH, 0);
+    return;
+  }
+  /* Leading zeros don't count */
+  while ((ch = READER_NEXT(reader)) == ' ');
+  for (; ch != '\n' && ch != '\0'; ch = READER_NEXT(reader)) {
+    if (n_bit == vm->literal_capacity) {
+      vm->literal_capacity = vm->literal_capacity == 0 ? 64 : vm->literal_capacity * 2;
+      if ((vm->literal = (char *) realloc(vm->literal, vm->literal_capacity)) == NULL) {
+        fputs("Failed to allocate memory for literal\n", stderr);
+        exit(EXIT_FAILURE);
+      }
+    }
+    vm->literal[n_bit++] = ch;
+  }
+  digit = vm->literal;
+  if (n_bit < sizeof(WsInt) * 8) {
+    unsigned int sum = 0;
+    for (; n_bit > 0; n_bit--) {
+      sum = sum << 1 | (*digit++ == '\t');
+    }
+    emit_num(bytecode, STACK_PUSH, (WsInt) (sign == ' ' ? sum : 0u - sum));
+    return;
+  }
+  for (; n_bit > 0; digit++) {
+    chunk = chunk << 1 | (*digit == '\t');
+    if (--n_bit % LITERAL_CHUNK_BITS != 0) {
+      continue;
+    }
+    if (is_first) {
+      emit_num(bytecode, STACK_PUSH, chunk);
+      is_first = FALSE;
+    } else {
+      emit_num(bytecode, STACK_PUSH, (WsInt) 1 << LITERAL_CHUNK_BITS);
+      emit_opcode(bytecode, ARITH_MUL);
+      emit_num(bytecode, STACK_PUSH, chunk);
+      emit_opcode(bytecode, ARITH_ADD);
+    }
+    chunk = 0;
+  }
+  if (sign == '\t') {
+    emit_num(bytecode, STACK_PUSH, -1);
+    emit_opcode(bytecode, ARITH_MUL);
   }
-  *bytecode_size = (size_t) ADDR_DIFF(bytecode, base);
-  free_label_info_list(label_info_list);
 }
 
 
 /*!
  * @brief Generate bytecode about stack manipulation
- * @param [out]    bytecode_ptr  Pointer to bytecode buffer
- * @param [in,out] code_ptr      pointer to blankspace source code
+ * @param [in,out] vm        VM
+ * @param [out]    bytecode  Bytecode buffer
+ * @param [in,out] reader    Reader of blankspace source code
  */
-void gen_stack_code(unsigned char **bytecode_ptr, const char **code_ptr) {
-  unsigned char *bytecode = *bytecode_ptr;
-  const char *code = *code_ptr;
-  switch (*++code) {
+void gen_stack_code(BsVM *vm, Bytecode *bytecode, SourceReader *reader) {
+  switch (READER_NEXT(reader)) {
     case ' ':
-      *bytecode++ = STACK_PUSH;
-      *((WsInt *) bytecode) = read_nstr(&code);
-      bytecode += sizeof(WsInt);
+      gen_push_code(vm, bytecode, reader);
       break;
     case '\t':
-      switch (*++code) {
+      switch (READER_NEXT(reader)) {
         case ' ':
-          *bytecode++ = STACK_DUP_N;
-          *((WsInt *) bytecode) = read_nstr(&code);
-          bytecode += sizeof(WsInt);
+          emit_num(bytecode, STACK_DUP_N, read_nstr(reader));
           break;
         case '\t':
           fputs("Undefined Stack manipulation command is detected: [S][TT]\n", stderr);
           break;
         case '\n':
-          *bytecode++ = STACK_SLIDE;
-          *((WsInt *) bytecode) = read_nstr(&code);
-          bytecode += sizeof(WsInt);
+          emit_num(bytecode, STACK_SLIDE, read_nstr(reader));
           break;
       }
       break;
     case '\n':
-      switch (*++code) {
+      switch (READER_NEXT(reader)) {
         case ' ':
-          *bytecode++ = STACK_DUP_N;
-          *((WsInt *) bytecode) = 0;
-          bytecode += sizeof(WsInt);
+          emit_num(bytecode, STACK_DUP_N, 0);
           break;
         case '\t':
-          *bytecode++ = STACK_SWAP;
+          emit_opcode(bytecode, STACK_SWAP);
           break;
         case '\n':
-          *bytecode++ = STACK_DISCARD;
+          emit_opcode(bytecode, STACK_DISCARD);
           break;
       }
       break;
   }
-  *bytecode_ptr = bytecode;
-  *code_ptr = code;
 }
 
 
 /*!
  * @brief Generate bytecode about arithmetic
- * @param [out]    bytecode_ptr  Pointer to bytecode buffer
- * @param [in,out] code_ptr      pointer to blankspace source code
+ * @param [out]    bytecode  Bytecode buffer
+ * @param [in,out] reader    Reader of blankspace source code
  */
-void gen_arith_code(unsigned char **bytecode_ptr, const char **code_ptr) {
-  unsigned char *bytecode = *bytecode_ptr;
-  const char *code = *code_ptr;
-  switch (*++code) {
+void gen_arith_code(Bytecode *bytecode, SourceReader *reader) {
+  switch (READER_NEXT(reader)) {
     case ' ':
-      switch (*++code) {
+      switch (READER_NEXT(reader)) {
         case ' ':
-          *bytecode++ = ARITH_ADD;
+          emit_opcode(bytecode, ARITH_ADD);
           break;
         case '\t':
-          *bytecode++ = ARITH_SUB;
+          emit_opcode(bytecode, ARITH_SUB);
           break;
         case '\n':
-          *bytecode++ = ARITH_MUL;
+          emit_opcode(bytecode, ARITH_MUL);
           break;
       }
       break;
     case '\t':
-      switch (*++code) {
+      switch (READER_NEXT(reader)) {
         case ' ':
-          *bytecode++ = ARITH_DIV;
+          emit_opcode(bytecode, ARITH_DIV);
           break;
         case '\t':
-          *bytecode++ = ARITH_MOD;
+          emit_opcode(bytecode, ARITH_MOD);
           break;
         case '\n':
           fputs("Undefined arithmetic command is detected: [TS][TN]\n", stderr);
@@ -285,30 +1274,30 @@ void gen_arith_code(unsigned char **bytecode_ptr, const char **code_ptr) {
       }
       break;
     case '\n':
-      switch (*++code) {
+      switch (READER_NEXT(reader)) {
         case ' ':
-          switch (*++code) {
+          switch (READER_NEXT(reader)) {
             case ' ':
-              *bytecode++ = BIT_AND;
+              emit_opcode(bytecode, BIT_AND);
               break;
             case '\t':
-              *bytecode++ = BIT_OR;
+              emit_opcode(bytecode, BIT_OR);
               break;
             case '\n':
-              *bytecode++ = BIT_XOR;
+              emit_opcode(bytecode, BIT_XOR);
               break;
           }
           break;
         case '\t':
-          switch (*++code) {
+          switch (READER_NEXT(reader)) {
             case ' ':
-              *bytecode++ = BIT_LS;
+              emit_opcode(bytecode, BIT_LS);
               break;
             case '\t':
-              *bytecode++ = BIT_RS;
+              emit_opcode(bytecode, BIT_RS);
               break;
             case '\n':
-              *bytecode++ = BIT_NOT;
+              emit_opcode(bytecode, BIT_NOT);
               break;
           }
           break;
@@ -318,104 +1307,88 @@ void gen_arith_code(unsigned char **bytecode_ptr, const char **code_ptr) {
       }
       break;
   }
-  *bytecode_ptr = bytecode;
-  *code_ptr = code;
 }
 
 
 /*!
  * @brief Generate bytecode about heap access
- * @param [out]    bytecode_ptr  Pointer to bytecode buffer
- * @param [in,out] code_ptr      pointer to blankspace source code
+ * @param [out]    bytecode  Bytecode buffer
+ * @param [in,out] reader    Reader of blankspace source code
  */
-void gen_heap_code(unsigned char **bytecode_ptr, const char **code_ptr) {
-  unsigned char *bytecode = *bytecode_ptr;
-  const char *code = *code_ptr;
-  switch (*++code) {
+void gen_heap_code(Bytecode *bytecode, SourceReader *reader) {
+  switch (READER_NEXT(reader)) {
     case ' ':
-      *bytecode++ = HEAP_STORE;
+      emit_opcode(bytecode, HEAP_STORE);
       break;
     case '\t':
-      *bytecode++ = HEAP_LOAD;
+      emit_opcode(bytecode, HEAP_LOAD);
       break;
     case '\n':
       fputs("Undefined heap access command is detected: [TT][N]\n", stderr);
       break;
   }
-  *bytecode_ptr = bytecode;
-  *code_ptr = code;
 }
 
 
 /*!
  * @brief Generate bytecode about flow control
- * @param [out]    bytecode_ptr  Pointer to bytecode buffer
- * @param [in,out] code_ptr      pointer to blankspace source code
- * @param [in]     base          Base address of the bytecode buffer
+ * @param [in,out] vm        VM
+ * @param [out]    bytecode  Bytecode buffer
+ * @param [in,out] reader    Reader of blankspace source code
  */
-void gen_flow_code(unsigned char **bytecode_ptr, const char **code_ptr, unsigned char *base) {
-  unsigned char *bytecode = *bytecode_ptr;
-  const char *code = *code_ptr;
-  switch (*++code) {
+void gen_flow_code(BsVM *vm, Bytecode *bytecode, SourceReader *reader) {
+  switch (READER_NEXT(reader)) {
     case ' ':
-      switch (*++code) {
+      switch (READER_NEXT(reader)) {
         case ' ':
-          process_label_define(&bytecode, &code, base);
+          process_label_define(vm, bytecode, reader);
           break;
         case '\t':
-          *bytecode++ = FLOW_GOSUB;
-          process_label_jump(&bytecode, &code, base);
+          process_label_jump(vm, bytecode, reader, FLOW_GOSUB);
           break;
         case '\n':
-          *bytecode++ = FLOW_JUMP;
-          process_label_jump(&bytecode, &code, base);
+          process_label_jump(vm, bytecode, reader, FLOW_JUMP);
           break;
       }
       break;
     case '\t':
-      switch (*++code) {
+      switch (READER_NEXT(reader)) {
         case ' ':
-          *bytecode++ = FLOW_BEZ;
-          process_label_jump(&bytecode, &code, base);
+          process_label_jump(vm, bytecode, reader, FLOW_BEZ);
           break;
         case '\t':
-          *bytecode++ = FLOW_BLTZ;
-          process_label_jump(&bytecode, &code, base);
+          process_label_jump(vm, bytecode, reader, FLOW_BLTZ);
           break;
         case '\n':
-          *bytecode++ = FLOW_ENDSUB;
+          emit_opcode(bytecode, FLOW_ENDSUB);
           break;
       }
       break;
     case '\n':
-      if (*++code == '\n') {
-        *bytecode++ = FLOW_HALT;
+      if (READER_NEXT(reader) == '\n') {
+        emit_opcode(bytecode, FLOW_HALT);
       } else {
         fputs("Undefined flow control command is detected: [N][S/T]\n", stderr);
       }
       break;
   }
-  *bytecode_ptr = bytecode;
-  *code_ptr = code;
 }
 
 
 /*!
  * @brief Generate bytecode about I/O
- * @param [out]    bytecode_ptr  Pointer to bytecode buffer
- * @param [in,out] code_ptr      pointer to blankspace source code
+ * @param [out]    bytecode  Bytecode buffer
+ * @param [in,out] reader    Reader of blankspace source code
  */
-void gen_io_code(unsigned char **bytecode_ptr, const char **code_ptr) {
-  unsigned char *bytecode = *bytecode_ptr;
-  const char *code = *code_ptr;
-  switch (*++code) {
+void gen_io_code(Bytecode *bytecode, SourceReader *reader) {
+  switch (READER_NEXT(reader)) {
     case ' ':
-      switch (*++code) {
+      switch (READER_NEXT(reader)) {
         case ' ':
-          *bytecode++ = IO_PUT_CHAR;
+          emit_opcode(bytecode, IO_PUT_CHAR);
           break;
         case '\t':
-          *bytecode++ = IO_PUT_NUM;
+          emit_opcode(bytecode, IO_PUT_NUM);
           break;
         case '\n':
           fputs("Undefined I/O command is detected: [TN][SN]\n", stderr);
@@ -423,12 +1396,12 @@ void gen_io_code(unsigned char **bytecode_ptr, const char **code_ptr) {
       }
       break;
     case '\t':
-      switch (*++code) {
+      switch (READER_NEXT(reader)) {
         case ' ':
-          *bytecode++ = IO_READ_CHAR;
+          emit_opcode(bytecode, IO_READ_CHAR);
           break;
         case '\t':
-          *bytecode++ = IO_READ_NUM;
+          emit_opcode(bytecode, IO_READ_NUM);
           break;
         case '\n':
           fputs("Undefined I/O command is detected: [TN][TN]\n", stderr);
@@ -439,146 +1412,60 @@ void gen_io_code(unsigned char **bytecode_ptr, const char **code_ptr) {
       fputs("Undefined I/O command is detected: [TN][N]\n", stderr);
       break;
   }
-  *bytecode_ptr = bytecode;
-  *code_ptr = code;
-}
-
-
-/*!
- * @brief Check given label is already defined or not
- *
- * If label is already defined, return the label information
- * @param [in] label  Label you want to check
- * @return  Label information
- */
-__attribute__((pure))
-LabelInfo* search_label(const char *label) {
-  size_t i;
-  for (i = 0; i < n_label_info; i++) {
-    if (!strcmp(label, label_info_list[i]->label)) {
-      return label_info_list[i];
-    }
-  }
-  return NULL;
 }
 
 
 /*!
  * @brief Write where to jump to the bytecode
- * @param [out]    bytecode_ptr  Pointer to bytecode buffer
- * @param [in,out] code_ptr      pointer to blankspace source code
- * @param [in]     base          Base address of the bytecode buffer
+ * @param [in,out] vm        VM
+ * @param [out]    bytecode  Bytecode buffer
+ * @param [in,out] reader    Reader of blankspace source code
  */
-void process_label_define(unsigned char **bytecode_ptr, const char **code_ptr, unsigned char *base) {
-  const char *code = *code_ptr;
-  unsigned char *bytecode = *bytecode_ptr;
-  char *label = read_label(&code);
-  LabelInfo *label_info = search_label(label);
-
-  if (label_info == NULL) {
-    add_label(label, (WsAddrInt) ADDR_DIFF(bytecode, base));
-  } else {
-    if (label_info->addr == UNDEF_ADDR) {
-      int i;
-      for (i = 0; i < label_info->n_undef; i++) {
-        *((WsAddrInt *) &base[label_info->undef_list[i]]) = (WsAddrInt) ADDR_DIFF(bytecode, base);
-      }
-      label_info->addr = (WsAddrInt) ADDR_DIFF(bytecode, base);
-      free(label_info->undef_list);
-      label_info->undef_list = NULL;
-    } else {
-      fputs("Duplicate label definition\n", stderr);
-    }
-  }
-  *code_ptr = code;
-  *bytecode_ptr = bytecode;
-}
+void process_label_define(BsVM *vm, Bytecode *bytecode, SourceReader *reader) {
+  WsAddrInt addr = (WsAddrInt) bytecode->size;
+  Label label;
+  LabelInfo *label_info;
 
-
-/*!
- * @brief Write where to jump to the bytecode
- *
- * If label is not defined yet, write it after label is defined.
- * @param [out]    bytecode_ptr  Pointer to bytecode buffer
- * @param [in,out] code_ptr      pointer to blankspace source code
- * @param [in]     base          Base address of the bytecode buffer
- */
-void process_label_jump(unsigned char **bytecode_ptr, const char **code_ptr, unsigned char *base) {
-  const char *code = *code_ptr;
-  unsigned char *bytecode = *bytecode_ptr;
-  char *label = read_label(&code);
-  LabelInfo *label_info = search_label(label);
-
-  if (label_info == NULL) {
-    add_undef_label(label, (WsAddrInt) ADDR_DIFF(bytecode, base));
+  read_label(&vm->labels, reader, &label);
+  if ((label_info = search_label(&vm->labels, &label)) == NULL) {
+    add_label(&vm->labels, &label, addr);
   } else if (label_info->addr == UNDEF_ADDR) {
-    label_info->undef_list[label_info->n_undef++] = (WsAddrInt) ADDR_DIFF(bytecode, base);
+    size_t i;
+    for (i = 0; i < label_info->n_undef; i++) {
+      memcpy(&bytecode->data[label_info->undef_list[i]], &addr, sizeof(WsAddrInt));
+    }
+    label_info->addr = addr;
+    free(label_info->undef_list);
+    label_info->undef_list = NULL;
+    label_info->n_undef = label_info->undef_capacity = 0;
   } else {
-    *((WsAddrInt *) bytecode) = label_info->addr;
+    fputs("Duplicate label definition\n", stderr);
   }
-  bytecode += sizeof(WsAddrInt);
-  *code_ptr = code;
-  *bytecode_ptr = bytecode;
 }
 
 
 /*!
- * @brief Add label information to the label list
- * @param [in] _label  Label name
- * @param [in] addr    Label position
- */
-void add_label(const char *_label, WsAddrInt addr) {
-  char *label = (char *) calloc(strlen(_label) + 1, sizeof(char));
-  LabelInfo *label_info = (LabelInfo *) calloc(1, sizeof(LabelInfo));
-
-  if (label == NULL || label_info == NULL) {
-    fprintf(stderr, "Failed to allocate heap for label\n");
-    exit(EXIT_FAILURE);
-  }
-  strcpy(label, _label);
-
-  free(label_info->undef_list);
-  label_info->undef_list = NULL;
-  label_info->label = label;
-  label_info->addr = addr;
-  label_info->n_undef = 0;
-  label_info_list[n_label_info++] = label_info;
-}
-
-
-/*!
- * @brief Add unseen/undefined label to the label list
- * @param [in] _label  Label name
- * @param [in] pos     The position given label was found
+ * @brief Emit a jump instruction to a label
+ *
+ * If label is not defined yet, write it after label is defined.
+ * @param [in,out] vm        VM
+ * @param [out]    bytecode  Bytecode buffer
+ * @param [in,out] reader    Reader of blankspace source code
+ * @param [in]     opcode    Opcode of the jump instruction
  */
-void add_undef_label(const char *_label, WsAddrInt pos) {
-  char *label = (char *) calloc(strlen(_label) + 1, sizeof(char));
-  LabelInfo *label_info = (LabelInfo *) calloc(1, sizeof(LabelInfo));
-  label_info->undef_list = (WsAddrInt *) calloc(UNDEF_LIST_SIZE, sizeof(WsAddrInt));
+void process_label_jump(BsVM *vm, Bytecode *bytecode, SourceReader *reader, int opcode) {
+  WsAddrInt addr = UNDEF_ADDR;
+  Label label;
+  LabelInfo *label_info;
 
-  if (label == NULL || label_info == NULL || label_info->undef_list == NULL) {
-    fprintf(stderr, "Failed to allocate heap for label\n");
-    exit(EXIT_FAILURE);
+  read_label(&vm->labels, reader, &label);
+  if ((label_info = search_label(&vm->labels, &label)) == NULL) {
+    label_info = add_label(&vm->labels, &label, UNDEF_ADDR);
   }
-  strcpy(label, _label);
-
-  label_info->undef_list[0] = pos;
-  label_info->label = label;
-  label_info->addr = UNDEF_ADDR;
-  label_info->n_undef = 1;
-  label_info_list[n_label_info++] = label_info;
-}
-
-
-/*!
- * @brief Free label informations
- * @param [in] label_info_list  Label list
- */
-void free_label_info_list(LabelInfo *label_info_list[]) {
-  size_t i = 0;
-  for (i = 0; i < n_label_info; i++) {
-    free(label_info_list[i]->label);
-    free(label_info_list[i]->undef_list);
-    free(label_info_list[i]);
+  if (label_info->addr == UNDEF_ADDR) {
+    add_undef_label(label_info, (WsAddrInt) bytecode->size + 1);
+  } else {
+    addr = label_info->addr;
   }
+  emit_addr(bytecode, opcode, addr);
 }
@@ -0,0 +1,683 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * x86-64 JIT compiler                                                       *
+ * ------------------------------------------------------------------------- */
+#if defined(__x86_64__) && (defined(__unix__) || defined(__APPLE__))
+#  define USE_JIT
+#endif
+
+#ifdef USE_JIT
+#include <stdint.h>
+#include <sys/mman.h>
+
+/*
+ * Register assignment of the generated code.
+ * All of them are callee-saved in the System V ABI, so they survive calls
+ * into the C helpers.
+ *   rbx  Stack pointer (points to the next free slot, same as execute())
+ *   r12d Cached top of the stack
+ *   r13  Page directory of the low region of the heap
+ *   r14  End of the stack
+ *   r15  Base address of the stack
+ *   rbp  Scratch register used to realign rsp around C helper calls
+ * FLOW_GOSUB and FLOW_ENDSUB are mapped onto native call and ret.
+ * The C helpers take the VM in rdi, so their own arguments start at rsi.
+ */
+
+/*! Kind of runtime errors detected by the generated code */
+enum JitError {
+  JIT_STACK_UNDERFLOW, JIT_STACK_OVERFLOW,
+  JIT_ZERO_DIVISION, JIT_CALL_STACK_OVERFLOW, JIT_CALL_STACK_UNDERFLOW,
+  N_JIT_ERROR
+};
+
+/*!
+ * @brief Buffer to emit machine code into
+ */
+typedef struct {
+  unsigned char *code;
+  size_t size;
+  size_t capacity;
+} CodeBuffer;
+
+/*!
+ * @brief Position of a rel32 field which must be patched after emission
+ */
+typedef struct {
+  size_t pos;
+  size_t target;
+} Fixup;
+
+/*! Type of the C helpers called from the generated code */
+typedef void (*JitHelper)(void);
+
+/*!
+ * @brief State of a run which the generated code refers to by address
+ */
+typedef struct {
+  const void *entry_rsp;
+  const void *rsp_limit;
+  WsInt *sp;
+} JitState;
+
+
+/*!
+ * @brief Append bytes to the code buffer
+ * @param [in,out] buf    Code buffer
+ * @param [in]     bytes  Bytes to append
+ * @param [in]     n      The number of bytes
+ */
+static void emit(CodeBuffer *buf, const void *bytes, size_t n) {
+  if (buf->size + n > buf->capacity) {
+    buf->capacity = (buf->capacity + n) * 2;
+    if ((buf->code = (unsigned char *) realloc(buf->code, buf->capacity)) == NULL) {
+      fputs("Failed to allocate memory for JIT code\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(&buf->code[buf->size], bytes, n);
+  buf->size += n;
+}
+
+#define EMIT(buf, ...) \
+  do { \
+    static const unsigned char bytes_[] = {__VA_ARGS__}; \
+    emit(buf, bytes_, sizeof(bytes_)); \
+  } while (0)
+
+
+/*!
+ * @brief Append a 32-bit little-endian immediate
+ * @param [in,out] buf  Code buffer
+ * @param [in]     x    Immediate value
+ */
+static void emit_imm32(CodeBuffer *buf, unsigned int x) {
+  unsigned char bytes[4];
+  bytes[0] = (unsigned char) x;
+  bytes[1] = (unsigned char) (x >> 8);
+  bytes[2] = (unsigned char) (x >> 16);
+  bytes[3] = (unsigned char) (x >> 24);
+  emit(buf, bytes, sizeof(bytes));
+}
+
+
+/*!
+ * @brief Append a 64-bit little-endian immediate
+ * @param [in,out] buf  Code buffer
+ * @param [in]     p    Pointer to embed
+ */
+static void emit_ptr(CodeBuffer *buf, const void *p) {
+  emit(buf, &p, sizeof(p));
+}
+
+
+/*!
+ * @brief Emit a jump with rel32 displacement to an instruction index
+ *
+ * The displacement is filled in after all instructions are emitted.
+ * @param [in,out] buf       Code buffer
+ * @param [in,out] fixups    Fixup list
+ * @param [in,out] n_fixup   The number of fixups
+ * @param [in]     target    Index of the target instruction
+ */
+static void emit_rel32(CodeBuffer *buf, Fixup *fixups, size_t *n_fixup, size_t target) {
+  fixups[*n_fixup].pos = buf->size;
+  fixups[*n_fixup].target = target;
+  (*n_fixup)++;
+  emit_imm32(buf, 0);
+}
+
+
+/*!
+ * @brief Emit a short jump whose rel8 displacement is patched later
+ * @param [in,out] buf     Code buffer
+ * @param [in]     opcode  Opcode of the jcc rel8 or jmp rel8
+ * @return  Position of the rel8 field
+ */
+static size_t emit_jump8(CodeBuffer *buf, unsigned char opcode) {
+  unsigned char bytes[2];
+  bytes[0] = opcode;
+  bytes[1] = 0;
+  emit(buf, bytes, sizeof(bytes));
+  return buf->size - 1;
+}
+
+
+/*!
+ * @brief Make a short jump emitted by emit_jump8() land on the current position
+ */
+static void patch_jump8(CodeBuffer *buf, size_t pos) {
+  buf->code[pos] = (unsigned char) (buf->size - (pos + 1));
+}
+
+
+/*!
+ * @brief Emit a conditional jump to the error stub of given kind
+ * @param [in,out] buf    Code buffer
+ * @param [in]     cc     Second byte of the 0F 8x jcc opcode, or 0 for jmp
+ * @param [in]     kind   Kind of the error
+ * @param [out]    sites  Positions to patch, per kind of error
+ * @param [in,out] n_site The number of positions, per kind of error
+ */
+static void emit_error_jump(CodeBuffer *buf, unsigned char cc, int kind, size_t *sites[], size_t n_site[]) {
+  unsigned char bytes[2];
+  if (cc == 0) {
+    bytes[0] = 0xe9;
+    emit(buf, bytes, 1);
+  } else {
+    bytes[0] = 0x0f;
+    bytes[1] = cc;
+    emit(buf, bytes, sizeof(bytes));
+  }
+  sites[kind][n_site[kind]++] = buf->size;
+  emit_imm32(buf, 0);
+}
+
+
+/*!
+ * @brief Emit a check that the stack holds at least n elements
+ */
+static void emit_require(CodeBuffer *buf, size_t n, size_t *sites[], size_t n_site[]) {
+  EMIT(buf, 0x49, 0x8d, 0x87);  /* lea rax, [r15 + 4n] */
+  emit_imm32(buf, (unsigned int) (n * sizeof(WsInt)));
+  EMIT(buf, 0x48, 0x39, 0xc3);  /* cmp rbx, rax */
+  emit_error_jump(buf, 0x82, JIT_STACK_UNDERFLOW, sites, n_site);  /* jb */
+}
+
+
+/*!
+ * @brief Emit a check that the stack has room for n more elements
+ */
+static void emit_reserve(CodeBuffer *buf, size_t n, size_t *sites[], size_t n_site[]) {
+  EMIT(buf, 0x49, 0x8d, 0x86);  /* lea rax, [r14 - 4n] */
+  emit_imm32(buf, (unsigned int) -(WsInt) (n * sizeof(WsInt)));
+  EMIT(buf, 0x48, 0x39, 0xc3);  /* cmp rbx, rax */
+  emit_error_jump(buf, 0x87, JIT_STACK_OVERFLOW, sites, n_site);  /* ja */
+}
+
+
+/*!
+ * @brief Emit code which spills the cached top of the stack
+ */
+static void emit_spill(CodeBuffer *buf) {
+  EMIT(buf,
+      0x44, 0x89, 0x23,         /* mov [rbx], r12d */
+      0x48, 0x83, 0xc3, 0x04);  /* add rbx, 4 */
+}
+
+
+/*!
+ * @brief Emit code which reloads the top of the stack from memory
+ */
+static void emit_reload(CodeBuffer *buf) {
+  EMIT(buf,
+      0x48, 0x83, 0xeb, 0x04,  /* sub rbx, 4 */
+      0x44, 0x8b, 0x23);       /* mov r12d, [rbx] */
+}
+
+
+/*!
+ * @brief Emit a call to a C helper with rsp aligned to 16 bytes
+ * @param [in,out] buf     Code buffer
+ * @param [in]     vm      VM passed as the first argument
+ * @param [in]     helper  Address of the helper
+ */
+static void emit_call_helper(CodeBuffer *buf, const BsVM *vm, JitHelper helper) {
+  EMIT(buf, 0x48, 0xbf);  /* mov rdi, imm64 */
+  emit_ptr(buf, vm);
+  EMIT(buf, 0x48, 0xb8);  /* mov rax, imm64 */
+  emit(buf, &helper, sizeof(helper));
+  EMIT(buf,
+      0x48, 0x89, 0xe5,        /* mov rbp, rsp */
+      0x48, 0x83, 0xe4, 0xf0,  /* and rsp, -16 */
+      0xff, 0xd0,              /* call rax */
+      0x48, 0x89, 0xec);       /* mov rsp, rbp */
+}
+
+
+static void jit_put_char(BsVM *vm, WsInt c) {
+  OUTPUT_CHAR(&vm->output, c);
+}
+
+
+static void jit_put_num(BsVM *vm, WsInt n) {
+  output_num(&vm->output, n);
+}
+
+
+static void jit_read_char(BsVM *vm, WsInt addr) {
+  OUTPUT_SYNC(&vm->output);
+  heap_store(&vm->heap, addr, INPUT_CHAR(&vm->input));
+}
+
+
+static void jit_read_num(BsVM *vm, WsInt addr) {
+  int n;
+  OUTPUT_SYNC(&vm->output);
+  if (input_num(&vm->input, &n)) {
+    heap_store(&vm->heap, addr, n);
+  }
+}
+
+
+static WsInt jit_heap_load(BsVM *vm, WsInt addr) {
+  return heap_load(&vm->heap, addr);
+}
+
+
+static void jit_heap_store(BsVM *vm, WsInt addr, WsInt value) {
+  heap_store(&vm->heap, addr, value);
+}
+
+
+static void jit_undefined(BsVM *vm, int opcode) {
+  (void) vm;
+  fprintf(stderr, "Undefined instruction is detected [%02x]\n", opcode);
+}
+
+
+static void jit_error(BsVM *vm, int kind) {
+  static const char *const messages[] = {
+    "Stack underflow",
+    "Stack overflow",
+    "Zero division",
+    "Call stack overflow",
+    "Call stack underflow"
+  };
+  vm->error = messages[kind];
+}
+
+
+/*!
+ * @brief Translate decoded instructions into x86-64 machine code
+ *
+ * The addresses of the stack and the heap of the VM and of the state are
+ * embedded into the code, so it can only be run on them.
+ * @param [in]  vm      VM to run the code on
+ * @param [in]  state   State of the run
+ * @param [in]  code    Instruction records terminated with FLOW_HALT
+ * @param [in]  n_inst  The number of instructions
+ * @param [out] size    Size of the generated code
+ * @return  Generated code (must be freed by the caller)
+ */
+static unsigned char *jit_compile(const BsVM *vm, JitState *state, const Instruction *code, size_t n_inst, size_t *size) {
+  CodeBuffer buf = {NULL, 0, 0};
+  size_t *inst_pos = (size_t *) malloc((n_inst + 1) * sizeof(size_t));
+  Fixup *fixups = (Fixup *) malloc((n_inst + 1) * sizeof(Fixup));
+  size_t *sites[N_JIT_ERROR];
+  size_t n_site[N_JIT_ERROR] = {0};
+  size_t i, j, n_fixup = 0, halt_pos, slow, zero, done;
+
+  if (inst_pos == NULL || fixups == NULL) {
+    fputs("Failed to allocate memory for JIT code\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < N_JIT_ERROR; i++) {
+    /* Every instruction emits at most two checks of the same kind */
+    if ((sites[i] = (size_t *) malloc((2 * n_inst + 1) * sizeof(size_t))) == NULL) {
+      fputs("Failed to allocate memory for JIT code\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* Prologue: void entry(void) */
+  EMIT(&buf,
+      0x53,                    /* push rbx */
+      0x55,                    /* push rbp */
+      0x41, 0x54,              /* push r12 */
+      0x41, 0x55,              /* push r13 */
+      0x41, 0x56,              /* push r14 */
+      0x41, 0x57,              /* push r15 */
+      0x48, 0x83, 0xec, 0x08,  /* sub rsp, 8 */
+      0x48, 0xb8);             /* mov rax, imm64 */
+  emit_ptr(&buf, &state->entry_rsp);
+  EMIT(&buf, 0x48, 0x89, 0x20);  /* mov [rax], rsp */
+  EMIT(&buf, 0x48, 0xbb);  /* mov rbx, imm64 */
+  emit_ptr(&buf, vm->stack);
+  EMIT(&buf, 0x49, 0xbd);  /* mov r13, imm64 */
+  emit_ptr(&buf, vm->heap.low);
+  EMIT(&buf, 0x49, 0xbe);  /* mov r14, imm64 */
+  emit_ptr(&buf, vm->stack + LENGTHOF(vm->stack));
+  EMIT(&buf, 0x49, 0xbf);  /* mov r15, imm64 */
+  emit_ptr(&buf, vm->stack);
+  EMIT(&buf, 0x45, 0x31, 0xe4);  /* xor r12d, r12d */
+
+  for (i = 0; i <= n_inst; i++) {
+    /* The JIT has no dispatch overhead, so fused instructions are split again */
+    int opcode = unfused_opcode(code[i].opcode);
+    inst_pos[i] = buf.size;
+    switch (opcode) {
+      case STACK_PUSH:
+        emit_spill(&buf);
+        EMIT(&buf, 0x41, 0xbc);  /* mov r12d, imm32 */
+        emit_imm32(&buf, (unsigned int) code[i].operand.num);
+        break;
+      case STACK_DUP_N:
+        if (code[i].operand.num < 0) {
+          emit_error_jump(&buf, 0, JIT_STACK_UNDERFLOW, sites, n_site);  /* jmp */
+          break;
+        }
+        if (code[i].operand.num == 0) {
+          emit_spill(&buf);
+          break;
+        }
+        EMIT(&buf, 0x8b, 0x83);  /* mov eax, [rbx - 4n] */
+        emit_imm32(&buf, (unsigned int) -(code[i].operand.num * (WsInt) sizeof(WsInt)));
+        emit_spill(&buf);
+        EMIT(&buf, 0x41, 0x89, 0xc4);  /* mov r12d, eax */
+        break;
+      case STACK_DUP:
+        emit_spill(&buf);
+        break;
+      case STACK_SLIDE:
+        if (code[i].operand.num < 0) {
+          emit_error_jump(&buf, 0, JIT_STACK_UNDERFLOW, sites, n_site);  /* jmp */
+          break;
+        }
+        EMIT(&buf, 0x48, 0x81, 0xeb);  /* sub rbx, imm32 */
+        emit_imm32(&buf, (unsigned int) (code[i].operand.num * (WsInt) sizeof(WsInt)));
+        break;
+      case STACK_SWAP:
+        EMIT(&buf,
+            0x8b, 0x43, 0xfc,        /* mov eax, [rbx - 4] */
+            0x44, 0x89, 0x63, 0xfc,  /* mov [rbx - 4], r12d */
+            0x41, 0x89, 0xc4);       /* mov r12d, eax */
+        break;
+      case STACK_DISCARD:
+        emit_reload(&buf);
+        break;
+      case ARITH_ADD:
+        EMIT(&buf,
+            0x48, 0x83, 0xeb, 0x04,  /* sub rbx, 4 */
+            0x44, 0x03, 0x23);       /* add r12d, [rbx] */
+        break;
+      case ARITH_SUB:
+        EMIT(&buf,
+            0x48, 0x83, 0xeb, 0x04,  /* sub rbx, 4 */
+            0x8b, 0x03,              /* mov eax, [rbx] */
+            0x44, 0x29, 0xe0,        /* sub eax, r12d */
+            0x41, 0x89, 0xc4);       /* mov r12d, eax */
+        break;
+      case ARITH_MUL:
+        EMIT(&buf,
+            0x48, 0x83, 0xeb, 0x04,  /* sub rbx, 4 */
+            0x44, 0x0f, 0xaf, 0x23); /* imul r12d, [rbx] */
+        break;
+      case ARITH_DIV:
+      case ARITH_MOD:
+        EMIT(&buf, 0x45, 0x85, 0xe4);  /* test r12d, r12d */
+        emit_error_jump(&buf, 0x84, JIT_ZERO_DIVISION, sites, n_site);  /* jz */
+        EMIT(&buf,
+            0x48, 0x83, 0xeb, 0x04,  /* sub rbx, 4 */
+            0x8b, 0x03,              /* mov eax, [rbx] */
+            0x99,                    /* cdq */
+            0x41, 0xf7, 0xfc);       /* idiv r12d */
+        if (opcode == ARITH_DIV) {
+          EMIT(&buf, 0x41, 0x89, 0xc4);  /* mov r12d, eax */
+        } else {
+          EMIT(&buf, 0x41, 0x89, 0xd4);  /* mov r12d, edx */
+        }
+        break;
+      case BIT_AND:
+        EMIT(&buf,
+            0x48, 0x83, 0xeb, 0x04,  /* sub rbx, 4 */
+            0x44, 0x23, 0x23);       /* and r12d, [rbx] */
+        break;
+      case BIT_OR:
+        EMIT(&buf,
+            0x48, 0x83, 0xeb, 0x04,  /* sub rbx, 4 */
+            0x44, 0x0b, 0x23);       /* or r12d, [rbx] */
+        break;
+      case BIT_XOR:
+        EMIT(&buf,
+            0x48, 0x83, 0xeb, 0x04,  /* sub rbx, 4 */
+            0x44, 0x33, 0x23);       /* xor r12d, [rbx] */
+        break;
+      case BIT_LS:
+      case BIT_RS:
+        EMIT(&buf,
+            0x48, 0x83, 0xeb, 0x04,  /* sub rbx, 4 */
+            0x44, 0x89, 0xe1,        /* mov ecx, r12d */
+            0x8b, 0x03);             /* mov eax, [rbx] */
+        if (opcode == BIT_LS) {
+          EMIT(&buf, 0xd3, 0xe0);  /* shl eax, cl */
+        } else {
+          EMIT(&buf, 0xd3, 0xf8);  /* sar eax, cl */
+        }
+        EMIT(&buf, 0x41, 0x89, 0xc4);  /* mov r12d, eax */
+        break;
+      case BIT_NOT:
+        EMIT(&buf, 0x41, 0xf7, 0xd4);  /* not r12d */
+        break;
+      case HEAP_STORE:
+        /* Allocated pages of the low region are written inline, like HEAP_WRITE() */
+        EMIT(&buf, 0x8b, 0x43, 0xfc, 0x3d);  /* mov eax, [rbx - 4]; cmp eax, imm32 */
+        emit_imm32(&buf, (unsigned int) HEAP_SIZE);
+        slow = emit_jump8(&buf, 0x73);  /* jae rel8 */
+        EMIT(&buf,
+            0x89, 0xc1,                    /* mov ecx, eax */
+            0xc1, 0xe9, HEAP_PAGE_BITS,    /* shr ecx, HEAP_PAGE_BITS */
+            0x49, 0x8b, 0x4c, 0xcd, 0x00,  /* mov rcx, [r13 + rcx * 8] */
+            0x48, 0xba);                   /* mov rdx, imm64 */
+        emit_ptr(&buf, vm->heap.zero_page);
+        EMIT(&buf, 0x48, 0x39, 0xd1);  /* cmp rcx, rdx */
+        zero = emit_jump8(&buf, 0x74);  /* je rel8 */
+        EMIT(&buf, 0x25);  /* and eax, imm32 */
+        emit_imm32(&buf, (unsigned int) HEAP_PAGE_MASK);
+        EMIT(&buf, 0x44, 0x89, 0x24, 0x81);  /* mov [rcx + rax * 4], r12d */
+        done = emit_jump8(&buf, 0xeb);  /* jmp rel8 */
+        patch_jump8(&buf, slow);
+        patch_jump8(&buf, zero);
+        EMIT(&buf,
+            0x89, 0xc6,          /* mov esi, eax */
+            0x44, 0x89, 0xe2);   /* mov edx, r12d */
+        emit_call_helper(&buf, vm, (JitHelper) jit_heap_store);
+        patch_jump8(&buf, done);
+        EMIT(&buf,
+            0x48, 0x83, 0xeb, 0x08,  /* sub rbx, 8 */
+            0x44, 0x8b, 0x23);       /* mov r12d, [rbx] */
+        break;
+      case HEAP_LOAD:
+        /* The low region is read inline, like HEAP_READ() */
+        EMIT(&buf, 0x41, 0x81, 0xfc);  /* cmp r12d, imm32 */
+        emit_imm32(&buf, (unsigned int) HEAP_SIZE);
+        slow = emit_jump8(&buf, 0x73);  /* jae rel8 */
+        EMIT(&buf,
+            0x44, 0x89, 0xe0,              /* mov eax, r12d */
+            0xc1, 0xe8, HEAP_PAGE_BITS,    /* shr eax, HEAP_PAGE_BITS */
+            0x49, 0x8b, 0x4c, 0xc5, 0x00,  /* mov rcx, [r13 + rax * 8] */
+            0x44, 0x89, 0xe0,              /* mov eax, r12d */
+            0x25);                         /* and eax, imm32 */
+        emit_imm32(&buf, (unsigned int) HEAP_PAGE_MASK);
+        EMIT(&buf, 0x44, 0x8b, 0x24, 0x81);  /* mov r12d, [rcx + rax * 4] */
+        done = emit_jump8(&buf, 0xeb);  /* jmp rel8 */
+        patch_jump8(&buf, slow);
+        EMIT(&buf, 0x44, 0x89, 0xe6);  /* mov esi, r12d */
+        emit_call_helper(&buf, vm, (JitHelper) jit_heap_load);
+        EMIT(&buf, 0x41, 0x89, 0xc4);  /* mov r12d, eax */
+        patch_jump8(&buf, done);
+        break;
+      case FLOW_GOSUB:
+        EMIT(&buf, 0x48, 0xb8);  /* mov rax, imm64 */
+        emit_ptr(&buf, &state->rsp_limit);
+        EMIT(&buf, 0x48, 0x3b, 0x20);  /* cmp rsp, [rax] */
+        emit_error_jump(&buf, 0x86, JIT_CALL_STACK_OVERFLOW, sites, n_site);  /* jbe */
+        EMIT(&buf, 0xe8);  /* call rel32 */
+        emit_rel32(&buf, fixups, &n_fixup, code[i].operand.addr);
+        break;
+      case FLOW_JUMP:
+        EMIT(&buf, 0xe9);  /* jmp rel32 */
+        emit_rel32(&buf, fixups, &n_fixup, code[i].operand.addr);
+        break;
+      case FLOW_BEZ:
+      case FLOW_BLTZ:
+        EMIT(&buf, 0x44, 0x89, 0xe0);  /* mov eax, r12d */
+        emit_reload(&buf);
+        EMIT(&buf, 0x85, 0xc0);  /* test eax, eax */
+        if (opcode == FLOW_BEZ) {
+          EMIT(&buf, 0x0f, 0x84);  /* jz rel32 */
+        } else {
+          EMIT(&buf, 0x0f, 0x88);  /* js rel32 */
+        }
+        emit_rel32(&buf, fixups, &n_fixup, code[i].operand.addr);
+        break;
+      case FLOW_ENDSUB:
+        /* Returning from the outermost level is an error, as in execute() */
+        EMIT(&buf, 0x48, 0xb8);  /* mov rax, imm64 */
+        emit_ptr(&buf, &state->entry_rsp);
+        EMIT(&buf, 0x48, 0x3b, 0x20);  /* cmp rsp, [rax] */
+        emit_error_jump(&buf, 0x83, JIT_CALL_STACK_UNDERFLOW, sites, n_site);  /* jae */
+        EMIT(&buf, 0xc3);  /* ret */
+        break;
+      case IO_PUT_CHAR:
+      case IO_PUT_NUM:
+      case IO_READ_CHAR:
+      case IO_READ_NUM:
+        EMIT(&buf, 0x44, 0x89, 0xe6);  /* mov esi, r12d */
+        emit_reload(&buf);
+        emit_call_helper(&buf, vm,
+            opcode == IO_PUT_CHAR ? (JitHelper) jit_put_char
+            : opcode == IO_PUT_NUM ? (JitHelper) jit_put_num
+            : opcode == IO_READ_CHAR ? (JitHelper) jit_read_char
+            : (JitHelper) jit_read_num);
+        break;
+      case CHECK_STACK:
+        emit_require(&buf, (size_t) code[i].operand.num, sites, n_site);
+        break;
+      case CHECK_ROOM:
+        emit_reserve(&buf, (size_t) code[i].operand.num, sites, n_site);
+        break;
+      case FLOW_HALT:
+        if (i != n_inst) {
+          EMIT(&buf, 0xe9);  /* jmp rel32 */
+          emit_rel32(&buf, fixups, &n_fixup, n_inst);
+        }
+        break;
+      default:
+        EMIT(&buf, 0xbe);  /* mov esi, imm32 */
+        emit_imm32(&buf, (unsigned int) opcode);
+        emit_call_helper(&buf, vm, (JitHelper) jit_undefined);
+        break;
+    }
+  }
+
+  /* Epilogue, reached by FLOW_HALT from any call depth */
+  halt_pos = inst_pos[n_inst];
+  EMIT(&buf, 0x48, 0xb8);  /* mov rax, imm64 */
+  emit_ptr(&buf, &state->sp);
+  EMIT(&buf, 0x48, 0x89, 0x18);  /* mov [rax], rbx */
+  EMIT(&buf, 0x48, 0xb8);  /* mov rax, imm64 */
+  emit_ptr(&buf, &state->entry_rsp);
+  EMIT(&buf,
+      0x48, 0x8b, 0x20,        /* mov rsp, [rax] */
+      0x48, 0x83, 0xc4, 0x08,  /* add rsp, 8 */
+      0x41, 0x5f,              /* pop r15 */
+      0x41, 0x5e,              /* pop r14 */
+      0x41, 0x5d,              /* pop r13 */
+      0x41, 0x5c,              /* pop r12 */
+      0x5d,                    /* pop rbp */
+      0x5b,                    /* pop rbx */
+      0xc3);                   /* ret */
+
+  /* Error stubs, which leave the message in the VM and halt */
+  for (i = 0; i < N_JIT_ERROR; i++) {
+    size_t stub_pos = buf.size;
+    for (j = 0; j < n_site[i]; j++) {
+      unsigned int rel = (unsigned int) (stub_pos - (sites[i][j] + 4));
+      memcpy(&buf.code[sites[i][j]], &rel, sizeof(rel));
+    }
+    EMIT(&buf, 0xbe);  /* mov esi, imm32 */
+    emit_imm32(&buf, (unsigned int) i);
+    emit_call_helper(&buf, vm, (JitHelper) jit_error);
+    EMIT(&buf, 0xe9);  /* jmp rel32 */
+    emit_imm32(&buf, (unsigned int) (halt_pos - (buf.size + 4)));
+    free(sites[i]);
+  }
+
+  for (i = 0; i < n_fixup; i++) {
+    size_t target = fixups[i].target <= n_inst ? inst_pos[fixups[i].target] : halt_pos;
+    unsigned int rel = (unsigned int) (target - (fixups[i].pos + 4));
+    memcpy(&buf.code[fixups[i].pos], &rel, sizeof(rel));
+  }
+  free(inst_pos);
+  free(fixups);
+  *size = buf.size;
+  return buf.code;
+}
+#endif
+
+
+/*!
+ * @brief Check whether jit_execute() can run on this platform and WS_INT
+ * @return  TRUE if the JIT compiler is available, otherwise FALSE
+ */
+__attribute__((const))
+int jit_available(void) {
+#ifdef USE_JIT
+  /* The generated code operates on 32-bit stack and heap cells */
+  return sizeof(WsInt) == 4;
+#else
+  return FALSE;
+#endif
+}
+
+
+/*!
+ * @brief Compile decoded instructions into native code and run it
+ *
+ * The stack is only checked by CHECK_STACK and CHECK_ROOM inserted by
+ * verify(), like execute().
+ * @param [in,out] vm      VM to run the code on
+ * @param [in]     code    Instruction records terminated with FLOW_HALT
+ * @param [in]     n_inst  The number of instructions
+ * @return  FALSE if the JIT compiler is not available on this platform or
+ *          for this WS_INT
+ */
+int jit_execute(BsVM *vm, const Instruction *code, size_t n_inst) {
+#ifdef USE_JIT
+  JitState state;
+  Instruction *verified;
+  size_t n_verified, size;
+  unsigned char *native;
+  void *mem;
+  union {
+    void *p;
+    void (*entry)(void);
+  } fn;
+  char rsp_probe;
+
+  if (!jit_available()) {
+    return FALSE;
+  }
+  verified = verify(code, n_inst, &n_verified);
+  native = jit_compile(vm, &state, verified, n_verified, &size);
+  free(verified);
+  mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+  memcpy(mem, native, size);
+  free(native);
+  if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+    perror("mprotect");
+    exit(EXIT_FAILURE);
+  }
+  /* Each nested GOSUB consumes one return address on the native stack */
+  state.rsp_limit = (const void *) ((uintptr_t) &rsp_probe - CALL_STACK_SIZE * sizeof(void *));
+  state.sp = vm->stack;
+  vm->error = NULL;
+  fn.p = mem;
+  fn.entry();
+  vm->stack_idx = (size_t) (state.sp - vm->stack);
+  output_flush(&vm->output);
+  munmap(mem, size);
+  return TRUE;
+#else
+  (void) vm;
+  (void) code;
+  (void) n_inst;
+  return FALSE;
+#endif
+}
@@ -0,0 +1,235 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Label table                                                               *
+ * ------------------------------------------------------------------------- */
+/*! The number of bits of a label which can be packed into its key */
+#define LABEL_KEY_BITS  63
+/*! Initial number of buckets of the label table (must be a power of 2) */
+#define INITIAL_N_BUCKET  256
+/*! Initial capacity of the list of unresolved references to a label */
+#define INITIAL_N_UNDEF  4
+
+/*!
+ * @brief Allocate memory or exit on failure
+ */
+static void *xrealloc(void *ptr, size_t size) {
+  void *p = realloc(ptr, size);
+  if (p == NULL) {
+    fprintf(stderr, "Failed to allocate heap for label\n");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+/*!
+ * @brief Get the bucket of a label key in the label table
+ */
+__attribute__((const))
+static size_t hash_key(uint64_t key, size_t n_bucket) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdULL;
+  key ^= key >> 33;
+  return (size_t) key & (n_bucket - 1);
+}
+
+
+/*!
+ * @brief Check whether two labels are the same
+ */
+__attribute__((pure))
+static int is_same_label(const Label *a, const Label *b) {
+  return a->key == b->key && a->n_bit == b->n_bit
+    && (a->bits == NULL || !memcmp(a->bits, b->bits, ((a->n_bit + 63) / 64) * sizeof(uint64_t)));
+}
+
+
+/*!
+ * @brief Read a label and pack it into an integer key
+ *
+ * A space is packed as 0 and a tab as 1.
+ * A label of at most LABEL_KEY_BITS bits is identified by its key alone,
+ * which holds its bits after a leading 1.
+ * For a longer label, the key is a hash of the bits, which are kept in
+ * the table and referred to by label->bits until the next call.
+ * @param [in,out] table   Label table
+ * @param [in,out] reader  Reader of blankspace source code
+ * @param [out]    label   Label read
+ */
+void read_label(LabelTable *table, SourceReader *reader, Label *label) {
+  uint64_t word = 1;
+  size_t n_bit = 0;
+  char ch;
+
+  while ((ch = READER_NEXT(reader)) != '\n' && ch != '\0') {
+    if (n_bit != 0 && n_bit % 64 == 0) {
+      if (n_bit / 64 > table->long_bits_capacity) {
+        table->long_bits_capacity = table->long_bits_capacity == 0 ? 16 : table->long_bits_capacity * 2;
+        table->long_bits = (uint64_t *) xrealloc(table->long_bits, table->long_bits_capacity * sizeof(uint64_t));
+      }
+      table->long_bits[n_bit / 64 - 1] = word;
+      word = 0;
+    }
+    word = (word << 1) | (uint64_t) (ch == '\t');
+    n_bit++;
+  }
+  label->n_bit = n_bit;
+  if (n_bit <= LABEL_KEY_BITS) {
+    label->key = word;
+    label->bits = NULL;
+  } else {
+    size_t i, n_word = (n_bit + 63) / 64;
+    if (n_word > table->long_bits_capacity) {
+      table->long_bits_capacity = n_word;
+      table->long_bits = (uint64_t *) xrealloc(table->long_bits, table->long_bits_capacity * sizeof(uint64_t));
+    }
+    table->long_bits[n_word - 1] = word;
+    label->key = (uint64_t) n_bit;
+    for (i = 0; i < n_word; i++) {
+      label->key = (label->key ^ table->long_bits[i]) * 0x100000001b3ULL;
+    }
+    label->bits = table->long_bits;
+  }
+}
+
+
+/*!
+ * @brief Spell a label with S for a space and T for a tab
+ * @param [in] label  Label read by read_label()
+ * @return  Name of the label (must be freed by the caller)
+ */
+char *label_name(const Label *label) {
+  char *name = (char *) xrealloc(NULL, label->n_bit + 1);
+  size_t i, n_word = (label->n_bit + 63) / 64;
+
+  for (i = 0; i < label->n_bit; i++) {
+    uint64_t bit;
+    if (label->bits == NULL) {
+      bit = label->key >> (label->n_bit - 1 - i);
+    } else {
+      /* Only the last word can have less than 64 bits */
+      size_t n_word_bit = i / 64 == n_word - 1 ? label->n_bit - (n_word - 1) * 64 : 64;
+      bit = label->bits[i / 64] >> (n_word_bit - 1 - i % 64);
+    }
+    name[i] = (bit & 1) ? 'T' : 'S';
+  }
+  name[label->n_bit] = '\0';
+  return name;
+}
+
+
+/*!
+ * @brief Double the number of buckets of the label table
+ */
+static void grow_label_table(LabelTable *table) {
+  size_t n_bucket = table->n_bucket == 0 ? INITIAL_N_BUCKET : table->n_bucket * 2;
+  LabelInfo *entries = (LabelInfo *) xrealloc(NULL, n_bucket * sizeof(LabelInfo));
+  size_t i;
+
+  for (i = 0; i < n_bucket; i++) {
+    entries[i].is_used = FALSE;
+  }
+  for (i = 0; i < table->n_bucket; i++) {
+    size_t j;
+    if (!table->entries[i].is_used) {
+      continue;
+    }
+    for (j = hash_key(table->entries[i].label.key, n_bucket); entries[j].is_used; j = (j + 1) & (n_bucket - 1));
+    entries[j] = table->entries[i];
+  }
+  free(table->entries);
+  table->entries = entries;
+  table->n_bucket = n_bucket;
+}
+
+
+/*!
+ * @brief Find a label in the label table
+ * @param [in] table  Label table
+ * @param [in] label  Label you want to find
+ * @return  Label information, or NULL if the label has never been seen
+ */
+__attribute__((pure))
+LabelInfo *search_label(const LabelTable *table, const Label *label) {
+  size_t i;
+  if (table->n_bucket == 0) {
+    return NULL;
+  }
+  for (i = hash_key(label->key, table->n_bucket); table->entries[i].is_used; i = (i + 1) & (table->n_bucket - 1)) {
+    if (is_same_label(&table->entries[i].label, label)) {
+      return &table->entries[i];
+    }
+  }
+  return NULL;
+}
+
+
+/*!
+ * @brief Add a label to the label table
+ *
+ * The returned pointer is valid until the next label is added.
+ * @param [in,out] table  Label table
+ * @param [in]     label  Label which is not in the table yet
+ * @param [in]     addr   Label position, or UNDEF_ADDR if it is not defined yet
+ * @return  Label information
+ */
+LabelInfo *add_label(LabelTable *table, const Label *label, WsAddrInt addr) {
+  LabelInfo *info;
+  size_t i;
+
+  /* Keep the load factor at most 1/2 */
+  if (2 * (table->n_label + 1) > table->n_bucket) {
+    grow_label_table(table);
+  }
+  for (i = hash_key(label->key, table->n_bucket); table->entries[i].is_used; i = (i + 1) & (table->n_bucket - 1));
+  info = &table->entries[i];
+  info->is_used = TRUE;
+  info->label = *label;
+  if (label->bits != NULL) {
+    size_t size = ((label->n_bit + 63) / 64) * sizeof(uint64_t);
+    info->label.bits = (uint64_t *) xrealloc(NULL, size);
+    memcpy(info->label.bits, label->bits, size);
+  }
+  info->addr = addr;
+  info->n_undef = 0;
+  info->undef_capacity = 0;
+  info->undef_list = NULL;
+  table->n_label++;
+  return info;
+}
+
+
+/*!
+ * @brief Record a reference to a label which is not defined yet
+ * @param [in,out] info  Label information
+ * @param [in]     pos   The position of the operand to patch
+ */
+void add_undef_label(LabelInfo *info, WsAddrInt pos) {
+  if (info->n_undef == info->undef_capacity) {
+    info->undef_capacity = info->undef_capacity == 0 ? INITIAL_N_UNDEF : info->undef_capacity * 2;
+    info->undef_list = (WsAddrInt *) xrealloc(info->undef_list, info->undef_capacity * sizeof(WsAddrInt));
+  }
+  info->undef_list[info->n_undef++] = pos;
+}
+
+
+/*!
+ * @brief Free all the labels of the label table
+ * @param [in,out] table  Label table
+ */
+void free_label_table(LabelTable *table) {
+  size_t i;
+  for (i = 0; i < table->n_bucket; i++) {
+    if (table->entries[i].is_used) {
+      free(table->entries[i].label.bits);
+      free(table->entries[i].undef_list);
+    }
+  }
+  free(table->entries);
+  free(table->long_bits);
+  table->entries = NULL;
+  table->n_bucket = table->n_label = 0;
+  table->long_bits = NULL;
+  table->long_bits_capacity = 0;
+}
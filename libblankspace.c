@@ -0,0 +1,239 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Library interface                                                         *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Compiled program
+ *
+ * The interpreter runs the prepared code, which is verified and threaded
+ * only once; bignum mode and the JIT compiler prepare the instructions by
+ * themselves on every run.
+ */
+struct BsProgram {
+  Instruction  *code;      /*!< Instructions for bignum mode and the JIT, or NULL */
+  size_t        n_inst;
+  PreparedCode  prepared;  /*!< Prepared code for the interpreter */
+  int           bignum;
+  int           use_jit;
+};
+
+
+/*!
+ * @brief Compile, decode and optimize blankspace source code
+ *
+ * With BS_LOAD_BYTECODE, the file is a bytecode image which is used
+ * instead.
+ * With a cache directory, the optimized instructions are looked up in it by
+ * the hash of the source code and the optimization level, and are saved
+ * there on a miss.
+ * stdin is never cached, since it can't be read twice.
+ * If a source map is requested, the source code is always compiled, since
+ * bytecode images don't have it; it is left empty for BS_LOAD_BYTECODE.
+ * @param [in,out] vm          VM to compile with
+ * @param [in]     filename    Name of the file, used by BS_LOAD_BYTECODE
+ * @param [in,out] reader      Reader of blankspace source code
+ * @param [in]     options     Options of compilation
+ * @param [in]     allow_fuse  Whether the consumer can run superinstructions
+ * @param [out]    map         Source map of the instructions (must be
+ *                             released with free_source_map()), or NULL
+ * @param [out]    n_inst      The number of instructions
+ * @return  Decoded instructions (must be released with free_instructions()),
+ *          or NULL if the bytecode image can't be used
+ */
+Instruction *build_instructions(BsVM *vm, const char *filename, SourceReader *reader, const BsOptions *options, int allow_fuse, SourceMap *map, size_t *n_inst) {
+  Bytecode bytecode;
+  Instruction *inst = NULL;
+  char *cache_filename = NULL;
+  uint64_t source_hash = 0;
+  int opt_level = options->opt_level;
+
+  if (map != NULL) {
+    map->offsets = NULL;
+    map->n_inst = map->capacity = 0;
+    map->labels = NULL;
+    map->n_label = 0;
+  }
+  if (options->flags & BS_LOAD_BYTECODE) {
+    if ((inst = load_image(filename, TRUE, n_inst, &opt_level, &source_hash)) == NULL) {
+      return NULL;
+    }
+  } else {
+    if (options->cache_dir != NULL && map == NULL && hash_and_rewind(reader, &source_hash)) {
+      uint64_t image_hash;
+      int image_level;
+      if ((cache_filename = (char *) malloc(strlen(options->cache_dir) + 64)) == NULL) {
+        fputs("Failed to allocate memory for cache filename\n", stderr);
+        exit(EXIT_FAILURE);
+      }
+      sprintf(cache_filename, "%s/%016llx-O%d.bsc",
+          options->cache_dir, (unsigned long long) source_hash, opt_level);
+      inst = load_image(cache_filename, FALSE, n_inst, &image_level, &image_hash);
+      if (inst != NULL && (image_hash != source_hash || image_level != opt_level)) {
+        free_instructions(inst);
+        inst = NULL;
+      }
+    }
+    if (inst == NULL) {
+      compile(vm, &bytecode, reader, map);
+      inst = decode(bytecode.data, bytecode.size, n_inst);
+      inst = wrap_instructions(inst, *n_inst);
+      free(bytecode.data);
+      optimize(inst, n_inst, opt_level, map != NULL ? map->offsets : NULL);
+      if (map != NULL) {
+        map->n_inst = *n_inst;
+      }
+      if (cache_filename != NULL) {
+        save_image(cache_filename, inst, *n_inst, opt_level, source_hash);
+      }
+    }
+    free(cache_filename);
+  }
+  if (allow_fuse && ((options->flags & BS_FUSE) || opt_level >= 2)) {
+    fuse_superinstructions(inst, *n_inst);
+  }
+  return inst;
+}
+
+
+/*!
+ * @brief Hash the source code and rewind it to be read again from the top
+ * @param [in,out] reader       Reader of blankspace source code
+ * @param [out]    source_hash  hash_source() of the source code
+ * @return  TRUE on success, or FALSE if the source code can't be read twice,
+ *          in which case it is left unread
+ */
+int hash_and_rewind(SourceReader *reader, uint64_t *source_hash) {
+  if (!rewind_source(reader)) {
+    return FALSE;
+  }
+  *source_hash = hash_source(reader);
+  return rewind_source(reader);
+}
+
+
+/*!
+ * @brief Build a program from a reader
+ * @param [in]     filename  Name of the file, used by BS_LOAD_BYTECODE
+ * @param [in,out] reader    Reader of blankspace source code, or NULL with
+ *                           BS_LOAD_BYTECODE
+ * @param [in]     options   Options of compilation
+ * @return  Program, or NULL if the bytecode image can't be used
+ */
+static BsProgram *new_program(const char *filename, SourceReader *reader, const BsOptions *options) {
+  BsProgram *program = (BsProgram *) calloc(1, sizeof(BsProgram));
+  BsVM *vm;
+  Instruction *inst;
+
+  if (program == NULL) {
+    fputs("Failed to allocate memory for program\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  program->bignum = (options->flags & BS_BIGNUM) != 0;
+  program->use_jit = !program->bignum && (options->flags & BS_JIT) && jit_available();
+
+  vm = vm_create();
+  inst = build_instructions(vm, filename, reader, options, !program->bignum && !program->use_jit, NULL, &program->n_inst);
+  vm_destroy(vm);
+  if (inst == NULL) {
+    free(program);
+    return NULL;
+  }
+  if (program->bignum || program->use_jit) {
+    program->code = inst;
+  } else {
+    prepare_code(&program->prepared, inst, program->n_inst, options);
+    free_instructions(inst);
+  }
+  return program;
+}
+
+
+BsProgram *bs_compile(const char *source, size_t size, const BsOptions *options) {
+  BsOptions opts = {0, 0, NULL, 0};
+  SourceReader reader;
+  BsProgram *program;
+
+  if (options != NULL) {
+    opts = *options;
+  }
+  opts.flags &= ~(unsigned int) BS_LOAD_BYTECODE;
+  open_source_memory(&reader, source, size);
+  program = new_program(NULL, &reader, &opts);
+  close_source(&reader);
+  return program;
+}
+
+
+BsProgram *bs_compile_file(const char *filename, const BsOptions *options) {
+  static const BsOptions default_options = {0, 0, NULL, 0};
+  SourceReader reader;
+  BsProgram *program;
+
+  if (options == NULL) {
+    options = &default_options;
+  }
+  if (options->flags & BS_LOAD_BYTECODE) {
+    return new_program(filename, NULL, options);
+  }
+  if (!open_source(&reader, filename)) {
+    return NULL;
+  }
+  program = new_program(filename, &reader, options);
+  close_source(&reader);
+  return program;
+}
+
+
+void bs_program_free(BsProgram *program) {
+  if (program == NULL) {
+    return;
+  }
+  free_instructions(program->code);
+  if (program->prepared.verified != NULL) {
+    free_prepared_code(&program->prepared);
+  }
+  free(program);
+}
+
+
+BsVM *bs_vm_create(void) {
+  return vm_create();
+}
+
+
+int bs_run(BsVM *vm, const BsProgram *program, const BsIO *io) {
+  vm_reset(vm);
+  vm_set_io(vm, io);
+  if (program->bignum) {
+    return execute_bignum(vm, program->code, program->n_inst);
+  } else if (program->use_jit) {
+    return jit_execute(vm, program->code, program->n_inst) && vm->error == NULL;
+  } else {
+    return execute_prepared(vm, &program->prepared);
+  }
+}
+
+
+__attribute__((pure))
+const char *bs_vm_error(const BsVM *vm) {
+  return vm->error;
+}
+
+
+const char *bs_vm_output(const BsVM *vm, size_t *size) {
+  *size = vm->output.mem_size;
+  return vm->output.mem_size != 0 ? vm->output.mem : NULL;
+}
+
+
+void bs_vm_show_heap_stats(const BsVM *vm, FILE *fp) {
+  heap_show_stats(fp, &vm->heap);
+}
+
+
+void bs_vm_free(BsVM *vm) {
+  if (vm != NULL) {
+    vm_destroy(vm);
+  }
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <stddef.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__) && !defined(_WIN32)
+#  define BS_API  __attribute__((visibility("default")))
+#else
+#  define BS_API
+#endif
+
+/*! Bumped whenever a declaration of this header changes incompatibly */
+#define BS_API_VERSION  2
+
+/*! Flags of BsOptions */
+enum BsFlag {
+  BS_FUSE          = 0x01,  /*!< Fuse frequent instruction pairs */
+  BS_BIGNUM        = 0x02,  /*!< Use arbitrary-precision integers */
+  BS_JIT           = 0x04,  /*!< Run on x86-64 machine code if available */
+  BS_LOAD_BYTECODE = 0x08,  /*!< The file is a bytecode image (bs_compile_file() only) */
+  BS_TIERED        = 0x10   /*!< Compile hot subroutines and loops to native code in the background */
+};
+
+/*!
+ * @brief Options of compilation
+ */
+typedef struct {
+  int           opt_level;  /*!< Optimization level, 0 to 2 */
+  unsigned int  flags;      /*!< Bitwise OR of BsFlag */
+  const char   *cache_dir;  /*!< Directory of cached bytecode images and shared
+                                 objects, or NULL */
+  unsigned long tier_threshold;  /*!< Hits of a region before BS_TIERED compiles
+                                      it, or 0 for the default */
+} BsOptions;
+
+/*!
+ * @brief Read up to size bytes of input into buf
+ *
+ * Blocking until at least one byte is available is fine; returning 0 means
+ * the end of input.
+ */
+typedef size_t (*BsReadFunc)(void *arg, char *buf, size_t size);
+
+/*!
+ * @brief Write size bytes of output in buf
+ */
+typedef void (*BsWriteFunc)(void *arg, const char *buf, size_t size);
+
+/*!
+ * @brief Input and output of a run
+ *
+ * Zero-initialize it and set only what is needed: without a read callback
+ * the input is taken from input and input_size, and without a write
+ * callback the output is kept in the VM (see bs_vm_output()).
+ */
+typedef struct {
+  BsReadFunc   read;         /*!< Callback supplying the input, or NULL */
+  BsWriteFunc  write;        /*!< Callback receiving the output, or NULL */
+  void        *arg;          /*!< First argument of the callbacks */
+  const char  *input;        /*!< Whole input in memory, used without read */
+  size_t       input_size;
+  int          interactive;  /*!< Hand the pending output to write before every read */
+} BsIO;
+
+/*! Compiled program, which is immutable and can be shared by threads */
+typedef struct BsProgram BsProgram;
+/*! Stack, heap and output of runs, which must be used by one thread at a time */
+typedef struct BsVM BsVM;
+
+
+/*!
+ * @brief Compile blankspace source code in memory
+ * @param [in] source   Source code
+ * @param [in] size     Length of the source code
+ * @param [in] options  Options, or NULL for the defaults
+ * @return  Program (must be released with bs_program_free())
+ */
+BS_API BsProgram *
+bs_compile(const char *source, size_t size, const BsOptions *options);
+
+/*!
+ * @brief Compile a blankspace source file, or load a bytecode image
+ * @param [in] filename  Name of the file, or "-" for stdin
+ * @param [in] options   Options, or NULL for the defaults
+ * @return  Program (must be released with bs_program_free()), or NULL if
+ *          the file can't be read
+ */
+BS_API BsProgram *
+bs_compile_file(const char *filename, const BsOptions *options);
+
+/*!
+ * @brief Release a program
+ * @param [in] program  Program, or NULL
+ */
+BS_API void
+bs_program_free(BsProgram *program);
+
+/*!
+ * @brief Create a VM to run programs on
+ * @return  VM (must be released with bs_vm_free())
+ */
+BS_API BsVM *
+bs_vm_create(void);
+
+/*!
+ * @brief Run a program from scratch
+ *
+ * The stack, the heap and the output kept by the previous run are
+ * discarded first.
+ * A runtime error, such as stack underflow or zero division, stops the run
+ * and leaves its message in the VM; only running out of memory terminates
+ * the process.
+ * @param [in,out] vm       VM
+ * @param [in]     program  Program
+ * @param [in]     io       Input and output of the run
+ * @return  1 if the program halts, or 0 if it stops on a runtime error
+ */
+BS_API int
+bs_run(BsVM *vm, const BsProgram *program, const BsIO *io);
+
+/*!
+ * @brief Get the message of the runtime error of the last run
+ * @param [in] vm  VM
+ * @return  Message, or NULL if the run halted
+ */
+BS_API const char *
+bs_vm_error(const BsVM *vm);
+
+/*!
+ * @brief Get the output of the last run without a write callback
+ * @param [in]  vm    VM
+ * @param [out] size  Size of the output
+ * @return  Output, which is valid until the next run, or NULL if it is empty
+ */
+BS_API const char *
+bs_vm_output(const BsVM *vm, size_t *size);
+
+/*!
+ * @brief Show statistics of the heap of the last run
+ * @param [in] vm  VM
+ * @param [in] fp  Stream to write into
+ */
+BS_API void
+bs_vm_show_heap_stats(const BsVM *vm, FILE *fp);
+
+/*!
+ * @brief Release a VM
+ * @param [in] vm  VM, or NULL
+ */
+BS_API void
+bs_vm_free(BsVM *vm);
+
+#ifdef __cplusplus
+}
+#endif
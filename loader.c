@@ -0,0 +1,235 @@
+#include "blankspace.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#  include <immintrin.h>
+#endif
+#ifndef _WIN32
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+/* ------------------------------------------------------------------------- *
+ * Source loader                                                             *
+ * ------------------------------------------------------------------------- */
+/*! Size of the chunks of source code compacted at a time */
+#define READ_CHUNK_SIZE  65536
+
+
+/*!
+ * @brief Allocate memory or exit on failure
+ */
+static char *xrealloc(char *ptr, size_t size) {
+  char *p = (char *) realloc(ptr, size);
+  if (p == NULL) {
+    fputs("Failed to allocate memory for source code\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+/*!
+ * @brief Copy only the space, tab and newline characters
+ *
+ * Blocks of 32 (AVX2) or 16 (SSE2) bytes are classified at once; a block
+ * which consists only of whitespaces is copied with one store and a block
+ * without them is skipped.
+ * @param [out] dst  Destination, which can hold n bytes
+ * @param [in]  src  Source text
+ * @param [in]  n    Length of src
+ * @return  The number of bytes written into dst
+ */
+static size_t compact_whitespace(char *dst, const char *src, size_t n) {
+  size_t i = 0, j = 0;
+#if defined(__AVX2__)
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (const void *) &src[i]);
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+        _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)),
+          _mm256_cmpeq_epi8(v, newline)));
+    if (mask == 0xffffffffU) {
+      _mm256_storeu_si256((__m256i *) (void *) &dst[j], v);
+      j += 32;
+      continue;
+    }
+    for (; mask != 0; mask &= mask - 1) {
+      dst[j++] = src[i + (size_t) __builtin_ctz(mask)];
+    }
+  }
+#elif defined(__SSE2__)
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (const void *) &src[i]);
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(
+        _mm_or_si128(
+          _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+          _mm_cmpeq_epi8(v, newline)));
+    if (mask == 0xffffU) {
+      _mm_storeu_si128((__m128i *) (void *) &dst[j], v);
+      j += 16;
+      continue;
+    }
+    for (; mask != 0; mask &= mask - 1) {
+      dst[j++] = src[i + (size_t) __builtin_ctz(mask)];
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    switch (src[i]) {
+      case ' ':
+      case '\t':
+      case '\n':
+        dst[j++] = src[i];
+        break;
+    }
+  }
+  return j;
+}
+
+
+/*!
+ * @brief Open blankspace source code to read its whitespaces
+ *
+ * Regular files are mapped into memory, so that they are read without
+ * going through stdio; other inputs, including stdin, are read in chunks.
+ * Only one chunk of whitespaces is kept at a time, so the memory used
+ * doesn't depend on the size of the source code.
+ * @param [out] reader    Reader to initialize
+ * @param [in]  filename  Name of the source file, or "-" for stdin
+ * @return  TRUE if the file is opened, otherwise FALSE
+ */
+int open_source(SourceReader *reader, const char *filename) {
+  reader->fp = NULL;
+  reader->text = NULL;
+  reader->text_size = 0;
+  reader->src = NULL;
+  reader->src_size = 0;
+  reader->map = NULL;
+  reader->map_size = 0;
+  reader->pos = reader->len = reader->n_read = 0;
+  if (!strcmp(filename, "-")) {
+    reader->fp = stdin;
+  } else {
+#ifndef _WIN32
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+      return FALSE;
+    }
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+#  ifdef MADV_SEQUENTIAL
+        madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+#  endif
+        reader->map = map;
+        reader->map_size = (size_t) st.st_size;
+        reader->text = reader->src = (const char *) map;
+        reader->text_size = reader->src_size = reader->map_size;
+      }
+    }
+    close(fd);
+#endif
+    if (reader->map == NULL && (reader->fp = fopen(filename, "rb")) == NULL) {
+      return FALSE;
+    }
+  }
+  reader->buf = xrealloc(NULL, READ_CHUNK_SIZE);
+  return TRUE;
+}
+
+
+/*!
+ * @brief Open blankspace source code in memory to read its whitespaces
+ * @param [out] reader  Reader to initialize
+ * @param [in]  source  Source code, which must outlive the reader
+ * @param [in]  size    Length of the source code
+ */
+void open_source_memory(SourceReader *reader, const char *source, size_t size) {
+  reader->fp = NULL;
+  reader->text = reader->src = source;
+  reader->text_size = reader->src_size = size;
+  reader->map = NULL;
+  reader->map_size = 0;
+  reader->pos = reader->len = reader->n_read = 0;
+  reader->buf = xrealloc(NULL, READ_CHUNK_SIZE);
+}
+
+
+/*!
+ * @brief Rewind a reader to read the source code again from the top
+ * @param [in,out] reader  Reader
+ * @return  TRUE on success, or FALSE if the source code can't be read twice,
+ *          like stdin
+ */
+int rewind_source(SourceReader *reader) {
+  if (reader->text != NULL) {
+    reader->src = reader->text;
+    reader->src_size = reader->text_size;
+  } else if (reader->fp == NULL || reader->fp == stdin || fseek(reader->fp, 0, SEEK_SET) != 0) {
+    return FALSE;
+  }
+  reader->pos = reader->len = reader->n_read = 0;
+  return TRUE;
+}
+
+
+/*!
+ * @brief Read the next chunk of whitespaces
+ *
+ * READER_NEXT() calls this function when all the whitespaces of the current
+ * chunk have been consumed.
+ * @param [in,out] reader  Reader
+ * @return  The first whitespace of the next chunk, or '\0' at the end
+ */
+char reader_fill(SourceReader *reader) {
+  for (;;) {
+    size_t n;
+    reader->n_read += reader->len;
+    if (reader->src_size > 0) {
+      n = reader->src_size < READ_CHUNK_SIZE ? reader->src_size : READ_CHUNK_SIZE;
+      reader->len = compact_whitespace(reader->buf, reader->src, n);
+      reader->src += n;
+      reader->src_size -= n;
+    } else if (reader->fp != NULL && (n = fread(reader->buf, 1, READ_CHUNK_SIZE, reader->fp)) != 0) {
+      /* Compaction never overtakes its input, so it can be done in place */
+      reader->len = compact_whitespace(reader->buf, reader->buf, n);
+    } else {
+      reader->pos = reader->len = 0;
+      return '\0';
+    }
+    if (reader->len != 0) {
+      reader->pos = 1;
+      return reader->buf[0];
+    }
+  }
+}
+
+
+/*!
+ * @brief Close blankspace source code opened by open_source()
+ * @param [in,out] reader  Reader
+ */
+void close_source(SourceReader *reader) {
+#ifndef _WIN32
+  if (reader->map != NULL) {
+    munmap(reader->map, reader->map_size);
+  }
+#endif
+  if (reader->fp != NULL && reader->fp != stdin) {
+    fclose(reader->fp);
+  }
+  free(reader->buf);
+  reader->map = NULL;
+  reader->text = NULL;
+  reader->fp = NULL;
+  reader->buf = NULL;
+}
+
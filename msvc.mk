@@ -29,30 +29,34 @@ MSVC_MACROS = /DNDEBUG /D_CRT_SECURE_NO_WARNINGS /D_CRT_NONSTDC_NO_WARNINGS \
               /D_USE_MATH_DEFINES
 !endif
 
-MAX_SOURCE_SIZE   = 65536
-MAX_BYTECODE_SIZE = 1048576
-MAX_LABEL_LENGTH  = 65536
-MAX_N_LABEL       = 1024
-UNDEF_LIST_SIZE   = 256
 STACK_SIZE        = 65536
 HEAP_SIZE         = 65536
+HEAP_PAGE_BITS    = 12
+OUTPUT_BUFFER_SIZE = 65536
+INPUT_BUFFER_SIZE = 4096
 CALL_STACK_SIZE   = 65536
 WS_INT            = int
 WS_ADDR_INT       = "unsigned int"
+TRANSLATION_UNIT_SIZE = 2048
 INDENT_STR        = "\"  \""
+NATIVE_CC         = "\"cc\""
+NATIVE_CFLAGS     = "\"-O2 -shared -fPIC\""
+TIER_THRESHOLD    = 10000
 
 MACROS = $(MSVC_MACROS) \
-         /DMAX_SOURCE_SIZE=$(MAX_SOURCE_SIZE) \
-         /DMAX_BYTECODE_SIZE=$(MAX_BYTECODE_SIZE) \
-         /DMAX_LABEL_LENGTH=$(MAX_LABEL_LENGTH) \
-         /DMAX_N_LABEL=$(MAX_N_LABEL) \
-         /DUNDEF_LIST_SIZE=$(UNDEF_LIST_SIZE) \
          /DSTACK_SIZE=$(STACK_SIZE) \
          /DHEAP_SIZE=$(HEAP_SIZE) \
+         /DHEAP_PAGE_BITS=$(HEAP_PAGE_BITS) \
+         /DOUTPUT_BUFFER_SIZE=$(OUTPUT_BUFFER_SIZE) \
+         /DINPUT_BUFFER_SIZE=$(INPUT_BUFFER_SIZE) \
          /DCALL_STACK_SIZE=$(CALL_STACK_SIZE) \
          /DWS_INT=$(WS_INT) \
          /DWS_ADDR_INT=$(WS_ADDR_INT) \
-         /DINDENT_STR=$(INDENT_STR)
+         /DTRANSLATION_UNIT_SIZE=$(TRANSLATION_UNIT_SIZE) \
+         /DINDENT_STR=$(INDENT_STR) \
+         /DNATIVE_CC=$(NATIVE_CC) \
+         /DNATIVE_CFLAGS=$(NATIVE_CFLAGS) \
+         /DTIER_THRESHOLD=$(TIER_THRESHOLD)
 
 CC       = cl
 RM       = del /F
@@ -0,0 +1,400 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Native compilation through the C translator                               *
+ * ------------------------------------------------------------------------- */
+#if defined(__unix__) || defined(__APPLE__)
+#  define USE_NATIVE
+#endif
+
+#ifdef USE_NATIVE
+#include <dlfcn.h>
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+/*! Version of the code translate() prints, which is a part of the cache key */
+#define NATIVE_VERSION  1
+
+/*!
+ * @brief Hash a string with 64-bit FNV-1a
+ * @param [in] hash  Hash of the preceding strings
+ * @param [in] str   String to hash
+ * @return  Hash of the concatenation
+ */
+__attribute__((pure))
+static uint64_t hash_string(uint64_t hash, const char *str) {
+  for (; *str != '\0'; str++) {
+    hash = (hash ^ (unsigned char) *str) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+
+/*!
+ * @brief Get the C compiler to build shared objects with
+ * @return  Command of the compiler, $CC if set
+ */
+static const char *native_cc(void) {
+  const char *cc = getenv("CC");
+  return cc != NULL && *cc != '\0' ? cc : NATIVE_CC;
+}
+
+
+/*!
+ * @brief Concatenate three strings into a new string
+ * @param [in] a  First string
+ * @param [in] b  Second string
+ * @param [in] c  Third string
+ * @return  Concatenation (must be freed by the caller)
+ */
+static char *concat_path(const char *a, const char *b, const char *c) {
+  char *path = (char *) malloc(strlen(a) + strlen(b) + strlen(c) + 1);
+  if (path == NULL) {
+    fputs("Failed to allocate memory for native compilation\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  strcat(strcat(strcpy(path, a), b), c);
+  return path;
+}
+
+
+/*!
+ * @brief Run a command of the shell in a new process group
+ *
+ * The process group can be killed by native_cancel() through job, so that
+ * the compiler and everything it started stop together.
+ * The process is reaped only after job->pid is cleared and no
+ * native_cancel() is about to signal it, so that its ID is never reused
+ * under native_cancel().
+ * @param [in]     command  Command line
+ * @param [in,out] job      Job to publish the process group in, or NULL
+ * @return  TRUE if the command exits with 0, otherwise FALSE
+ */
+static int run_command(char *command, NativeJob *job) {
+  char sh[] = "sh", option[] = "-c";
+  posix_spawnattr_t attr;
+  siginfo_t info;
+  char *argv[4];
+  pid_t pid;
+  int status = -1;
+
+  argv[0] = sh;
+  argv[1] = option;
+  argv[2] = command;
+  argv[3] = NULL;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, 0);
+  if (posix_spawn(&pid, "/bin/sh", NULL, &attr, argv, environ) != 0) {
+    posix_spawnattr_destroy(&attr);
+    return FALSE;
+  }
+  posix_spawnattr_destroy(&attr);
+  if (job != NULL) {
+    __atomic_store_n(&job->pid, (long) pid, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&job->is_cancelled, __ATOMIC_SEQ_CST)) {
+      kill(-pid, SIGKILL);
+    }
+  }
+  while (waitid(P_PID, (id_t) pid, &info, WEXITED | WNOWAIT) != 0 && errno == EINTR);
+  if (job != NULL) {
+    __atomic_store_n(&job->pid, 0L, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&job->n_killer, __ATOMIC_SEQ_CST) != 0) {
+      sched_yield();
+    }
+  }
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+/*!
+ * @brief Compile a file of translated C source code into a shared object
+ *
+ * The shared object is built under a temporary name and renamed at the end,
+ * so that concurrent runs never load a partially written file.
+ * The C source code is removed.
+ * @param [in]     filename    Name of the shared object
+ * @param [in]     c_filename  Name of the C source code
+ * @param [in]     suffix      Suffix of the temporary name
+ * @param [in,out] job         Job of the compiler, or NULL
+ * @return  TRUE on success, otherwise FALSE
+ */
+static int compile_shared_object(const char *filename, const char *c_filename, const char *suffix, NativeJob *job) {
+  char *tmp_filename = concat_path(filename, suffix, ".tmp");
+  char *command;
+  int ok;
+
+  command = (char *) malloc(strlen(native_cc()) + strlen(NATIVE_CFLAGS) + strlen(tmp_filename) + strlen(c_filename) + 16);
+  if (command == NULL) {
+    fputs("Failed to allocate memory for native compilation\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  sprintf(command, "%s %s -o \"%s\" \"%s\"", native_cc(), NATIVE_CFLAGS, tmp_filename, c_filename);
+  if (!(ok = run_command(command, job))) {
+    if (job == NULL || !__atomic_load_n(&job->is_cancelled, __ATOMIC_SEQ_CST)) {
+      fprintf(stderr, "Failed to compile translated code: %s\n", command);
+    }
+    remove(tmp_filename);
+  } else if (rename(tmp_filename, filename) != 0) {
+    fprintf(stderr, "Unable to rename %s to %s\n", tmp_filename, filename);
+    remove(tmp_filename);
+    ok = FALSE;
+  }
+  remove(c_filename);
+  free(command);
+  free(tmp_filename);
+  return ok;
+}
+
+
+/*!
+ * @brief Make a suffix of temporary names unique among threads and processes
+ * @param [out] suffix  Suffix
+ */
+static void make_temp_suffix(char suffix[48]) {
+  static unsigned long n_temp = 0;
+  sprintf(suffix, ".%ld.%lu", (long) getpid(), __atomic_fetch_add(&n_temp, 1UL, __ATOMIC_RELAXED));
+}
+
+
+/*!
+ * @brief Look up a symbol of a shared object
+ *
+ * The shared object is never unloaded once the symbol is found.
+ * @param [in] filename  Name of the shared object
+ * @param [in] name      Name of the symbol
+ * @return  Address of the symbol, or NULL if it can't be loaded
+ */
+static void *load_symbol(const char *filename, const char *name) {
+  void *handle, *p;
+
+  if ((handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+    return NULL;
+  }
+  if ((p = dlsym(handle, name)) == NULL) {
+    dlclose(handle);
+  }
+  return p;
+}
+#endif
+
+
+/*!
+ * @brief Check whether native compilation is available
+ * @return  TRUE if shared objects can be built and loaded, otherwise FALSE
+ */
+__attribute__((const))
+int native_available(void) {
+#ifdef USE_NATIVE
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+
+/*!
+ * @brief Get the name of the cached shared object of a program
+ *
+ * The name consists of the hash of the source code and the hash of
+ * everything else which changes the shared object: the compiler, its flags,
+ * the optimization level and the sizes of the stacks and the heap.
+ * Without a cache directory, $XDG_CACHE_HOME/blankspace or
+ * ~/.cache/blankspace is used.
+ * The directory is created if it is missing.
+ * @param [in] cache_dir    Name of the cache directory, or NULL
+ * @param [in] source_hash  hash_source() of the source code
+ * @param [in] opt_level    Optimization level of translation
+ * @return  Name of the shared object (must be freed by the caller), or NULL
+ *          if no cache directory is available
+ */
+char *native_cache_filename(const char *cache_dir, uint64_t source_hash, int opt_level) {
+#ifdef USE_NATIVE
+  char *dirname, *filename, key[256];
+  const char *base;
+  uint64_t flags_hash;
+
+  if (cache_dir != NULL) {
+    dirname = concat_path(cache_dir, "", "");
+  } else if ((base = getenv("XDG_CACHE_HOME")) != NULL && *base != '\0') {
+    dirname = concat_path(base, "/blankspace", "");
+  } else if ((base = getenv("HOME")) != NULL && *base != '\0') {
+    dirname = concat_path(base, "/.cache/blankspace", "");
+  } else {
+    return NULL;
+  }
+  if (!make_directories(dirname)) {
+    fprintf(stderr, "Unable to create directory: %s\n", dirname);
+    free(dirname);
+    return NULL;
+  }
+  sprintf(key, "|O%d|%d|%lu|%lu|%lu|%lu", opt_level, NATIVE_VERSION,
+      (unsigned long) STACK_SIZE, (unsigned long) HEAP_SIZE,
+      (unsigned long) CALL_STACK_SIZE, (unsigned long) OUTPUT_BUFFER_SIZE);
+  flags_hash = hash_string(hash_string(hash_string(0xcbf29ce484222325ULL, native_cc()), " " NATIVE_CFLAGS), key);
+  sprintf(key, "/%016llx-%016llx.so", (unsigned long long) source_hash, (unsigned long long) flags_hash);
+  filename = concat_path(dirname, key, "");
+  free(dirname);
+  return filename;
+#else
+  (void) cache_dir;
+  (void) source_hash;
+  (void) opt_level;
+  return NULL;
+#endif
+}
+
+
+/*!
+ * @brief Translate decoded instructions into C and build a shared object
+ * @param [in] filename   Name of the shared object
+ * @param [in] code       Decoded instructions terminated with FLOW_HALT
+ * @param [in] n_inst     The number of instructions
+ * @param [in] opt_level  Optimization level of translation
+ * @return  TRUE on success, otherwise FALSE
+ */
+int native_compile(const char *filename, const Instruction *code, size_t n_inst, int opt_level) {
+#ifdef USE_NATIVE
+  char suffix[48], *c_filename;
+  FILE *fp;
+  int ok;
+
+  make_temp_suffix(suffix);
+  c_filename = concat_path(filename, suffix, ".c");
+  if ((fp = fopen(c_filename, "w")) == NULL) {
+    fprintf(stderr, "Unable to open file: %s\n", c_filename);
+    free(c_filename);
+    return FALSE;
+  }
+  translate(fp, code, n_inst, opt_level, NATIVE_ENTRY);
+  fclose(fp);
+  ok = compile_shared_object(filename, c_filename, suffix, NULL);
+  free(c_filename);
+  return ok;
+#else
+  (void) filename;
+  (void) code;
+  (void) n_inst;
+  (void) opt_level;
+  return FALSE;
+#endif
+}
+
+
+/*!
+ * @brief Translate a region of a program into C and build a shared object
+ *        for tiered execution
+ * @param [in]     filename  Name of the shared object
+ * @param [in]     code      Decoded instructions terminated with FLOW_HALT,
+ *                           without superinstructions
+ * @param [in]     n_inst    The number of instructions
+ * @param [in]     region    Region to translate (see find_regions())
+ * @param [in,out] job       Job of the compiler, which native_cancel() can
+ *                           stop, or NULL
+ * @return  TRUE on success, otherwise FALSE
+ */
+int native_compile_region(const char *filename, const Instruction *code, size_t n_inst, size_t region, NativeJob *job) {
+#ifdef USE_NATIVE
+  char suffix[48], *c_filename;
+  FILE *fp;
+  int ok;
+
+  make_temp_suffix(suffix);
+  c_filename = concat_path(filename, suffix, ".c");
+  if ((fp = fopen(c_filename, "w")) == NULL) {
+    fprintf(stderr, "Unable to open file: %s\n", c_filename);
+    free(c_filename);
+    return FALSE;
+  }
+  ok = translate_region(fp, code, n_inst, region);
+  fclose(fp);
+  if (ok) {
+    ok = compile_shared_object(filename, c_filename, suffix, job);
+  } else {
+    remove(c_filename);
+  }
+  free(c_filename);
+  return ok;
+#else
+  (void) filename;
+  (void) code;
+  (void) n_inst;
+  (void) region;
+  (void) job;
+  return FALSE;
+#endif
+}
+
+
+/*!
+ * @brief Stop the compiler of native_compile_region() from another thread
+ *
+ * The compiler is killed if it is running, and is never started afterwards.
+ * @param [in,out] job  Job of the compiler
+ */
+void native_cancel(NativeJob *job) {
+#ifdef USE_NATIVE
+  long pid;
+  __atomic_store_n(&job->is_cancelled, TRUE, __ATOMIC_SEQ_CST);
+  __atomic_fetch_add(&job->n_killer, 1, __ATOMIC_SEQ_CST);
+  if ((pid = __atomic_load_n(&job->pid, __ATOMIC_SEQ_CST)) != 0) {
+    kill((pid_t) -pid, SIGKILL);
+  }
+  __atomic_fetch_sub(&job->n_killer, 1, __ATOMIC_SEQ_CST);
+#else
+  (void) job;
+#endif
+}
+
+
+/*!
+ * @brief Load a shared object built by native_compile()
+ *
+ * The shared object is never unloaded, since the translated program
+ * registers its output flusher with atexit().
+ * @param [in] filename  Name of the shared object
+ * @return  Entry function of the program, or NULL if it can't be loaded
+ */
+NativeEntry native_load(const char *filename) {
+#ifdef USE_NATIVE
+  union {
+    void *p;
+    NativeEntry entry;
+  } fn;
+  fn.p = load_symbol(filename, NATIVE_ENTRY);
+  return fn.p != NULL ? fn.entry : NULL;
+#else
+  (void) filename;
+  return NULL;
+#endif
+}
+
+
+/*!
+ * @brief Load a shared object built by native_compile_region()
+ *
+ * The shared object is never unloaded, since the interpreter may be
+ * running it on another thread.
+ * @param [in] filename  Name of the shared object
+ * @return  Entry function of the region, or NULL if it can't be loaded
+ */
+TierEntry native_load_region(const char *filename) {
+#ifdef USE_NATIVE
+  union {
+    void *p;
+    TierEntry entry;
+  } fn;
+  fn.p = load_symbol(filename, TIER_ENTRY);
+  return fn.p != NULL ? fn.entry : NULL;
+#else
+  (void) filename;
+  return NULL;
+#endif
+}
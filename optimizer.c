@@ -0,0 +1,408 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Superinstruction                                                          *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Fuse frequent instruction pairs into superinstructions
+ *
+ * The first instruction of a pair is rewritten into a fused opcode whose
+ * handler executes both instructions and skips the second one.
+ * The second instruction is left in place, so that jumps which land on it
+ * still work and no jump target has to be relocated.
+ * @param [in,out] code    Decoded instructions
+ * @param [in]     n_inst  The number of instructions
+ * @return  The number of fused pairs
+ */
+size_t fuse_superinstructions(Instruction *code, size_t n_inst) {
+  size_t i, n_fused = 0;
+  for (i = 0; i + 1 < n_inst; i++) {
+    Instruction *next = &code[i + 1];
+    switch (code[i].opcode) {
+      case STACK_PUSH:
+        if (next->opcode == ARITH_ADD) {
+          code[i].opcode = FUSED_PUSH_ADD;
+        } else if (next->opcode == HEAP_LOAD) {
+          code[i].opcode = FUSED_PUSH_LOAD;
+        } else {
+          continue;
+        }
+        break;
+      case STACK_DUP_N:
+        if (code[i].operand.num != 0) {
+          continue;
+        }
+        /* FALLTHROUGH */
+      case STACK_DUP:
+        if (next->opcode != FLOW_BEZ) {
+          continue;
+        }
+        code[i].opcode = FUSED_DUP_BEZ;
+        code[i].operand.addr = next->operand.addr;
+        break;
+      case ARITH_SUB:
+        if (next->opcode != FLOW_BLTZ) {
+          continue;
+        }
+        code[i].opcode = FUSED_SUB_BLTZ;
+        code[i].operand.addr = next->operand.addr;
+        break;
+      default:
+        continue;
+    }
+    n_fused++;
+    i++;
+  }
+  return n_fused;
+}
+
+
+/* ------------------------------------------------------------------------- *
+ * Optimizer                                                                 *
+ * ------------------------------------------------------------------------- */
+/*! Marker of instructions removed by the optimizer, until compaction */
+#define DELETED  (-1)
+/*! Upper bound of FLOW_JUMP chains followed by jump threading */
+#define MAX_JUMP_CHAIN  64
+
+
+/*!
+ * @brief Mark the instructions which are targets of some jump
+ * @param [in]  code       Decoded instructions
+ * @param [in]  n_inst     The number of instructions
+ * @param [out] is_target  Flags of jump targets (n_inst + 1 elements)
+ */
+static void mark_jump_targets(const Instruction *code, size_t n_inst, unsigned char *is_target) {
+  size_t i;
+  memset(is_target, FALSE, n_inst + 1);
+  for (i = 0; i < n_inst; i++) {
+    if (is_jump(code[i].opcode) && code[i].operand.addr <= n_inst) {
+      is_target[code[i].operand.addr] = TRUE;
+    }
+  }
+}
+
+
+/*!
+ * @brief Remove the instructions marked as DELETED and relocate jump targets
+ *
+ * A jump to a removed instruction is redirected to the next remaining one.
+ * @param [in,out] code        Decoded instructions terminated with FLOW_HALT
+ * @param [in,out] n_inst      The number of instructions
+ * @param [in,out] source_map  Source offsets of the instructions, or NULL
+ */
+static void compact(Instruction *code, size_t *n_inst, size_t *source_map) {
+  size_t *new_idx = (size_t *) malloc((*n_inst + 1) * sizeof(size_t));
+  size_t i, n = 0;
+
+  if (new_idx == NULL) {
+    fputs("Failed to allocate memory for optimizer\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i <= *n_inst; i++) {
+    new_idx[i] = n;
+    if (i == *n_inst || code[i].opcode != DELETED) {
+      n++;
+    }
+  }
+  for (i = 0; i <= *n_inst; i++) {
+    if (i != *n_inst && code[i].opcode == DELETED) {
+      continue;
+    }
+    if (is_jump(code[i].opcode)) {
+      code[i].operand.addr = (WsAddrInt) new_idx[code[i].operand.addr <= *n_inst ? code[i].operand.addr : *n_inst];
+    }
+    code[new_idx[i]] = code[i];
+    if (source_map != NULL && i != *n_inst) {
+      source_map[new_idx[i]] = source_map[i];
+    }
+  }
+  *n_inst = new_idx[*n_inst];
+  free(new_idx);
+}
+
+
+/*!
+ * @brief Evaluate a binary operator at compile time
+ * @param [in]  opcode  Opcode of the operator
+ * @param [in]  a       Left operand (second element of the stack)
+ * @param [in]  b       Right operand (top of the stack)
+ * @param [out] result  Result of the operation
+ * @return  TRUE if the result is well-defined and could be computed
+ */
+static int fold_binary(int opcode, WsInt a, WsInt b, WsInt *result) {
+  switch (opcode) {
+    case ARITH_ADD:
+      return !__builtin_add_overflow(a, b, result);
+    case ARITH_SUB:
+      return !__builtin_sub_overflow(a, b, result);
+    case ARITH_MUL:
+      return !__builtin_mul_overflow(a, b, result);
+    case ARITH_DIV:
+    case ARITH_MOD:
+      if (b == 0 || (b == -1 && __builtin_sub_overflow((WsInt) 0, a, result))) {
+        return FALSE;
+      }
+      *result = opcode == ARITH_DIV ? a / b : a % b;
+      return TRUE;
+    case BIT_AND:
+      *result = a & b;
+      return TRUE;
+    case BIT_OR:
+      *result = a | b;
+      return TRUE;
+    case BIT_XOR:
+      *result = a ^ b;
+      return TRUE;
+    case BIT_LS:
+      if (a < 0 || b < 0 || b >= (WsInt) (sizeof(WsInt) * 8)) {
+        return FALSE;
+      }
+      return !__builtin_mul_overflow(a, (WsInt) 1 << b, result);
+    case BIT_RS:
+      if (b < 0 || b >= (WsInt) (sizeof(WsInt) * 8)) {
+        return FALSE;
+      }
+      *result = a >> b;
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+
+/*!
+ * @brief Check whether pushing k and applying given operator is a no-op
+ * @param [in] opcode  Opcode of the operator
+ * @param [in] k       Pushed constant (right operand)
+ * @return  TRUE if "STACK_PUSH k; opcode" leaves the stack unchanged
+ */
+__attribute__((const))
+static int is_identity(int opcode, WsInt k) {
+  switch (opcode) {
+    case ARITH_ADD:
+    case ARITH_SUB:
+    case BIT_OR:
+    case BIT_XOR:
+    case BIT_LS:
+    case BIT_RS:
+      return k == 0;
+    case ARITH_MUL:
+    case ARITH_DIV:
+      return k == 1;
+    case BIT_AND:
+      return k == -1;
+    default:
+      return FALSE;
+  }
+}
+
+
+/*!
+ * @brief Check whether given instruction duplicates or pushes one element
+ *        without any other side effect
+ */
+__attribute__((pure))
+static int is_pure_push(const Instruction *inst) {
+  return inst->opcode == STACK_PUSH || inst->opcode == STACK_DUP
+    || (inst->opcode == STACK_DUP_N && inst->operand.num == 0);
+}
+
+
+/*!
+ * @brief Constant folding, algebraic simplification and dead pair removal
+ *
+ * Only the first instruction of a rewritten sequence may be a jump target,
+ * so that every sequence is always entered from its beginning.
+ * @param [in,out] code       Decoded instructions
+ * @param [in]     n_inst     The number of instructions
+ * @param [in]     is_target  Flags of jump targets
+ * @return  TRUE if some instruction is rewritten
+ */
+static int peephole(Instruction *code, size_t n_inst, const unsigned char *is_target) {
+  size_t i;
+  int changed = FALSE;
+  WsInt result;
+
+  for (i = 0; i + 1 < n_inst; i++) {
+    Instruction *x = &code[i], *y = &code[i + 1];
+    if (is_target[i + 1]) {
+      continue;
+    }
+    if (x->opcode == STACK_PUSH && y->opcode == STACK_PUSH && i + 2 < n_inst && !is_target[i + 2]
+        && fold_binary(code[i + 2].opcode, x->operand.num, y->operand.num, &result)) {
+      /* PUSH a; PUSH b; OP  =>  PUSH (a OP b) */
+      x->operand.num = result;
+      y->opcode = code[i + 2].opcode = DELETED;
+      i += 2;
+    } else if (x->opcode == STACK_PUSH && y->opcode == BIT_NOT) {
+      /* PUSH a; NOT  =>  PUSH ~a */
+      x->operand.num = ~x->operand.num;
+      y->opcode = DELETED;
+      i++;
+    } else if (x->opcode == STACK_PUSH && is_identity(y->opcode, x->operand.num)) {
+      /* PUSH 0; ADD, PUSH 1; MUL, ...  =>  (nothing) */
+      x->opcode = y->opcode = DELETED;
+      i++;
+    } else if (is_pure_push(x) && y->opcode == STACK_DISCARD) {
+      /* PUSH k; DISCARD, DUP; DISCARD  =>  (nothing) */
+      x->opcode = y->opcode = DELETED;
+      i++;
+    } else if (x->opcode == STACK_SWAP && y->opcode == STACK_SWAP) {
+      x->opcode = y->opcode = DELETED;
+      i++;
+    } else if (x->opcode == STACK_SLIDE && x->operand.num == 0) {
+      x->opcode = DELETED;
+    } else {
+      continue;
+    }
+    changed = TRUE;
+  }
+  return changed;
+}
+
+
+/*!
+ * @brief Redirect jumps which land on FLOW_JUMP to its final destination
+ *
+ * Unconditional jumps to the next instruction are removed and conditional
+ * ones are replaced with STACK_DISCARD.
+ * @param [in,out] code    Decoded instructions
+ * @param [in]     n_inst  The number of instructions
+ * @return  TRUE if some instruction is rewritten
+ */
+static int thread_jumps(Instruction *code, size_t n_inst) {
+  size_t i, j;
+  int changed = FALSE;
+
+  for (i = 0; i < n_inst; i++) {
+    WsAddrInt target;
+    if (!is_jump(code[i].opcode)) {
+      continue;
+    }
+    target = code[i].operand.addr;
+    for (j = 0; j < MAX_JUMP_CHAIN && target < n_inst && code[target].opcode == FLOW_JUMP
+        && code[target].operand.addr != target; j++) {
+      target = code[target].operand.addr;
+    }
+    if (target != code[i].operand.addr) {
+      code[i].operand.addr = target;
+      changed = TRUE;
+    }
+    if (target == i + 1) {
+      switch (code[i].opcode) {
+        case FLOW_JUMP:
+          code[i].opcode = DELETED;
+          changed = TRUE;
+          break;
+        case FLOW_BEZ:
+        case FLOW_BLTZ:
+          code[i].opcode = STACK_DISCARD;
+          changed = TRUE;
+          break;
+      }
+    }
+  }
+  return changed;
+}
+
+
+/*!
+ * @brief Remove instructions which are never reached from the entry point
+ * @param [in,out] code    Decoded instructions
+ * @param [in]     n_inst  The number of instructions
+ * @return  TRUE if some instruction is removed
+ */
+static int remove_unreachable(Instruction *code, size_t n_inst) {
+  unsigned char *reached = (unsigned char *) calloc(n_inst + 1, sizeof(unsigned char));
+  size_t *worklist = (size_t *) malloc((n_inst + 1) * sizeof(size_t));
+  size_t i, n_work = 0;
+  int changed = FALSE;
+
+  if (reached == NULL || worklist == NULL) {
+    fputs("Failed to allocate memory for optimizer\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  reached[0] = TRUE;
+  worklist[n_work++] = 0;
+  while (n_work > 0) {
+    size_t succ[2];
+    size_t n_succ = 0;
+    i = worklist[--n_work];
+    if (i >= n_inst) {
+      continue;
+    }
+    switch (code[i].opcode) {
+      case FLOW_JUMP:
+        succ[n_succ++] = code[i].operand.addr;
+        break;
+      case FLOW_GOSUB:
+      case FLOW_BEZ:
+      case FLOW_BLTZ:
+        succ[n_succ++] = code[i].operand.addr;
+        succ[n_succ++] = i + 1;
+        break;
+      case FLOW_ENDSUB:
+      case FLOW_HALT:
+        break;
+      default:
+        succ[n_succ++] = i + 1;
+        break;
+    }
+    while (n_succ > 0) {
+      size_t s = succ[--n_succ];
+      if (s <= n_inst && !reached[s]) {
+        reached[s] = TRUE;
+        worklist[n_work++] = s;
+      }
+    }
+  }
+  for (i = 0; i < n_inst; i++) {
+    if (!reached[i] && code[i].opcode != DELETED) {
+      code[i].opcode = DELETED;
+      changed = TRUE;
+    }
+  }
+  free(reached);
+  free(worklist);
+  return changed;
+}
+
+
+/*!
+ * @brief Optimize decoded instructions
+ *
+ * -O1 performs constant folding, algebraic simplification, removal of dead
+ * push/discard pairs and jump threading.
+ * -O2 additionally removes unreachable instructions.
+ * Superinstruction fusion is not done here, because the translator can't
+ * handle fused instructions; see fuse_superinstructions().
+ * The source offsets move with the instructions; a folded instruction keeps
+ * the offset of the instruction it replaces.
+ * @param [in,out] code        Decoded instructions terminated with FLOW_HALT
+ * @param [in,out] n_inst      The number of instructions
+ * @param [in]     level       Optimization level
+ * @param [in,out] source_map  Source offsets of the instructions, or NULL
+ */
+void optimize(Instruction *code, size_t *n_inst, int level, size_t *source_map) {
+  unsigned char *is_target;
+  int changed;
+
+  if (level < 1) {
+    return;
+  }
+  if ((is_target = (unsigned char *) malloc(*n_inst + 1)) == NULL) {
+    fputs("Failed to allocate memory for optimizer\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  do {
+    mark_jump_targets(code, *n_inst, is_target);
+    changed = peephole(code, *n_inst, is_target);
+    changed |= thread_jumps(code, *n_inst);
+    if (level >= 2) {
+      changed |= remove_unreachable(code, *n_inst);
+    }
+    compact(code, n_inst, source_map);
+  } while (changed);
+  free(is_target);
+}
@@ -0,0 +1,125 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Output buffer                                                             *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Initialize the output buffer of a VM
+ *
+ * The buffer is flushed when it is full and when the VM halts.
+ * In interactive mode it is also flushed before every read, so that prompts
+ * are shown.
+ * If no callback is given, the output is kept in memory until it is taken
+ * with output_detach().
+ * @param [out] out          Output buffer
+ * @param [in]  write        Callback to flush the buffer into, or NULL
+ * @param [in]  arg          First argument of write
+ * @param [in]  interactive  TRUE to flush before reads
+ */
+void output_init(OutputBuffer *out, BsWriteFunc write, void *arg, int interactive) {
+  out->write = write;
+  out->arg = arg;
+  out->mem = NULL;
+  out->mem_size = out->mem_capacity = 0;
+  out->size = 0;
+  out->interactive = write != NULL && interactive;
+}
+
+
+/*!
+ * @brief Append bytes to the memory of an output buffer without a callback
+ */
+static void append_mem(OutputBuffer *out, const char *str, size_t n) {
+  if (out->mem_size + n > out->mem_capacity) {
+    size_t capacity = out->mem_capacity == 0 ? OUTPUT_BUFFER_SIZE : out->mem_capacity;
+    while (capacity < out->mem_size + n) {
+      capacity *= 2;
+    }
+    if ((out->mem = (char *) realloc(out->mem, capacity)) == NULL) {
+      fputs("Failed to allocate memory for output\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+    out->mem_capacity = capacity;
+  }
+  memcpy(&out->mem[out->mem_size], str, n);
+  out->mem_size += n;
+}
+
+
+/*!
+ * @brief Write the contents of the output buffer to its callback or memory
+ * @param [in,out] out  Output buffer
+ */
+void output_flush(OutputBuffer *out) {
+  if (out->size != 0) {
+    if (out->write == NULL) {
+      append_mem(out, out->data, out->size);
+    } else {
+      out->write(out->arg, out->data, out->size);
+    }
+    out->size = 0;
+  }
+}
+
+
+/*!
+ * @brief Append bytes to the output buffer
+ * @param [in,out] out  Output buffer
+ * @param [in]     str  Bytes to append
+ * @param [in]     n    The number of bytes
+ */
+void output_write(OutputBuffer *out, const char *str, size_t n) {
+  if (out->size + n > OUTPUT_BUFFER_SIZE) {
+    output_flush(out);
+    if (n > OUTPUT_BUFFER_SIZE) {
+      if (out->write == NULL) {
+        append_mem(out, str, n);
+      } else {
+        out->write(out->arg, str, n);
+      }
+      return;
+    }
+  }
+  memcpy(&out->data[out->size], str, n);
+  out->size += n;
+}
+
+
+/*!
+ * @brief Append an integer in decimal to the output buffer
+ * @param [in,out] out  Output buffer
+ * @param [in]     n    Integer to append
+ */
+void output_num(OutputBuffer *out, WsInt n) {
+  char buf[sizeof(WsInt) * 3 + 2];
+  char *p = buf + sizeof(buf);
+  unsigned long long m = n < 0 ? 0ULL - (unsigned long long) n : (unsigned long long) n;
+
+  do {
+    *--p = (char) ('0' + m % 10);
+    m /= 10;
+  } while (m != 0);
+  if (n < 0) {
+    *--p = '-';
+  }
+  output_write(out, p, (size_t) (buf + sizeof(buf) - p));
+}
+
+
+/*!
+ * @brief Take the output kept in memory by an output buffer without a callback
+ *
+ * The buffer starts over empty.
+ * @param [in,out] out   Output buffer
+ * @param [out]    size  Size of the output
+ * @return  The output, or NULL if it is empty (must be freed by the caller)
+ */
+char *output_detach(OutputBuffer *out, size_t *size) {
+  char *mem;
+  output_flush(out);
+  mem = out->mem;
+  *size = out->mem_size;
+  out->mem = NULL;
+  out->mem_size = out->mem_capacity = 0;
+  return mem;
+}
@@ -0,0 +1,881 @@
+#include "blankspace.h"
+#include <time.h>
+/* Count cycles by the time stamp counter on x86 */
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#  define USE_TSC
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  else
+#    include <x86intrin.h>
+#  endif
+#endif
+
+/* ------------------------------------------------------------------------- *
+ * Profiler                                                                  *
+ * ------------------------------------------------------------------------- */
+#define NEXT()        { ip++; continue; }
+#define NEXT2()       { ip += 2; continue; }
+#define OPERAND_NUM   (ip->operand.num)
+#define OPERAND_ADDR  (ip->operand.addr)
+#define RETURN_ADDR   ((size_t) (ip - code) + 1)
+#define JUMP(addr)    { ip = &code[addr]; continue; }
+
+/*!
+ * @brief Activation of a subroutine
+ */
+typedef struct {
+  size_t             entry;  /*!< Index of the subroutine */
+  unsigned long long start;  /*!< Time of the call in nanoseconds */
+  unsigned long long tick;   /*!< Instructions executed before the call */
+} Frame;
+
+/*!
+ * @brief Call graph being built by execute_profile()
+ */
+typedef struct {
+  Profile            *profile;
+  Frame              *frames;          /*!< Activations by depth */
+  size_t             *n_active;        /*!< Activations of every subroutine */
+  size_t              node;            /*!< Node of the current call path */
+  size_t              node_capacity;   /*!< Allocated length of nodes */
+  size_t              event_capacity;  /*!< Allocated length of events */
+  unsigned long long  cycles;          /*!< Cycles at the last call or return */
+  unsigned long long  start;           /*!< Time of the start in nanoseconds */
+  int                 trace;           /*!< Record the calls as events */
+} CallGraph;
+
+/*!
+ * @brief Instruction or opcode with its count, to be sorted by hotness
+ */
+typedef struct {
+  unsigned long long count;
+  size_t             index;
+} Entry;
+
+/*!
+ * @brief Position of an instruction in source code
+ */
+typedef struct {
+  unsigned long line;    /*!< Line number from 1, or 0 if unknown */
+  unsigned long column;  /*!< Column number in bytes from 1 */
+} Location;
+
+/*!
+ * @brief Totals of a subroutine over all of its call paths
+ */
+typedef struct {
+  unsigned long long calls;
+  unsigned long long samples;       /*!< Including its callees */
+  unsigned long long self_samples;
+  unsigned long long cycles;        /*!< Including its callees */
+  unsigned long long self_cycles;
+} CallSum;
+
+
+/*!
+ * @brief Allocate zero-filled memory or exit on failure
+ */
+static void *xcalloc(size_t n, size_t size) {
+  void *p = calloc(n, size);
+  if (p == NULL) {
+    fputs("Failed to allocate memory for profiler\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+/*!
+ * @brief Reallocate memory or exit on failure
+ */
+static void *xrealloc(void *ptr, size_t size) {
+  void *p = realloc(ptr, size);
+  if (p == NULL) {
+    fputs("Failed to allocate memory for profiler\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+/*!
+ * @brief Get the time of a monotonic clock in nanoseconds
+ */
+static unsigned long long now_nsec(void) {
+#ifdef _WIN32
+  return (unsigned long long) clock() * (1000000000ULL / CLOCKS_PER_SEC);
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+#endif
+}
+
+
+/*!
+ * @brief Read the cycle counter of the CPU, or the clock in nanoseconds if
+ *        the CPU has none which can be read
+ */
+static unsigned long long read_cycles(void) {
+#ifdef USE_TSC
+  return (unsigned long long) __rdtsc();
+#else
+  return now_nsec();
+#endif
+}
+
+
+/*!
+ * @brief Find the node of a callee of the current call path, or add it
+ * @param [in,out] graph  Call graph
+ * @param [in]     entry  Index of the callee
+ * @return  Index of the node
+ */
+static size_t child_node(CallGraph *graph, size_t entry) {
+  Profile *profile = graph->profile;
+  CallNode *node;
+  size_t i;
+
+  for (i = profile->nodes[graph->node].first_child; i != 0; i = profile->nodes[i].next_sibling) {
+    if (profile->nodes[i].entry == entry) {
+      return i;
+    }
+  }
+  if (profile->n_node == graph->node_capacity) {
+    graph->node_capacity *= 2;
+    profile->nodes = (CallNode *) xrealloc(profile->nodes, graph->node_capacity * sizeof(CallNode));
+  }
+  i = profile->n_node++;
+  node = &profile->nodes[i];
+  memset(node, 0, sizeof(CallNode));
+  node->entry = entry;
+  node->parent = graph->node;
+  node->next_sibling = profile->nodes[graph->node].first_child;
+  profile->nodes[graph->node].first_child = i;
+  return i;
+}
+
+
+/*!
+ * @brief Enter a subroutine
+ * @param [in,out] graph  Call graph
+ * @param [in]     depth  Index of the call stack of the call
+ * @param [in]     entry  Index of the subroutine
+ * @param [in]     tick   Instructions executed so far
+ */
+static void enter_call(CallGraph *graph, size_t depth, size_t entry, unsigned long long tick) {
+  Profile *profile = graph->profile;
+  Frame *frame = &graph->frames[depth];
+  unsigned long long cycles = read_cycles();
+
+  profile->nodes[graph->node].cycles += cycles - graph->cycles;
+  graph->cycles = cycles;
+  graph->node = child_node(graph, entry);
+  profile->nodes[graph->node].calls++;
+  profile->calls[entry]++;
+  graph->n_active[entry]++;
+  frame->entry = entry;
+  frame->tick = tick;
+  frame->start = now_nsec();
+}
+
+
+/*!
+ * @brief Leave a subroutine
+ *
+ * Only the outermost activation of a recursive subroutine is timed, so that
+ * its time isn't counted more than once.
+ * The calls shorter than the sampling period aren't traced.
+ * @param [in,out] graph  Call graph
+ * @param [in]     depth  Index of the call stack of the call
+ * @param [in]     tick   Instructions executed so far
+ * @param [in]     now    Current time in nanoseconds
+ */
+static void leave_call(CallGraph *graph, size_t depth, unsigned long long tick, unsigned long long now) {
+  Profile *profile = graph->profile;
+  const Frame *frame = &graph->frames[depth];
+  unsigned long long cycles = read_cycles();
+  TraceEvent *event;
+
+  profile->nodes[graph->node].cycles += cycles - graph->cycles;
+  graph->cycles = cycles;
+  if (--graph->n_active[frame->entry] == 0) {
+    profile->nsecs[frame->entry] += now - frame->start;
+  }
+  if (graph->trace && tick - frame->tick >= profile->period) {
+    if (profile->n_event == graph->event_capacity) {
+      graph->event_capacity = graph->event_capacity == 0 ? 1024 : graph->event_capacity * 2;
+      profile->events = (TraceEvent *) xrealloc(profile->events, graph->event_capacity * sizeof(TraceEvent));
+    }
+    event = &profile->events[profile->n_event++];
+    event->node = graph->node;
+    event->start = frame->start - graph->start;
+    event->nsec = now - frame->start;
+  }
+  graph->node = profile->nodes[graph->node].parent;
+}
+
+
+/*!
+ * @brief Execute blankspace and count the executions of the instructions
+ *
+ * This is a dispatch loop of its own, so that the interpreter doesn't pay
+ * for the counters when the profiler isn't used.
+ * The counts are collected by the verified instructions and folded into the
+ * given instructions at the end; the checks inserted by verify() count as
+ * opcodes, but not as instructions.
+ * With a period of N, every Nth instruction is sampled into the counts and
+ * into the call path it runs in; the total is still exact.
+ * Every call is timed until the matching return, or until the end of the
+ * program, and is added to the call graph, whose nodes are the call paths.
+ * @param [in,out] vm       VM to run the instructions on
+ * @param [in]     base     Instruction records terminated with FLOW_HALT
+ * @param [in]     n_inst   The number of instructions
+ * @param [in]     period   Sampling period in instructions (0 for 1)
+ * @param [in]     trace    Record every call for write_trace()
+ * @param [out]    profile  Profile of the run (must be released with
+ *                          free_profile())
+ * @return  TRUE if the program halts, or FALSE if it stops on a runtime
+ *          error, whose message is left in vm->error
+ */
+int execute_profile(BsVM *vm, const Instruction *base, size_t n_inst, unsigned long period, int trace, Profile *profile) {
+  size_t *call_stack = vm->call_stack;
+  size_t call_stack_idx = 0;
+  size_t n_verified;
+  Instruction *verified = verify(base, n_inst, &n_verified);
+  const Instruction *code = verified;
+  const Instruction *ip = code;
+  unsigned long long *counts = (unsigned long long *) xcalloc(n_verified + 1, sizeof(unsigned long long));
+  size_t *orig = (size_t *) xcalloc(n_verified + 1, sizeof(size_t));
+  unsigned long long n_sample = 0, now;
+  unsigned long countdown;
+  CallGraph graph;
+  WsInt *sp = vm->stack;
+  WsInt tos = 0;
+  WsInt a = 0;
+  int n = 0;
+  size_t i, j;
+
+  if (period == 0) {
+    period = 1;
+  }
+  /* A check belongs to the instruction it guards, which follows it */
+  for (i = j = 0; i <= n_verified; i++) {
+    orig[i] = j;
+    if (code[i].opcode != CHECK_STACK && code[i].opcode != CHECK_ROOM) {
+      j++;
+    }
+  }
+  memset(profile->opcode_counts, 0, sizeof(profile->opcode_counts));
+  profile->counts = (unsigned long long *) xcalloc(n_inst + 1, sizeof(unsigned long long));
+  profile->calls = (unsigned long long *) xcalloc(n_inst + 1, sizeof(unsigned long long));
+  profile->nsecs = (unsigned long long *) xcalloc(n_inst + 1, sizeof(unsigned long long));
+  profile->n_inst = n_inst;
+  profile->period = period;
+  profile->nodes = (CallNode *) xcalloc(64, sizeof(CallNode));
+  profile->nodes[0].entry = PROFILE_ROOT;
+  profile->nodes[0].calls = 1;
+  profile->n_node = 1;
+  profile->events = NULL;
+  profile->n_event = 0;
+
+  graph.profile = profile;
+  graph.frames = (Frame *) xcalloc(CALL_STACK_SIZE, sizeof(Frame));
+  graph.n_active = (size_t *) xcalloc(n_inst + 1, sizeof(size_t));
+  graph.node = 0;
+  graph.node_capacity = 64;
+  graph.event_capacity = 0;
+  graph.trace = trace;
+  graph.start = now_nsec();
+  graph.cycles = read_cycles();
+
+/* The number of instructions executed so far */
+#define TICK  (n_sample * period + (period - countdown))
+
+  countdown = period;
+  vm->error = NULL;
+  for (;;) {
+    if (--countdown == 0) {
+      countdown = period;
+      counts[ip - code]++;
+      profile->nodes[graph.node].samples++;
+      n_sample++;
+    }
+    switch (ip->opcode) {
+      case STACK_PUSH:
+        *sp++ = tos;
+        tos = OPERAND_NUM;
+        NEXT();
+      case STACK_DUP_N:
+        a = OPERAND_NUM == 0 ? tos : sp[-OPERAND_NUM];
+        *sp++ = tos;
+        tos = a;
+        NEXT();
+      case STACK_DUP:
+        *sp++ = tos;
+        NEXT();
+      case STACK_SLIDE:
+        sp -= OPERAND_NUM;
+        NEXT();
+      case STACK_SWAP:
+        a = sp[-1];
+        sp[-1] = tos;
+        tos = a;
+        NEXT();
+      case STACK_DISCARD:
+        tos = *--sp;
+        NEXT();
+      case ARITH_ADD:
+        tos = *--sp + tos;
+        NEXT();
+      case ARITH_SUB:
+        tos = *--sp - tos;
+        NEXT();
+      case ARITH_MUL:
+        tos = *--sp * tos;
+        NEXT();
+      case ARITH_DIV:
+        if (tos == 0) {
+          vm->error = "Zero division";
+          break;
+        }
+        tos = *--sp / tos;
+        NEXT();
+      case ARITH_MOD:
+        if (tos == 0) {
+          vm->error = "Zero division";
+          break;
+        }
+        tos = *--sp % tos;
+        NEXT();
+      case BIT_AND:
+        tos = *--sp & tos;
+        NEXT();
+      case BIT_OR:
+        tos = *--sp | tos;
+        NEXT();
+      case BIT_XOR:
+        tos = *--sp ^ tos;
+        NEXT();
+      case BIT_LS:
+        tos = *--sp << tos;
+        NEXT();
+      case BIT_RS:
+        tos = *--sp >> tos;
+        NEXT();
+      case BIT_NOT:
+        tos = ~tos;
+        NEXT();
+      case HEAP_STORE:
+        a = sp[-1];
+        HEAP_WRITE(&vm->heap, a, tos);
+        sp -= 2;
+        tos = *sp;
+        NEXT();
+      case HEAP_LOAD:
+        tos = HEAP_READ(&vm->heap, tos);
+        NEXT();
+      case FLOW_GOSUB:
+        if (call_stack_idx == LENGTHOF(vm->call_stack)) {
+          vm->error = "Call stack overflow";
+          break;
+        }
+        enter_call(&graph, call_stack_idx, orig[OPERAND_ADDR], TICK);
+        call_stack[call_stack_idx++] = RETURN_ADDR;
+        JUMP(OPERAND_ADDR);
+      case FLOW_JUMP:
+        JUMP(OPERAND_ADDR);
+      case FLOW_BEZ:
+        a = tos;
+        tos = *--sp;
+        if (!a) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT();
+      case FLOW_BLTZ:
+        a = tos;
+        tos = *--sp;
+        if (a < 0) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT();
+      case FLOW_ENDSUB:
+        if (call_stack_idx == 0) {
+          vm->error = "Call stack underflow";
+          break;
+        }
+        call_stack_idx--;
+        leave_call(&graph, call_stack_idx, TICK, now_nsec());
+        JUMP(call_stack[call_stack_idx]);
+      case IO_PUT_CHAR:
+        OUTPUT_CHAR(&vm->output, tos);
+        tos = *--sp;
+        NEXT();
+      case IO_PUT_NUM:
+        output_num(&vm->output, tos);
+        tos = *--sp;
+        NEXT();
+      case IO_READ_CHAR:
+        a = tos;
+        tos = *--sp;
+        OUTPUT_SYNC(&vm->output);
+        HEAP_WRITE(&vm->heap, a, INPUT_CHAR(&vm->input));
+        NEXT();
+      case IO_READ_NUM:
+        a = tos;
+        tos = *--sp;
+        OUTPUT_SYNC(&vm->output);
+        if (input_num(&vm->input, &n)) {
+          HEAP_WRITE(&vm->heap, a, n);
+        }
+        NEXT();
+      case FUSED_PUSH_ADD:
+        tos += OPERAND_NUM;
+        NEXT2();
+      case FUSED_DUP_BEZ:
+        if (!tos) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT2();
+      case FUSED_SUB_BLTZ:
+        a = *--sp - tos;
+        tos = *--sp;
+        if (a < 0) {
+          JUMP(OPERAND_ADDR);
+        }
+        NEXT2();
+      case FUSED_PUSH_LOAD:
+        *sp++ = tos;
+        tos = HEAP_READ(&vm->heap, OPERAND_NUM);
+        NEXT2();
+      case CHECK_STACK:
+        if (sp - vm->stack < OPERAND_NUM) {
+          vm->error = "Stack underflow";
+          break;
+        }
+        NEXT();
+      case CHECK_ROOM:
+        if (vm->stack + LENGTHOF(vm->stack) - sp < OPERAND_NUM) {
+          vm->error = "Stack overflow";
+          break;
+        }
+        NEXT();
+      case FLOW_HALT:
+        break;
+      default:
+        fprintf(stderr, "Undefined instruction is detected [%02x]\n", ip->opcode);
+        NEXT();
+    }
+    break;
+  }
+  vm->stack_idx = (size_t) (sp - vm->stack);
+  output_flush(&vm->output);
+  now = now_nsec();
+  while (call_stack_idx > 0) {
+    leave_call(&graph, --call_stack_idx, TICK, now);
+  }
+  profile->nodes[0].cycles += read_cycles() - graph.cycles;
+  profile->total = TICK;
+  profile->total_nsec = now - graph.start;
+#undef TICK
+
+  for (i = 0; i <= n_verified; i++) {
+    if (code[i].opcode >= 0 && (size_t) code[i].opcode < LENGTHOF(profile->opcode_counts)) {
+      profile->opcode_counts[code[i].opcode] += counts[i];
+    }
+    if (code[i].opcode != CHECK_STACK && code[i].opcode != CHECK_ROOM) {
+      profile->counts[orig[i]] += counts[i];
+    }
+  }
+  free(graph.frames);
+  free(graph.n_active);
+  free(orig);
+  free(counts);
+  free(verified);
+  return vm->error == NULL;
+}
+
+
+/*!
+ * @brief Release a profile collected by execute_profile()
+ * @param [in,out] profile  Profile
+ */
+void free_profile(Profile *profile) {
+  free(profile->counts);
+  free(profile->calls);
+  free(profile->nsecs);
+  free(profile->nodes);
+  free(profile->events);
+  profile->counts = profile->calls = profile->nsecs = NULL;
+  profile->nodes = NULL;
+  profile->events = NULL;
+}
+
+
+/*!
+ * @brief Compare entries in descending order of counts, then in ascending
+ *        order of indices
+ */
+static int compare_entries(const void *p, const void *q) {
+  const Entry *x = (const Entry *) p;
+  const Entry *y = (const Entry *) q;
+  if (x->count != y->count) {
+    return x->count < y->count ? 1 : -1;
+  }
+  return x->index < y->index ? -1 : x->index > y->index;
+}
+
+
+/*!
+ * @brief Collect the entries which were run, sorted by hotness
+ * @param [in]  counts   Counts to sort by, by index
+ * @param [in]  runs     Non-zero at the indices which were run
+ * @param [in]  n        The number of elements of counts and runs
+ * @param [out] n_entry  The number of entries
+ * @return  Entries (must be freed by the caller)
+ */
+static Entry *sort_entries(const unsigned long long *counts, const unsigned long long *runs, size_t n, size_t *n_entry) {
+  Entry *entries = (Entry *) xcalloc(n + 1, sizeof(Entry));
+  size_t i;
+
+  *n_entry = 0;
+  for (i = 0; i < n; i++) {
+    if (runs[i] != 0) {
+      entries[*n_entry].count = counts[i];
+      entries[*n_entry].index = i;
+      (*n_entry)++;
+    }
+  }
+  qsort(entries, *n_entry, sizeof(Entry), compare_entries);
+  return entries;
+}
+
+
+/*!
+ * @brief Resolve the source offsets of the instructions into lines and
+ *        columns
+ *
+ * The source file is read again with the other characters than whitespaces,
+ * which compile() never sees.
+ * The offsets only increase with the index, since neither the optimizer nor
+ * the fusion reorders the instructions, so one pass is enough.
+ * @param [in] filename    Name of the source file
+ * @param [in] source_map  Source offsets of the instructions
+ * @param [in] n_inst      The number of instructions
+ * @return  Locations of the instructions (must be freed by the caller), or
+ *          NULL if the source file can't be read again
+ */
+static Location *locate_source(const char *filename, const size_t *source_map, size_t n_inst) {
+  Location *locations;
+  unsigned long line = 1, column = 1;
+  size_t i = 0, offset = 0;
+  FILE *fp;
+  int c;
+
+  if (filename == NULL || !strcmp(filename, "-") || (fp = fopen(filename, "rb")) == NULL) {
+    return NULL;
+  }
+  locations = (Location *) xcalloc(n_inst + 1, sizeof(Location));
+  while (i < n_inst && (c = getc(fp)) != EOF) {
+    if (c == ' ' || c == '\t' || c == '\n') {
+      for (; i < n_inst && source_map[i] <= offset; i++) {
+        locations[i].line = line;
+        locations[i].column = column;
+      }
+      offset++;
+    }
+    if (c == '\n') {
+      line++;
+      column = 1;
+    } else {
+      column++;
+    }
+  }
+  fclose(fp);
+  return locations;
+}
+
+
+/*!
+ * @brief Print the source location of an instruction in a column
+ * @param [in] fp         Output file pointer
+ * @param [in] locations  Locations of the instructions, or NULL
+ * @param [in] n_inst     The number of instructions
+ * @param [in] index      Index of the instruction
+ */
+static void print_location(FILE *fp, const Location *locations, size_t n_inst, size_t index) {
+  char buf[64];
+  if (locations == NULL || index >= n_inst || locations[index].line == 0) {
+    strcpy(buf, "-");
+  } else {
+    sprintf(buf, "%lu:%lu", locations[index].line, locations[index].column);
+  }
+  fprintf(fp, "%12s  ", buf);
+}
+
+
+/*!
+ * @brief Name a subroutine after the label it starts at
+ *
+ * A subroutine is named after the last label at or before its entry in
+ * source code, or after its index if there is none.
+ * @param [in]  profile  Profile
+ * @param [in]  map      Source map of the instructions, or NULL
+ * @param [in]  entry    Index of the subroutine, or PROFILE_ROOT
+ * @param [out] buf      Buffer for a name made of the index
+ * @return  Name of the subroutine
+ */
+static const char *entry_name(const Profile *profile, const SourceMap *map, size_t entry, char *buf) {
+  size_t lo = 0, hi;
+
+  if (entry == PROFILE_ROOT) {
+    return "main";
+  }
+  if (map != NULL && map->n_inst == profile->n_inst && entry < map->n_inst) {
+    hi = map->n_label;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (map->labels[mid].offset <= map->offsets[entry]) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo > 0) {
+      return map->labels[lo - 1].name;
+    }
+  }
+  sprintf(buf, "@%04d", (int) entry);
+  return buf;
+}
+
+
+/*!
+ * @brief Sum up the call graph by subroutine
+ *
+ * The nodes are walked in depth-first order, and the inclusive counts of a
+ * recursive subroutine are only taken from its outermost call paths, so
+ * that they aren't counted more than once.
+ * The main program is summed up at the index n_inst + 1.
+ * @param [in] profile  Profile
+ * @return  Totals by index (must be freed by the caller)
+ */
+static CallSum *sum_call_graph(const Profile *profile) {
+  const CallNode *nodes = profile->nodes;
+  size_t n_inst = profile->n_inst;
+  CallSum *sums = (CallSum *) xcalloc(n_inst + 2, sizeof(CallSum));
+  unsigned long long *samples = (unsigned long long *) xcalloc(profile->n_node, sizeof(unsigned long long));
+  unsigned long long *cycles = (unsigned long long *) xcalloc(profile->n_node, sizeof(unsigned long long));
+  size_t *n_active = (size_t *) xcalloc(n_inst + 2, sizeof(size_t));
+  size_t i, k;
+
+  for (i = 0; i < profile->n_node; i++) {
+    samples[i] = nodes[i].samples;
+    cycles[i] = nodes[i].cycles;
+  }
+  /* Every parent comes before its children */
+  for (i = profile->n_node; i-- > 1;) {
+    samples[nodes[i].parent] += samples[i];
+    cycles[nodes[i].parent] += cycles[i];
+  }
+  i = 0;
+  for (;;) {
+    k = nodes[i].entry == PROFILE_ROOT ? n_inst + 1 : nodes[i].entry;
+    sums[k].calls += nodes[i].calls;
+    sums[k].self_samples += nodes[i].samples;
+    sums[k].self_cycles += nodes[i].cycles;
+    if (n_active[k]++ == 0) {
+      sums[k].samples += samples[i];
+      sums[k].cycles += cycles[i];
+    }
+    if (nodes[i].first_child != 0) {
+      i = nodes[i].first_child;
+      continue;
+    }
+    /* Leave the nodes which have no more children to visit */
+    for (;;) {
+      k = nodes[i].entry == PROFILE_ROOT ? n_inst + 1 : nodes[i].entry;
+      n_active[k]--;
+      if (i == 0 || nodes[i].next_sibling != 0) {
+        break;
+      }
+      i = nodes[i].parent;
+    }
+    if (i == 0) {
+      break;
+    }
+    i = nodes[i].next_sibling;
+  }
+  free(n_active);
+  free(cycles);
+  free(samples);
+  return sums;
+}
+
+
+/*!
+ * @brief Show a profile as annotated listings sorted by hotness
+ *
+ * The opcodes and the instructions are sorted by the number of executions,
+ * and the subroutines by the time spent in them, including their callees.
+ * Every instruction is shown as show_mnemonic() does, after its count and
+ * its line and column in source code.
+ * The call graph is summed up by subroutine, which is named after its label.
+ * @param [in] fp        Output file pointer
+ * @param [in] profile   Profile collected by execute_profile()
+ * @param [in] code      Instructions which were profiled
+ * @param [in] filename  Name of the source file, or NULL
+ * @param [in] map       Source map of the instructions, or NULL
+ */
+void show_profile(FILE *fp, const Profile *profile, const Instruction *code, const char *filename, const SourceMap *map) {
+  size_t n_inst = profile->n_inst;
+  unsigned long long n_sample = 0;
+  double total, total_nsec, total_cycles;
+  Location *locations;
+  const char *name;
+  const char *count_label = profile->period > 1 ? "samples" : "count";
+  char buf[64];
+  Entry *entries;
+  CallSum *sums;
+  unsigned long long *keys;
+  size_t i, n_entry;
+
+  if (map != NULL && map->n_inst != n_inst) {
+    map = NULL;
+  }
+  locations = map != NULL ? locate_source(filename, map->offsets, n_inst) : NULL;
+  for (i = 0; i < LENGTHOF(profile->opcode_counts); i++) {
+    n_sample += profile->opcode_counts[i];
+  }
+  total = n_sample != 0 ? (double) n_sample : 1;
+  total_nsec = profile->total_nsec != 0 ? (double) profile->total_nsec : 1;
+
+  fprintf(fp, "Profile: %llu instructions executed in %.3f ms\n",
+      profile->total, (double) profile->total_nsec / 1000000);
+  if (profile->period > 1) {
+    fprintf(fp, "Sampled every %lu instructions: %llu samples\n", profile->period, n_sample);
+  }
+
+  fputs("\nOpcodes by executions:\n", fp);
+  fprintf(fp, "%14s %7s  %s\n", count_label, "%", "opcode");
+  entries = sort_entries(profile->opcode_counts, profile->opcode_counts, LENGTHOF(profile->opcode_counts), &n_entry);
+  for (i = 0; i < n_entry; i++) {
+    name = opcode_name((int) entries[i].index);
+    fprintf(fp, "%14llu %6.2f%%  %s\n", entries[i].count, (double) entries[i].count * 100 / total,
+        name != NULL ? name : "UNDEFINED_INSTRUCTION");
+  }
+  free(entries);
+
+  fputs("\nInstructions by executions:\n", fp);
+  fprintf(fp, "%14s %7s  %12s  %s\n", count_label, "%", "source", "instruction");
+  entries = sort_entries(profile->counts, profile->counts, n_inst + 1, &n_entry);
+  for (i = 0; i < n_entry; i++) {
+    fprintf(fp, "%14llu %6.2f%%  ", entries[i].count, (double) entries[i].count * 100 / total);
+    print_location(fp, locations, n_inst, entries[i].index);
+    fprintf(fp, "%04d: ", (int) entries[i].index);
+    print_mnemonic(fp, &code[entries[i].index]);
+    fputc('\n', fp);
+  }
+  free(entries);
+
+  fputs("\nSubroutines by time:\n", fp);
+  fprintf(fp, "%14s %14s %7s  %12s  %s\n", "calls", "time [ms]", "%", "source", "entry");
+  entries = sort_entries(profile->nsecs, profile->calls, n_inst + 1, &n_entry);
+  for (i = 0; i < n_entry; i++) {
+    size_t index = entries[i].index;
+    fprintf(fp, "%14llu %14.3f %6.2f%%  ", profile->calls[index],
+        (double) entries[i].count / 1000000, (double) entries[i].count * 100 / total_nsec);
+    print_location(fp, locations, n_inst, index);
+    fprintf(fp, "%04d: ", (int) index);
+    print_mnemonic(fp, &code[index]);
+    fputc('\n', fp);
+  }
+  free(entries);
+
+  sums = sum_call_graph(profile);
+  keys = (unsigned long long *) xcalloc(n_inst + 2, sizeof(unsigned long long));
+  for (i = 0; i < n_inst + 2; i++) {
+    keys[i] = sums[i].cycles;
+  }
+  total_cycles = sums[n_inst + 1].cycles != 0 ? (double) sums[n_inst + 1].cycles : 1;
+#ifdef USE_TSC
+  fputs("\nCall graph by cycles:\n", fp);
+#else
+  fputs("\nCall graph by time [ns]:\n", fp);
+#endif
+  fprintf(fp, "%14s %14s %14s %14s %14s %7s  %s\n",
+      "calls", "instructions", "self", "cycles", "self", "%", "subroutine");
+  entries = sort_entries(keys, keys, n_inst + 2, &n_entry);
+  for (i = 0; i < n_entry; i++) {
+    const CallSum *sum = &sums[entries[i].index];
+    fprintf(fp, "%14llu %14llu %14llu %14llu %14llu %6.2f%%  %s\n", sum->calls,
+        sum->samples * profile->period, sum->self_samples * profile->period,
+        sum->cycles, sum->self_cycles, (double) sum->cycles * 100 / total_cycles,
+        entry_name(profile, map, entries[i].index == n_inst + 1 ? PROFILE_ROOT : entries[i].index, buf));
+  }
+  free(entries);
+  free(keys);
+  free(sums);
+  free(locations);
+}
+
+
+/*!
+ * @brief Write the call paths of a profile as folded stacks
+ *
+ * Every line is a call path from the main program, whose frames are
+ * separated by semicolons, followed by the samples taken in the path itself,
+ * as flamegraph.pl and speedscope read.
+ * @param [in] fp       Output file pointer
+ * @param [in] profile  Profile collected by execute_profile()
+ * @param [in] map      Source map of the instructions, or NULL
+ */
+void write_folded(FILE *fp, const Profile *profile, const SourceMap *map) {
+  const CallNode *nodes = profile->nodes;
+  size_t *path = (size_t *) xcalloc(profile->n_node, sizeof(size_t));
+  char buf[64];
+  size_t i, j, depth;
+
+  for (i = 0; i < profile->n_node; i++) {
+    if (nodes[i].samples == 0) {
+      continue;
+    }
+    depth = 0;
+    for (j = i; j != 0; j = nodes[j].parent) {
+      path[depth++] = j;
+    }
+    fputs(entry_name(profile, map, PROFILE_ROOT, buf), fp);
+    while (depth > 0) {
+      fputc(';', fp);
+      fputs(entry_name(profile, map, nodes[path[--depth]].entry, buf), fp);
+    }
+    fprintf(fp, " %llu\n", nodes[i].samples);
+  }
+  free(path);
+}
+
+
+/*!
+ * @brief Write the calls of a profile in the Trace Event Format
+ *
+ * The calls recorded by execute_profile() are written as complete events
+ * in microseconds, which chrome://tracing and Perfetto read.
+ * @param [in] fp       Output file pointer
+ * @param [in] profile  Profile collected by execute_profile()
+ * @param [in] map      Source map of the instructions, or NULL
+ */
+void write_trace(FILE *fp, const Profile *profile, const SourceMap *map) {
+  char buf[64];
+  size_t i;
+
+  fputs("{\"traceEvents\":[\n", fp);
+  fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":0.000,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+      entry_name(profile, map, PROFILE_ROOT, buf), (double) profile->total_nsec / 1000);
+  for (i = 0; i < profile->n_event; i++) {
+    const TraceEvent *event = &profile->events[i];
+    size_t entry = profile->nodes[event->node].entry;
+    fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"entry\":%d}}",
+        entry_name(profile, map, entry, buf), (double) event->start / 1000, (double) event->nsec / 1000, (int) entry);
+  }
+  fputs("\n],\"displayTimeUnit\":\"ns\"}\n", fp);
+}
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libblankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Test of libblankspace                                                     *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Report a failed check with the options in scope, and count it
+ */
+#define CHECK(cond) \
+  do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: %s (flags %u, -O%d)\n", __FILE__, __LINE__, #cond, options->flags, options->opt_level); \
+      n_failure++; \
+    } \
+  } while (0)
+
+/*! Print 1000 divided by the number given as input */
+#define DIVIDE_SOURCE  "SSSSLTLTTSSSTTTTTSTSSSLSSSSLTTTTSTSTLSTSSSTSTSLTLSSLLL"
+/*! Print 7, and return with an empty call stack */
+#define UNDERFLOW_SOURCE  "SSSTTTLTLSTSSSTSTSLTLSSLTLLLL"
+
+
+/*!
+ * @brief Output collected by write_output()
+ */
+typedef struct {
+  char   buf[256];
+  size_t size;
+} Sink;
+
+/*!
+ * @brief Input handed out by read_input()
+ */
+typedef struct {
+  const char *input;
+  size_t      pos;
+  Sink        sink;
+} Channel;
+
+
+static int n_failure = 0;
+
+
+/*!
+ * @brief Compile source code written with S, T and L for the whitespaces
+ * @param [in] stl      Source code with S, T and L
+ * @param [in] options  Options of compilation
+ * @return  Program
+ */
+static BsProgram *compile_stl(const char *stl, const BsOptions *options) {
+  size_t i, size = strlen(stl);
+  char *source = (char *) malloc(size);
+  BsProgram *program;
+
+  if (source == NULL) {
+    fputs("Failed to allocate memory for source code\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < size; i++) {
+    source[i] = stl[i] == 'S' ? ' ' : stl[i] == 'T' ? '\t' : '\n';
+  }
+  program = bs_compile(source, size, options);
+  free(source);
+  return program;
+}
+
+
+/*!
+ * @brief BsReadFunc which hands out the input one byte at a time
+ */
+static size_t read_input(void *arg, char *buf, size_t size) {
+  Channel *channel = (Channel *) arg;
+  if (size == 0 || channel->input[channel->pos] == '\0') {
+    return 0;
+  }
+  buf[0] = channel->input[channel->pos++];
+  return 1;
+}
+
+
+/*!
+ * @brief BsWriteFunc which appends the output to a Sink
+ */
+static void write_output(void *arg, const char *buf, size_t size) {
+  Sink *sink = &((Channel *) arg)->sink;
+  if (sink->size + size <= sizeof(sink->buf)) {
+    memcpy(sink->buf + sink->size, buf, size);
+  }
+  sink->size += size;
+}
+
+
+/*!
+ * @brief Run a program on a VM with the input in memory
+ * @param [in,out] vm       VM
+ * @param [in]     program  Program
+ * @param [in]     input    Input of the run
+ * @return  Return value of bs_run()
+ */
+static int run_with_input(BsVM *vm, const BsProgram *program, const char *input) {
+  BsIO io;
+  memset(&io, 0, sizeof(io));
+  io.input = input;
+  io.input_size = strlen(input);
+  return bs_run(vm, program, &io);
+}
+
+
+/*!
+ * @brief Check whether the output kept in a VM is the expected one
+ */
+static int has_output(const BsVM *vm, const char *expected) {
+  size_t size;
+  const char *output = bs_vm_output(vm, &size);
+  if (expected[0] == '\0') {
+    return output == NULL && size == 0;
+  }
+  return output != NULL && size == strlen(expected) && memcmp(output, expected, size) == 0;
+}
+
+
+/*!
+ * @brief Check runs of a program compiled once on one VM
+ * @param [in] options  Options of compilation
+ */
+static void test_reuse(const BsOptions *options) {
+  BsProgram *program = compile_stl(DIVIDE_SOURCE, options);
+  BsVM *vm = bs_vm_create();
+
+  CHECK(program != NULL);
+  if (program == NULL) {
+    bs_vm_free(vm);
+    return;
+  }
+  CHECK(run_with_input(vm, program, "8\n") == 1);
+  CHECK(bs_vm_error(vm) == NULL);
+  CHECK(has_output(vm, "125\n"));
+
+  CHECK(run_with_input(vm, program, "0\n") == 0);
+  CHECK(bs_vm_error(vm) != NULL && strcmp(bs_vm_error(vm), "Zero division") == 0);
+  CHECK(has_output(vm, ""));
+
+  /* A failed run leaves nothing behind for the next one */
+  CHECK(run_with_input(vm, program, "-40\n") == 1);
+  CHECK(bs_vm_error(vm) == NULL);
+  CHECK(has_output(vm, "-25\n"));
+
+  bs_vm_free(vm);
+  bs_program_free(program);
+}
+
+
+/*!
+ * @brief Check runs with the read and write callbacks
+ * @param [in] options  Options of compilation
+ */
+static void test_callbacks(const BsOptions *options) {
+  BsProgram *divide = compile_stl(DIVIDE_SOURCE, options);
+  BsProgram *underflow = compile_stl(UNDERFLOW_SOURCE, options);
+  BsVM *vm = bs_vm_create();
+  Channel channel;
+  BsIO io;
+
+  CHECK(divide != NULL && underflow != NULL);
+  if (divide == NULL || underflow == NULL) {
+    bs_program_free(divide);
+    bs_program_free(underflow);
+    bs_vm_free(vm);
+    return;
+  }
+  memset(&io, 0, sizeof(io));
+  io.read = read_input;
+  io.write = write_output;
+  io.arg = &channel;
+
+  memset(&channel, 0, sizeof(channel));
+  channel.input = "1000\n";
+  CHECK(bs_run(vm, divide, &io) == 1);
+  CHECK(bs_vm_error(vm) == NULL);
+  CHECK(channel.sink.size == 2 && memcmp(channel.sink.buf, "1\n", 2) == 0);
+  CHECK(has_output(vm, ""));
+
+  /* The output before a runtime error still reaches the callback */
+  memset(&channel, 0, sizeof(channel));
+  channel.input = "";
+  CHECK(bs_run(vm, underflow, &io) == 0);
+  CHECK(bs_vm_error(vm) != NULL && strcmp(bs_vm_error(vm), "Call stack underflow") == 0);
+  CHECK(channel.sink.size == 2 && memcmp(channel.sink.buf, "7\n", 2) == 0);
+
+  memset(&channel, 0, sizeof(channel));
+  channel.input = "0\n";
+  CHECK(bs_run(vm, divide, &io) == 0);
+  CHECK(bs_vm_error(vm) != NULL && strcmp(bs_vm_error(vm), "Zero division") == 0);
+  CHECK(channel.sink.size == 0);
+
+  bs_vm_free(vm);
+  bs_program_free(divide);
+  bs_program_free(underflow);
+}
+
+
+/*!
+ * @brief Check a program compiled from a file against its expected output
+ * @param [in] options  Options of compilation
+ */
+static void test_file(const BsOptions *options) {
+  BsProgram *program = bs_compile_file("sudoku.bs", options);
+  BsVM *vm = bs_vm_create();
+  char input[256], expected[4096];
+  size_t input_size = 0, expected_size = 0;
+  FILE *fp;
+
+  CHECK(program != NULL);
+  if ((fp = fopen("inputs/sudoku.txt", "rb")) != NULL) {
+    input_size = fread(input, 1, sizeof(input) - 1, fp);
+    fclose(fp);
+  }
+  input[input_size] = '\0';
+  if ((fp = fopen("expects/sudoku.txt", "rb")) != NULL) {
+    expected_size = fread(expected, 1, sizeof(expected) - 1, fp);
+    fclose(fp);
+  }
+  expected[expected_size] = '\0';
+  CHECK(input_size != 0 && expected_size != 0);
+  if (program != NULL) {
+    CHECK(run_with_input(vm, program, input) == 1);
+    CHECK(has_output(vm, expected));
+    CHECK(run_with_input(vm, program, input) == 1);
+    CHECK(has_output(vm, expected));
+  }
+  bs_vm_free(vm);
+  bs_program_free(program);
+}
+
+
+int main(void) {
+  static const unsigned int flags[] = {0, BS_FUSE, BS_JIT, BS_BIGNUM};
+  size_t i;
+  int opt_level;
+
+  for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+    for (opt_level = 0; opt_level <= 2; opt_level += 2) {
+      BsOptions options;
+      memset(&options, 0, sizeof(options));
+      options.flags = flags[i];
+      options.opt_level = opt_level;
+      test_reuse(&options);
+      test_callbacks(&options);
+      test_file(&options);
+    }
+  }
+  if (n_failure != 0) {
+    fprintf(stderr, "%d checks failed\n", n_failure);
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,440 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Tiered execution                                                          *
+ * ------------------------------------------------------------------------- */
+#if (defined(__unix__) || defined(__APPLE__)) && defined(__GNUC__)
+#  define USE_TIER
+#endif
+
+#ifdef USE_TIER
+#include <pthread.h>
+
+/*! Version of the code translate_region() prints, which is a part of the cache key */
+#define TIER_VERSION  1
+
+/*!
+ * @brief Region of a program, which is main() or an outlined subroutine
+ */
+typedef struct {
+  TierEntry     entry;   /*!< Compiled region, or NULL */
+  unsigned long hits;    /*!< Entries and back-edges counted so far */
+} Region;
+
+/*!
+ * @brief Regions of a program compiled in the background
+ *
+ * The interpreter counts the hits of the regions with tier_poll(), and the
+ * worker thread compiles a region once it reaches the threshold.
+ * Compiled regions are published with a release store, so that the
+ * interpreters of any thread can pick them up without a lock.
+ */
+struct Tier {
+  Instruction     *code;         /*!< Instructions without superinstructions */
+  size_t           n_inst;
+  size_t          *owner;        /*!< Region of each instruction (see find_regions()) */
+  size_t          *orig_of;      /*!< Index in code of each verified instruction */
+  Region          *regions;      /*!< Regions by entry + 1, or 0 for main() */
+  unsigned long    threshold;    /*!< Hits to compile a region */
+  char            *cache_dir;    /*!< Cache directory of native_cache_filename(), or NULL */
+  pthread_mutex_t  lock;         /*!< Lock of the members below */
+  pthread_cond_t   cond;
+  pthread_t        thread;
+  int              has_thread;   /*!< Whether the worker thread is started */
+  int              is_stopping;  /*!< Whether tier_free() is called */
+  size_t          *queue;        /*!< Regions to compile */
+  size_t           head;
+  size_t           tail;
+  NativeJob        job;          /*!< Compiler the worker thread is running */
+};
+
+
+/*!
+ * @brief Hash a region of a program with 64-bit FNV-1a
+ * @param [in] tier    Tier of the program
+ * @param [in] region  Region to hash
+ * @return  Hash of the instructions and the region
+ */
+__attribute__((pure))
+static uint64_t hash_region(const Tier *tier, size_t region) {
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  unsigned long words[3];
+  size_t i, j, k;
+
+  for (i = 0; i <= tier->n_inst + 1; i++) {
+    if (i <= tier->n_inst) {
+      words[0] = (unsigned long) tier->code[i].opcode;
+      words[1] = (unsigned long) tier->code[i].operand.addr;
+      words[2] = 0;
+    } else {
+      words[0] = (unsigned long) region;
+      words[1] = TIER_VERSION;
+      words[2] = 0x74696572UL;  /* "tier" */
+    }
+    for (j = 0; j < LENGTHOF(words); j++) {
+      for (k = 0; k < 4; k++) {
+        hash = (hash ^ ((words[j] >> (k * 8)) & 0xff)) * 0x100000001b3ULL;
+      }
+    }
+  }
+  return hash;
+}
+
+
+/*!
+ * @brief Load a region from the cache, or compile it
+ * @param [in,out] tier    Tier of the program
+ * @param [in]     region  Region to compile
+ * @return  Entry of the region, or NULL on failure
+ */
+static TierEntry compile_region(Tier *tier, size_t region) {
+  char *filename = native_cache_filename(tier->cache_dir, hash_region(tier, region), 1);
+  TierEntry entry;
+
+  if (filename == NULL) {
+    return NULL;
+  }
+  if ((entry = native_load_region(filename)) == NULL
+      && native_compile_region(filename, tier->code, tier->n_inst, region, &tier->job)) {
+    entry = native_load_region(filename);
+  }
+  free(filename);
+  return entry;
+}
+
+
+/*!
+ * @brief Compile the queued regions until tier_free() is called
+ * @param [in,out] arg  Tier of the program
+ * @return  NULL
+ */
+static void *work(void *arg) {
+  Tier *tier = (Tier *) arg;
+  TierEntry entry;
+  size_t region;
+
+  pthread_mutex_lock(&tier->lock);
+  for (;;) {
+    while (!tier->is_stopping && tier->head == tier->tail) {
+      pthread_cond_wait(&tier->cond, &tier->lock);
+    }
+    if (tier->is_stopping) {
+      break;
+    }
+    region = tier->queue[tier->head++];
+    pthread_mutex_unlock(&tier->lock);
+    if ((entry = compile_region(tier, region)) != NULL) {
+      __atomic_store_n(&tier->regions[region].entry, entry, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_lock(&tier->lock);
+  }
+  pthread_mutex_unlock(&tier->lock);
+  return NULL;
+}
+
+
+/*!
+ * @brief Queue a region for the worker thread, which is started if needed
+ * @param [in,out] tier    Tier of the program
+ * @param [in]     region  Region to compile
+ */
+static void request(Tier *tier, size_t region) {
+  pthread_mutex_lock(&tier->lock);
+  if (!tier->has_thread && !tier->is_stopping) {
+    tier->has_thread = pthread_create(&tier->thread, NULL, work, tier) == 0;
+  }
+  tier->queue[tier->tail++] = region;
+  pthread_cond_signal(&tier->cond);
+  pthread_mutex_unlock(&tier->lock);
+}
+
+
+/*!
+ * @brief Read a heap cell of a VM for TierContext
+ */
+static WsInt tier_heap_load(void *vm, WsInt addr) {
+  return heap_load(&((BsVM *) vm)->heap, addr);
+}
+
+
+/*!
+ * @brief Write a heap cell of a VM for TierContext
+ */
+static void tier_heap_store(void *vm, WsInt addr, WsInt value) {
+  heap_store(&((BsVM *) vm)->heap, addr, value);
+}
+
+
+/*!
+ * @brief Output a character on a VM for TierContext
+ */
+static void tier_put_char(void *vm, int c) {
+  OUTPUT_CHAR(&((BsVM *) vm)->output, c);
+}
+
+
+/*!
+ * @brief Output a number on a VM for TierContext
+ */
+static void tier_put_num(void *vm, WsInt n) {
+  output_num(&((BsVM *) vm)->output, n);
+}
+
+
+/*!
+ * @brief Read a character on a VM for TierContext, same as IO_READ_CHAR
+ */
+static int tier_read_char(void *vm) {
+  OUTPUT_SYNC(&((BsVM *) vm)->output);
+  return INPUT_CHAR(&((BsVM *) vm)->input);
+}
+
+
+/*!
+ * @brief Read a number into a heap cell of a VM for TierContext, same as
+ *        IO_READ_NUM
+ */
+static void tier_read_num(void *vm, WsInt addr) {
+  int n;
+  OUTPUT_SYNC(&((BsVM *) vm)->output);
+  if (input_num(&((BsVM *) vm)->input, &n)) {
+    HEAP_WRITE(&((BsVM *) vm)->heap, addr, n);
+  }
+}
+#endif
+
+
+/*!
+ * @brief Check whether tiered execution is available
+ *
+ * The compiled code handles the values as int.
+ * @return  TRUE if regions can be compiled and run, otherwise FALSE
+ */
+__attribute__((const))
+int tier_available(void) {
+#ifdef USE_TIER
+  return native_available() && sizeof(WsInt) == sizeof(int);
+#else
+  return FALSE;
+#endif
+}
+
+
+/*!
+ * @brief Prepare a program for tiered execution
+ *
+ * Nothing is compiled until a region gets hot.
+ * @param [in] code        Instruction records terminated with FLOW_HALT
+ * @param [in] n_inst      The number of instructions
+ * @param [in] verified    Instructions returned by verify() from code
+ * @param [in] n_verified  The number of verified instructions
+ * @param [in] options     Options of the program
+ * @return  Tier (must be released with tier_free()), or NULL if tiered
+ *          execution is not available
+ */
+Tier *tier_create(const Instruction *code, size_t n_inst, const Instruction *verified, size_t n_verified, const BsOptions *options) {
+#ifdef USE_TIER
+  Tier *tier;
+  size_t i, n;
+
+  if (!tier_available()) {
+    return NULL;
+  }
+  tier = (Tier *) calloc(1, sizeof(Tier));
+  if (tier == NULL
+      || (tier->code = (Instruction *) malloc((n_inst + 1) * sizeof(Instruction))) == NULL
+      || (tier->orig_of = (size_t *) malloc((n_verified + 1) * sizeof(size_t))) == NULL
+      || (tier->regions = (Region *) calloc(n_inst + 1, sizeof(Region))) == NULL
+      || (tier->queue = (size_t *) malloc((n_inst + 1) * sizeof(size_t))) == NULL) {
+    fputs("Failed to allocate memory for tiered execution\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  /* The second records of the superinstructions are still there */
+  for (i = 0; i <= n_inst; i++) {
+    tier->code[i] = code[i];
+    tier->code[i].opcode = unfused_opcode(code[i].opcode);
+  }
+  tier->n_inst = n_inst;
+  tier->owner = find_regions(tier->code, n_inst);
+  /* verify() only inserts checks in front of the instructions */
+  for (i = 0, n = 0; i <= n_verified; i++) {
+    tier->orig_of[i] = n;
+    if (verified[i].opcode != CHECK_STACK && verified[i].opcode != CHECK_ROOM) {
+      n++;
+    }
+  }
+  tier->threshold = options->tier_threshold != 0 ? options->tier_threshold : TIER_THRESHOLD;
+  if (options->cache_dir != NULL) {
+    if ((tier->cache_dir = (char *) malloc(strlen(options->cache_dir) + 1)) == NULL) {
+      fputs("Failed to allocate memory for tiered execution\n", stderr);
+      exit(EXIT_FAILURE);
+    }
+    strcpy(tier->cache_dir, options->cache_dir);
+  }
+  pthread_mutex_init(&tier->lock, NULL);
+  pthread_cond_init(&tier->cond, NULL);
+  return tier;
+#else
+  (void) code;
+  (void) n_inst;
+  (void) verified;
+  (void) n_verified;
+  (void) options;
+  return NULL;
+#endif
+}
+
+
+/*!
+ * @brief Stop the worker thread and release a tier
+ *
+ * A running compiler is killed instead of being waited for.
+ * @param [in,out] tier  Tier, or NULL
+ */
+void tier_free(Tier *tier) {
+#ifdef USE_TIER
+  if (tier == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&tier->lock);
+  tier->is_stopping = TRUE;
+  pthread_cond_signal(&tier->cond);
+  pthread_mutex_unlock(&tier->lock);
+  native_cancel(&tier->job);
+  if (tier->has_thread) {
+    pthread_join(tier->thread, NULL);
+  }
+  pthread_cond_destroy(&tier->cond);
+  pthread_mutex_destroy(&tier->lock);
+  free(tier->code);
+  free(tier->owner);
+  free(tier->orig_of);
+  free(tier->regions);
+  free(tier->queue);
+  free(tier->cache_dir);
+  free(tier);
+#else
+  (void) tier;
+#endif
+}
+
+
+/*!
+ * @brief Check whether a verified instruction is the entry of a region
+ * @param [in] tier  Tier of the program
+ * @param [in] addr  Index of the verified instruction
+ * @return  TRUE if a call to addr can run a compiled region
+ */
+__attribute__((pure))
+int tier_is_entry(const Tier *tier, size_t addr) {
+#ifdef USE_TIER
+  size_t i = tier->orig_of[addr];
+  return i < tier->n_inst && tier->owner[i] == i + 1;
+#else
+  (void) tier;
+  (void) addr;
+  return FALSE;
+#endif
+}
+
+
+/*!
+ * @brief Get the region of a verified instruction
+ * @param [in] tier  Tier of the program
+ * @param [in] addr  Index of the verified instruction
+ * @return  Region of the instruction
+ */
+__attribute__((pure))
+size_t tier_region_of(const Tier *tier, size_t addr) {
+#ifdef USE_TIER
+  return tier->owner[tier->orig_of[addr]];
+#else
+  (void) tier;
+  (void) addr;
+  return 0;
+#endif
+}
+
+
+/*!
+ * @brief Count a hit of a region at a safe point
+ *
+ * The region is queued for compilation when it reaches the threshold.
+ * @param [in,out] tier    Tier of the program
+ * @param [in]     region  Region which is entered or loops
+ * @return  Entry of the compiled region, or NULL if it is not compiled yet
+ */
+TierEntry tier_poll(Tier *tier, size_t region) {
+#ifdef USE_TIER
+  Region *r = &tier->regions[region];
+  TierEntry entry = __atomic_load_n(&r->entry, __ATOMIC_ACQUIRE);
+  if (entry == NULL && __atomic_load_n(&r->hits, __ATOMIC_RELAXED) < tier->threshold
+      && __atomic_add_fetch(&r->hits, 1UL, __ATOMIC_RELAXED) == tier->threshold) {
+    request(tier, region);
+  }
+  return entry;
+#else
+  (void) tier;
+  (void) region;
+  return NULL;
+#endif
+}
+
+
+/*!
+ * @brief Run a compiled region on a VM
+ *
+ * The stack of the VM must be spilled into vm->stack with vm->stack_idx
+ * elements.
+ * Return addresses on the call stack are converted into original indices
+ * before main() is resumed, since it never comes back to the interpreter.
+ * @param [in,out] tier            Tier of the program
+ * @param [in]     entry           Entry of the region returned by tier_poll()
+ * @param [in,out] vm              VM to run the region on
+ * @param [in]     resume_addr     Index of the verified instruction to
+ *                                 resume at, or TIER_FROM_ENTRY
+ * @param [in]     call_stack_idx  The number of return addresses
+ * @return  TIER_RETURNED, TIER_HALTED, or TIER_FAILED with the message in
+ *          vm->error
+ */
+int tier_run(Tier *tier, TierEntry entry, BsVM *vm, size_t resume_addr, size_t call_stack_idx) {
+#ifdef USE_TIER
+  TierContext ctx;
+  size_t i;
+  int status;
+
+  if (resume_addr != TIER_FROM_ENTRY && tier_region_of(tier, resume_addr) == 0) {
+    for (i = 0; i < call_stack_idx; i++) {
+      vm->call_stack[i] = tier->orig_of[vm->call_stack[i]];
+    }
+  }
+  ctx.stack = (WsInt (*)[STACK_SIZE - 1]) (vm->stack + 1);
+  ctx.stack_idx = vm->stack_idx;
+  ctx.call_stack = &vm->call_stack;
+  ctx.call_stack_idx = call_stack_idx;
+  ctx.heap_low = vm->heap.low;
+  ctx.zero_page = vm->heap.zero_page;
+  ctx.vm = vm;
+  ctx.heap_load = tier_heap_load;
+  ctx.heap_store = tier_heap_store;
+  ctx.put_char = tier_put_char;
+  ctx.put_num = tier_put_num;
+  ctx.read_char = tier_read_char;
+  ctx.read_num = tier_read_num;
+  ctx.resume_at = resume_addr != TIER_FROM_ENTRY ? (unsigned int) tier->orig_of[resume_addr] : TIER_NO_RESUME;
+  ctx.error = NULL;
+  status = entry(&ctx);
+  vm->stack_idx = ctx.stack_idx;
+  if (status == TIER_FAILED) {
+    vm->error = ctx.error;
+  }
+  return status;
+#else
+  (void) tier;
+  (void) entry;
+  (void) vm;
+  (void) resume_addr;
+  (void) call_stack_idx;
+  return TIER_FAILED;
+#endif
+}
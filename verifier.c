@@ -0,0 +1,602 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * Verifier                                                                  *
+ * ------------------------------------------------------------------------- */
+/*! Saturation bound of stack depths; a depth beyond it is unbounded */
+#define DEPTH_INF  ((long) STACK_SIZE * 4 + 4)
+/*! The number of updates of a block after which its bounds are widened */
+#define WIDEN_LIMIT  8
+#define UNDEF_BLOCK  ((size_t) -1)
+#define CHECK_STACK_BIT  0x01
+#define CHECK_ROOM_BIT   0x02
+
+
+/*!
+ * @brief Interval of the stack depth, which is empty (lo > hi) if the point
+ *        is never reached
+ */
+typedef struct {
+  long lo;
+  long hi;
+} Depth;
+
+/*!
+ * @brief Basic block and its stack effect
+ */
+typedef struct {
+  size_t head;   /*!< Index of the first instruction */
+  size_t tail;   /*!< Index of the last instruction */
+  long   need;   /*!< Minimum depth at the entry to avoid underflow */
+  long   grow;   /*!< Maximum depth above the depth at the entry */
+  long   delta;  /*!< Depth at the exit relative to the entry */
+  int    check;  /*!< Checks required at the entry (CHECK_*_BIT) */
+} Block;
+
+/*!
+ * @brief Control-flow graph and the working storage of the analysis
+ */
+typedef struct {
+  const Instruction *code;
+  Block         *blocks;
+  size_t         n_block;
+  size_t        *block_of;  /*!< Index of the block led by each instruction */
+  Depth         *summary;   /*!< Effect of the subroutine led by each block */
+  Depth         *in;        /*!< Depth at the entry of each block */
+  unsigned char *n_update;
+  unsigned char *queued;
+  size_t        *worklist;
+  size_t         n_work;
+  size_t        *reached;   /*!< Blocks whose depth has been set */
+  size_t         n_reached;
+} Cfg;
+
+static const Depth EMPTY_DEPTH = {1, 0};
+
+
+/*!
+ * @brief Allocate memory for the verifier or die
+ */
+static void *verifier_alloc(size_t size) {
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == NULL) {
+    fputs("Failed to allocate memory for verifier\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+
+/*!
+ * @brief Add two depths, keeping infinity as it is
+ */
+__attribute__((const))
+static long depth_add(long a, long b) {
+  long x;
+  if (a == DEPTH_INF || a == -DEPTH_INF) {
+    return a;
+  }
+  if (b == DEPTH_INF || b == -DEPTH_INF) {
+    return b;
+  }
+  x = a + b;
+  return x < -DEPTH_INF ? -DEPTH_INF : x > DEPTH_INF ? DEPTH_INF : x;
+}
+
+
+/*!
+ * @brief Get the minimum depth required by an operand n which reads the nth
+ *        element below the top
+ */
+__attribute__((const))
+static long depth_of_operand(WsInt n) {
+  return n < 0 || n >= (WsInt) STACK_SIZE ? (long) STACK_SIZE + 1 : (long) n + 1;
+}
+
+
+/*!
+ * @brief Get the stack effect of an instruction
+ * @param [in]  inst   Instruction
+ * @param [out] need   The number of elements the instruction reads
+ * @param [out] delta  Change of the depth
+ */
+static void stack_effect(const Instruction *inst, long *need, long *delta) {
+  switch (inst->opcode) {
+    case STACK_PUSH:
+      *need = 0;
+      *delta = 1;
+      break;
+    case STACK_DUP_N:
+      *need = depth_of_operand(inst->operand.num);
+      *delta = 1;
+      break;
+    case STACK_DUP:
+      *need = 1;
+      *delta = 1;
+      break;
+    case STACK_SLIDE:
+      *need = depth_of_operand(inst->operand.num);
+      *delta = 1 - *need;
+      break;
+    case STACK_SWAP:
+      *need = 2;
+      *delta = 0;
+      break;
+    case STACK_DISCARD:
+    case FLOW_BEZ:
+    case FLOW_BLTZ:
+    case IO_PUT_CHAR:
+    case IO_PUT_NUM:
+    case IO_READ_CHAR:
+    case IO_READ_NUM:
+      *need = 1;
+      *delta = -1;
+      break;
+    case ARITH_ADD:
+    case ARITH_SUB:
+    case ARITH_MUL:
+    case ARITH_DIV:
+    case ARITH_MOD:
+    case BIT_AND:
+    case BIT_OR:
+    case BIT_XOR:
+    case BIT_LS:
+    case BIT_RS:
+      *need = 2;
+      *delta = -1;
+      break;
+    case BIT_NOT:
+    case HEAP_LOAD:
+      *need = 1;
+      *delta = 0;
+      break;
+    case HEAP_STORE:
+      *need = 2;
+      *delta = -2;
+      break;
+    default:
+      *need = 0;
+      *delta = 0;
+      break;
+  }
+}
+
+
+/*!
+ * @brief Check whether given opcode is a superinstruction
+ */
+__attribute__((const))
+static int is_fused(int opcode) {
+  return unfused_opcode(opcode) != opcode;
+}
+
+
+/*!
+ * @brief Check whether given opcode takes a jump target, including the fused
+ *        conditional branches
+ */
+__attribute__((const))
+static int has_target(int opcode) {
+  return is_jump(opcode) || opcode == FUSED_DUP_BEZ || opcode == FUSED_SUB_BLTZ;
+}
+
+
+/*!
+ * @brief Check whether given opcode terminates a basic block
+ */
+__attribute__((const))
+static int ends_block(int opcode) {
+  return has_target(opcode) || opcode == FLOW_ENDSUB || opcode == FLOW_HALT;
+}
+
+
+/*!
+ * @brief Get the index of the instruction executed after given one when it
+ *        falls through
+ */
+__attribute__((const))
+static size_t next_index(int opcode, size_t i) {
+  return is_fused(opcode) ? i + 2 : i + 1;
+}
+
+
+/*!
+ * @brief Add the stack effect of an instruction to its block
+ * @param [in,out] block  Block which contains the instruction
+ * @param [in]     inst   Instruction
+ * @param [in,out] r      Depth before/after the instruction relative to the
+ *                        entry of the block
+ */
+static void add_stack_effect(Block *block, const Instruction *inst, long *r) {
+  long need, delta;
+  stack_effect(inst, &need, &delta);
+  if (need - *r > block->need) {
+    block->need = need - *r;
+  }
+  *r = depth_add(*r, delta);
+  if (*r > block->grow) {
+    block->grow = *r;
+  }
+}
+
+
+/*!
+ * @brief Split instructions into basic blocks and compute their stack effect
+ * @param [in,out] cfg        Control-flow graph
+ * @param [in]     n_inst     The number of instructions
+ * @param [in]     is_leader  Flags of the first instructions of the blocks
+ */
+static void build_blocks(Cfg *cfg, size_t n_inst, const unsigned char *is_leader) {
+  size_t i;
+  for (i = 0; i <= n_inst; i++) {
+    cfg->block_of[i] = UNDEF_BLOCK;
+  }
+  for (i = 0; i <= n_inst; i++) {
+    Block *block;
+    size_t j, next;
+    long r = 0;
+    if (!is_leader[i]) {
+      continue;
+    }
+    block = &cfg->blocks[cfg->n_block];
+    cfg->block_of[i] = cfg->n_block++;
+    block->head = i;
+    block->need = 0;
+    block->grow = 0;
+    for (j = i;; j = next) {
+      if (is_fused(cfg->code[j].opcode)) {
+        /* Same as the pair, since the JIT executes them one by one */
+        Instruction head = cfg->code[j];
+        head.opcode = unfused_opcode(head.opcode);
+        add_stack_effect(block, &head, &r);
+        add_stack_effect(block, &cfg->code[j + 1], &r);
+      } else {
+        add_stack_effect(block, &cfg->code[j], &r);
+      }
+      next = next_index(cfg->code[j].opcode, j);
+      if (ends_block(cfg->code[j].opcode) || next > n_inst || is_leader[next]) {
+        break;
+      }
+    }
+    block->tail = j;
+    block->delta = r;
+    if (block->need > (long) STACK_SIZE + 1) {
+      block->need = (long) STACK_SIZE + 1;
+    }
+    if (block->grow > (long) STACK_SIZE + 1) {
+      block->grow = (long) STACK_SIZE + 1;
+    }
+  }
+}
+
+
+/*!
+ * @brief Merge a depth into the entry of a block and schedule the block
+ *
+ * Every cycle of the graph contains an edge to a block which doesn't come
+ * after its source.  Such a block is widened when it has been updated too
+ * many times, so that the analysis terminates on loops and recursions which
+ * keep growing or shrinking the stack.
+ * An absolute depth is widened to the capacity of the stack rather than to
+ * infinity, since every push is guarded.
+ * @param [in,out] cfg       Control-flow graph
+ * @param [in]     from      Index of the source block
+ * @param [in]     to        Index of the destination block
+ * @param [in]     d         Depth flowing into the block
+ * @param [in]     absolute  TRUE if the depth is absolute
+ */
+static void merge_depth(Cfg *cfg, size_t from, size_t to, Depth d, int absolute) {
+  Depth *in = &cfg->in[to];
+  Depth old = *in;
+
+  if (d.lo > d.hi) {
+    return;
+  }
+  if (old.lo > old.hi) {
+    *in = d;
+    cfg->reached[cfg->n_reached++] = to;
+  } else {
+    if (d.lo < in->lo) {
+      in->lo = d.lo;
+    }
+    if (d.hi > in->hi) {
+      in->hi = d.hi;
+    }
+    if (in->lo == old.lo && in->hi == old.hi) {
+      return;
+    }
+    if (to <= from && ++cfg->n_update[to] > WIDEN_LIMIT) {
+      if (in->lo < old.lo) {
+        in->lo = absolute ? 0 : -DEPTH_INF;
+      }
+      if (in->hi > old.hi) {
+        in->hi = absolute ? (long) STACK_SIZE : DEPTH_INF;
+      }
+    }
+  }
+  if (!cfg->queued[to]) {
+    cfg->queued[to] = TRUE;
+    cfg->worklist[cfg->n_work++] = to;
+  }
+}
+
+
+/*!
+ * @brief Propagate stack depths over the control-flow graph
+ *
+ * If absolute is TRUE, the depth is absolute, FLOW_GOSUB is followed into
+ * the subroutine and every block which reads or grows the stack is assumed
+ * to be guarded, so the depth after it is within its bounds.
+ * Otherwise the depth is relative to the entry, FLOW_GOSUB is not followed
+ * and the effect of the subroutine is obtained from the summary.
+ * In both cases the return point of FLOW_GOSUB is reached with the depth
+ * at the call plus the summary of the callee.
+ * @param [in,out] cfg       Control-flow graph
+ * @param [in]     entry     Index of the entry block
+ * @param [in]     absolute  TRUE if the depth is absolute
+ * @return  Join of the depths at FLOW_ENDSUB
+ */
+static Depth propagate(Cfg *cfg, size_t entry, int absolute) {
+  Depth ret = EMPTY_DEPTH;
+  Depth start = {0, 0};
+  size_t i;
+
+  /* Only the blocks reached by the previous run have to be reset */
+  for (i = 0; i < cfg->n_reached; i++) {
+    cfg->in[cfg->reached[i]] = EMPTY_DEPTH;
+    cfg->n_update[cfg->reached[i]] = 0;
+  }
+  cfg->n_reached = 0;
+  cfg->n_work = 0;
+  merge_depth(cfg, entry, entry, start, absolute);
+
+  while (cfg->n_work > 0) {
+    size_t b = cfg->worklist[--cfg->n_work];
+    const Block *block = &cfg->blocks[b];
+    const Instruction *tail = &cfg->code[block->tail];
+    size_t next = next_index(tail->opcode, block->tail);
+    Depth d = cfg->in[b];
+
+    cfg->queued[b] = FALSE;
+    if (absolute) {
+      if (d.lo < block->need) {
+        d.lo = block->need;
+      }
+      if (d.hi > (long) STACK_SIZE - block->grow) {
+        d.hi = (long) STACK_SIZE - block->grow;
+      }
+      if (d.lo > d.hi) {
+        continue;
+      }
+    }
+    d.lo = depth_add(d.lo, block->delta);
+    d.hi = depth_add(d.hi, block->delta);
+    if (absolute && d.lo < 0) {
+      d.lo = 0;
+    }
+
+    switch (tail->opcode) {
+      case FLOW_JUMP:
+        merge_depth(cfg, b, cfg->block_of[tail->operand.addr], d, absolute);
+        break;
+      case FLOW_BEZ:
+      case FLOW_BLTZ:
+      case FUSED_DUP_BEZ:
+      case FUSED_SUB_BLTZ:
+        merge_depth(cfg, b, cfg->block_of[tail->operand.addr], d, absolute);
+        merge_depth(cfg, b, cfg->block_of[next], d, absolute);
+        break;
+      case FLOW_GOSUB:
+        {
+          size_t callee = cfg->block_of[tail->operand.addr];
+          Depth s = cfg->summary[callee];
+          if (absolute) {
+            merge_depth(cfg, b, callee, d, absolute);
+          }
+          if (s.lo <= s.hi) {
+            d.lo = depth_add(d.lo, s.lo);
+            d.hi = depth_add(d.hi, s.hi);
+            if (absolute) {
+              d.lo = d.lo < 0 ? 0 : d.lo;
+              d.hi = d.hi > (long) STACK_SIZE ? (long) STACK_SIZE : d.hi;
+            }
+            merge_depth(cfg, b, cfg->block_of[next], d, absolute);
+          }
+        }
+        break;
+      case FLOW_ENDSUB:
+        if (ret.lo > ret.hi) {
+          ret = d;
+        } else {
+          ret.lo = d.lo < ret.lo ? d.lo : ret.lo;
+          ret.hi = d.hi > ret.hi ? d.hi : ret.hi;
+        }
+        break;
+      case FLOW_HALT:
+        break;
+      default:
+        merge_depth(cfg, b, cfg->block_of[next], d, absolute);
+        break;
+    }
+  }
+  return ret;
+}
+
+
+/*!
+ * @brief Compute the stack effect of every subroutine
+ *
+ * The summaries start as "never returns" and grow until a fixed point is
+ * reached, so recursive subroutines are handled as well.
+ * @param [in,out] cfg  Control-flow graph
+ */
+static void summarize_subroutines(Cfg *cfg) {
+  unsigned char *is_sub = (unsigned char *) verifier_alloc(cfg->n_block);
+  size_t i, n_round = 0;
+  int changed;
+
+  memset(is_sub, FALSE, cfg->n_block);
+  for (i = 0; i < cfg->n_block; i++) {
+    const Instruction *tail = &cfg->code[cfg->blocks[i].tail];
+    cfg->summary[i] = EMPTY_DEPTH;
+    if (tail->opcode == FLOW_GOSUB) {
+      is_sub[cfg->block_of[tail->operand.addr]] = TRUE;
+    }
+  }
+  do {
+    changed = FALSE;
+    n_round++;
+    for (i = 0; i < cfg->n_block; i++) {
+      Depth *s = &cfg->summary[i];
+      Depth d;
+      if (!is_sub[i]) {
+        continue;
+      }
+      d = propagate(cfg, i, FALSE);
+      if (d.lo > d.hi || (s->lo <= s->hi && s->lo <= d.lo && d.hi <= s->hi)) {
+        continue;
+      }
+      if (s->lo > s->hi) {
+        *s = d;
+      } else if (n_round > WIDEN_LIMIT) {
+        s->lo = d.lo < s->lo ? -DEPTH_INF : s->lo;
+        s->hi = d.hi > s->hi ? DEPTH_INF : s->hi;
+      } else {
+        s->lo = d.lo < s->lo ? d.lo : s->lo;
+        s->hi = d.hi > s->hi ? d.hi : s->hi;
+      }
+      changed = TRUE;
+    }
+  } while (changed);
+  free(is_sub);
+}
+
+
+/*!
+ * @brief Verify the stack safety of instructions and insert runtime checks
+ *        where it can't be proven
+ *
+ * The instructions are split into basic blocks and the range of the stack
+ * depth at the entry of every block is computed from the control-flow
+ * graph.
+ * A block whose elements are proven to exist and whose pushes are proven to
+ * fit in the stack gets no check.
+ * Otherwise CHECK_STACK and/or CHECK_ROOM are put at its entry, so that
+ * the handlers of the backends never have to check the stack by themselves.
+ * @param [in]  code        Instruction records terminated with FLOW_HALT
+ * @param [in]  n_inst      The number of instructions
+ * @param [out] n_verified  The number of instructions after verification
+ * @return  Verified instruction records terminated with FLOW_HALT (must be
+ *          freed by the caller)
+ */
+Instruction *verify(const Instruction *code, size_t n_inst, size_t *n_verified) {
+  Instruction *work = (Instruction *) verifier_alloc((n_inst + 1) * sizeof(Instruction));
+  unsigned char *is_leader = (unsigned char *) verifier_alloc(n_inst + 1);
+  size_t *new_idx = (size_t *) verifier_alloc((n_inst + 1) * sizeof(size_t));
+  Instruction *verified;
+  Cfg cfg;
+  size_t i, n = 0;
+
+  memcpy(work, code, (n_inst + 1) * sizeof(Instruction));
+  memset(is_leader, FALSE, n_inst + 1);
+  for (i = 0; i <= n_inst; i++) {
+    if (has_target(work[i].opcode)) {
+      is_leader[work[i].operand.addr <= n_inst ? work[i].operand.addr : n_inst] = TRUE;
+    }
+  }
+  /*
+   * A check can't be put in front of the second instruction of a fused pair,
+   * because the fused handler skips exactly one record.
+   * Such a pair is split again, which is rare.
+   */
+  for (i = 0; i < n_inst; i++) {
+    if (is_fused(work[i].opcode) && is_leader[i + 1]) {
+      work[i].opcode = unfused_opcode(work[i].opcode);
+    }
+  }
+  for (i = 0; i <= n_inst; i++) {
+    if (has_target(work[i].opcode) && work[i].operand.addr > n_inst) {
+      work[i].operand.addr = (WsAddrInt) n_inst;
+    }
+    if (ends_block(work[i].opcode) && next_index(work[i].opcode, i) <= n_inst) {
+      is_leader[next_index(work[i].opcode, i)] = TRUE;
+    }
+  }
+  is_leader[0] = is_leader[n_inst] = TRUE;
+
+  cfg.code = work;
+  cfg.n_block = 0;
+  cfg.blocks = (Block *) verifier_alloc((n_inst + 1) * sizeof(Block));
+  cfg.block_of = (size_t *) verifier_alloc((n_inst + 1) * sizeof(size_t));
+  build_blocks(&cfg, n_inst, is_leader);
+  cfg.summary = (Depth *) verifier_alloc(cfg.n_block * sizeof(Depth));
+  cfg.in = (Depth *) verifier_alloc(cfg.n_block * sizeof(Depth));
+  cfg.n_update = (unsigned char *) verifier_alloc(cfg.n_block);
+  cfg.queued = (unsigned char *) verifier_alloc(cfg.n_block);
+  cfg.worklist = (size_t *) verifier_alloc(cfg.n_block * sizeof(size_t));
+  cfg.reached = (size_t *) verifier_alloc(cfg.n_block * sizeof(size_t));
+  cfg.n_reached = 0;
+  for (i = 0; i < cfg.n_block; i++) {
+    cfg.in[i] = EMPTY_DEPTH;
+    cfg.n_update[i] = 0;
+    cfg.queued[i] = FALSE;
+  }
+  summarize_subroutines(&cfg);
+  propagate(&cfg, cfg.block_of[0], TRUE);
+
+  for (i = 0; i < cfg.n_block; i++) {
+    Block *block = &cfg.blocks[i];
+    Depth d = cfg.in[i];
+    int reached = d.lo <= d.hi;
+    block->check = 0;
+    if (block->need > 0 && !(reached && d.lo >= block->need)) {
+      block->check |= CHECK_STACK_BIT;
+    }
+    if (block->grow > 0 && !(reached && d.hi + block->grow <= (long) STACK_SIZE)) {
+      block->check |= CHECK_ROOM_BIT;
+    }
+  }
+  for (i = 0; i <= n_inst; i++) {
+    new_idx[i] = n++;
+    if (cfg.block_of[i] != UNDEF_BLOCK) {
+      int check = cfg.blocks[cfg.block_of[i]].check;
+      n += (size_t) ((check & CHECK_STACK_BIT) != 0) + (size_t) ((check & CHECK_ROOM_BIT) != 0);
+    }
+  }
+
+  verified = (Instruction *) verifier_alloc(n * sizeof(Instruction));
+  for (i = 0; i <= n_inst; i++) {
+    Instruction *inst = &verified[new_idx[i]];
+    if (cfg.block_of[i] != UNDEF_BLOCK) {
+      const Block *block = &cfg.blocks[cfg.block_of[i]];
+      if (block->check & CHECK_STACK_BIT) {
+        inst->opcode = CHECK_STACK;
+        inst->operand.num = (WsInt) block->need;
+        inst++;
+      }
+      if (block->check & CHECK_ROOM_BIT) {
+        inst->opcode = CHECK_ROOM;
+        inst->operand.num = (WsInt) block->grow;
+        inst++;
+      }
+    }
+    *inst = work[i];
+    if (has_target(inst->opcode)) {
+      inst->operand.addr = (WsAddrInt) new_idx[inst->operand.addr];
+    }
+  }
+  *n_verified = n - 1;
+
+  free(cfg.blocks);
+  free(cfg.block_of);
+  free(cfg.summary);
+  free(cfg.in);
+  free(cfg.n_update);
+  free(cfg.queued);
+  free(cfg.worklist);
+  free(cfg.reached);
+  free(work);
+  free(is_leader);
+  free(new_idx);
+  return verified;
+}
@@ -0,0 +1,76 @@
+#include "blankspace.h"
+
+/* ------------------------------------------------------------------------- *
+ * VM context                                                                *
+ * ------------------------------------------------------------------------- */
+/*!
+ * @brief Create a VM with an empty stack and heap
+ *
+ * A VM can compile and run programs one after another; the heap carries over
+ * between runs unless vm_reset() is called, while every run starts with an
+ * empty stack.
+ * Each VM is independent, so that different threads can use different VMs.
+ * Until vm_set_io() is called, the input is empty and the output is kept in
+ * memory.
+ * @return  VM (must be released with vm_destroy())
+ */
+BsVM *vm_create(void) {
+  BsVM *vm = (BsVM *) calloc(1, sizeof(BsVM));
+  if (vm == NULL) {
+    fputs("Failed to allocate memory for VM\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  heap_init(&vm->heap);
+  input_init(&vm->input, NULL, NULL, NULL, 0);
+  output_init(&vm->output, NULL, NULL, FALSE);
+  return vm;
+}
+
+
+/*!
+ * @brief Set the input and the output of the following runs
+ *
+ * The pending output is flushed where it was going first.
+ * @param [in,out] vm  VM
+ * @param [in]     io  Input and output
+ */
+void vm_set_io(BsVM *vm, const BsIO *io) {
+  output_flush(&vm->output);
+  input_init(&vm->input, io->read, io->arg, io->input, io->input_size);
+  vm->output.write = io->write;
+  vm->output.arg = io->arg;
+  vm->output.interactive = io->write != NULL && io->interactive;
+}
+
+
+/*!
+ * @brief Empty the stack, the heap and the bignums of a VM
+ *
+ * The output kept in memory is discarded, but its memory is kept for the
+ * next run; the input and the output are left as they are.
+ * @param [in,out] vm  VM
+ */
+void vm_reset(BsVM *vm) {
+  vm->stack_idx = 0;
+  vm->error = NULL;
+  heap_free(&vm->heap);
+  heap_init(&vm->heap);
+  bignum_free_all(vm);
+  vm->output.mem_size = 0;
+  vm->output.size = 0;
+}
+
+
+/*!
+ * @brief Flush the pending output of a VM and release it
+ * @param [in,out] vm  VM created by vm_create()
+ */
+void vm_destroy(BsVM *vm) {
+  output_flush(&vm->output);
+  free(vm->output.mem);
+  heap_free(&vm->heap);
+  bignum_free_all(vm);
+  free_label_table(&vm->labels);
+  free(vm->literal);
+  free(vm);
+}